@@ -31,6 +31,13 @@ translation_optiondescription = OptionDescription(
     BoolOption("continuation", "enable single-shot continuations",
                default=False, cmdline="--continuation",
                requires=[("translation.type_system", "lltype")]),
+    ChoiceOption("stacklet", "how to implement the stacklets of --continuation: "
+                 "by copying slices of the C stack around, or by running "
+                 "each of them in its own mmap()ed stack",
+                 ["copy", "separate"], default="copy", cmdline="--stacklet",
+                 requires={
+                     "separate": [("translation.gcrootfinder", "shadowstack")],
+                     }),
     ChoiceOption("type_system", "Type system to use when RTyping",
                  ["lltype", "ootype"], cmdline=None, default="lltype",
                  requires={
@@ -120,7 +127,7 @@ translation_optiondescription = OptionDescription(
                  ["auto", "x86", "x86-without-sse2", "llvm"],
                  default="auto", cmdline="--jit-backend"),
     ChoiceOption("jit_profiler", "integrate profiler support into the JIT",
-                 ["off", "oprofile"],
+                 ["off", "oprofile", "sampler"],
                  default="off"),
     # jit_ffi is automatically turned on by withmod-_ffi (which is enabled by default)
     BoolOption("jit_ffi", "optimize libffi calls", default=False, cmdline=None),
@@ -143,6 +150,10 @@ translation_optiondescription = OptionDescription(
                default=False, cmdline=None),
     BoolOption("countmallocs", "Count mallocs and frees", default=False,
                cmdline=None),
+    BoolOption("obmalloc_tcache",
+               "Put per-thread caches in front of obmalloc's small blocks",
+               default=False, cmdline="--obmalloc-tcache",
+               requires=[("translation.thread", True)]),
     ChoiceOption("fork_before",
                  "(UNIX) Create restartable checkpoint before step",
                  ["annotate", "rtype", "backendopt", "database", "source",
@@ -239,6 +250,11 @@ translation_optiondescription = OptionDescription(
                   "for profile based inlining",
                 default="pypy.translator.backendopt.inline.inlining_heuristic",
                 ),  # cmdline="--prof-based-inline-heuristic" fix me
+        # control profile based branch hints
+        StrOption("profile_based_branches",
+                  "Use a training run to give branch and hot/cold "
+                  "function hints to the C compiler, specify arguments",
+                  default=None),
         # control clever malloc removal
         BoolOption("clever_malloc_removal",
                    "Drives inlining to remove mallocs in a clever way",
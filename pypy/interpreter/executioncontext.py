@@ -2,7 +2,8 @@ import sys
 from pypy.interpreter.error import OperationError
 from pypy.rlib.rarithmetic import LONG_BIT
 from pypy.rlib.unroll import unrolling_iterable
-from pypy.rlib import jit
+from pypy.rlib import jit, rsampler
+from pypy.rpython.lltypesystem import lltype
 
 TICK_COUNTER_STEP = 100
 
@@ -36,6 +37,9 @@ class ExecutionContext(object):
         self.compiler = space.createcompiler()
         self.profilefunc = None        # if not None, no JIT
         self.w_profilefuncarg = None
+        # the code stack of the sampling profiler, see rlib/rsampler.py
+        self.sampler_stack = lltype.nullptr(rsampler.STACK.TO)
+        self.sampler_generation = 0
 
     def gettopframe(self):
         return self.topframeref()
@@ -57,12 +61,16 @@ class ExecutionContext(object):
     def enter(self, frame):
         frame.f_backref = self.topframeref
         self.topframeref = jit.virtual_ref(frame)
+        if rsampler.state.enabled:
+            self._sampler_push(frame.pycode)
 
     def leave(self, frame, w_exitvalue, got_exception):
         try:
             if self.profilefunc:
                 self._trace(frame, 'leaveframe', w_exitvalue)
         finally:
+            if rsampler.state.enabled:
+                self._sampler_pop()
             frame_vref = self.topframeref
             self.topframeref = frame.f_backref
             if frame.escaped or got_exception:
@@ -79,6 +87,36 @@ class ExecutionContext(object):
         if self.w_tracefunc is not None and not frame.hide():
             self.space.frame_trace_action.fire()
 
+    def _sampler_push(self, code):
+        if self.sampler_generation != rsampler.state.generation:
+            self.sampler_reset_stack()    # this pushes 'code' too
+        else:
+            code.sampler_register()
+            rsampler.push(self.sampler_stack, code.get_sampler_id())
+
+    def _sampler_pop(self):
+        if self.sampler_generation != rsampler.state.generation:
+            self.sampler_reset_stack()
+        rsampler.pop(self.sampler_stack)
+
+    @jit.dont_look_inside
+    def sampler_reset_stack(self):
+        """Called the first time that this thread enters or leaves a frame
+        after the sampling profiler was started: fill the code stack with
+        the frames that are already running."""
+        stack = rsampler.thread_stack()
+        self.sampler_stack = stack
+        self.sampler_generation = rsampler.state.generation
+        frames = []
+        frame = self.gettopframe()
+        while frame is not None:
+            frames.append(frame)
+            frame = frame.f_backref()
+        for i in range(len(frames) - 1, -1, -1):
+            code = frames[i].pycode
+            code.sampler_register()
+            rsampler.push(stack, code.get_sampler_id())
+
     # ________________________________________________________________
 
     def c_call_trace(self, frame, w_func, args=None):
@@ -23,3 +23,26 @@ class ThreadLocals:
     def getallvalues(self):
         return {0: self._value}
 
+    # without the 'thread' module there is no GIL: the switch interval
+    # is only recorded, and nobody ever waits
+    _switch_interval = 5000       # in microseconds
+
+    def setswitchinterval(self, interval):
+        self._switch_interval = interval
+
+    def getswitchinterval(self):
+        return self._switch_interval
+
+    def getgilwaitstats(self):
+        return 0, 0
+
+    def gil_profile_enable(self, enable):
+        return False
+
+    def gil_profile_reset(self):
+        pass
+
+    def gil_profile_snapshot(self):
+        from pypy.module.thread.ll_thread import GIL_PROFILE_SIZE
+        return [0] * GIL_PROFILE_SIZE
+
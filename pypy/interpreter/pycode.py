@@ -15,7 +15,7 @@ from pypy.interpreter.astcompiler.consts import (
     CO_GENERATOR, CO_CONTAINSGLOBALS)
 from pypy.rlib.rarithmetic import intmask
 from pypy.rlib.debug import make_sure_not_resized
-from pypy.rlib import jit
+from pypy.rlib import jit, rsampler
 from pypy.rlib.objectmodel import compute_hash
 from pypy.tool.stdlib_opcode import opcodedesc, HAVE_ARGUMENT
 
@@ -53,7 +53,7 @@ class PyCode(eval.Code):
     "CPython-style code objects."
     _immutable_ = True
     _immutable_fields_ = ["co_consts_w[*]", "co_names_w[*]", "co_varnames[*]",
-                          "co_freevars[*]", "co_cellvars[*]"]
+                          "co_freevars[*]", "co_cellvars[*]", "_sampler_id"]
 
     def __init__(self, space,  argcount, nlocals, stacksize, flags,
                      code, consts, names, varnames, filename,
@@ -81,6 +81,7 @@ class PyCode(eval.Code):
         self.hidden_applevel = hidden_applevel
         self.magic = magic
         self._signature = cpython_code_signature(self)
+        self._sampler_id = rsampler.new_code_id()
         self._initialize()
 
     def _initialize(self):
@@ -148,6 +149,17 @@ class PyCode(eval.Code):
     def signature(self):
         return self._signature
 
+    def get_sampler_id(self):
+        """The id of this code in the code stack of the sampling profiler."""
+        return self._sampler_id
+
+    def sampler_register(self):
+        """Give the name of this code to the sampling profiler, unless it
+        already has it."""
+        if not rsampler.is_registered(self._sampler_id):
+            rsampler.register_app_code(self._sampler_id, self.co_name,
+                                       self.co_firstlineno, self.co_filename)
+
     @classmethod
     def _from_code(cls, space, code, hidden_applevel=False, code_hook=None):
         """ Initialize the code object from a real (CPython) one.
@@ -1,3 +1,5 @@
+from pypy.rlib import rsampler
+
 
 class ProfileAgent(object):
     """ A class that communicates to a profiler which assembler code belongs to
@@ -10,3 +12,10 @@ class ProfileAgent(object):
     def native_code_written(self, name, address, size):
         pass
 
+
+class SamplerAgent(ProfileAgent):
+    """ Gives the names of the loops and bridges to the sampling profiler,
+    see pypy/rlib/rsampler.py. """
+
+    def native_code_written(self, name, address, size):
+        rsampler.register_code(rsampler.CODE_JIT, address, size, name)
@@ -7,7 +7,7 @@ from pypy.jit.codewriter import longlong
 from pypy.jit.metainterp import history, compile
 from pypy.jit.backend.x86.assembler import Assembler386
 from pypy.jit.backend.x86.arch import FORCE_INDEX_OFS, IS_X86_32
-from pypy.jit.backend.x86.profagent import ProfileAgent
+from pypy.jit.backend.x86.profagent import ProfileAgent, SamplerAgent
 from pypy.jit.backend.llsupport.llmodel import AbstractLLCPU
 from pypy.jit.backend.x86 import regloc
 import sys
@@ -40,6 +40,8 @@ class AbstractX86CPU(AbstractLLCPU):
                 if not oprofile.OPROFILE_AVAILABLE:
                     log.WARNING('oprofile support was explicitly enabled, but oprofile headers seem not to be available')
                 profile_agent = oprofile.OProfileAgent()
+            elif config.translation.jit_profiler == "sampler":
+                profile_agent = SamplerAgent()
             self.with_threads = config.translation.thread
 
         self.profile_agent = profile_agent
@@ -43,6 +43,12 @@ class Module(MixedModule):
         'lookup_special'            : 'interp_magic.lookup_special',
         'do_what_I_mean'            : 'interp_magic.do_what_I_mean',
         'list_strategy'             : 'interp_magic.list_strategy',
+        'gil_wait_stats'            : 'interp_magic.gil_wait_stats',
+        'gil_profile'               : 'interp_magic.gil_profile',
+        'gil_profile_reset'         : 'interp_magic.gil_profile_reset',
+        'gil_profile_stats'         : 'interp_magic.gil_profile_stats',
+        'sampler_start'             : 'interp_sampler.sampler_start',
+        'sampler_stop'              : 'interp_sampler.sampler_stop',
     }
 
     submodules = {
@@ -63,6 +69,9 @@ class Module(MixedModule):
             if self.space.config.objspace.std.withmapdict:
                 self.extra_interpdef('mapdict_cache_counter',
                                      'interp_magic.mapdict_cache_counter')
+        if self.space.config.objspace.usemodules._sre:
+            self.extra_interpdef('sre_cache_counter',
+                                 'interp_magic.sre_cache_counter')
         PYC_MAGIC = get_pyc_magic(self.space)
         self.extra_interpdef('PYC_MAGIC', 'space.wrap(%d)' % PYC_MAGIC)
         #
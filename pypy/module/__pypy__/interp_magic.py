@@ -53,6 +53,15 @@ def mapdict_cache_counter(space, name):
     return space.newtuple([space.newint(cache.hits.get(name, 0)),
                            space.newint(cache.misses.get(name, 0))])
 
+def sre_cache_counter(space):
+    """Return a tuple (hits, misses, size) for the cache of the compiled
+    regular expressions of _sre; 'size' is the number of patterns in it."""
+    from pypy.module._sre.interp_sre import PatternCache
+    cache = space.fromcache(PatternCache)
+    return space.newtuple([space.newint(cache.hits),
+                           space.newint(cache.misses),
+                           space.newint(cache.size)])
+
 def builtinify(space, w_func):
     from pypy.interpreter.function import Function, BuiltinFunction
     func = space.interp_w(Function, w_func)
@@ -80,3 +89,51 @@ def list_strategy(space, w_list):
     else:
         w_msg = space.wrap("Can only get the list strategy of a list")
         raise OperationError(space.w_TypeError, w_msg)
+
+def gil_wait_stats(space):
+    """Return (number of waits, total seconds spent waiting) for the GIL
+    in the current thread."""
+    count, microseconds = space.threadlocals.getgilwaitstats()
+    return space.newtuple([space.wrap(count),
+                           space.wrap(microseconds * 1e-6)])
+
+@unwrap_spec(enable=bool)
+def gil_profile(space, enable):
+    """Turn the GIL contention profiler on or off.  Return the previous
+    state.  It can also be turned on at startup with the environment
+    variable PYPY_GIL_PROFILE=1."""
+    return space.wrap(space.threadlocals.gil_profile_enable(enable))
+
+def gil_profile_reset(space):
+    """Reset the numbers collected by the GIL contention profiler."""
+    space.threadlocals.gil_profile_reset()
+
+def gil_profile_stats(space):
+    """Return a dict with the numbers collected by the GIL contention
+    profiler since the last reset: the number of 'acquires', of
+    'contended_acquires' that had to wait, of 'forced_switches' by
+    running threads asked to give up the GIL and of 'drop_requests' by
+    waiting threads; the total 'wait_time' and 'hold_time' in seconds;
+    and 'acquire_latency' and 'hold_durations', histograms where the
+    item n counts the durations between 2**(n-1) and 2**n microseconds
+    (the item 0 counts the durations below one microsecond)."""
+    from pypy.module.thread import ll_thread
+    snapshot = space.threadlocals.gil_profile_snapshot()
+    w_result = space.newdict()
+    ncounters = len(ll_thread.GIL_PROFILE_COUNTERS)
+    for i in range(ncounters):
+        name = ll_thread.GIL_PROFILE_COUNTERS[i]
+        value = snapshot[i]
+        if name.endswith('_time'):
+            w_value = space.wrap(value * 1e-6)
+        else:
+            w_value = space.wrap(value)
+        space.setitem_str(w_result, name, w_value)
+    start = ncounters
+    for name in ['acquire_latency', 'hold_durations']:
+        stop = start + ll_thread.GIL_PROFILE_BUCKETS
+        w_list = space.newlist([space.wrap(snapshot[i])
+                                for i in range(start, stop)])
+        space.setitem_str(w_result, name, w_list)
+        start = stop
+    return w_result
@@ -0,0 +1,35 @@
+from pypy.interpreter.error import OperationError, wrap_oserror
+from pypy.interpreter.gateway import unwrap_spec
+from pypy.rlib import rsampler
+
+
+@unwrap_spec(fd=int, interval=float)
+def sampler_start(space, fd, interval=0.001):
+    """Start the sampling profiler.  Every 'interval' seconds of CPU time
+    used by the process, the thread that runs records its app-level
+    frames and the RPython function or the JIT-compiled loop that it was
+    running.  A helper thread writes these samples to the file descriptor
+    'fd', which must stay open until sampler_stop().  The resolution of
+    'interval' is limited by the kernel, usually to a few milliseconds.
+
+    The profiler uses SIGPROF: don't use this signal for something else
+    at the same time.  Use pypy/tool/samplerdump.py to read the file."""
+    interval_usec = int(interval * 1000000.0)
+    if interval_usec <= 0:
+        raise OperationError(space.w_ValueError,
+                             space.wrap("interval must be positive"))
+    try:
+        rsampler.start(fd, interval_usec)
+    except OSError, e:
+        raise wrap_oserror(space, e)
+    space.getexecutioncontext().sampler_reset_stack()
+
+def sampler_stop(space):
+    """Stop the sampling profiler and wait until all the samples are
+    written.  Returns the number of samples that were lost because the
+    helper thread did not write them fast enough."""
+    lost = rsampler.stop()
+    if lost < 0:
+        raise OperationError(space.w_RuntimeError,
+                             space.wrap("the sampling profiler is not running"))
+    return space.wrap(lost)
@@ -0,0 +1,40 @@
+import py, sys
+from pypy.interpreter.gateway import interp2app
+from pypy.tool.udir import udir
+from pypy.tool.samplerdump import read_profile, collapse
+
+
+class AppTestSampler(object):
+    def setup_class(cls):
+        if sys.platform == 'win32':
+            py.test.skip("no SIGPROF")
+        from pypy.conftest import gettestobjspace
+        cls.space = gettestobjspace(usemodules=['__pypy__'])
+        path = udir.join('test_sampler_profile')
+        cls.w_path = cls.space.wrap(str(path))
+        def stacks(space):
+            stacks = collapse(read_profile(str(path)))
+            return space.wrap([[frame.split(' ')[0] for frame in frames]
+                               for frames in stacks])
+        cls.w_stacks = cls.space.wrap(interp2app(stacks))
+
+    def test_sampler(self):
+        import __pypy__, os, time
+        def busy():
+            end = time.clock() + 0.3
+            while time.clock() < end:
+                pass
+        def callee():
+            busy()
+        fd = os.open(self.path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC)
+        __pypy__.sampler_start(fd, 0.001)
+        raises(OSError, __pypy__.sampler_start, fd)
+        callee()
+        assert __pypy__.sampler_stop() == 0
+        raises(RuntimeError, __pypy__.sampler_stop)
+        os.close(fd)
+        raises(ValueError, __pypy__.sampler_start, fd, 0.0)
+        #
+        stacks = self.stacks()
+        assert [frames for frames in stacks
+                if frames[-3:] == ['test_sampler', 'callee', 'busy']]
@@ -22,6 +22,27 @@ class AppTest(object):
         import __pypy__
         assert hasattr(__pypy__, 'cpumodel')
 
+    def test_gil_wait_stats(self):
+        import __pypy__
+        count, seconds = __pypy__.gil_wait_stats()
+        assert count >= 0
+        assert seconds >= 0.0
+
+    def test_gil_profile(self):
+        import __pypy__
+        was_on = __pypy__.gil_profile(True)
+        try:
+            __pypy__.gil_profile_reset()
+            stats = __pypy__.gil_profile_stats()
+            for key in ['acquires', 'contended_acquires', 'forced_switches',
+                        'drop_requests', 'wait_time', 'hold_time']:
+                assert stats[key] >= 0
+            assert len(stats['acquire_latency']) == 32
+            assert len(stats['hold_durations']) == 32
+            assert isinstance(stats['wait_time'], float)
+        finally:
+            __pypy__.gil_profile(was_on)
+
     def test_builtinify(self):
         import __pypy__
         class A(object):
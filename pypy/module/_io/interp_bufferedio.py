@@ -3,7 +3,7 @@ from pypy.interpreter.typedef import (
     TypeDef, GetSetProperty, generic_new_descr, interp_attrproperty_w)
 from pypy.interpreter.gateway import interp2app, unwrap_spec
 from pypy.interpreter.error import OperationError, operationerrfmt
-from pypy.interpreter.buffer import RWBuffer
+from pypy.interpreter.buffer import RWBuffer, RWSubBuffer
 from pypy.rlib.rstring import StringBuilder
 from pypy.rlib.rarithmetic import r_longlong, intmask
 from pypy.tool.sourcetools import func_renamer
@@ -11,6 +11,7 @@ from pypy.module._io.interp_iobase import (
     W_IOBase, DEFAULT_BUFFER_SIZE, convert_size,
     check_readable_w, check_writable_w, check_seekable_w)
 from pypy.module._io.interp_io import W_BlockingIOError
+from pypy.module._io.interp_fileio import W_FileIO, HAVE_WRITEV
 from pypy.module.thread import ll_thread
 import errno
 
@@ -30,26 +31,55 @@ def trap_eintr(space, error):
 
 
 class TryLock(object):
-    "A Lock that raises RuntimeError when acquired twice by the same thread"
+    """A Lock that raises RuntimeError when acquired twice by the same thread.
+
+    It is biased towards the first thread that takes it: as long as no
+    other thread does, it only records the owner, without a real lock,
+    whose acquire() and release() release and take the GIL again.  The
+    real lock is allocated when a second thread comes, and used from then
+    on.  This relies on the biased path not releasing the GIL."""
     def __init__(self, space):
-        ## XXX cannot free a Lock?
-        ## if self.lock:
-        ##     self.lock.free()
-        self.lock = space.allocate_lock()
+        self.space = space
+        self.lock = None    # the real lock, once a second thread came
+        self.bias = 0       # the thread that doesn't need the real lock
         self.owner = 0
         self.operr = OperationError(space.w_RuntimeError,
                                     space.wrap("reentrant call"))
 
     def __enter__(self):
+        ident = ll_thread.get_ident()
+        if self.lock is None:
+            if self.bias == 0:
+                self.bias = ident
+            if self.bias == ident:
+                if self.owner == ident:
+                    raise self.operr
+                self.owner = ident
+                return
+            self._unbias()
         if not self.lock.acquire(False):
-            if self.owner == ll_thread.get_ident():
+            if self.owner == ident:
                 raise self.operr
             self.lock.acquire(True)
-        self.owner = ll_thread.get_ident()
-    
-    def __exit__(self,*args):
+        self.owner = ident
+
+    def _unbias(self):
+        ## XXX cannot free a Lock?
+        lock = self.space.allocate_lock()
+        if self.owner != 0:
+            # The biased thread is in the middle of an operation, which
+            # released the GIL.  Take the new lock on its behalf, without
+            # releasing the GIL ourselves: it releases the lock in
+            # __exit__, and the lock is never seen free before that.
+            assert isinstance(lock, ll_thread.Lock)
+            acquired = ll_thread.acquire_NOAUTO(lock._lock, False)
+            assert acquired
+        self.lock = lock
+
+    def __exit__(self, *args):
         self.owner = 0
-        self.lock.release()
+        if self.lock is not None:
+            self.lock.release()
 
 
 class BlockingIOError(Exception):
@@ -370,11 +400,8 @@ class BufferedMixin:
         return written
 
     def _raw_write(self, space, start, end):
-        # XXX inefficient
-        l = []
-        for i in range(start, end):
-            l.append(self.buffer[i])
-        return self._write(space, ''.join(l))
+        assert 0 <= start <= end
+        return self._write(space, ''.join(self.buffer[start:end]))
 
     def detach_w(self, space):
         self._check_init(space)
@@ -525,7 +552,11 @@ class BufferedMixin:
 
     def _raw_read(self, space, buffer, start, length):
         length = intmask(length)
-        w_buf = space.wrap(RawBuffer(buffer, start, length))
+        return self._raw_readinto(space, RawBuffer(buffer, start, length))
+
+    def _raw_readinto(self, space, rwbuffer):
+        length = rwbuffer.getlength()
+        w_buf = space.wrap(rwbuffer)
         while True:
             try:
                 w_size = space.call_method(self.w_raw, "readinto", w_buf)
@@ -623,6 +654,66 @@ class BufferedMixin:
 
         return ''.join(result_buffer[:written])
 
+    def readinto_w(self, space, w_buffer):
+        self._check_init(space)
+        self._check_closed(space, "readinto of closed file")
+        rwbuffer = space.rwbuffer_w(w_buffer)
+        length = rwbuffer.getlength()
+
+        with self.lock:
+            if self.writable:
+                self._writer_flush_unlocked(space, restore_pos=True)
+
+            # First copy what we have in the current buffer
+            written = self._readahead()
+            if written > length:
+                written = length
+            if written > 0:
+                endpos = self.pos + written
+                assert endpos >= 0
+                rwbuffer.setslice(0, ''.join(self.buffer[self.pos:endpos]))
+                self.pos = endpos
+            if written == length:
+                return space.wrap(written)
+            self._reader_reset_buf()
+
+            # Read the large requests straight into the caller's buffer,
+            # instead of going through ours
+            while length - written >= self.buffer_size:
+                try:
+                    size = self._raw_readinto(space, RWSubBuffer(
+                        rwbuffer, written, length - written))
+                except BlockingIOError:
+                    if written == 0:
+                        return space.w_None
+                    size = 0
+                if size == 0:
+                    return space.wrap(written)
+                written += size
+
+            # Fill our buffer for the rest
+            self.pos = 0
+            self.raw_pos = 0
+            self.read_end = 0
+            while written < length:
+                try:
+                    size = self._fill_buffer(space)
+                except BlockingIOError:
+                    if written == 0:
+                        return space.w_None
+                    size = 0
+                if size == 0:
+                    break
+                if size > length - written:
+                    size = length - written
+                endpos = self.pos + size
+                assert endpos >= 0
+                rwbuffer.setslice(written,
+                                  ''.join(self.buffer[self.pos:endpos]))
+                self.pos = endpos
+                written += size
+            return space.wrap(written)
+
     def _read_fast(self, n):
         """Read n bytes from the buffer if it can, otherwise return None.
            This function is simple enough that it can run unlocked."""
@@ -667,6 +758,9 @@ class BufferedMixin:
                     self.write_end = self.pos
                 return space.wrap(size)
 
+            if self._can_writev():
+                return self._writev_unlocked(space, data)
+
             # First write the current buffer
             try:
                 self._writer_flush_unlocked(space)
@@ -755,6 +849,56 @@ class BufferedMixin:
             self.raw_pos = 0
         return space.wrap(written)
 
+    def _can_writev(self):
+        # a BufferedWriter on a plain FileIO, whose pending bytes are
+        # just before the logical position and just after the raw one
+        return (HAVE_WRITEV and not self.readable and
+                type(self.w_raw) is W_FileIO and
+                (self.write_end == -1 or
+                 (self.raw_pos == self.write_pos and
+                  self.pos == self.write_end)))
+
+    def _writev_unlocked(self, space, data):
+        """Write the pending bytes and 'data', which does not fit in the
+        buffer, with writev() on the file descriptor of the FileIO: 'data'
+        is neither copied into the buffer nor concatenated to the pending
+        bytes."""
+        w_raw = self.w_raw
+        assert isinstance(w_raw, W_FileIO)
+        pending = ''
+        if self.write_end != -1:
+            start = self.write_pos
+            end = self.write_end
+            assert 0 <= start <= end
+            pending = ''.join(self.buffer[start:end])
+        total = len(pending) + len(data)
+        written = 0
+        while written < total:
+            try:
+                n = w_raw.writev(space, [pending, data], written)
+            except OperationError, e:
+                if trap_eintr(space, e):
+                    continue  # try again
+                if written < len(pending):
+                    self.write_pos += written
+                    self.raw_pos = self.write_pos
+                else:
+                    self._writer_reset_buf()
+                    self.pos = 0
+                    self.raw_pos = 0
+                raise
+            if self.abs_pos != -1:
+                self.abs_pos += n
+            written += n
+            # Partial writes can return successfully when interrupted by a
+            # signal (see write(2)).  We must run signal handlers before
+            # blocking another time, possibly indefinitely.
+            space.getexecutioncontext().checksignals()
+        self._writer_reset_buf()
+        self.pos = 0
+        self.raw_pos = 0
+        return space.wrap(len(data))
+
     def flush_w(self, space):
         self._check_init(space)
         self._check_closed(space, "flush of closed file")
@@ -790,6 +934,7 @@ W_BufferedReader.typedef = TypeDef(
     read = interp2app(W_BufferedReader.read_w),
     peek = interp2app(W_BufferedReader.peek_w),
     read1 = interp2app(W_BufferedReader.read1_w),
+    readinto = interp2app(W_BufferedReader.readinto_w),
     raw = interp_attrproperty_w("w_raw", cls=W_BufferedReader),
 
     # from the mixin class
@@ -964,6 +1109,7 @@ W_BufferedRandom.typedef = TypeDef(
     read = interp2app(W_BufferedRandom.read_w),
     peek = interp2app(W_BufferedRandom.peek_w),
     read1 = interp2app(W_BufferedRandom.read1_w),
+    readinto = interp2app(W_BufferedRandom.readinto_w),
 
     write = interp2app(W_BufferedRandom.write_w),
     flush = interp2app(W_BufferedRandom.flush_w),
@@ -1,8 +1,12 @@
 from pypy.interpreter.typedef import TypeDef, interp_attrproperty, GetSetProperty
 from pypy.interpreter.gateway import interp2app, unwrap_spec
 from pypy.interpreter.error import OperationError, wrap_oserror, wrap_oserror2
-from pypy.rlib.rarithmetic import r_longlong
+from pypy.rlib.rarithmetic import r_longlong, widen
 from pypy.rlib.rstring import StringBuilder
+from pypy.rlib import rposix
+from pypy.rpython.lltypesystem import lltype, rffi
+from pypy.rpython.tool import rffi_platform as platform
+from pypy.translator.tool.cbuild import ExternalCompilationInfo
 from os import O_RDONLY, O_WRONLY, O_RDWR, O_CREAT, O_TRUNC
 import sys, os, stat, errno
 from pypy.module._io.interp_iobase import W_RawIOBase, convert_size
@@ -120,6 +124,22 @@ def new_buffersize(fd, currentsize):
 def verify_fd(fd):
     return
 
+# writev(), for BufferedWriter.write() of data that does not fit in the
+# buffer: the pending bytes and the data go out with one system call
+HAVE_WRITEV = sys.platform != 'win32'
+if HAVE_WRITEV:
+    class CConfig:
+        _compilation_info_ = ExternalCompilationInfo(
+            includes = ['sys/uio.h']
+        )
+        iovec = platform.Struct('struct iovec', [('iov_base', rffi.CCHARP),
+                                                 ('iov_len', rffi.SIZE_T)])
+    IOVEC = platform.configure(CConfig)['iovec']
+    c_writev = rffi.llexternal('writev',
+                               [rffi.INT, rffi.CArrayPtr(IOVEC), rffi.INT],
+                               rffi.SSIZE_T,
+                               compilation_info=CConfig._compilation_info_)
+
 class W_FileIO(W_RawIOBase):
     def __init__(self, space):
         W_RawIOBase.__init__(self, space)
@@ -338,6 +358,39 @@ class W_FileIO(W_RawIOBase):
 
         return space.wrap(n)
 
+    def writev(self, space, strings, start):
+        """Interp-level: writes the concatenation of the 'strings' from
+        the position 'start' with writev(), without concatenating them.
+        Returns the number of bytes written, like write()."""
+        assert HAVE_WRITEV
+        self._check_closed(space)
+        self._check_writable(space)
+        count = len(strings)
+        bufs = [rffi.get_nonmovingbuffer(string) for string in strings]
+        iov = lltype.malloc(rffi.CArray(IOVEC), count, flavor='raw')
+        try:
+            n = 0
+            for i in range(count):
+                length = len(strings[i])
+                if start >= length:
+                    start -= length
+                    continue
+                iov[n].c_iov_base = rffi.ptradd(bufs[i], start)
+                rffi.setintfield(iov[n], 'c_iov_len', length - start)
+                start = 0
+                n += 1
+            written = widen(c_writev(self.fd, iov, n))
+            if written < 0:
+                raise OSError(rposix.get_errno(), "writev failed")
+        except OSError, e:
+            raise wrap_oserror(space, e,
+                               exception_name='w_IOError')
+        finally:
+            lltype.free(iov, flavor='raw')
+            for i in range(count):
+                rffi.free_nonmovingbuffer(strings[i], bufs[i])
+        return written
+
     def read_w(self, space, w_size=None):
         self._check_closed(space)
         self._check_readable(space)
@@ -12,6 +12,9 @@ class AppTestBufferedReader:
         tmpfile = udir.join('tmpfile')
         tmpfile.write("a\nb\nc", mode='wb')
         cls.w_tmpfile = cls.space.wrap(str(tmpfile))
+        bigfile = udir.join('bigfile')
+        bigfile.write("abcdefghij" * 30, mode='wb')
+        cls.w_bigfile = cls.space.wrap(str(bigfile))
 
     def test_simple_read(self):
         import _io
@@ -142,6 +145,31 @@ class AppTestBufferedReader:
         f.close()
         assert a == 'a\nb\ncxxxxx'
 
+    def test_readinto_large(self):
+        import _io
+        class RecordingFileIO(_io.FileIO):
+            def readinto(self, buf):
+                self.sizes.append(len(buf))
+                return _io.FileIO.readinto(self, buf)
+        raw = RecordingFileIO(self.bigfile)
+        raw.sizes = []
+        f = _io.BufferedReader(raw, buffer_size=16)
+        assert f.read(3) == "abc"
+        a = bytearray(100)
+        assert f.readinto(a) == 100
+        assert a == "defghij" + "abcdefghij" * 9 + "abc"
+        # the 87 bytes after the buffered ones are read directly into 'a'
+        assert raw.sizes == [16, 87]
+        a = bytearray(10)
+        assert f.readinto(a) == 10
+        assert a == "defghijabc"
+        assert raw.sizes == [16, 87, 16]
+        a = bytearray(500)
+        assert f.readinto(a) == 187
+        assert a[:187] == "defghij" + "abcdefghij" * 18
+        assert f.readinto(a) == 0
+        f.close()
+
     def test_seek(self):
         import _io
         raw = _io.FileIO(self.tmpfile)
@@ -246,6 +274,35 @@ class AppTestBufferedWriter:
         f.close()
         assert self.readfile() == "abcd" * 5000
 
+    def test_write_pending_and_large(self):
+        import _io
+        raw = _io.FileIO(self.tmpfile, 'w')
+        f = _io.BufferedWriter(raw, buffer_size=16)
+        f.write("abc")
+        # "abc" and the data go out together, with one writev()
+        assert f.write("d" * 40) == 40
+        assert f.tell() == 43
+        f.write("e" * 5)
+        assert f.tell() == 48
+        assert f.write("f" * 20) == 20
+        f.close()
+        assert self.readfile() == "abc" + "d" * 40 + "e" * 5 + "f" * 20
+
+    def test_write_large_subclass(self):
+        import _io
+        class RecordingFileIO(_io.FileIO):
+            def write(self, data):
+                self.sizes.append(len(data))
+                return _io.FileIO.write(self, data)
+        raw = RecordingFileIO(self.tmpfile, 'w')
+        raw.sizes = []
+        f = _io.BufferedWriter(raw, buffer_size=16)
+        f.write("abc")
+        f.write("d" * 40)
+        assert raw.sizes == [3, 40]
+        f.close()
+        assert self.readfile() == "abc" + "d" * 40
+
     def test_incomplete(self):
         import _io
         raw = _io.FileIO(self.tmpfile)
@@ -487,6 +544,21 @@ class AppTestBufferedRandom:
         f.seek(0)
         assert f.read() == 'a\nbxxxx'
 
+    def test_readinto(self):
+        import _io
+        raw = _io.FileIO(self.tmpfile, 'wb+')
+        raw.write('a\nb\nc')
+        raw.seek(0)
+        f = _io.BufferedRandom(raw, buffer_size=2)
+        assert f.read(1) == 'a'
+        f.write('B')
+        a = bytearray('xxxxx')
+        assert f.readinto(a) == 3
+        assert a == 'b\ncxx'
+        f.seek(0)
+        assert f.read() == 'aBb\nc'
+        f.close()
+
     def test_write_rewind_write(self):
         # Various combinations of reading / writing / seeking
         # backwards / writing again
@@ -525,3 +597,29 @@ class TestNonReentrantLock:
             exc = py.test.raises(OperationError, "with lock: pass")
         assert exc.value.match(space, space.w_RuntimeError)
 
+    def test_biased(self, monkeypatch):
+        space = gettestobjspace(usemodules=['thread'])
+        lock = interp_bufferedio.TryLock(space)
+        ident = [1]
+        monkeypatch.setattr(interp_bufferedio.ll_thread, 'get_ident',
+                            lambda: ident[0])
+        with lock:
+            assert lock.owner == 1
+        assert lock.owner == 0
+        assert lock.lock is None
+        # a second thread comes while the first one holds the lock
+        lock.__enter__()
+        ident[0] = 2
+        lock._unbias()
+        assert lock.lock is not None
+        assert not lock.lock.acquire(False)
+        ident[0] = 1
+        lock.__exit__(None, None, None)
+        ident[0] = 2
+        with lock:
+            assert lock.owner == 2
+            exc = py.test.raises(OperationError, "with lock: pass")
+            assert exc.value.match(space, space.w_RuntimeError)
+        assert lock.lock.acquire(False)
+        lock.lock.release()
+
@@ -99,6 +99,15 @@ class AppTestClasses:
             r = d.decode("a" * (2**i))
             assert r == u"a" * (2**i)
 
+    def test_decode_hz_error_handler_grow(self):
+        import codecs
+        codecs.register_error("test.hz_long", lambda e: (u"-" * 100, e.end))
+        d = self.IncrementalHzDecoder("test.hz_long")
+        r = d.decode("x~{ab")
+        assert r == u'x\u5f95'
+        r = d.decode("c", True)
+        assert r == u"-" * 100
+
     def test_encode_hz(self):
         e = self.IncrementalHzEncoder()
         r = e.encode("abcd")
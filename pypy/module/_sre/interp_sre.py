@@ -6,6 +6,7 @@ from pypy.interpreter.typedef import make_weakref_descr
 from pypy.interpreter.gateway import interp2app, unwrap_spec
 from pypy.interpreter.error import OperationError
 from pypy.rlib.rarithmetic import intmask
+from pypy.rlib import jit
 from pypy.tool.pairtype import extendabletype
 
 
@@ -13,7 +14,7 @@ from pypy.tool.pairtype import extendabletype
 #
 # Constants and exposed functions
 
-from pypy.rlib.rsre import rsre_core
+from pypy.rlib.rsre import rsre_core, rsre_dfa
 from pypy.rlib.rsre.rsre_char import MAGIC, CODESIZE, getlower, set_unicode_db
 
 @unwrap_spec(char_ord=int, flags=int)
@@ -94,12 +95,118 @@ def searchcontext(space, ctx):
     except rsre_core.Error, e:
         raise OperationError(space.w_RuntimeError, space.wrap(e.msg))
 
+# ____________________________________________________________
+#
+# Cache of the compiled patterns
+
+class CompiledPattern(object):
+    """The code of a pattern, shared by all the SRE_Pattern objects made
+    from the same code and flags.  The JIT of rsre makes its loops for
+    each code list (it is a green), so a program that compiles the same
+    patterns again and again reuses the loops made the first time."""
+    _immutable_fields_ = ['code[*]', 'flags', 'hash']
+    uses = 0
+    promoted = False
+    referenced = False     # for the clock of PatternCache
+
+    def __init__(self, code, flags, hash):
+        self.code = code
+        self.flags = flags
+        self.hash = hash
+
+def pattern_hash(code, flags):
+    x = flags
+    for c in code:
+        x = intmask((1000003 * x) ^ c)
+    return x
+
+class PatternCache(object):
+    """The CompiledPatterns, for space.fromcache().  There are at most
+    MAX_SIZE of them that are not promoted: then a new one replaces one
+    that was not found recently, chosen with the clock algorithm.  A
+    pattern found PROMOTE_AFTER times is promoted: it is never dropped
+    (up to MAX_PROMOTED of them), and the JIT traces that use it see it
+    as a constant."""
+    MAX_SIZE = 500
+    MAX_PROMOTED = 100
+    PROMOTE_AFTER = 3
+
+    def __init__(self, space):
+        self.buckets = {}     # hash -> list of CompiledPatterns
+        self.clock = []       # the patterns that can be dropped
+        self.hand = 0
+        self.size = 0
+        self.num_promoted = 0
+        self.hits = 0
+        self.misses = 0
+
+    @jit.dont_look_inside
+    def get(self, code, flags):
+        hash = pattern_hash(code, flags)
+        bucket = self.buckets.get(hash, None)
+        if bucket is not None:
+            for found in bucket:
+                if found.flags == flags and found.code == code:
+                    self.hits += 1
+                    self._found(found)
+                    return found
+        self.misses += 1
+        compiled = CompiledPattern(code, flags, hash)
+        if bucket is None:
+            self.buckets[hash] = [compiled]
+        else:
+            bucket.append(compiled)
+        self.size += 1
+        self._add_to_clock(compiled)
+        return compiled
+
+    def _found(self, compiled):
+        if compiled.promoted:
+            return
+        compiled.referenced = True
+        compiled.uses += 1
+        if (compiled.uses >= self.PROMOTE_AFTER and
+                self.num_promoted < self.MAX_PROMOTED):
+            # it stays in the clock, but only as a free slot
+            compiled.promoted = True
+            self.num_promoted += 1
+
+    def _add_to_clock(self, compiled):
+        if len(self.clock) < self.MAX_SIZE:
+            self.clock.append(compiled)
+            return
+        while True:
+            if self.hand >= len(self.clock):
+                self.hand = 0
+            old = self.clock[self.hand]
+            if old.promoted:
+                break
+            if not old.referenced:
+                self._drop(old)
+                break
+            old.referenced = False
+            self.hand += 1
+        self.clock[self.hand] = compiled
+        self.hand += 1
+
+    def _drop(self, compiled):
+        bucket = self.buckets[compiled.hash]
+        bucket.remove(compiled)
+        if not bucket:
+            del self.buckets[compiled.hash]
+        self.size -= 1
+
 # ____________________________________________________________
 #
 # SRE_Pattern class
 
 class W_SRE_Pattern(Wrappable):
-    _immutable_fields_ = ["code", "flags"]
+    _immutable_fields_ = ["compiled", "code", "flags", "dfa?",
+                          "dfa_compiled?"]
+    # The DFA is not shared with the CompiledPattern: its cache of
+    # states can be big, and must go away with the pattern objects.
+    dfa = None
+    dfa_compiled = False
 
     def cannot_copy_w(self):
         space = self.space
@@ -110,20 +217,34 @@ class W_SRE_Pattern(Wrappable):
         """Make a StrMatchContext or a UnicodeMatchContext for searching
         in the given w_string object."""
         space = self.space
+        compiled = self.compiled
+        if compiled.promoted:
+            compiled = jit.promote(compiled)
         if pos < 0: pos = 0
         if endpos < pos: endpos = pos
         if space.is_true(space.isinstance(w_string, space.w_unicode)):
             unicodestr = space.unicode_w(w_string)
             if pos > len(unicodestr): pos = len(unicodestr)
             if endpos > len(unicodestr): endpos = len(unicodestr)
-            return rsre_core.UnicodeMatchContext(self.code, unicodestr,
-                                                 pos, endpos, self.flags)
+            ctx = rsre_core.UnicodeMatchContext(compiled.code, unicodestr,
+                                                pos, endpos, compiled.flags)
         else:
             str = space.bufferstr_w(w_string)
             if pos > len(str): pos = len(str)
             if endpos > len(str): endpos = len(str)
-            return rsre_core.StrMatchContext(self.code, str,
-                                             pos, endpos, self.flags)
+            ctx = rsre_core.StrMatchContext(compiled.code, str,
+                                            pos, endpos, compiled.flags)
+        ctx.dfa = self.get_dfa()
+        return ctx
+
+    def get_dfa(self):
+        # compiled the first time the pattern is used; None if the
+        # pattern needs the backtracking matcher, or if the backtracking
+        # matcher and its JIT do fine on it (see rsre_dfa.py)
+        if not self.dfa_compiled:
+            self.dfa = rsre_dfa.compile_if_needed(self.code, self.flags)
+            self.dfa_compiled = True
+        return self.dfa
 
     def getmatch(self, ctx, found):
         if found:
@@ -294,13 +415,15 @@ def SRE_Pattern__new__(space, w_subtype, w_pattern, flags, w_code,
     n = space.len_w(w_code)
     code = [intmask(space.uint_w(space.getitem(w_code, space.wrap(i))))
             for i in range(n)]
+    compiled = space.fromcache(PatternCache).get(code, flags)
     #
     w_srepat = space.allocate_instance(W_SRE_Pattern, w_subtype)
     srepat = space.interp_w(W_SRE_Pattern, w_srepat)
     srepat.space = space
     srepat.w_pattern = w_pattern      # the original uncompiled pattern
+    srepat.compiled = compiled
     srepat.flags = flags
-    srepat.code = code
+    srepat.code = compiled.code
     srepat.num_groups = groups
     srepat.w_groupindex = w_groupindex
     srepat.w_indexgroup = w_indexgroup
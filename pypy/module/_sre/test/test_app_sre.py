@@ -916,3 +916,31 @@ class AppTestOptimizations:
         import re
         assert re.search(".+ab", "wowowowawoabwowo")
         assert None == re.search(".+ab", "wowowaowowo")
+
+    def test_no_exponential_backtracking(self):
+        # the patterns with nested repetitions and without groups are
+        # run by the DFA of rsre_dfa.py
+        import re
+        assert re.match("(?:a|aa)*c", "a" * 50) is None
+        assert re.search("(?:x+x+)+y", "x" * 50) is None
+        m = re.search("(?:a|aa)*b", "c" + "a" * 50 + "b")
+        assert m.span() == (1, 52)
+        m = re.match("(?:(?:a|aa)*c|a+)", "a" * 50)
+        assert m.span() == (0, 50)
+        assert re.findall("(?:a|ab)(?:c|bcd)", "abcd-abcd") == ["abcd", "abcd"]
+
+
+class AppTestPatternCache:
+
+    def test_counter(self):
+        import re, sre_compile, __pypy__
+        hits, misses, size = __pypy__.sre_cache_counter()
+        # sre_compile.compile() always calls _sre.compile()
+        p1 = sre_compile.compile("cache(a|b)+c")
+        p2 = sre_compile.compile("cache(a|b)+c")
+        p3 = sre_compile.compile("cache(a|b)+c", re.IGNORECASE)
+        assert __pypy__.sre_cache_counter()[:2] == (hits + 1, misses + 2)
+        assert p2 is not p1
+        assert p2.match("cacheabac").group(1) == "a"
+        assert p3.match("CACHEAC").group(1) == "A"
+
@@ -0,0 +1,65 @@
+from pypy.module._sre import interp_sre
+from pypy.module._sre.interp_sre import PatternCache
+
+
+def test_pattern_cache():
+    cache = PatternCache(None)
+    c1 = cache.get([17, 4, 0, 1, 1, 19, 120, 1], 0)
+    c2 = cache.get([17, 4, 0, 1, 1, 19, 120, 1], 0)
+    c3 = cache.get([17, 4, 0, 1, 1, 19, 120, 1], 2)
+    assert c2 is c1
+    assert c3 is not c1
+    assert c3.flags == 2
+    assert (cache.hits, cache.misses) == (1, 2)
+
+def test_pattern_cache_bounded():
+    cache = PatternCache(None)
+    cache.MAX_SIZE = 10
+    for i in range(25):
+        cache.get([19, i, 1], 0)
+    assert cache.size == 10
+    assert len(cache.clock) == 10
+    assert cache.misses == 25
+
+def test_pattern_cache_keeps_recent():
+    cache = PatternCache(None)
+    cache.MAX_SIZE = 10
+    cache.MAX_PROMOTED = 0
+    hot = cache.get([19, 1000, 1], 0)
+    for i in range(25):
+        cache.get([19, i, 1], 0)
+        # found again between the new patterns: it is never dropped
+        assert cache.get([19, 1000, 1], 0) is hot
+    assert not hot.promoted
+    assert hot.uses == 25
+    assert cache.size == 10
+    assert cache.misses == 26
+
+def test_pattern_cache_collisions(monkeypatch):
+    monkeypatch.setattr(interp_sre, 'pattern_hash', lambda code, flags: 42)
+    cache = PatternCache(None)
+    cache.MAX_SIZE = 3
+    patterns = [cache.get([19, i, 1], 0) for i in range(5)]
+    assert cache.size == 3
+    assert len(cache.buckets[42]) == 3
+    assert cache.get([19, 4, 1], 0) is patterns[4]
+    assert cache.get([19, 0, 1], 0) is not patterns[0]
+
+def test_pattern_cache_promote():
+    cache = PatternCache(None)
+    cache.MAX_SIZE = 10
+    hot = cache.get([19, 1000, 1], 0)
+    for i in range(cache.PROMOTE_AFTER):
+        assert not hot.promoted
+        assert cache.get([19, 1000, 1], 0) is hot
+    assert hot.promoted
+    for i in range(25):
+        cache.get([19, i, 1], 0)
+    # the promoted pattern was not dropped with the others
+    assert cache.get([19, 1000, 1], 0) is hot
+    assert cache.get([19, 0, 1], 0) is not None
+    #
+    cache.MAX_PROMOTED = 1
+    for i in range(cache.PROMOTE_AFTER + 1):
+        other = cache.get([19, 2000, 1], 0)
+    assert not other.promoted
@@ -0,0 +1,25 @@
+from pypy.module.pypyjit.test_pypy_c.test_00_model import BaseTestPyPyC
+
+
+class TestSre(BaseTestPyPyC):
+    def test_match_makes_rsre_loops(self):
+        def main(n):
+            import re
+            r = re.compile(r'(?:ab)*c')
+            s = 'ab' * 500 + 'c'
+            i = 0
+            total = 0
+            while i < n:
+                total += r.match(s).end()
+                i += 1
+            return total
+        #
+        log = self.run(main, [300])
+        assert log.result == 1001 * 300
+        # the loops of rsre are compiled too: a pattern like this one is
+        # not run by the DFA of rsre_dfa.py
+        rsre_loops = [loop for loop in log.loops
+                      if loop.filename is None and
+                         (loop.chunks[0].bytecode_name or '').startswith(
+                             're MaxUntil')]
+        assert rsre_loops
@@ -1,6 +1,6 @@
 
 from pypy.interpreter.mixedmodule import MixedModule
-import os
+import os, sys
 import signal as cpy_signal
 
 class Module(MixedModule):
@@ -19,6 +19,8 @@ class Module(MixedModule):
         interpleveldefs['alarm'] = 'interp_signal.alarm'
         interpleveldefs['pause'] = 'interp_signal.pause'
         interpleveldefs['siginterrupt'] = 'interp_signal.siginterrupt'
+    if sys.platform.startswith('linux'):
+        interpleveldefs['use_signalfd'] = 'interp_signal.use_signalfd'
 
     if os.name == 'posix':
         interpleveldefs['setitimer'] = 'interp_signal.setitimer'
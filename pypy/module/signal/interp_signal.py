@@ -1,5 +1,6 @@
 from __future__ import with_statement
 from pypy.interpreter.error import OperationError, exception_from_errno
+from pypy.interpreter.error import wrap_oserror
 from pypy.interpreter.executioncontext import AsyncAction, AbstractActionFlag
 from pypy.interpreter.executioncontext import PeriodicAsyncAction
 from pypy.interpreter.gateway import unwrap_spec
@@ -27,15 +28,21 @@ signal_names = list(setup())
 includes = ['stdlib.h', 'src/signals.h']
 if sys.platform != 'win32':
     includes.append('sys/time.h')
+if sys.platform.startswith('linux'):
+    libraries = ['pthread']    # for the reader thread of the signalfd
+else:
+    libraries = []
 
 eci = ExternalCompilationInfo(
     includes = includes,
     separate_module_sources = ['#include <src/signals.h>'],
     include_dirs = [str(py.path.local(autopath.pypydir).join('translator', 'c'))],
+    libraries = libraries,
     export_symbols = ['pypysig_poll', 'pypysig_default',
                       'pypysig_ignore', 'pypysig_setflag',
                       'pypysig_reinstall',
                       'pypysig_set_wakeup_fd',
+                      'pypysig_set_signalfd',
                       'pypysig_getaddr_occurred'],
 )
 
@@ -68,6 +75,8 @@ pypysig_default = external('pypysig_default', [rffi.INT], lltype.Void)
 pypysig_setflag = external('pypysig_setflag', [rffi.INT], lltype.Void)
 pypysig_reinstall = external('pypysig_reinstall', [rffi.INT], lltype.Void)
 pypysig_set_wakeup_fd = external('pypysig_set_wakeup_fd', [rffi.INT], rffi.INT)
+pypysig_set_signalfd = external('pypysig_set_signalfd', [rffi.INT, rffi.INT],
+                                rffi.INT)
 pypysig_poll = external('pypysig_poll', [], rffi.INT, threadsafe=False)
 # don't bother releasing the GIL around a call to pypysig_poll: it's
 # pointless and a performance issue
@@ -303,6 +312,30 @@ def set_wakeup_fd(space, fd):
     old_fd = pypysig_set_wakeup_fd(fd)
     return space.wrap(intmask(old_fd))
 
+@jit.dont_look_inside
+@unwrap_spec(signum=int, flag=int)
+def use_signalfd(space, signum, flag=1):
+    """use_signalfd(sig, flag=1)
+
+    PyPy-specific, Linux only.  If 'flag' is true, the signal is blocked
+    in the calling thread (and in the threads it starts afterwards) and
+    read by a helper thread from a signalfd, which batches the signals
+    that arrive together: the handler is then invoked without the cost
+    of a C-level signal handler and of a write to the wakeup fd per
+    signal.  Meant for signals that can arrive in storms, like SIGCHLD.
+    Note that these signals no longer interrupt blocking system calls.
+    """
+    check_signum(space, signum)
+    if space.config.objspace.usemodules.thread:
+        main_ec = space.threadlocals.getmainthreadvalue()
+        ec = space.getexecutioncontext()
+        if ec is not main_ec:
+            raise OperationError(
+                space.w_ValueError,
+                space.wrap("use_signalfd only works in main thread"))
+    if rffi.cast(lltype.Signed, pypysig_set_signalfd(signum, flag)) < 0:
+        raise wrap_oserror(space, OSError(rposix.get_errno(), "signalfd"))
+
 @unwrap_spec(signum=int, flag=int)
 def siginterrupt(space, signum, flag):
     check_signum(space, signum)
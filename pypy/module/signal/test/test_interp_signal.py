@@ -32,7 +32,34 @@ def test_simple():
     interp_signal.pypysig_default(interp_signal.SIGUSR1)
     check(-1)
 
+def test_several():
+    import os
+    fd_read, fd_write = os.pipe()
+    interp_signal.pypysig_set_wakeup_fd(fd_write)
+    interp_signal.pypysig_setflag(interp_signal.SIGUSR1)
+    interp_signal.pypysig_setflag(interp_signal.SIGUSR2)
+    os.kill(os.getpid(), interp_signal.SIGUSR2)
+    os.kill(os.getpid(), interp_signal.SIGUSR1)
+    # both are taken in the same poll(), and returned in order
+    check(interp_signal.SIGUSR1)
+    check(interp_signal.SIGUSR2)
+    check(-1)
+    # only one byte was written to the wakeup fd for both
+    os.kill(os.getpid(), interp_signal.SIGUSR1)
+    assert os.read(fd_read, 10) == '\x00\x00'
+    check(interp_signal.SIGUSR1)
+    check(-1)
+    interp_signal.pypysig_set_wakeup_fd(-1)
+    interp_signal.pypysig_default(interp_signal.SIGUSR1)
+    interp_signal.pypysig_default(interp_signal.SIGUSR2)
+    os.close(fd_read)
+    os.close(fd_write)
+
 
 def test_compile():
     fn = compile(test_simple, [])
     fn()
+
+def test_compile_several():
+    fn = compile(test_several, [])
+    fn()
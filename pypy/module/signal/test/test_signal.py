@@ -196,6 +196,31 @@ class AppTestSignal:
         #
         signal.signal(signal.SIGUSR1, signal.SIG_DFL)
 
+    def test_use_signalfd(self):
+        import signal, posix, sys
+        if not hasattr(signal, 'use_signalfd'):
+            skip("Linux only")
+        received = []
+        def myhandler(signum, frame):
+            received.append(signum)
+        signal.signal(signal.SIGUSR1, myhandler)
+        fd_read, fd_write = posix.pipe()
+        old_wakeup = signal.set_wakeup_fd(fd_write)
+        signal.use_signalfd(signal.SIGUSR1)
+        try:
+            posix.kill(posix.getpid(), signal.SIGUSR1)
+            # delivered by the reader thread, which writes to the wakeup fd
+            assert posix.read(fd_read, 1) == '\x00'
+            for i in range(1000):
+                if received:
+                    break
+            assert received == [signal.SIGUSR1]
+        finally:
+            signal.use_signalfd(signal.SIGUSR1, 0)
+            signal.set_wakeup_fd(old_wakeup)
+            signal.signal(signal.SIGUSR1, signal.SIG_DFL)
+        raises(ValueError, signal.use_signalfd, 0)
+
     def test_siginterrupt(self):
         import signal, os, time
         signum = signal.SIGUSR1
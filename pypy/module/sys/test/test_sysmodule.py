@@ -350,6 +350,20 @@ class AppTestSysModulePortedFromCPython:
             sys.setcheckinterval(n)
             assert sys.getcheckinterval() == n
 
+    def test_switchinterval(self):
+        import sys
+        raises(TypeError, sys.setswitchinterval)
+        raises(ValueError, sys.setswitchinterval, 0.0)
+        raises(ValueError, sys.setswitchinterval, -1.5)
+        orig = sys.getswitchinterval()
+        try:
+            sys.setswitchinterval(0.0025)
+            assert abs(sys.getswitchinterval() - 0.0025) < 1e-9
+            sys.setswitchinterval(1e-9)
+            assert sys.getswitchinterval() > 0.0
+        finally:
+            sys.setswitchinterval(orig)
+
     def test_recursionlimit(self):
         import sys
         raises(TypeError, sys.getrecursionlimit, 42)
@@ -51,7 +51,8 @@ can occur before a RuntimeError is raised.  On PyPy the limit is
 approximative and checked at a lower level.  The default 1000
 reserves 768KB of stack space, which should suffice (on Linux,
 depending on the compiler settings) for ~1400 calls.  Setting the
-value to N reserves N/1000 times 768KB of stack space.
+value to N reserves N/1000 times 768KB of stack space, but never more
+than the real size of the stack of the thread, if it is known.
 """
     from pypy.rlib.rstack import _stack_set_length_fraction
     new_limit = space.int_w(w_new_limit)
@@ -85,6 +86,27 @@ def getcheckinterval(space):
         result = 0
     return space.wrap(result)
 
+@unwrap_spec(interval=float)
+def setswitchinterval(space, interval):
+    """Set the ideal thread switching delay inside the Python interpreter,
+    in seconds.  A thread waiting for the GIL asks the running thread to
+    release it after this delay.  (Backported from Python 3.2.)"""
+    if interval <= 0.0:
+        raise OperationError(space.w_ValueError,
+                             space.wrap("switch interval must be strictly "
+                                        "positive"))
+    interval *= 1000000.0
+    if interval > 2147483647.0:
+        interval = 2147483647.0
+    microseconds = int(interval)
+    if microseconds < 1:
+        microseconds = 1
+    space.threadlocals.setswitchinterval(microseconds)
+
+def getswitchinterval(space):
+    """Return the thread switch interval; see setswitchinterval()."""
+    return space.wrap(space.threadlocals.getswitchinterval() * 1e-6)
+
 def exc_info(space):
     """Return the (type, value, traceback) of the most recent exception
 caught by an except clause in the current stack frame or in an older stack
@@ -13,6 +13,7 @@ from pypy.interpreter.executioncontext import PeriodicAsyncAction
 from pypy.module.thread.threadlocals import OSThreadLocals
 from pypy.rlib.objectmodel import invoke_around_extcall
 from pypy.rlib.rposix import get_errno, set_errno
+from pypy.rpython.lltypesystem import lltype
 
 class GILThreadLocals(OSThreadLocals):
     """A version of OSThreadLocals that enforces a GIL."""
@@ -54,9 +55,40 @@ class GILThreadLocals(OSThreadLocals):
     def yield_thread(self):
         do_yield_thread()
 
+    def setswitchinterval(self, interval):
+        thread.gil_set_switch_interval(interval)
+
+    def getswitchinterval(self):
+        return thread.gil_get_switch_interval()
+
+    def getgilwaitstats(self):
+        """Returns (number of waits, total microseconds spent waiting)
+        for the GIL in the current thread."""
+        return (thread.gil_thread_wait_count(),
+                thread.gil_thread_wait_time())
+
+    def gil_profile_enable(self, enable):
+        """Turns the GIL contention profiler on or off.  Returns the
+        previous state."""
+        return thread.gil_profile_enable(int(enable)) != 0
+
+    def gil_profile_reset(self):
+        thread.gil_profile_reset()
+
+    def gil_profile_snapshot(self):
+        """Returns all the numbers of the GIL contention profiler, read
+        together: its counters, then the buckets of its histograms of
+        acquire latencies and of hold times."""
+        size = thread.GIL_PROFILE_SIZE
+        with lltype.scoped_alloc(thread.GIL_PROFILE_ARRAY, size) as array:
+            thread.gil_profile_snapshot(array)
+            return [array[i] for i in range(size)]
+
 class GILReleaseAction(PeriodicAsyncAction):
     """An action called every sys.checkinterval bytecodes.  It releases
-    the GIL to give some other thread a chance to run.
+    the GIL if another thread has been waiting for it for longer than
+    the switch interval (see sys.setswitchinterval()); otherwise it
+    does nothing and is very cheap.
     """
 
     def perform(self, executioncontext, frame):
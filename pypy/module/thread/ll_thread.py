@@ -20,6 +20,10 @@ eci = ExternalCompilationInfo(
                       'RPyThreadAcquireLock', 'RPyThreadReleaseLock',
                       'RPyGilAllocate', 'RPyGilYieldThread',
                       'RPyGilRelease', 'RPyGilAcquire',
+                      'RPyGilSetSwitchInterval', 'RPyGilGetSwitchInterval',
+                      'RPyGilThreadWaitCount', 'RPyGilThreadWaitTime',
+                      'RPyGilProfileEnable', 'RPyGilProfileReset',
+                      'RPyGilProfileSnapshot',
                       'RPyThreadGetStackSize', 'RPyThreadSetStackSize',
                       'RPyOpaqueDealloc_ThreadLock',
                       'RPyThreadAfterFork']
@@ -81,6 +85,34 @@ gil_release      = llexternal('RPyGilRelease', [], lltype.Void,
                               _nowrapper=True)
 gil_acquire      = llexternal('RPyGilAcquire', [], lltype.Void,
                               _nowrapper=True)
+# the switch interval is in microseconds; the statistics are about the
+# current thread: the number of times it had to wait for the GIL, and
+# the total time spent waiting, in microseconds
+gil_set_switch_interval = llexternal('RPyGilSetSwitchInterval',
+                                     [lltype.Signed], lltype.Void,
+                                     _nowrapper=True)
+gil_get_switch_interval = llexternal('RPyGilGetSwitchInterval',
+                                     [], lltype.Signed, _nowrapper=True)
+gil_thread_wait_count   = llexternal('RPyGilThreadWaitCount',
+                                     [], lltype.Signed, _nowrapper=True)
+gil_thread_wait_time    = llexternal('RPyGilThreadWaitTime',
+                                     [], lltype.Signed, _nowrapper=True)
+# the GIL contention profiler, see thread_pthread.h.  A snapshot copies
+# all its numbers at once into an array of GIL_PROFILE_SIZE longs: the
+# counters, then the histograms of the acquire latencies and of the hold
+# times, with GIL_PROFILE_BUCKETS power-of-two buckets of microseconds each
+GIL_PROFILE_COUNTERS = ['acquires', 'contended_acquires', 'forced_switches',
+                        'drop_requests', 'wait_time', 'hold_time']
+GIL_PROFILE_BUCKETS = 32
+GIL_PROFILE_SIZE = len(GIL_PROFILE_COUNTERS) + 2 * GIL_PROFILE_BUCKETS
+GIL_PROFILE_ARRAY = rffi.CArray(lltype.Signed)
+gil_profile_enable = llexternal('RPyGilProfileEnable', [lltype.Signed],
+                                lltype.Signed, _nowrapper=True)
+gil_profile_reset  = llexternal('RPyGilProfileReset', [], lltype.Void,
+                                _nowrapper=True)
+gil_profile_snapshot = llexternal('RPyGilProfileSnapshot',
+                                  [lltype.Ptr(GIL_PROFILE_ARRAY)],
+                                  lltype.Void, _nowrapper=True)
 
 def allocate_lock():
     return Lock(allocate_ll_lock())
@@ -104,6 +104,96 @@ class GILTests(test_ll_thread.AbstractGCTestClass):
     def test_one_thread_rev(self):
         self.test_one_thread(skew=-1)
 
+    def test_switch_interval(self):
+        # the main thread never releases the GIL explicitly: the other
+        # thread only gets it because it asks for it after waiting for
+        # the switch interval
+        space = FakeSpace()
+        class State:
+            pass
+        state = State()
+        def bootstrap():
+            try:
+                state.sub_waits = thread.gil_thread_wait_count()
+                state.sub_wait_time = thread.gil_thread_wait_time()
+                state.sub_done = True
+            finally:
+                thread.gc_thread_die()
+        def f():
+            state.sub_done = False
+            state.threadlocals = gil.GILThreadLocals()
+            state.threadlocals.setup_threads(space)
+            state.threadlocals.setswitchinterval(1000)
+            if state.threadlocals.getswitchinterval() != 1000:
+                return -1
+            thread.gc_thread_prepare()
+            thread.start_new_thread(bootstrap, ())
+            count = 0
+            while not state.sub_done:
+                count += 1
+                if count > 100000000:
+                    return -2
+                state.threadlocals.yield_thread()
+            if state.sub_waits < 1:
+                return -3
+            if state.sub_wait_time < 0:
+                return -4
+            return 1
+
+        fn = self.getcompiled(f, [])
+        res = fn()
+        assert res == 1
+
+    def test_profile(self):
+        space = FakeSpace()
+        class State:
+            pass
+        state = State()
+        def bootstrap():
+            try:
+                state.sub_done = True
+            finally:
+                thread.gc_thread_die()
+        def profile_sum(snapshot, start):
+            total = 0
+            for i in range(thread.GIL_PROFILE_BUCKETS):
+                total += snapshot[start + i]
+            return total
+        def f():
+            state.sub_done = False
+            state.threadlocals = gil.GILThreadLocals()
+            state.threadlocals.setup_threads(space)
+            state.threadlocals.setswitchinterval(1000)
+            state.threadlocals.gil_profile_enable(True)
+            state.threadlocals.gil_profile_reset()
+            thread.gc_thread_prepare()
+            thread.start_new_thread(bootstrap, ())
+            while not state.sub_done:
+                state.threadlocals.yield_thread()
+            snapshot = state.threadlocals.gil_profile_snapshot()
+            acquires = snapshot[0]
+            contended = snapshot[1]
+            forced = snapshot[2]
+            ncounters = len(thread.GIL_PROFILE_COUNTERS)
+            latencies = profile_sum(snapshot, ncounters)
+            holds = profile_sum(snapshot,
+                                ncounters + thread.GIL_PROFILE_BUCKETS)
+            if not state.threadlocals.gil_profile_enable(False):
+                return -1
+            if len(snapshot) != thread.GIL_PROFILE_SIZE:
+                return -2
+            if contended < 1 or forced < 1:
+                return -3
+            if latencies != acquires:
+                return -4
+            if holds < 1:
+                return -5
+            return 1
+
+        fn = self.getcompiled(f, [])
+        res = fn()
+        assert res == 1
+
 
 class TestRunDirectly(GILTests):
     def getcompiled(self, f, argtypes):
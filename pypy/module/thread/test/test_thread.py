@@ -233,3 +233,20 @@ class AppTestThread(GenericTestThread):
 
         thread.start_new_thread(f, ())
         raises(KeyboardInterrupt, busy_wait)
+
+    def test_gil_profile(self):
+        import thread, __pypy__
+        was_on = __pypy__.gil_profile(True)
+        try:
+            __pypy__.gil_profile_reset()
+            done = []
+            def f():
+                done.append(1)
+            thread.start_new_thread(f, ())
+            self.waitfor(lambda: done)
+            stats = __pypy__.gil_profile_stats()
+            assert stats['acquires'] >= 1
+            assert sum(stats['acquire_latency']) == stats['acquires']
+            assert sum(stats['hold_durations']) >= 1
+        finally:
+            __pypy__.gil_profile(was_on)
@@ -0,0 +1,34 @@
+import sys
+import py
+from pypy.tool.autopath import pypydir
+from pypy.rpython.lltypesystem import lltype, rffi
+from pypy.rlib.rsampler import STACK
+from pypy.translator.tool.cbuild import ExternalCompilationInfo
+
+
+cdir = py.path.local(pypydir) / 'translator' / 'c'
+
+if sys.platform.startswith('linux'):
+    libraries = ['pthread']     # for the writer thread
+else:
+    libraries = []
+
+eci = ExternalCompilationInfo(
+    include_dirs = [cdir],
+    includes = ['src/sampler.h'],
+    separate_module_sources = ['#include "src/sampler.c"\n'],
+    libraries = libraries,
+)
+
+
+def llexternal(name, args, result):
+    return rffi.llexternal(name, args, result, compilation_info=eci,
+                           sandboxsafe=True, _nowrapper=True)
+
+start = llexternal('pypy_sampler_start', [lltype.Signed, lltype.Signed],
+                   lltype.Signed)
+stop = llexternal('pypy_sampler_stop', [], lltype.Signed)
+thread_stack = llexternal('pypy_sampler_thread_stack', [], STACK)
+register_code = llexternal('pypy_sampler_register_code',
+                           [lltype.Signed, lltype.Signed, lltype.Signed,
+                            rffi.CCHARP], lltype.Void)
@@ -27,6 +27,9 @@ if 'masm' in dir(eci.platform): # Microsoft compiler
         'stacklet_switch',
         'stacklet_destroy',
         '_stacklet_translate_pointer',
+        'stacklet_pool_stat',
+        'stacklet_newthread_separate',
+        'stacklet_set_stack_end_hook',
         )
 
 rffi_platform.verify_eci(eci.convert_sources_to_files())
@@ -41,6 +44,7 @@ handle = rffi.COpaquePtr(typedef='stacklet_handle', compilation_info=eci)
 thread_handle = rffi.COpaquePtr(typedef='stacklet_thread_handle',
                                 compilation_info=eci)
 run_fn = lltype.Ptr(lltype.FuncType([handle, llmemory.Address], handle))
+stack_end_hook_fn = lltype.Ptr(lltype.FuncType([rffi.CCHARP], rffi.CCHARP))
 
 # ----- constants -----
 
@@ -49,16 +53,29 @@ null_handle = lltype.nullptr(handle.TO)
 def is_empty_handle(h):
     return rffi.cast(lltype.Signed, h) == -1
 
+# the 'which' argument of pool_stat(), see stacklet.h
+POOL_HITS   = 0
+POOL_MISSES = 1
+POOL_FREES  = 2
+POOL_BYTES  = 3
+
 # ----- functions -----
 
 newthread = llexternal('stacklet_newthread', [], thread_handle)
 deletethread = llexternal('stacklet_deletethread',[thread_handle], lltype.Void)
+newthread_separate = llexternal('stacklet_newthread_separate', [lltype.Signed],
+                                thread_handle)
+set_stack_end_hook = llexternal('stacklet_set_stack_end_hook',
+                                [thread_handle, stack_end_hook_fn],
+                                lltype.Void)
 
 new = llexternal('stacklet_new', [thread_handle, run_fn, llmemory.Address],
                  handle, random_effects_on_gcobjs=True)
 switch = llexternal('stacklet_switch', [thread_handle, handle], handle,
                     random_effects_on_gcobjs=True)
 destroy = llexternal('stacklet_destroy', [thread_handle, handle], lltype.Void)
+pool_stat = llexternal('stacklet_pool_stat', [thread_handle, rffi.INT],
+                       lltype.Signed)
 
 _translate_pointer = llexternal("_stacklet_translate_pointer",
                                 [llmemory.Address, llmemory.Address],
@@ -0,0 +1,43 @@
+"""
+Statistics about, and trimming of, the C-level allocator that serves the
+raw mallocs of a translated program (translator/c/src/obmalloc.c).
+Only meaningful in a standalone translated program; untranslated, in a
+non-standalone program, and when the program is compiled without
+obmalloc, they all return 0.
+"""
+
+from pypy.rpython.lltypesystem import lltype, rffi
+from pypy.translator.tool.cbuild import ExternalCompilationInfo
+
+# the functions are always present: in a standalone program via
+# src/allocator.h, and otherwise as stubs in src/g_include.h; we only
+# need their prototypes
+compilation_info = ExternalCompilationInfo(post_include_bits=[
+    'long pypy_obmalloc_trim(void);',
+    'long pypy_obmalloc_committed(void);',
+    'long pypy_obmalloc_used(void);',
+    ])
+
+def llexternal(name, _callable):
+    return rffi.llexternal(name, [], rffi.LONG,
+                           compilation_info=compilation_info,
+                           sandboxsafe=True, _nowrapper=True,
+                           _callable=_callable)
+
+_obmalloc_trim = llexternal('pypy_obmalloc_trim', lambda: 0)
+_obmalloc_committed = llexternal('pypy_obmalloc_committed', lambda: 0)
+_obmalloc_used = llexternal('pypy_obmalloc_used', lambda: 0)
+
+
+def trim():
+    """Give the memory of the empty pools and arenas back to the OS.
+    Returns the number of bytes released."""
+    return rffi.cast(lltype.Signed, _obmalloc_trim())
+
+def get_committed_bytes():
+    """Number of bytes of arena memory that the OS still backs."""
+    return rffi.cast(lltype.Signed, _obmalloc_committed())
+
+def get_used_bytes():
+    """Number of bytes in the blocks currently allocated."""
+    return rffi.cast(lltype.Signed, _obmalloc_used())
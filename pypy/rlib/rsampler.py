@@ -0,0 +1,110 @@
+"""
+A statistical profiler driven by SIGPROF: see translator/c/src/sampler.h
+for how it works, and pypy/tool/samplerdump.py to turn its output into
+something that flame graph tools can read.
+
+The interpreter maintains a "code stack" per thread, with push() and
+pop(), while 'state.enabled' is true.  The JIT sees the code stack as a
+raw array: the quasi-immutable 'state.enabled' costs nothing in the
+machine code when sampling is off, and the code stack is updated with
+a few raw memory operations when it is on.
+"""
+from pypy.rpython.lltypesystem import lltype
+from pypy.rlib import jit
+
+# the C functions are in _rffi_sampler.py, which is imported lazily:
+# this module is imported by the interpreter, which is imported when
+# rffi is.
+
+# the format of the file, see src/sampler.h
+MAGIC        = 0x50534d50
+VERSION      = 1
+HEADER_WORDS = 6
+TAG_SAMPLE   = 1
+TAG_CODE     = 2
+TAG_LOST     = 3
+CODE_APP     = 0
+CODE_JIT     = 1
+STACK_DEPTH  = 1024
+
+STACK = lltype.Ptr(lltype.Array(lltype.Signed, hints={'nolength': True}))
+
+
+class SamplerState(object):
+    _immutable_fields_ = ['enabled?', 'generation?']
+
+    def __init__(self):
+        self.enabled = False
+        self.generation = 0   # changes at each start(), see thread_stack()
+        self.next_code_id = 1
+        self.registered = []  # which app-level code ids have a name
+
+state = SamplerState()
+
+
+def start(fd, interval_usec):
+    """Start sampling every 'interval_usec' microseconds of CPU time,
+    writing the samples to the file descriptor 'fd'.  Raises OSError."""
+    from pypy.rlib import _rffi_sampler
+    from pypy.rlib.rposix import get_errno
+    if _rffi_sampler.start(fd, interval_usec) < 0:
+        raise OSError(get_errno(), "cannot start the sampling profiler")
+    state.generation += 1
+    state.enabled = True
+
+def stop():
+    """Stop sampling.  Returns the number of samples that were lost, or
+    -1 if the profiler was not started."""
+    from pypy.rlib import _rffi_sampler
+    state.enabled = False
+    return _rffi_sampler.stop()
+
+def thread_stack():
+    """Return the code stack of the current thread, emptied."""
+    from pypy.rlib import _rffi_sampler
+    stack = _rffi_sampler.thread_stack()
+    if not stack:
+        raise MemoryError
+    stack[0] = 0
+    return stack
+
+def new_code_id():
+    """Allocate an id for an app-level code object."""
+    uid = state.next_code_id
+    state.next_code_id = uid + 1
+    return uid
+
+def is_registered(uid):
+    """Check if the code id 'uid' has a name.  Cheap enough for the JIT
+    to trace, unlike register_app_code()."""
+    registered = state.registered
+    return uid < len(registered) and registered[uid]
+
+@jit.dont_look_inside
+def register_app_code(uid, co_name, firstlineno, filename):
+    """Give the name 'co_name:firstlineno:filename' to the code id 'uid',
+    unless it already has one."""
+    registered = state.registered
+    if uid >= len(registered):
+        registered.extend([False] * (uid + 1 - len(registered)))
+    if not registered[uid]:
+        registered[uid] = True
+        register_code(CODE_APP, uid, firstlineno,
+                      '%s:%d:%s' % (co_name, firstlineno, filename))
+
+def register_code(kind, addr, size, name):
+    from pypy.rlib import _rffi_sampler
+    from pypy.rpython.lltypesystem import rffi
+    with rffi.scoped_str2charp(name) as ll_name:
+        _rffi_sampler.register_code(kind, addr, size, ll_name)
+
+def push(stack, uid):
+    depth = stack[0] + 1
+    if depth <= STACK_DEPTH:
+        stack[depth] = uid
+    stack[0] = depth
+
+def pop(stack):
+    depth = stack[0]
+    if depth > 0:
+        stack[0] = depth - 1
@@ -1,7 +1,7 @@
 import sys
 from pypy.rlib.debug import check_nonneg
 from pypy.rlib.unroll import unrolling_iterable
-from pypy.rlib.rsre import rsre_char
+from pypy.rlib.rsre import rsre_char, rsre_scan
 from pypy.tool.sourcetools import func_with_new_name
 from pypy.rlib.objectmodel import we_are_translated
 from pypy.rlib import jit
@@ -85,6 +85,7 @@ class AbstractMatchContext(object):
     match_end = 0
     match_marks = None
     match_marks_flat = None
+    dfa = None      # an optional rsre_dfa.DFA for the pattern
 
     def __init__(self, pattern, match_start, end, flags):
         # 'match_start' and 'end' must be known to be non-negative
@@ -181,8 +182,10 @@ class StrMatchContext(AbstractMatchContext):
         return rsre_char.getlower(c, self.flags)
 
     def fresh_copy(self, start):
-        return StrMatchContext(self.pattern, self._string, start,
-                               self.end, self.flags)
+        ctx = StrMatchContext(self.pattern, self._string, start,
+                              self.end, self.flags)
+        ctx.dfa = self.dfa
+        return ctx
 
 class UnicodeMatchContext(AbstractMatchContext):
     """Concrete subclass for matching in a unicode string."""
@@ -200,8 +203,10 @@ class UnicodeMatchContext(AbstractMatchContext):
         return rsre_char.getlower(c, self.flags)
 
     def fresh_copy(self, start):
-        return UnicodeMatchContext(self.pattern, self._unicodestr, start,
-                                   self.end, self.flags)
+        ctx = UnicodeMatchContext(self.pattern, self._unicodestr, start,
+                                  self.end, self.flags)
+        ctx.dfa = self.dfa
+        return ctx
 
 # ____________________________________________________________
 
@@ -986,6 +991,8 @@ def match_context(ctx):
     ctx.original_pos = ctx.match_start
     if ctx.end < ctx.match_start:
         return False
+    if ctx.dfa is not None and not jit.we_are_jitted():
+        return ctx.dfa.match_context(ctx)      # see rsre_dfa.py
     ctx.jitdriver_Match.jit_merge_point(ctx=ctx)
     return sre_match(ctx, 0, ctx.match_start, None) is not None
 
@@ -993,22 +1000,38 @@ def search_context(ctx):
     ctx.original_pos = ctx.match_start
     if ctx.end < ctx.match_start:
         return False
+    if ctx.dfa is not None and not jit.we_are_jitted():
+        return ctx.dfa.search_context(ctx)     # see rsre_dfa.py
+    scan = fast_scan_possible(ctx)
     base = 0
     charset = False
     if ctx.pat(base) == OPCODE_INFO:
         flags = ctx.pat(2)
         if flags & rsre_char.SRE_INFO_PREFIX:
             if ctx.pat(5) > 1:
+                if scan:
+                    return prefix_scan_search(ctx)
                 return fast_search(ctx)
         else:
             charset = (flags & rsre_char.SRE_INFO_CHARSET)
         base += 1 + ctx.pat(1)
     if ctx.pat(base) == OPCODE_LITERAL:
+        if scan:
+            return literal_scan_search(ctx, base)
         return literal_search(ctx, base)
     if charset:
+        if scan and (ctx.end - ctx.match_start >=
+                     rsre_scan.CHARSET_SCAN_MIN_LENGTH):
+            return charset_scan_search(ctx, base)
         return charset_search(ctx, base)
     return regular_search(ctx, base)
 
+def fast_scan_possible(ctx):
+    # see rsre_scan.py
+    if jit.we_are_jitted() or not isinstance(ctx, StrMatchContext):
+        return False
+    return rsre_scan.can_scan(ctx._string, ctx.match_start, ctx.end)
+
 install_jitdriver('RegularSearch',
                   greens=['base', 'ctx.pattern'],
                   reds=['start', 'ctx'],
@@ -1064,6 +1087,67 @@ def charset_search(ctx, base):
         start += 1
     return False
 
+@jit.dont_look_inside
+def literal_scan_search(ctx, base):
+    # like literal_search(), with rsre_scan.find_char()
+    assert isinstance(ctx, StrMatchContext)
+    character = ctx.pat(base + 1)
+    base += 2
+    start = ctx.match_start
+    while True:
+        start = rsre_scan.find_char(ctx._string, start, ctx.end, character)
+        if start < 0:
+            return False
+        if sre_match(ctx, base, start + 1, None) is not None:
+            ctx.match_start = start
+            return True
+        start += 1
+
+@jit.dont_look_inside
+def charset_scan_search(ctx, base):
+    # like charset_search(), with rsre_scan.find_charset()
+    assert isinstance(ctx, StrMatchContext)
+    table = rsre_scan.alloc_charset_table(ctx.pattern, 5)
+    try:
+        start = ctx.match_start
+        while True:
+            start = rsre_scan.find_charset(ctx._string, start, ctx.end, table)
+            if start < 0:
+                return False
+            if sre_match(ctx, base, start, None) is not None:
+                ctx.match_start = start
+                return True
+            start += 1
+    finally:
+        rsre_scan.free(table)
+
+@jit.dont_look_inside
+def prefix_scan_search(ctx):
+    # like fast_search(), with rsre_scan.find_prefix()
+    # <INFO> <1=skip> <2=flags> <3=min> <4=...>
+    #        <5=length> <6=skip> <7=prefix data> <overlap data>
+    assert isinstance(ctx, StrMatchContext)
+    prefix_len = ctx.pat(5)
+    prefix_skip = ctx.pat(6)
+    ppos_start = ctx.pat(1) + 1 + 2 * prefix_skip
+    prefix = rsre_scan.alloc_prefix(ctx.pattern, 7, prefix_len)
+    if not prefix:
+        return False
+    try:
+        start = ctx.match_start
+        while True:
+            start = rsre_scan.find_prefix(ctx._string, start, ctx.end,
+                                          prefix, prefix_len)
+            if start < 0:
+                return False
+            if sre_match(ctx, ppos_start, start + prefix_skip,
+                         None) is not None:
+                ctx.match_start = start
+                return True
+            start += 1
+    finally:
+        rsre_scan.free(prefix)
+
 install_jitdriver_spec('FastSearch',
                        greens=['i', 'prefix_len', 'ctx.pattern'],
                        reds=['string_position', 'ctx'],
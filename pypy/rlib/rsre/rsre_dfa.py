@@ -0,0 +1,593 @@
+"""
+A lazy DFA for the patterns that don't need backtracking: no group
+references, no lookahead or lookbehind assertions, no conditionals, and
+no repetition of something that can match the empty string.  For them,
+the answer of the backtracking matcher of rsre_core.py can be computed
+in time linear in the length of the string, whatever the pattern, if it
+has no groups either (see below).
+
+The sre code is first compiled into an NFA, in which the branches and
+repetitions are split nodes with a preferred and an alternative exit.
+A DFA state is the list of the NFA nodes that are alive at a position,
+ordered by priority as the backtracking matcher would try them; the
+list is cut after the first match node, because the threads behind it
+can no longer win.  The states are built lazily, the first time a
+character is seen in a state, and cached; if there are too many of
+them, the cache is thrown away and rebuilt as needed.
+
+The DFA gives the end of the match.  For the groups, the backtracking
+matcher is run again at the position where the DFA found a match, which
+is not linear any more: a pattern like '(?:(a|aa)*c|a+)' makes it try
+all the ways to match the first alternative before it finds the match.
+
+A DFA object is attached to a match context as 'ctx.dfa' by the caller,
+and then match_context() and search_context() in rsre_core.py use it
+instead of the backtracking loops, but not in JIT-compiled code.  As
+this also means that the rsre JIT never compiles these loops, module/_sre
+only does it with compile_if_needed(), for the patterns on which the
+backtracking matcher can take exponential time: the ones that repeat
+something that contains a branch or another repetition, like '(?:a|aa)*c'
+or '(?:x+x+)+y', and that have no groups.
+"""
+from pypy.rlib.rsre import rsre_char, rsre_core, rsre_scan
+from pypy.rlib.rsre.rsre_core import StrMatchContext, specializectx
+from pypy.rlib import jit
+from pypy.rlib.objectmodel import specialize
+
+MAX_NFA_NODES = 2000    # give up on patterns bigger than that
+MAX_DFA_STATES = 1000   # then the cache of states is reset
+
+# the kinds of NFA nodes
+N_CHAR  = 0     # arg: the position in the pattern of the character test
+N_SPLIT = 1     # out1: the preferred exit, out2: the other one
+N_MATCH = 2
+N_FAIL  = 3
+N_BEGIN = 4     # at the start of the string
+N_END   = 5     # arg: AT_END or AT_END_STRING
+
+# the flags of a closure, describing the current position
+F_BEGIN      = 1    # at the start of the string
+F_SETTLE     = 2    # at the end or before a final newline: resolve N_END
+F_END_STRING = 4    # at the end
+F_END_LINE   = 8    # at the end, or before a final newline
+
+
+class Unsupported(Exception):
+    pass
+
+
+class NFABuilder(object):
+
+    def __init__(self, pattern):
+        self.pattern = pattern
+        self.kind = []
+        self.arg = []
+        self.out1 = []
+        self.out2 = []
+        self.has_marks = False
+        self.nested_repeat = False    # see compile_if_needed()
+
+    def new_node(self, kind, arg=0, out1=-1, out2=-1):
+        if len(self.kind) >= MAX_NFA_NODES:
+            raise Unsupported
+        self.kind.append(kind)
+        self.arg.append(arg)
+        self.out1.append(out1)
+        self.out2.append(out2)
+        return len(self.kind) - 1
+
+    def new_split(self, body, exit, greedy):
+        if greedy:
+            return self.new_node(N_SPLIT, 0, body, exit)
+        else:
+            return self.new_node(N_SPLIT, 0, exit, body)
+
+    def compile_seq(self, ppos, cont):
+        """Compiles the sequence of the pattern starting at 'ppos', up to
+        the end of its enclosing item; after it, the NFA goes on with
+        the node 'cont'.  Returns the first node."""
+        pattern = self.pattern
+        op = pattern[ppos]
+        if (op == rsre_core.OPCODE_SUCCESS or
+                op == rsre_core.OPCODE_JUMP or
+                op == rsre_core.OPCODE_MAX_UNTIL or
+                op == rsre_core.OPCODE_MIN_UNTIL):
+            return cont
+        if op == rsre_core.OPCODE_FAILURE:
+            return self.new_node(N_FAIL)
+        ppos += 1
+
+        if op == rsre_core.OPCODE_INFO:
+            return self.compile_seq(ppos + pattern[ppos], cont)
+
+        if op == rsre_core.OPCODE_MARK:
+            self.has_marks = True
+            return self.compile_seq(ppos + 1, cont)
+
+        if (op == rsre_core.OPCODE_ANY or
+                op == rsre_core.OPCODE_ANY_ALL):
+            rest = self.compile_seq(ppos, cont)
+            return self.new_node(N_CHAR, ppos - 1, rest)
+
+        if (op == rsre_core.OPCODE_LITERAL or
+                op == rsre_core.OPCODE_LITERAL_IGNORE or
+                op == rsre_core.OPCODE_NOT_LITERAL or
+                op == rsre_core.OPCODE_NOT_LITERAL_IGNORE or
+                op == rsre_core.OPCODE_CATEGORY):
+            rest = self.compile_seq(ppos + 1, cont)
+            return self.new_node(N_CHAR, ppos - 1, rest)
+
+        if (op == rsre_core.OPCODE_IN or
+                op == rsre_core.OPCODE_IN_IGNORE):
+            rest = self.compile_seq(ppos + pattern[ppos], cont)
+            return self.new_node(N_CHAR, ppos - 1, rest)
+
+        if op == rsre_core.OPCODE_AT:
+            atcode = pattern[ppos]
+            rest = self.compile_seq(ppos + 1, cont)
+            if (atcode == rsre_core.AT_BEGINNING or
+                    atcode == rsre_core.AT_BEGINNING_STRING):
+                return self.new_node(N_BEGIN, atcode, rest)
+            if (atcode == rsre_core.AT_END or
+                    atcode == rsre_core.AT_END_STRING):
+                return self.new_node(N_END, atcode, rest)
+            raise Unsupported     # line or word boundaries
+
+        if op == rsre_core.OPCODE_BRANCH:
+            # <BRANCH> <0=skip> code <JUMP> ... <NULL>
+            alternatives = []
+            while pattern[ppos]:
+                alternatives.append(ppos + 1)
+                ppos += pattern[ppos]
+            rest = self.compile_seq(ppos + 1, cont)
+            result = self.new_node(N_FAIL)
+            for i in range(len(alternatives) - 1, -1, -1):
+                first = self.compile_seq(alternatives[i], rest)
+                result = self.new_node(N_SPLIT, 0, first, result)
+            return result
+
+        if (op == rsre_core.OPCODE_REPEAT_ONE or
+                op == rsre_core.OPCODE_MIN_REPEAT_ONE):
+            # <REPEAT_ONE> <skip> <1=min> <2=max> item <SUCCESS> tail
+            rest = self.compile_seq(ppos + pattern[ppos], cont)
+            greedy = op == rsre_core.OPCODE_REPEAT_ONE
+            return self.compile_repeat(ppos + 3, pattern[ppos + 1],
+                                       pattern[ppos + 2], greedy, rest)
+
+        if op == rsre_core.OPCODE_REPEAT:
+            # <REPEAT> <skip> <1=min> <2=max> item <UNTIL> tail
+            untilppos = ppos + pattern[ppos]
+            greedy = pattern[untilppos] == rsre_core.OPCODE_MAX_UNTIL
+            if self.is_nullable(ppos + 3):
+                raise Unsupported     # the rules for empty loops of sre
+            rest = self.compile_seq(untilppos + 1, cont)
+            return self.compile_repeat(ppos + 3, pattern[ppos + 1],
+                                       pattern[ppos + 2], greedy, rest)
+
+        raise Unsupported     # GROUPREF, ASSERT, GROUPREF_EXISTS...
+
+    def compile_item(self, itemppos, cont, looping):
+        first = len(self.kind)
+        body = self.compile_seq(itemppos, cont)
+        if looping:
+            for node in range(first, len(self.kind)):
+                if self.kind[node] == N_SPLIT:
+                    self.nested_repeat = True
+        return body
+
+    def compile_repeat(self, itemppos, min, max, greedy, rest):
+        looping = max > 1
+        if max >= rsre_char.MAXREPEAT:      # no limit
+            loop = self.new_node(N_SPLIT)
+            body = self.compile_item(itemppos, loop, looping)
+            if greedy:
+                self.out1[loop] = body
+                self.out2[loop] = rest
+            else:
+                self.out1[loop] = rest
+                self.out2[loop] = body
+            result = loop
+        else:
+            result = rest
+            for i in range(max - min):
+                body = self.compile_item(itemppos, result, looping)
+                result = self.new_split(body, rest, greedy)
+        for i in range(min):
+            result = self.compile_item(itemppos, result, looping)
+        return result
+
+    def is_nullable(self, itemppos):
+        """Can the item at 'itemppos' match the empty string?"""
+        end = self.new_node(N_MATCH)
+        start = self.compile_seq(itemppos, end)
+        pending = [start]
+        seen = {}
+        while pending:
+            node = pending.pop()
+            if node == end:
+                return True
+            if node in seen:
+                continue
+            seen[node] = None
+            kind = self.kind[node]
+            if kind == N_SPLIT:
+                pending.append(self.out1[node])
+                pending.append(self.out2[node])
+            elif kind == N_BEGIN or kind == N_END:
+                pending.append(self.out1[node])
+        return False
+
+
+@jit.dont_look_inside
+def compile(pattern, flags):
+    """Returns a DFA for the sre code 'pattern', or None if the pattern
+    is not supported."""
+    builder = NFABuilder(pattern)
+    try:
+        start = builder.compile_seq(0, builder.new_node(N_MATCH))
+    except Unsupported:
+        return None
+    return DFA(builder, start, flags)
+
+@jit.dont_look_inside
+def compile_if_needed(pattern, flags):
+    """Like compile(), but also returns None if the backtracking matcher
+    is not exponential on the pattern, as far as we can tell: when it has
+    no repetition of something that contains a branch or a repetition;
+    and if the pattern has groups, for which the DFA would run the
+    backtracking matcher anyway."""
+    dfa = compile(pattern, flags)
+    if dfa is not None and (not dfa.nested_repeat or dfa.has_marks):
+        dfa = None
+    return dfa
+
+
+class DFAState(object):
+
+    def __init__(self, nodes, unanchored, is_match, has_end, cached):
+        self.nodes = nodes
+        self.unanchored = unanchored
+        self.is_match = is_match
+        self.has_end = has_end
+        # the next state for each character, or None if not computed yet,
+        # and the origin of its nodes (see compute_next())
+        if cached:
+            self.next = [None] * 256
+            self.next_origin = [None] * 256
+        else:
+            self.next = None     # a state for one position only
+            self.next_origin = None
+        self.next_big = None     # dicts for the characters above 255
+        self.next_big_origin = None
+
+    def is_dead(self):
+        return not self.nodes and not self.unanchored
+
+
+class DFA(object):
+
+    def __init__(self, builder, start, flags):
+        self.pattern = builder.pattern
+        self.kind = builder.kind
+        self.arg = builder.arg
+        self.out1 = builder.out1
+        self.out2 = builder.out2
+        self.has_marks = builder.has_marks
+        self.nested_repeat = builder.nested_repeat
+        self.start = start
+        self.flags = flags
+        self.seen = [0] * len(self.kind)
+        self.generation = 0
+        self.cache_resets = 0
+        self.first_char = self.find_first_char()
+        self.reset_cache()
+
+    def find_first_char(self):
+        """The character with which all the matches start, or -1."""
+        pattern = self.pattern
+        ppos = 0
+        if pattern[ppos] == rsre_core.OPCODE_INFO:
+            if pattern[ppos + 2] & rsre_char.SRE_INFO_PREFIX:
+                if pattern[ppos + 5] > 0:
+                    return pattern[ppos + 7]
+            ppos += 1 + pattern[ppos + 1]
+        if pattern[ppos] == rsre_core.OPCODE_LITERAL:
+            return pattern[ppos + 1]
+        return -1
+
+    def reset_cache(self):
+        self.states = {}
+        # the initial states, anchored or not, at the start or not
+        self.initial_states = [None, None, None, None]
+
+    # ____________________________________________________________
+    # Building the states
+
+    def char_matches(self, ppos, c):
+        pattern = self.pattern
+        op = pattern[ppos]
+        if op == rsre_core.OPCODE_LITERAL:
+            return c == pattern[ppos + 1]
+        elif op == rsre_core.OPCODE_LITERAL_IGNORE:
+            return rsre_char.getlower(c, self.flags) == pattern[ppos + 1]
+        elif op == rsre_core.OPCODE_NOT_LITERAL:
+            return c != pattern[ppos + 1]
+        elif op == rsre_core.OPCODE_NOT_LITERAL_IGNORE:
+            return rsre_char.getlower(c, self.flags) != pattern[ppos + 1]
+        elif op == rsre_core.OPCODE_ANY:
+            return not rsre_char.is_linebreak(c)
+        elif op == rsre_core.OPCODE_ANY_ALL:
+            return True
+        elif op == rsre_core.OPCODE_IN:
+            return rsre_char.check_charset(pattern, ppos + 2, c)
+        elif op == rsre_core.OPCODE_IN_IGNORE:
+            return rsre_char.check_charset(pattern, ppos + 2,
+                                           rsre_char.getlower(c, self.flags))
+        elif op == rsre_core.OPCODE_CATEGORY:
+            return rsre_char.category_dispatch(pattern[ppos + 1], c)
+        else:
+            raise AssertionError("not a character test")
+
+    def add_closure(self, node, nodes, flags):
+        """Appends to 'nodes' the nodes reachable from 'node' without
+        reading a character, in the order of their priority.  The N_END
+        nodes stay in the list until F_SETTLE tells if they are true."""
+        pending = [node]
+        while pending:
+            node = pending.pop()
+            if self.seen[node] == self.generation:
+                continue
+            self.seen[node] = self.generation
+            kind = self.kind[node]
+            if kind == N_SPLIT:
+                pending.append(self.out2[node])
+                pending.append(self.out1[node])
+            elif kind == N_BEGIN:
+                if flags & F_BEGIN:
+                    pending.append(self.out1[node])
+            elif kind == N_END:
+                if not (flags & F_SETTLE):
+                    nodes.append(node)
+                elif self.arg[node] == rsre_core.AT_END_STRING:
+                    if flags & F_END_STRING:
+                        pending.append(self.out1[node])
+                elif flags & F_END_LINE:
+                    pending.append(self.out1[node])
+            elif kind != N_FAIL:
+                nodes.append(node)      # N_CHAR or N_MATCH
+
+    def new_generation(self):
+        self.generation += 1
+        if self.generation == 0x7fffffff:
+            for i in range(len(self.seen)):
+                self.seen[i] = 0
+            self.generation = 1
+
+    def make_state(self, nodes, unanchored, cached):
+        is_match = False
+        has_end = False
+        for i in range(len(nodes)):
+            kind = self.kind[nodes[i]]
+            if kind == N_MATCH:
+                is_match = True
+                del nodes[i + 1:]     # the other threads cannot win
+                break
+            if kind == N_END:
+                has_end = True
+        if not cached:
+            return DFAState(nodes, unanchored, is_match, has_end, False)
+        parts = [str(node) for node in nodes]
+        if unanchored:
+            parts.append('u')
+        key = ','.join(parts)
+        try:
+            return self.states[key]
+        except KeyError:
+            pass
+        if len(self.states) >= MAX_DFA_STATES:
+            self.reset_cache()
+            self.cache_resets += 1
+        state = DFAState(nodes, unanchored, is_match, has_end, True)
+        self.states[key] = state
+        return state
+
+    def initial_state(self, unanchored, at_beginning):
+        index = int(unanchored) * 2 + int(at_beginning)
+        state = self.initial_states[index]
+        if state is None:
+            flags = 0
+            if at_beginning:
+                flags = F_BEGIN
+            self.new_generation()
+            nodes = []
+            self.add_closure(self.start, nodes, flags)
+            state = self.make_state(nodes, unanchored, True)
+            self.initial_states[index] = state
+        return state
+
+    def compute_next(self, state, c):
+        """Returns the next state and the origin of its nodes: for each
+        node, the index in 'state.nodes' of the thread that it continues,
+        or -1 for a thread of the unanchored search that starts after
+        'c'."""
+        self.new_generation()
+        nodes = []
+        origin = []
+        for i in range(len(state.nodes)):
+            node = state.nodes[i]
+            kind = self.kind[node]
+            if kind == N_MATCH:
+                break
+            if kind == N_CHAR and self.char_matches(self.arg[node], c):
+                self.add_closure(self.out1[node], nodes, 0)
+                while len(origin) < len(nodes):
+                    origin.append(i)
+        if state.unanchored:
+            self.add_closure(self.start, nodes, 0)   # a match starting here
+            while len(origin) < len(nodes):
+                origin.append(-1)
+        next = self.make_state(nodes, state.unanchored, True)
+        del origin[len(next.nodes):]
+        return next, origin
+
+    def settle(self, state, flags):
+        """The state at the end of the string, or before its final
+        newline: the N_END nodes are resolved.  Not cached.  Returns
+        the state and the origin of its nodes, like compute_next()."""
+        self.new_generation()
+        nodes = []
+        origin = []
+        for i in range(len(state.nodes)):
+            self.add_closure(state.nodes[i], nodes, flags | F_SETTLE)
+            while len(origin) < len(nodes):
+                origin.append(i)
+        next = self.make_state(nodes, state.unanchored, False)
+        del origin[len(next.nodes):]
+        return next, origin
+
+    def transition(self, state, c):
+        if state.next is None:
+            return self.compute_next(state, c)
+        if c < 256:
+            next = state.next[c]
+            if next is None:
+                next, origin = self.compute_next(state, c)
+                state.next[c] = next
+                state.next_origin[c] = origin
+            else:
+                origin = state.next_origin[c]
+        else:
+            if state.next_big is None:
+                state.next_big = {}
+                state.next_big_origin = {}
+            next = state.next_big.get(c, None)
+            if next is None:
+                next, origin = self.compute_next(state, c)
+                state.next_big[c] = next
+                state.next_big_origin[c] = origin
+            else:
+                origin = state.next_big_origin[c]
+        return next, origin
+
+    # ____________________________________________________________
+    # Running
+
+    @specialize.argtype(1)
+    def run(self, ctx, start, unanchored):
+        """Runs the DFA from 'start'.  Returns the start and the end of
+        the match that the backtracking matcher would find, either at
+        'start' or, unanchored, by searching from 'start'; or (-1, -1).
+
+        Unanchored, the threads that start at each position are added
+        behind the older ones, so that they have a lower priority; each
+        thread carries the position where it started.  When a match is
+        found, the threads behind it are dropped and no new thread is
+        started, but the run goes on as long as the older threads are
+        alive, because they may still find a match that wins."""
+        end = ctx.end
+        pos = start
+        state = self.initial_state(unanchored, start == 0)
+        found_start = -1
+        found_end = -1
+        if unanchored:
+            # the start of each thread of 'state', and a spare list
+            starts = [start] * len(self.kind)
+            other = [0] * len(self.kind)
+        else:
+            starts = other = None
+        while True:
+            if state.has_end and pos >= end - 1:
+                flags = 0
+                if pos == 0:
+                    flags = F_BEGIN     # for '$^' on an empty string
+                origin = None
+                if pos == end:
+                    state, origin = self.settle(state, flags | F_END_STRING |
+                                                       F_END_LINE)
+                elif rsre_char.is_linebreak(ctx.str(pos)):
+                    state, origin = self.settle(state, flags | F_END_LINE)
+                if origin is not None and starts is not None:
+                    for i in range(len(origin)):
+                        other[i] = starts[origin[i]]
+                    starts, other = other, starts
+            if state.is_match:
+                found_end = pos
+                if starts is None:
+                    found_start = start
+                else:
+                    # the match node is the last one, see make_state()
+                    found_start = starts[len(state.nodes) - 1]
+                    if state.unanchored:
+                        state = self.make_state(state.nodes[:], False,
+                                                state.next is not None)
+            if pos >= end or state.is_dead():
+                break
+            if (unanchored and self.first_char >= 0 and
+                    state is self.initial_states[2]):
+                # nothing started yet: skip to the first character
+                pos = self.skip_to_first_char(ctx, pos)
+                for i in range(len(state.nodes)):
+                    starts[i] = pos
+                if pos >= end:
+                    continue
+            state, origin = self.transition(state, ctx.str(pos))
+            pos += 1
+            if starts is not None:
+                for i in range(len(origin)):
+                    j = origin[i]
+                    if j < 0:
+                        other[i] = pos
+                    else:
+                        other[i] = starts[j]
+                starts, other = other, starts
+        return found_start, found_end
+
+    @specialize.argtype(1)
+    def skip_to_first_char(self, ctx, pos):
+        c = self.first_char
+        if (isinstance(ctx, StrMatchContext) and
+                rsre_scan.can_scan(ctx._string, pos, ctx.end)):
+            found = rsre_scan.find_char(ctx._string, pos, ctx.end, c)
+            if found < 0:
+                return ctx.end
+            return found
+        while pos < ctx.end and ctx.str(pos) != c:
+            pos += 1
+        return pos
+
+    @specialize.argtype(1)
+    def found_at(self, ctx, start, end):
+        ctx.match_start = start
+        if self.has_marks:
+            # the DFA does not know about the groups: ask the
+            # backtracking matcher, which finds the same match, but
+            # maybe not in linear time
+            return rsre_core.sre_match(ctx, 0, start, None) is not None
+        ctx.match_end = end
+        ctx.match_marks = None
+        return True
+
+    @jit.dont_look_inside
+    def match_context(self, ctx):
+        return dfa_match(ctx, self)
+
+    @jit.dont_look_inside
+    def search_context(self, ctx):
+        return dfa_search(ctx, self)
+
+
+@specializectx
+def dfa_match(ctx, dfa):
+    start, end = dfa.run(ctx, ctx.match_start, False)
+    if end < 0:
+        return False
+    assert start >= 0
+    return dfa.found_at(ctx, start, end)
+
+@specializectx
+def dfa_search(ctx, dfa):
+    start, end = dfa.run(ctx, ctx.match_start, True)
+    if end < 0:
+        return False
+    assert start >= 0
+    return dfa.found_at(ctx, start, end)
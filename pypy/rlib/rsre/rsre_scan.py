@@ -0,0 +1,105 @@
+"""
+Fast scanning for the searches of rsre_core.py.  When a pattern starts
+with a literal prefix, a literal character or a character from a
+charset, the search first skips to the next position where it can
+match, with C helpers (see translator/c/src/rsre_scan.c): memchr(), an
+SSE2 scan for the first and the last character of the prefix, or a
+lookup in a table of the 256 characters for the charset.  The full
+matcher is only entered at these positions.
+
+This is only done for plain strings that the GC will not move any more,
+so that the C code can read their characters in place, and not in
+JIT-compiled code, which has its own loop for each pattern.
+"""
+import py
+from pypy.tool.autopath import pypydir
+from pypy.rpython.lltypesystem import lltype, rffi
+from pypy.translator.tool.cbuild import ExternalCompilationInfo
+from pypy.rlib import rgc, jit
+from pypy.rlib.rsre import rsre_char
+
+SCAN_MIN_LENGTH = 64            # for less, the plain loops are as fast
+CHARSET_SCAN_MIN_LENGTH = 4096  # to pay for filling the table
+
+
+cdir = py.path.local(pypydir) / 'translator' / 'c'
+
+eci = ExternalCompilationInfo(
+    include_dirs = [cdir],
+    includes = ['src/rsre_scan.h'],
+    separate_module_sources = ['#include "src/rsre_scan.c"\n'],
+)
+
+
+def llexternal(name, args, result):
+    return rffi.llexternal(name, args, result, compilation_info=eci,
+                           sandboxsafe=True, _nowrapper=True)
+
+c_find_char = llexternal('pypy_rsre_find_char',
+                         [rffi.CCHARP, lltype.Signed, lltype.Signed,
+                          lltype.Signed], lltype.Signed)
+c_find_prefix = llexternal('pypy_rsre_find_prefix',
+                           [rffi.CCHARP, lltype.Signed, lltype.Signed,
+                            rffi.CCHARP, lltype.Signed], lltype.Signed)
+c_find_charset = llexternal('pypy_rsre_find_charset',
+                            [rffi.CCHARP, lltype.Signed, lltype.Signed,
+                             rffi.CCHARP], lltype.Signed)
+
+
+def can_scan(string, start, end):
+    return end - start >= SCAN_MIN_LENGTH and not rgc.can_move(string)
+
+@jit.dont_look_inside
+def find_char(string, start, end, char_ord):
+    if char_ord > 255:
+        return -1
+    assert string is not None
+    buf = rffi.get_nonmovingbuffer(string)
+    try:
+        return c_find_char(buf, start, end, char_ord)
+    finally:
+        rffi.free_nonmovingbuffer(string, buf)
+
+@jit.dont_look_inside
+def find_prefix(string, start, end, prefix, prefix_len):
+    assert string is not None
+    buf = rffi.get_nonmovingbuffer(string)
+    try:
+        return c_find_prefix(buf, start, end, prefix, prefix_len)
+    finally:
+        rffi.free_nonmovingbuffer(string, buf)
+
+@jit.dont_look_inside
+def find_charset(string, start, end, table):
+    assert string is not None
+    buf = rffi.get_nonmovingbuffer(string)
+    try:
+        return c_find_charset(buf, start, end, table)
+    finally:
+        rffi.free_nonmovingbuffer(string, buf)
+
+def alloc_prefix(pattern, ppos, prefix_len):
+    """A raw copy of the prefix at pattern[ppos:ppos+prefix_len], or NULL
+    if it contains a character above 255, which is not in any string."""
+    prefix = lltype.malloc(rffi.CCHARP.TO, prefix_len, flavor='raw')
+    for i in range(prefix_len):
+        char_ord = pattern[ppos + i]
+        if char_ord > 255:
+            lltype.free(prefix, flavor='raw')
+            return lltype.nullptr(rffi.CCHARP.TO)
+        prefix[i] = chr(char_ord)
+    return prefix
+
+def alloc_charset_table(pattern, ppos):
+    """A raw table of the 256 characters, which says for each one if it is
+    in the charset at pattern[ppos]."""
+    table = lltype.malloc(rffi.CCHARP.TO, 256, flavor='raw')
+    for char_ord in range(256):
+        if rsre_char.check_charset(pattern, ppos, char_ord):
+            table[char_ord] = '\x01'
+        else:
+            table[char_ord] = '\x00'
+    return table
+
+def free(buf):
+    lltype.free(buf, flavor='raw')
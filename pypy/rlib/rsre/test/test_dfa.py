@@ -0,0 +1,208 @@
+import re, random
+from pypy.rlib.rsre import rsre_core, rsre_dfa
+from pypy.rlib.rsre.rpy import get_code
+
+
+def dfa_match(regexp, string, start=0, flags=0, search=False):
+    code = get_code(regexp, flags)
+    dfa = rsre_dfa.compile(code, flags)
+    assert dfa is not None
+    ctx = rsre_core.StrMatchContext(code, string, start, len(string), flags)
+    ctx.dfa = dfa
+    if search:
+        found = rsre_core.search_context(ctx)
+    else:
+        found = rsre_core.match_context(ctx)
+    if found:
+        return ctx
+    return None
+
+def check(regexp, string, flags=0):
+    for search in [False, True]:
+        for start in range(len(string) + 1):
+            if search:
+                expected = re.compile(regexp, flags).search(string, start)
+            else:
+                expected = re.compile(regexp, flags).match(string, start)
+            res = dfa_match(regexp, string, start, flags, search)
+            if expected is None:
+                assert res is None, (regexp, string, start, search)
+            else:
+                assert res is not None, (regexp, string, start, search)
+                assert res.span() == expected.span(), (regexp, string, start)
+                for i in range(1, expected.re.groups + 1):
+                    assert res.span(i) == expected.span(i)
+
+def check_like_backtracker(regexp, string):
+    code = get_code(regexp)
+    dfa = rsre_dfa.compile(code, 0)
+    for start in range(len(string) + 1):
+        for run, run_context in [(rsre_core.match, rsre_core.match_context),
+                                 (rsre_core.search, rsre_core.search_context)]:
+            expected = run(code, string, start)
+            ctx = rsre_core.StrMatchContext(code, string, start,
+                                            len(string), 0)
+            ctx.dfa = dfa
+            found = run_context(ctx)
+            assert found == (expected is not None), (regexp, string, start)
+            if found:
+                assert ctx.flatten_marks() == expected.flatten_marks()
+
+
+def test_unsupported():
+    for regexp in [r'(a)\1', r'a(?=b)', r'a(?!b)', r'(?<=a)b', r'\bfoo',
+                   r'(a)?(?(1)b|c)', r'(a*)*', r'(a|)+b', r'^a$(?m)',
+                   r'a{1,5000}b{1,5000}']:
+        code = get_code(regexp)
+        assert rsre_dfa.compile(code, 0) is None, regexp
+
+def test_compile_if_needed():
+    # only the patterns on which backtracking can be exponential, and
+    # that have no groups
+    for regexp in [r'(?:a|aa)*c', r'(?:x+x+)+y', r'(?:a|bc)*?d',
+                   r'(?:ab?){2,}', r'(?:\w+\s?)+$']:
+        code = get_code(regexp)
+        assert rsre_dfa.compile_if_needed(code, 0) is not None, regexp
+    for regexp in [r'abc', r'a|bc', r'a*b+c?', r'(?:ab)*c', r'[a-z]+\d',
+                   r'(a|b)c*', r'(?:a|b)?c', r'(a)\1', r'(x+x+)+y',
+                   r'(a|bc)*?d', r'(?:(a|aa)*c|a+)']:
+        code = get_code(regexp)
+        assert rsre_dfa.compile_if_needed(code, 0) is None, regexp
+
+def test_simple():
+    check(r'abc', 'xxabcabc')
+    check(r'a|bc|def', 'xdefbca')
+    check(r'a.c', 'abcaxca\nc')
+    check(r'a[bcd]*e', 'abcdbeae')
+    check(r'[^a-c]+', 'abcxyzab')
+    check(r'\d+\s\w*', 'ab 12 xy3 z')
+    check(r'a{2,3}', 'aaaaaaa')
+    check(r'(?:ab){2,}', 'abababa')
+    check(r'(?:ab){1,2}?', 'ababab')
+
+def test_ignorecase():
+    check(r'AbC', 'xxabcABC', re.IGNORECASE)
+    check(r'[a-c]+X', 'xABCxAbcX', re.IGNORECASE)
+    check(r'[^a]B', 'aBaab', re.IGNORECASE)
+
+def test_anchors():
+    check(r'^ab', 'abab')
+    check(r'\Aab|b', 'abab')
+    check(r'ab$', 'abab')
+    check(r'ab$', 'abab\n')
+    check(r'ab\Z', 'abab\n')
+    check(r'ab$|a', 'ab\nab')
+    check(r'(?:b$)+', 'bb')
+
+def test_priority():
+    # the match found is the one of the backtracking matcher, not the
+    # longest one
+    check(r'a|ab', 'ab')
+    check(r'(?:a|ab)(?:c|bcd)', 'abcd')
+    check(r'a*?b', 'aaab')
+    check(r'a+?', 'aaa')
+    check(r'x*', 'xxx')
+    check(r'(?:a|b)*?c|a', 'ababc')
+
+def test_groups():
+    check(r'(a+)(b*)', 'xaabbb')
+    check(r'(a|ab)(c|bcd)(d*)', 'abcd')
+    check(r'<(\w+)>(.*?)</b>', '<b>x</b></b>')
+
+def test_random():
+    r = random.Random(42)
+    pieces = ['a', 'b', '.', '[ab]', 'a*', 'b+', 'a?', '(?:ab|a)',
+              '(a|b)', '(?:a|b)*?', 'b{1,2}', '$', '^', '\\Z', '(a*b)+',
+              '(a{2,3})*?', '(b|a+)??', '[^a]']
+    for i in range(300):
+        regexp = ''.join([r.choice(pieces)
+                          for j in range(r.randrange(1, 6))])
+        string = ''.join([r.choice('ab\n') for j in range(r.randrange(10))])
+        check_like_backtracker(regexp, string)
+
+def test_pathological():
+    # exponential for the backtracking matcher, but not for the DFA
+    assert dfa_match(r'(?:a|aa)*c', 'a' * 60) is None
+    assert dfa_match(r'(?:x+x+)+y', 'x' * 60, search=True) is None
+    res = dfa_match(r'(a|aa)*b', 'a' * 60 + 'b')
+    assert res.span() == (0, 61)
+    assert res.span(1) == (59, 60)
+
+def test_search_is_linear():
+    class CountingContext(rsre_core.StrMatchContext):
+        reads = 0
+        def str(self, index):
+            self.reads += 1
+            return rsre_core.StrMatchContext.str(self, index)
+    def reads(regexp, string):
+        code = get_code(regexp)
+        ctx = CountingContext(code, string, 0, len(string), 0)
+        ctx.dfa = rsre_dfa.compile(code, 0)
+        assert rsre_core.search_context(ctx)
+        return ctx.reads, ctx.span()
+    # the leftmost match starts long before the end of the match that
+    # ends first
+    for regexp, n, match in [(r'a*b|c', 'a', 'c'),
+                             (r'(?:x|xy)*z|y', 'x', 'y')]:
+        reads1, span1 = reads(regexp, n * 500 + match)
+        reads2, span2 = reads(regexp, n * 2000 + match)
+        assert span1 == (500, 501) and span2 == (2000, 2001)
+        assert reads2 < reads1 * 5
+
+def test_unicode():
+    code = get_code(u'a[\u1234b]+', 0)
+    dfa = rsre_dfa.compile(code, 0)
+    ctx = rsre_core.UnicodeMatchContext(code, u'xxa\u1234b\u1234c', 0, 7, 0)
+    ctx.dfa = dfa
+    assert rsre_core.search_context(ctx)
+    assert ctx.span() == (2, 6)
+
+def test_first_char_skip():
+    # long enough to use rsre_scan.find_char() when the string can't move
+    s = 'x' * 200 + 'ab' + 'x' * 50 + 'abbb'
+    res = dfa_match(r'ab+$', s, search=True)
+    assert res.span() == (252, 256)
+    assert dfa_match(r'abc', s, search=True) is None
+
+def test_cache_reset(monkeypatch):
+    monkeypatch.setattr(rsre_dfa, 'MAX_DFA_STATES', 5)
+    code = get_code(r'(?:a|b)*a(?:a|b)(?:a|b)(?:a|b)c')
+    dfa = rsre_dfa.compile(code, 0)
+    for s in ['abbbabaabc', 'bbaaaabbbbc', 'abababab']:
+        ctx = rsre_core.StrMatchContext(code, s, 0, len(s), 0)
+        ctx.dfa = dfa
+        expected = re.match(r'(?:a|b)*a(?:a|b)(?:a|b)(?:a|b)c', s)
+        assert rsre_core.match_context(ctx) == (expected is not None)
+        if expected is not None:
+            assert ctx.match_end == expected.end()
+        assert len(dfa.states) <= 5
+    assert dfa.cache_resets > 0
+
+def test_compiled():
+    from pypy.translator.c.test.test_genc import compile
+    codes = [get_code(r'(a|aa)*b'), get_code(r'x(?:a|b)*?c$'),
+             get_code(u'[\u1234a]+c')]
+    def f(n):
+        s = 'x' + 'ab' * n + 'aaab'
+        u = u'-' + u'a\u1234' * n + u'c'
+        total = 0
+        for code in codes:
+            dfa = rsre_dfa.compile(code, 0)
+            for i in range(2):
+                ctx = rsre_core.StrMatchContext(code, s, 0, len(s), 0)
+                ctx.dfa = dfa
+                if rsre_core.search_context(ctx):
+                    total = total * 1000 + ctx.match_end - ctx.match_start
+                ctx = rsre_core.UnicodeMatchContext(code, u, 0, len(u), 0)
+                ctx.dfa = dfa
+                if rsre_core.search_context(ctx):
+                    total = total * 1000 + ctx.match_end - ctx.match_start
+                ctx = rsre_core.StrMatchContext(code, s, 1, len(s), 0)
+                ctx.dfa = dfa
+                if rsre_core.match_context(ctx):
+                    total = total * 1000 + ctx.match_end
+        return total
+    expected = f(50)
+    fn = compile(f, [int])
+    # with refcounting, the cycles between the states are never freed
+    assert fn(50, expected_extra_mallocs=range(1000)) == expected
@@ -0,0 +1,111 @@
+import random
+from pypy.rpython.lltypesystem import rffi
+from pypy.rlib.rsre import rsre_core, rsre_scan
+from pypy.rlib.rsre.test.test_match import get_code
+from pypy.rlib.rsre.test.test_search import TestSearch
+
+
+def find_prefix(s, start, end, prefix):
+    with rffi.scoped_str2charp(s) as buf:
+        with rffi.scoped_str2charp(prefix) as p:
+            return rsre_scan.c_find_prefix(buf, start, end, p, len(prefix))
+
+def test_find_char():
+    s = 'abc' * 50 + 'x' + 'abc'
+    for start, end, expected in [(0, len(s), 150), (151, len(s), -1),
+                                 (0, 150, -1), (150, 151, 150),
+                                 (10, 5, -1)]:
+        with rffi.scoped_str2charp(s) as buf:
+            assert rsre_scan.c_find_char(buf, start, end,
+                                         ord('x')) == expected
+    assert rsre_scan.find_char(s, 0, len(s), ord('x')) == 150
+    assert rsre_scan.find_char(s, 0, len(s), 0x178) == -1
+
+def test_find_prefix():
+    s = 'xyzxyxyzzy' * 10
+    assert find_prefix(s, 0, len(s), 'yzz') == 6
+    assert find_prefix(s, 7, len(s), 'yzz') == 16
+    assert find_prefix(s, 7, 18, 'yzz') == -1
+    assert find_prefix(s, 7, 19, 'yzz') == 16
+    assert find_prefix(s, 0, len(s), 'zyx') == 8
+    assert find_prefix(s, 0, len(s), 'zyz') == -1
+    assert find_prefix(s, 0, len(s), 'zy') == 8
+    assert find_prefix(s, 97, len(s), 'zy') == 98
+    assert find_prefix(s, 99, len(s), 'zy') == -1
+
+def test_find_prefix_random():
+    # the SSE2 loop handles 16 positions at a time; compare with str.find()
+    r = random.Random(42)
+    for i in range(500):
+        s = ''.join([r.choice('ab') for j in range(r.randrange(80))])
+        prefix = ''.join([r.choice('ab') for j in range(r.randrange(2, 6))])
+        start = r.randrange(len(s) + 1)
+        end = r.randrange(start, len(s) + 1)
+        expected = s.find(prefix, start, end)
+        assert find_prefix(s, start, end, prefix) == expected
+
+def test_find_charset():
+    pattern = get_code(r'[0-9]x')
+    # <INFO> <1=skip> <2=flags> <3=min> <4=max> <5=charset>
+    table = rsre_scan.alloc_charset_table(pattern, 5)
+    try:
+        assert [chr(i) for i in range(256) if table[i] != '\x00'] == (
+            list('0123456789'))
+        s = 'abcdefghijklm5'
+        for start in range(len(s)):
+            assert rsre_scan.find_charset(s, start, len(s), table) == 13
+            assert rsre_scan.find_charset(s, 0, start, table) == -1
+    finally:
+        rsre_scan.free(table)
+
+def test_alloc_prefix():
+    prefix = rsre_scan.alloc_prefix([1, 97, 98, 99], 1, 3)
+    assert rffi.charpsize2str(prefix, 3) == 'abc'
+    rsre_scan.free(prefix)
+    assert not rsre_scan.alloc_prefix([97, 0x1234], 0, 2)
+
+
+class TestScanSearch(TestSearch):
+    # all the tests of TestSearch again, with the fast scanning
+    def setup_method(self, meth):
+        self.saved = rsre_scan.can_scan, rsre_scan.CHARSET_SCAN_MIN_LENGTH
+        self.scans = []
+        def can_scan(string, start, end):
+            self.scans.append(string)
+            return isinstance(string, str)
+        rsre_scan.can_scan = can_scan
+        rsre_scan.CHARSET_SCAN_MIN_LENGTH = 0
+
+    def teardown_method(self, meth):
+        rsre_scan.can_scan, rsre_scan.CHARSET_SCAN_MIN_LENGTH = self.saved
+
+    def test_scan_used(self):
+        for regexp, expected in [(r'foo\w', (9, 13)),          # prefix
+                                 (r'f[aeiou]o+', (9, 12)),     # literal
+                                 (r'[xyz]r', (14, 16))]:       # charset
+            res = rsre_core.search(get_code(regexp), 'fxyz fxo foob xr')
+            assert res.span() == expected
+        assert len(self.scans) == 3
+
+    def test_no_match(self):
+        assert rsre_core.search(get_code(r'ab[cd]'), 'abeab' * 20) is None
+        assert rsre_core.search(get_code(r'b\d'), 'abeab' * 20) is None
+        assert rsre_core.search(get_code(r'[cd]e'), 'abeab' * 20) is None
+        assert rsre_core.search(get_code(u'a\u1234'), 'a' * 20) is None
+
+def test_compiled():
+    # with refcounting, the strings don't move: the searches scan
+    from pypy.translator.c.test.test_genc import compile
+    prefix_code = get_code(r'foo\w')
+    literal_code = get_code(r'f[aeiou]o+')
+    charset_code = get_code(r'[xyz]r')
+    def f(n):
+        s = 'fxyz fxo ' * n + 'xx foob xr'
+        total = 0
+        for code in [prefix_code, literal_code, charset_code]:
+            res = rsre_core.search(code, s)
+            total = total * 100 + res.match_start - 9 * n
+        return total
+    assert f(1000) == 30308
+    fn = compile(f, [int])
+    assert fn(1000) == 30308
@@ -33,6 +33,9 @@ _stack_set_length_fraction = llexternal('LL_stack_set_length_fraction',
 _stack_too_big_slowpath = llexternal('LL_stack_too_big_slowpath',
                                      [lltype.Signed], lltype.Char,
                                      lambda cur: '\x00')
+# the following is used by stacklets running in separate stacks
+_stack_replace_end = llexternal('LL_stack_replace_end', [rffi.CCHARP],
+                                rffi.CCHARP, lambda new_end: new_end)
 # the following is used by the JIT
 _stack_get_end_adr   = llexternal('LL_stack_get_end_adr',   [], lltype.Signed)
 _stack_get_length_adr= llexternal('LL_stack_get_length_adr',[], lltype.Signed)
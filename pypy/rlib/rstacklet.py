@@ -2,7 +2,7 @@ import sys
 from pypy.rlib import _rffi_stacklet as _c
 from pypy.rlib import jit
 from pypy.rlib.objectmodel import we_are_translated
-from pypy.rpython.lltypesystem import lltype, llmemory
+from pypy.rpython.lltypesystem import lltype, llmemory, rffi
 
 DEBUG = False
 
@@ -12,9 +12,18 @@ class StackletThread(object):
     @jit.dont_look_inside
     def __init__(self, config):
         self._gcrootfinder = _getgcrootfinder(config, we_are_translated())
-        self._thrd = _c.newthread()
-        if not self._thrd:
-            raise MemoryError
+        if _separate_stacks(config):
+            self._thrd = _c.newthread_separate(0)
+            if not self._thrd:
+                raise MemoryError
+            if we_are_translated():
+                # keep the stack overflow detection in sync
+                from pypy.rlib import rstack
+                _c.set_stack_end_hook(self._thrd, rstack._stack_replace_end)
+        else:
+            self._thrd = _c.newthread()
+            if not self._thrd:
+                raise MemoryError
         self._thrd_deleter = StackletThreadDeleter(self._thrd)
         if DEBUG:
             assert debug.sthread is None, "multithread debug support missing"
@@ -53,6 +62,12 @@ class StackletThread(object):
     def get_null_handle(self):
         return self._gcrootfinder.get_null_handle()
 
+    def pool_stat(self, which):
+        """Statistics about the recycling of the memory holding the
+        suspended stacks: 'which' is one of the POOL_* constants of
+        _rffi_stacklet."""
+        return _c.pool_stat(self._thrd, rffi.cast(rffi.INT, which))
+
 
 class StackletThreadDeleter(object):
     # quick hack: the __del__ is on another object, so that
@@ -92,6 +107,10 @@ def _getgcrootfinder(config, translated):
     return module.gcrootfinder
 _getgcrootfinder._annspecialcase_ = 'specialize:memo'
 
+def _separate_stacks(config):
+    return config is not None and config.translation.stacklet == 'separate'
+_separate_stacks._annspecialcase_ = 'specialize:memo'
+
 
 class StackletDebugError(Exception):
     pass
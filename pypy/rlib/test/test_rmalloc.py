@@ -0,0 +1,58 @@
+from pypy.rlib import rmalloc
+from pypy.rpython.lltypesystem import lltype, rffi
+from pypy.translator.c.test.test_standalone import StandaloneTests
+
+
+def test_untranslated():
+    assert rmalloc.trim() == 0
+    assert rmalloc.get_committed_bytes() == 0
+    assert rmalloc.get_used_bytes() == 0
+
+def test_not_standalone():
+    from pypy.translator.c.test.test_genc import compile
+    def f():
+        return (rmalloc.trim() + rmalloc.get_committed_bytes() +
+                rmalloc.get_used_bytes())
+    fn = compile(f, [])
+    assert fn() == 0
+
+
+class TestStandalone(StandaloneTests):
+
+    def test_trim(self):
+        def allocate(n):
+            blocks = []
+            for i in range(n):
+                blocks.append(lltype.malloc(rffi.CCHARP.TO, 100,
+                                            flavor='raw'))
+            return blocks
+
+        def entry_point(argv):
+            used0 = rmalloc.get_used_bytes()
+            committed0 = rmalloc.get_committed_bytes()
+            blocks = allocate(20000)
+            used1 = rmalloc.get_used_bytes()
+            committed1 = rmalloc.get_committed_bytes()
+            assert used1 - used0 >= 20000 * 100
+            assert committed1 - committed0 >= 20000 * 100
+            keep = blocks.pop()
+            for p in blocks:
+                lltype.free(p, flavor='raw')
+            assert rmalloc.get_used_bytes() - used0 < 10000
+            committed2 = rmalloc.get_committed_bytes()
+            released = rmalloc.trim()
+            committed3 = rmalloc.get_committed_bytes()
+            assert released >= (20000 - 100) * 100
+            assert committed2 - committed3 == released
+            # the decommitted pools and the released arenas can be reused
+            blocks = allocate(20000)
+            assert rmalloc.get_committed_bytes() - committed3 >= 20000 * 100
+            for p in blocks:
+                lltype.free(p, flavor='raw')
+            lltype.free(keep, flavor='raw')
+            print "ok"
+            return 0
+
+        t, cbuilder = self.compile(entry_point)
+        data = cbuilder.cmdexec('')
+        assert data == "ok\n"
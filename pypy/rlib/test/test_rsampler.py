@@ -0,0 +1,70 @@
+import os
+from pypy.rlib import rsampler
+from pypy.rpython.lltypesystem import lltype
+from pypy.translator.c.test import test_standalone
+from pypy.tool.samplerdump import read_profile, collapse
+from pypy.tool.udir import udir
+
+
+def test_push_pop():
+    stack = lltype.malloc(rsampler.STACK.TO, rsampler.STACK_DEPTH + 1,
+                          flavor='raw')
+    stack[0] = 0
+    rsampler.push(stack, 42)
+    rsampler.push(stack, 43)
+    assert stack[0] == 2
+    assert (stack[1], stack[2]) == (42, 43)
+    rsampler.pop(stack)
+    rsampler.pop(stack)
+    rsampler.pop(stack)        # ignored
+    assert stack[0] == 0
+    for i in range(rsampler.STACK_DEPTH + 5):
+        rsampler.push(stack, i)
+    assert stack[0] == rsampler.STACK_DEPTH + 5
+    assert stack[rsampler.STACK_DEPTH] == rsampler.STACK_DEPTH - 1
+    lltype.free(stack, flavor='raw')
+
+
+class TestStandalone(test_standalone.StandaloneTests):
+
+    def test_sampling(self):
+        def busy(n):
+            x = 0
+            for i in range(n):
+                x += i * (x & 7)
+            return x
+
+        def fn(argv):
+            fd = os.open(argv[1], os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0644)
+            n = int(argv[2])
+            rsampler.register_app_code(1, 'main', 10, 'x.py')
+            rsampler.start(fd, 1000)
+            try:
+                rsampler.start(fd, 1000)
+            except OSError:
+                print 'already started'
+            stack = rsampler.thread_stack()
+            rsampler.push(stack, 1)
+            rsampler.register_app_code(2, 'f', 20, 'x.py')
+            rsampler.push(stack, 2)
+            busy(n)
+            rsampler.pop(stack)
+            busy(n)
+            print 'lost', rsampler.stop()
+            print rsampler.stop()
+            os.close(fd)
+            return 0
+        #
+        t, cbuilder = self.compile(fn)
+        path = udir.join('test_rsampler_sampling')
+        data = cbuilder.cmdexec('%s %d' % (path, 200000000))
+        assert data == 'already started\nlost 0\n-1\n'
+        profile = read_profile(str(path))
+        assert profile.pid > 0
+        assert profile.interval_usec == 1000
+        assert profile.app_codes == {1: 'main:10:x.py', 2: 'f:20:x.py'}
+        stacks = collapse(profile)
+        in_f = stacks.get(('main (x.py:10)', 'f (x.py:20)'), 0)
+        in_main = stacks.get(('main (x.py:10)',), 0)
+        assert in_f > 10 and in_main > 10
+        assert sum(stacks.values()) < (in_f + in_main) * 1.1
@@ -74,6 +74,24 @@ class Runner:
                                  rffi.cast(llmemory.Address, 321))
             self.sthread.destroy(h)
 
+    @here_is_a_test
+    def test_pool(self):
+        from pypy.rlib import _rffi_stacklet as _c
+        hits = self.sthread.pool_stat(_c.POOL_HITS)
+        frees = self.sthread.pool_stat(_c.POOL_FREES)
+        for i in range(100):
+            self.status = 0
+            h = self.sthread.new(switchbackonce_callback,
+                                 rffi.cast(llmemory.Address, 321))
+            self.nextstatus(2)
+            h = self.sthread.switch(h)
+            self.nextstatus(4)
+            assert self.sthread.is_empty_handle(h)
+        # the save areas (or the whole stacks, with separate stacks)
+        # of the later iterations come from the pool
+        assert self.sthread.pool_stat(_c.POOL_HITS) - hits >= 99
+        assert self.sthread.pool_stat(_c.POOL_FREES) == frees
+
     def any_alive(self):
         for task in self.tasks:
             if task.h:
@@ -224,6 +242,7 @@ def entry_point(argv):
 
 
 class BaseTestStacklet(StandaloneTests):
+    stacklet = 'copy'
 
     def setup_class(cls):
         from pypy.config.pypyoption import get_pypy_config
@@ -233,6 +252,7 @@ class BaseTestStacklet(StandaloneTests):
             config.translation.continuation = True
             config.translation.gcrootfinder = cls.gcrootfinder
             GCROOTFINDER = cls.gcrootfinder
+        config.translation.stacklet = cls.stacklet
         cls.config = config
         cls.old_values = Runner.config, Runner.STATUSMAX
         Runner.config = config
@@ -274,6 +294,11 @@ class TestStackletShadowStack(BaseTestStacklet):
     gc = 'minimark'
     gcrootfinder = 'shadowstack'
 
+class TestStackletSeparate(BaseTestStacklet):
+    gc = 'minimark'
+    gcrootfinder = 'shadowstack'
+    stacklet = 'separate'
+
 
 def test_dont_keep_debug_to_true():
     assert not rstacklet.DEBUG
@@ -339,6 +339,17 @@ def arena_free(arena_addr):
     assert not arena_addr.arena.objectptrs
     arena_addr.arena.mark_freed()
 
+def arena_malloc_hugepages(nbytes):
+    """Allocate and return a new zero-initialized arena, backed if possible
+    by transparent huge pages.  Returns NULL if the platform cannot provide
+    them at all; the caller should then fall back to arena_malloc().
+    Must be released with arena_free_hugepages()."""
+    return Arena(nbytes, True).getaddr(0)
+
+def arena_free_hugepages(arena_addr, nbytes):
+    """Release an arena obtained from arena_malloc_hugepages()."""
+    arena_free(arena_addr)
+
 def arena_reset(arena_addr, size, zero):
     """Free all objects in the arena, which can then be reused.
     This can also be used on a subrange of the arena.
@@ -542,6 +553,98 @@ elif os.name == 'nt':
 else:
     has_protect = False
 
+if sys.platform.startswith('linux'):
+    # Arenas backed by transparent huge pages (2MB on x86).  The kernel can
+    # only use a huge page for a 2MB-aligned range that was madvise()d with
+    # MADV_HUGEPAGE, so we mmap() aligned chunks that are a multiple of 2MB
+    # and hand out arenas from them.  Freeing an arena munmap()s just its
+    # own range, which makes the kernel split the huge page if needed.
+    MADV_HUGEPAGE = rffi_platform.getdefinedinteger('MADV_HUGEPAGE',
+                                                    '#include <sys/mman.h>')
+    _MMAP_PROT = (rffi_platform.getconstantinteger('PROT_READ',
+                                                   '#include <sys/mman.h>') |
+                  rffi_platform.getconstantinteger('PROT_WRITE',
+                                                   '#include <sys/mman.h>'))
+    _MMAP_FLAGS = (rffi_platform.getconstantinteger('MAP_PRIVATE',
+                                                    '#include <sys/mman.h>') |
+                   rffi_platform.getconstantinteger('MAP_ANONYMOUS',
+                                                    '#include <sys/mman.h>'))
+    HUGEPAGE_SIZE = 2 * 1024 * 1024
+
+    linux_mmap = rffi.llexternal('mmap',
+                                 [llmemory.Address, rffi.SIZE_T, rffi.INT,
+                                  rffi.INT, rffi.INT, lltype.Signed],
+                                 llmemory.Address,
+                                 sandboxsafe=True, _nowrapper=True,
+                                 compilation_info=_eci)
+    linux_munmap = rffi.llexternal('munmap',
+                                   [llmemory.Address, rffi.SIZE_T], rffi.INT,
+                                   sandboxsafe=True, _nowrapper=True,
+                                   compilation_info=_eci)
+
+    class HugePageChunk:
+        # the part of the last mmap()ed chunk that was not handed out yet
+        def __init__(self):
+            self.start = 0
+            self.stop = 0
+        _freeze_ = __init__
+    hugepagechunk = HugePageChunk()
+
+    def _unmap(start, size):
+        if size > 0:
+            linux_munmap(rffi.cast(llmemory.Address, start),
+                         rffi.cast(rffi.SIZE_T, size))
+
+    def _round_up_to_linux_page(nbytes):
+        pagesize = linuxpagesize.pagesize
+        if pagesize == 0:
+            pagesize = rffi.cast(lltype.Signed, linux_getpagesize())
+            linuxpagesize.pagesize = pagesize
+        return (nbytes + pagesize - 1) & -pagesize
+
+    def llimpl_arena_malloc_hugepages(nbytes):
+        if MADV_HUGEPAGE is None:
+            return llmemory.NULL
+        nbytes = _round_up_to_linux_page(nbytes)
+        chunk = hugepagechunk
+        if chunk.stop - chunk.start < nbytes:
+            size = (nbytes + HUGEPAGE_SIZE - 1) & -HUGEPAGE_SIZE
+            # map one huge page more than needed, to be able to align
+            p = linux_mmap(llmemory.NULL,
+                           rffi.cast(rffi.SIZE_T, size + HUGEPAGE_SIZE),
+                           rffi.cast(rffi.INT, _MMAP_PROT),
+                           rffi.cast(rffi.INT, _MMAP_FLAGS),
+                           rffi.cast(rffi.INT, -1), 0)
+            p = rffi.cast(lltype.Signed, p)
+            if p == -1:
+                return llmemory.NULL
+            start = (p + HUGEPAGE_SIZE - 1) & -HUGEPAGE_SIZE
+            _unmap(p, start - p)
+            _unmap(start + size, p + HUGEPAGE_SIZE - start)
+            err = linux_madvise(rffi.cast(llmemory.Address, start),
+                                rffi.cast(rffi.SIZE_T, size),
+                                rffi.cast(rffi.INT, MADV_HUGEPAGE))
+            if rffi.cast(lltype.Signed, err) != 0:
+                _unmap(start, size)     # no huge pages in this kernel
+                return llmemory.NULL
+            # forget about the rest of the previous chunk
+            _unmap(chunk.start, chunk.stop - chunk.start)
+            chunk.start = start
+            chunk.stop = start + size
+        result = chunk.start
+        chunk.start += nbytes
+        return rffi.cast(llmemory.Address, result)
+
+    def llimpl_arena_free_hugepages(addr, nbytes):
+        _unmap(rffi.cast(lltype.Signed, addr), _round_up_to_linux_page(nbytes))
+
+else:
+    def llimpl_arena_malloc_hugepages(nbytes):
+        return llmemory.NULL
+
+    def llimpl_arena_free_hugepages(addr, nbytes):
+        pass
+
 
 llimpl_malloc = rffi.llexternal('malloc', [lltype.Signed], llmemory.Address,
                                 sandboxsafe=True, _nowrapper=True)
@@ -565,6 +668,18 @@ register_external(arena_free, [llmemory.Address], None, 'll_arena.arena_free',
                   llfakeimpl=arena_free,
                   sandboxsafe=True)
 
+register_external(arena_malloc_hugepages, [int], llmemory.Address,
+                  'll_arena.arena_malloc_hugepages',
+                  llimpl=llimpl_arena_malloc_hugepages,
+                  llfakeimpl=arena_malloc_hugepages,
+                  sandboxsafe=True)
+
+register_external(arena_free_hugepages, [llmemory.Address, int], None,
+                  'll_arena.arena_free_hugepages',
+                  llimpl=llimpl_arena_free_hugepages,
+                  llfakeimpl=arena_free_hugepages,
+                  sandboxsafe=True)
+
 def llimpl_arena_reset(arena_addr, size, zero):
     if zero:
         if zero == 1:
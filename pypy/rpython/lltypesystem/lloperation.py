@@ -518,6 +518,7 @@ LL_OPERATIONS = {
     'stack_current':        LLOp(sideeffects=False),
     'keepalive':            LLOp(),
     'same_as':              LLOp(canfold=True),
+    'expect':               LLOp(canfold=True),  # (x, expected value): x
     'hint':                 LLOp(),
     'check_no_more_arg':    LLOp(canraise=(Exception,)),
     'check_self_nonzero':   LLOp(canraise=(Exception,)),
@@ -7,6 +7,8 @@ from pypy.rpython.lltypesystem.llarena import round_up_for_allocation
 from pypy.rpython.lltypesystem.llarena import ArenaError, arena_new_view
 from pypy.rpython.lltypesystem.llarena import arena_shrink_obj
 from pypy.rpython.lltypesystem.llarena import arena_protect, has_protect
+from pypy.rpython.lltypesystem.llarena import arena_malloc_hugepages
+from pypy.rpython.lltypesystem.llarena import arena_free_hugepages
 from pypy.translator.c.test import test_genc, test_standalone
 
 def test_arena():
@@ -300,6 +302,15 @@ def test_arena_protect():
     p.x = 125
     assert p.x == 125
 
+def test_arena_malloc_hugepages():
+    S = lltype.Struct('S', ('x', lltype.Signed))
+    a = arena_malloc_hugepages(4096)
+    arena_reserve(a, llmemory.sizeof(S))
+    p = llmemory.cast_adr_to_ptr(a, lltype.Ptr(S))
+    assert p.x == 0
+    p.x = 42
+    arena_free_hugepages(a, 4096)
+
 
 class TestStandalone(test_standalone.StandaloneTests):
     def test_compiled_arena_protect(self):
@@ -331,3 +342,30 @@ class TestStandalone(test_standalone.StandaloneTests):
         if has_protect:
             cbuilder.cmdexec('1', expect_crash=True)
             cbuilder.cmdexec('2', expect_crash=True)
+
+    def test_compiled_arena_malloc_hugepages(self):
+        from pypy.rpython.lltypesystem.llarena import HUGEPAGE_SIZE
+        S = lltype.Struct('S', ('x', lltype.Signed))
+        #
+        def fn(argv):
+            a = arena_malloc_hugepages(100000)
+            if not a:
+                print 'unavailable'
+                return 0
+            # the first arena starts a fresh 2MB-aligned chunk
+            assert (llmemory.cast_adr_to_int(a) & (HUGEPAGE_SIZE - 1)) == 0
+            b = arena_malloc_hugepages(100000)
+            assert b - a >= 100000
+            for adr in [a, b + 99000]:
+                arena_reserve(adr, llmemory.sizeof(S))
+                p = llmemory.cast_adr_to_ptr(adr, lltype.Ptr(S))
+                assert p.x == 0      # zero-filled
+                p.x = 123
+            arena_free_hugepages(a, 100000)
+            arena_free_hugepages(b, 100000)
+            print 'ok'
+            return 0
+        #
+        t, cbuilder = self.compile(fn)
+        data = cbuilder.cmdexec('')
+        assert data in ('ok\n', 'unavailable\n')
@@ -125,6 +125,43 @@ else:
         return addressable_size       # XXX implement me for other platforms
 
 
+# ____________________________________________________________
+# Get the mode of transparent huge pages, as selected by the admin:
+# 'always', 'madvise' or 'never'.  Returns '' if unknown.
+
+def get_hugepage_mode_linux(filename):
+    debug_start("gc-hardware")
+    result = ''
+    try:
+        fd = os.open(filename, os.O_RDONLY, 0644)
+        try:
+            buf = os.read(fd, 4096)
+        finally:
+            os.close(fd)
+    except OSError:
+        pass
+    else:
+        # the selected mode is in brackets: "always [madvise] never"
+        start = buf.find('[')
+        if start >= 0:
+            start += 1
+            stop = buf.find(']', start)
+            if stop >= start:
+                result = buf[start:stop]
+    debug_print("transparent hugepages =", result)
+    debug_stop("gc-hardware")
+    return result
+
+if sys.platform.startswith('linux'):
+    def get_hugepage_mode():
+        return get_hugepage_mode_linux(
+            '/sys/kernel/mm/transparent_hugepage/enabled')
+
+else:
+    def get_hugepage_mode():
+        return ''
+
+
 # ____________________________________________________________
 # Estimation of the nursery size, based on the L2 cache.
 
@@ -33,6 +33,34 @@ Environment variables can be used to fine-tune the following parameters:
                         the GC in very small programs.  Defaults to 8
                         times the nursery.
 
+ PYPY_GC_HUGEPAGES      Set to 1 to back the nursery and the arenas of
+                        small old objects with transparent huge pages
+                        (Linux only, see MADV_HUGEPAGE).  Falls back to
+                        normal memory if they are not available.  What was
+                        obtained is reported in the PYPYLOG sections
+                        gc-set-nursery-size and gc-collect.
+
+ PYPY_GC_INCREMENT_STEP Enable incremental major collections: the marking
+                        is done in steps interleaved with the minor
+                        collections, each step tracing about this many
+                        bytes of objects (PYPYLOG section gc-collect-step).
+                        Defaults to 0, which means that the marking is
+                        done in one go.  Try values like 4 times the
+                        nursery size.  In all cases, the sweeping is done
+                        lazily after the marking: pages of small objects
+                        are swept when the allocator needs one, and the
+                        rest at the following minor collections.
+
+ PYPY_GC_MARK_THREADS   Do the part of the marking that stops the program
+                        with this many threads.  Defaults to 1.  The
+                        extra threads only exist during the marking.
+
+ PYPY_GC_TELEMETRY      Name of a file in which to write a record for each
+                        collection event (start and end of the minor
+                        and major collections, bytes promoted out of the
+                        nursery, ...).  It is a ring buffer that can be
+                        followed live with pypy/tool/gctelemetry.py.
+
  PYPY_GC_DEBUG          Enable extra checks around collections that are
                         too slow for normal use.  Values are 0 (off),
                         1 (on major collections) or 2 (also on minor
@@ -46,8 +74,10 @@ import sys
 from pypy.rpython.lltypesystem import lltype, llmemory, llarena, llgroup
 from pypy.rpython.lltypesystem.lloperation import llop
 from pypy.rpython.lltypesystem.llmemory import raw_malloc_usage
+from pypy.rpython.annlowlevel import llhelper
 from pypy.rpython.memory.gc.base import GCBase, MovingGCBase
-from pypy.rpython.memory.gc import minimarkpage, env
+from pypy.rpython.memory.gc import minimarkpage, env, parallelmark
+from pypy.rpython.memory.gc import telemetry
 from pypy.rpython.memory.support import mangle_hash
 from pypy.rlib.rarithmetic import ovfcheck, LONG_BIT, intmask, r_uint
 from pypy.rlib.rarithmetic import LONG_BIT_SHIFT
@@ -116,6 +146,18 @@ GCFLAG_CARDS_SET    = first_gcflag << 6     # <- at least one card bit is set
 
 TID_MASK            = (first_gcflag << 7) - 1
 
+# The states of the major collection.  Normally we are in STATE_SCANNING.
+# With PYPY_GC_INCREMENT_STEP, we are in STATE_MARKING between the start
+# and the end of the marking: the objects with GCFLAG_VISITED are 'black'
+# (fully traced), and the objects in 'objects_to_trace' are 'grey'.  Any
+# old object that is modified, or that is made old by a minor collection,
+# is traced again at the next minor collection.  Then we are in
+# STATE_SWEEPING until all the old objects have been swept: the surviving
+# ones still have GCFLAG_VISITED until then.
+STATE_SCANNING = 0
+STATE_MARKING  = 1
+STATE_SWEEPING = 2
+
 
 FORWARDSTUB = lltype.GcStruct('forwarding_stub',
                               ('forw', llmemory.Address))
@@ -215,6 +257,8 @@ class MiniMarkGC(MovingGCBase):
                  growth_rate_max=2.5,   # for tests
                  card_page_indices=0,
                  large_object=8*WORD,
+                 incremental_step=0,
+                 mark_threads=1,
                  ArenaCollectionClass=None,
                  **kwds):
         MovingGCBase.__init__(self, config, **kwds)
@@ -229,6 +273,13 @@ class MiniMarkGC(MovingGCBase):
         self.max_heap_size = 0.0
         self.max_heap_size_already_raised = False
         self.max_delta = float(r_uint(-1))
+        self.incremental_step = incremental_step    # 0: not incremental
+        self.gc_state = STATE_SCANNING
+        self.marking_memory_limit = 0.0
+        self.mark_threads = mark_threads            # 1: not parallel
+        self.telemetry = False                      # see PYPY_GC_TELEMETRY
+        self.nursery_bytes_promoted = 0
+        self.card_arrays_scanned = 0
         #
         self.card_page_indices = card_page_indices
         if self.card_page_indices > 0:
@@ -245,6 +296,8 @@ class MiniMarkGC(MovingGCBase):
         self.nursery_top  = NULL
         self.debug_tiny_nursery = -1
         self.debug_rotating_nurseries = None
+        self.use_hugepages = False       # see PYPY_GC_HUGEPAGES
+        self.nursery_hugepages = False
         #
         # The ArenaCollection() handles the nonmovable objects allocation.
         if ArenaCollectionClass is None:
@@ -273,6 +326,11 @@ class MiniMarkGC(MovingGCBase):
         self.prebuilt_root_objects = self.AddressStack()
         #
         self._init_writebarrier_logic()
+        #
+        # The function run by each thread of the parallel marking
+        def _mark_thread(n):
+            self.mark_thread_run(n)
+        self._mark_thread = _mark_thread
 
 
     def setup(self):
@@ -361,8 +419,26 @@ class MiniMarkGC(MovingGCBase):
             else:
                 self.max_delta = 0.125 * env.get_total_memory()
             #
+            incremental_step = env.read_from_env('PYPY_GC_INCREMENT_STEP')
+            if incremental_step > 0:
+                self.incremental_step = incremental_step
+            #
+            mark_threads = env.read_from_env('PYPY_GC_MARK_THREADS')
+            if mark_threads > 1:
+                self.mark_threads = mark_threads
+            #
+            if telemetry.open():
+                self.telemetry = True
+            #
+            if env.read_from_env('PYPY_GC_HUGEPAGES') > 0:
+                # 'never' means that madvise() would work but have no
+                # effect; don't bother in this case
+                if env.get_hugepage_mode() != 'never':
+                    self.use_hugepages = True
+                    self.ac.use_hugepages = True
+            #
             self.minor_collection()    # to empty the nursery
-            llarena.arena_free(self.nursery)
+            self._free_nursery()
             self.nursery_size = newsize
             self.allocate_nursery()
 
@@ -376,15 +452,34 @@ class MiniMarkGC(MovingGCBase):
         # the nursery than really needed, to simplify pointer arithmetic
         # in malloc_fixedsize_clear().  The few extra pages are never used
         # anyway so it doesn't even count.
+        if self.use_hugepages:
+            nursery = llarena.arena_malloc_hugepages(
+                self._nursery_memory_size())
+            if nursery:
+                self.nursery_hugepages = True
+                return nursery     # already zero-filled
+        self.nursery_hugepages = False
         nursery = llarena.arena_malloc(self._nursery_memory_size(), 2)
         if not nursery:
             raise MemoryError("cannot allocate nursery")
         return nursery
 
+    def _free_nursery(self):
+        if self.nursery_hugepages:
+            llarena.arena_free_hugepages(self.nursery,
+                                         self._nursery_memory_size())
+        else:
+            llarena.arena_free(self.nursery)
+
     def allocate_nursery(self):
         debug_start("gc-set-nursery-size")
         debug_print("nursery size:", self.nursery_size)
         self.nursery = self._alloc_nursery()
+        if self.use_hugepages:
+            debug_print("nursery in huge pages:", self.nursery_hugepages)
+        if self.telemetry:
+            telemetry.event(telemetry.EV_NURSERY_SIZE, self.nursery_size,
+                            0, 0)
         # the current position in the nursery:
         self.nursery_free = self.nursery
         # the end of the nursery:
@@ -570,6 +665,11 @@ class MiniMarkGC(MovingGCBase):
         """Do a minor (gen=0) or major (gen>0) collection."""
         self.minor_collection()
         if gen > 0:
+            if self.gc_state != STATE_SCANNING:
+                # finish the major collection in progress first: it
+                # keeps alive the objects that died since it started
+                self.major_collection()
+                self.minor_collection()
             self.major_collection()
 
     def collect_and_reserve(self, totalsize):
@@ -580,8 +680,9 @@ class MiniMarkGC(MovingGCBase):
         """
         self.minor_collection()
         #
-        if self.get_total_memory_used() > self.next_major_collection_threshold:
-            self.major_collection()
+        if (self.gc_state != STATE_SCANNING or
+            self.get_total_memory_used() > self.next_major_collection_threshold):
+            self.major_collection_step()
             #
             # The nursery might not be empty now, because of
             # execute_finalizers().  If it is almost full again,
@@ -634,11 +735,16 @@ class MiniMarkGC(MovingGCBase):
             raise MemoryError
         #
         # If somebody calls this function a lot, we must eventually
-        # force a full collection.
+        # force a full collection.  While a major collection is in
+        # progress, we only need to check 'marking_memory_limit'.
+        if self.gc_state == STATE_SCANNING:
+            threshold = self.next_major_collection_threshold
+        else:
+            threshold = self.marking_memory_limit
         if (float(self.get_total_memory_used()) + raw_malloc_usage(totalsize) >
-                self.next_major_collection_threshold):
+                threshold):
             self.minor_collection()
-            self.major_collection(raw_malloc_usage(totalsize))
+            self.major_collection_step(raw_malloc_usage(totalsize))
         #
         # Check if the object would fit in the ArenaCollection.
         if raw_malloc_usage(totalsize) <= self.small_request_threshold:
@@ -882,6 +988,7 @@ class MiniMarkGC(MovingGCBase):
     def get_total_memory_used(self):
         """Return the total memory used, not counting any object in the
         nursery: only objects in the ArenaCollection or raw-malloced.
+        While sweeping, the pages not swept yet are not counted.
         """
         return self.ac.total_memory_used + self.rawmalloced_total_size
 
@@ -918,9 +1025,11 @@ class MiniMarkGC(MovingGCBase):
         # similarily, all objects should have this flag:
         ll_assert(self.header(obj).tid & GCFLAG_TRACK_YOUNG_PTRS,
                   "missing GCFLAG_TRACK_YOUNG_PTRS")
-        # the GCFLAG_VISITED should not be set between collections
-        ll_assert(self.header(obj).tid & GCFLAG_VISITED == 0,
-                  "unexpected GCFLAG_VISITED")
+        # the GCFLAG_VISITED should not be set between collections,
+        # unless we are in the middle of an incremental major collection
+        if self.gc_state == STATE_SCANNING:
+            ll_assert(self.header(obj).tid & GCFLAG_VISITED == 0,
+                      "unexpected GCFLAG_VISITED")
         # the GCFLAG_FINALIZATION_ORDERING should not be set between coll.
         ll_assert(self.header(obj).tid & GCFLAG_FINALIZATION_ORDERING == 0,
                   "unexpected GCFLAG_FINALIZATION_ORDERING")
@@ -1016,8 +1125,12 @@ class MiniMarkGC(MovingGCBase):
             # to the list 'old_objects_pointing_to_young'.  We know that
             # 'addr_struct' cannot be in the nursery, because nursery objects
             # never have the flag GCFLAG_TRACK_YOUNG_PTRS to start with.
+            # During an incremental major collection we do it for any
+            # 'newvalue', so that the next minor collection traces
+            # 'addr_struct' again for the marking.
             objhdr = self.header(addr_struct)
-            if self.appears_to_be_young(newvalue):
+            if (self.appears_to_be_young(newvalue) or
+                    self.gc_state == STATE_MARKING):
                 self.old_objects_pointing_to_young.append(addr_struct)
                 objhdr.tid &= ~GCFLAG_TRACK_YOUNG_PTRS
             #
@@ -1105,8 +1218,9 @@ class MiniMarkGC(MovingGCBase):
                 # case with cards.
                 #
                 # If the newly written address does not actually point to a
-                # young object, leave now.
-                if not self.appears_to_be_young(newvalue):
+                # young object, leave now (unless we are marking).
+                if (not self.appears_to_be_young(newvalue) and
+                        self.gc_state != STATE_MARKING):
                     return
                 #
                 # 'addr_array' is a raw_malloc'ed array with card markers
@@ -1133,7 +1247,8 @@ class MiniMarkGC(MovingGCBase):
                 ll_assert(self.debug_is_old_object(addr_array),
                         "young array with no card but GCFLAG_TRACK_YOUNG_PTRS")
             #
-            if self.appears_to_be_young(newvalue):
+            if (self.appears_to_be_young(newvalue) or
+                    self.gc_state == STATE_MARKING):
                 self.old_objects_pointing_to_young.append(addr_array)
                 objhdr.tid &= ~GCFLAG_TRACK_YOUNG_PTRS
 
@@ -1174,7 +1289,15 @@ class MiniMarkGC(MovingGCBase):
             return True
         # ^^^ a fast path of write-barrier
         #
-        if source_hdr.tid & GCFLAG_HAS_CARDS != 0:
+        if self.gc_state == STATE_MARKING:
+            # During an incremental major collection, 'dest_addr' must be
+            # traced again at the next minor collection, as if we copied
+            # young pointers.  For arrays with cards, let ll_arraycopy
+            # call the write barrier on each item.
+            if dest_hdr.tid & GCFLAG_HAS_CARDS != 0:
+                return False
+            #
+        elif source_hdr.tid & GCFLAG_HAS_CARDS != 0:
             #
             if source_hdr.tid & GCFLAG_TRACK_YOUNG_PTRS == 0:
                 # The source object may have random young pointers.
@@ -1196,7 +1319,8 @@ class MiniMarkGC(MovingGCBase):
             self.manually_copy_card_bits(source_addr, dest_addr, length)
             return True
         #
-        if source_hdr.tid & GCFLAG_TRACK_YOUNG_PTRS == 0:
+        if (source_hdr.tid & GCFLAG_TRACK_YOUNG_PTRS == 0 or
+                self.gc_state == STATE_MARKING):
             # there might be in source a pointer to a young object
             self.old_objects_pointing_to_young.append(dest_addr)
             dest_hdr.tid &= ~GCFLAG_TRACK_YOUNG_PTRS
@@ -1235,6 +1359,11 @@ class MiniMarkGC(MovingGCBase):
         that remain alive and move them out."""
         #
         debug_start("gc-minor")
+        if self.telemetry:
+            telemetry.event(telemetry.EV_MINOR_START,
+                            self.nursery_free - self.nursery, 0, 0)
+        self.nursery_bytes_promoted = 0
+        self.card_arrays_scanned = 0
         #
         # Before everything else, remove from 'old_objects_pointing_to_young'
         # the young arrays.
@@ -1296,6 +1425,11 @@ class MiniMarkGC(MovingGCBase):
                     self.get_total_memory_used())
         if self.DEBUG >= 2:
             self.debug_check_consistency()     # expensive!
+        if self.telemetry:
+            telemetry.event(telemetry.EV_MINOR_STOP,
+                            self.nursery_bytes_promoted,
+                            self.card_arrays_scanned,
+                            intmask(self.get_total_memory_used()))
         debug_stop("gc-minor")
 
 
@@ -1321,6 +1455,7 @@ class MiniMarkGC(MovingGCBase):
             ll_assert(self.header(obj).tid & GCFLAG_CARDS_SET != 0,
                 "!GCFLAG_CARDS_SET but object in 'old_objects_with_cards_set'")
             self.header(obj).tid &= ~GCFLAG_CARDS_SET
+            self.card_arrays_scanned += 1
             #
             # Get the number of card marker bytes in the header.
             typeid = self.get_type_id(obj)
@@ -1362,6 +1497,11 @@ class MiniMarkGC(MovingGCBase):
                                           "premature end of object")
                             self.trace_and_drag_out_of_nursery_partial(
                                 obj, interval_start, interval_stop)
+                            if self.gc_state == STATE_MARKING:
+                                self.trace_partial(obj, interval_start,
+                                                   interval_stop,
+                                                   self._collect_ref_rec,
+                                                   None)
                         #
                         interval_start = interval_stop
                         cardbyte >>= 1
@@ -1389,6 +1529,19 @@ class MiniMarkGC(MovingGCBase):
             # outside the nursery, possibly forcing nursery objects out
             # and adding them to 'old_objects_pointing_to_young' as well.
             self.trace_and_drag_out_of_nursery(obj)
+            #
+            # If an incremental major collection is marking, 'obj' was
+            # either modified or just made old: make it black again.
+            if self.gc_state == STATE_MARKING:
+                self.retrace_for_marking(obj)
+
+    def retrace_for_marking(self, obj):
+        # Like visit(), but 'obj' may already have GCFLAG_VISITED.  All
+        # the objects it references now are added to 'objects_to_trace'.
+        hdr = self.header(obj)
+        if hdr.tid & GCFLAG_NO_HEAP_PTRS == 0:
+            hdr.tid |= GCFLAG_VISITED
+        self.trace(obj, self._collect_ref_rec, None)
 
     def trace_and_drag_out_of_nursery(self, obj):
         """obj must not be in the nursery.  This copies all the
@@ -1458,6 +1611,7 @@ class MiniMarkGC(MovingGCBase):
         # Copy it.  Note that references to other objects in the
         # nursery are kept unchanged in this step.
         llmemory.raw_memcopy(obj - size_gc_header, newhdr, totalsize)
+        self.nursery_bytes_promoted += raw_malloc_usage(totalsize)
         #
         # Set the old object's tid to -42 (containing all flags) and
         # replace the old object's content with the target address.
@@ -1544,7 +1698,12 @@ class MiniMarkGC(MovingGCBase):
 
     def _free_young_rawmalloced_obj(self, obj, ignored1, ignored2):
         # If 'obj' has GCFLAG_VISITED, it was seen by _trace_drag_out
-        # and survives.  Otherwise, it dies.
+        # and survives.  Otherwise, it dies.  If it survives while an
+        # incremental major collection is marking, it needs to be traced
+        # by the marking too: it loses GCFLAG_VISITED just below.
+        if (self.gc_state == STATE_MARKING and
+                self.header(obj).tid & GCFLAG_VISITED):
+            self.objects_to_trace.append(obj)
         self.free_rawmalloced_object_if_unvisited(obj)
 
     def remove_young_arrays_from_old_objects_pointing_to_young(self):
@@ -1564,11 +1723,95 @@ class MiniMarkGC(MovingGCBase):
     # Full collection
 
     def major_collection(self, reserving_size=0):
-        """Do a major collection.  Only for when the nursery is empty."""
+        """Do a major collection.  Only for when the nursery is empty.
+        If a major collection is already in progress, finish it."""
         #
         debug_start("gc-collect")
+        if self.telemetry:
+            telemetry.event(telemetry.EV_STEP_START, self.gc_state, 0, 0)
         debug_print()
         debug_print(".----------- Full collection ------------------")
+        marking = self.gc_state != STATE_SWEEPING
+        if self.gc_state == STATE_SCANNING:
+            self.start_major_collection()
+            self.finish_marking(False)
+        elif self.gc_state == STATE_MARKING:
+            debug_print("| finishing the incremental marking")
+            self.finish_marking(True)
+        else:
+            debug_print("| finishing the sweeping")
+        self.sweep_step(-1)
+        self.end_major_collection()
+        if self.telemetry:
+            telemetry.event(telemetry.EV_STEP_STOP, self.gc_state, 0, 0)
+        debug_stop("gc-collect")
+        self.major_collection_done(reserving_size)
+        #
+        # At the end, we can execute the finalizers of the objects
+        # listed in 'run_finalizers'.  Note that this will typically do
+        # more allocations.
+        if marking:
+            self.execute_finalizers()
+
+    def major_collection_step(self, reserving_size=0):
+        """Do a step of the major collection, starting a new one if
+        needed.  Only for when the nursery is empty.  The marking is done
+        in one step, or in several steps if PYPY_GC_INCREMENT_STEP is set;
+        then the sweeping is done lazily, in steps or whenever the
+        ArenaCollection needs a page of a size class not swept yet.  If
+        the memory grew too much since the start of the major collection,
+        the current phase is finished in one go."""
+        #
+        debug_start("gc-collect-step")
+        if self.telemetry:
+            telemetry.event(telemetry.EV_STEP_START, self.gc_state, 0, 0)
+        incremental = True
+        if self.gc_state == STATE_SCANNING:
+            debug_print()
+            debug_print(".----------- Major collection -----------------")
+            self.start_major_collection()
+            incremental = False
+        #
+        too_much_memory = (float(self.get_total_memory_used()) +
+                           reserving_size > self.marking_memory_limit)
+        marked = False
+        swept = False
+        if self.gc_state == STATE_MARKING:
+            if (self.incremental_step <= 0 or too_much_memory or
+                    self.visit_objects_step(self.incremental_step)):
+                self.finish_marking(incremental)
+                marked = True
+            else:
+                debug_print("marking step, total memory used:",
+                            self.get_total_memory_used())
+        #
+        # Unless there is too much memory, the sweeping starts only at
+        # the next step: allocation resumes right after the marking.
+        if self.gc_state == STATE_SWEEPING and (too_much_memory or
+                                                not marked):
+            if too_much_memory:
+                limit = -1
+            else:
+                limit = self.nursery_size // self.ac.page_size + 1
+            if self.sweep_step(limit):
+                self.end_major_collection()
+                swept = True
+            else:
+                debug_print("sweeping step, total memory used:",
+                            self.get_total_memory_used())
+        if self.telemetry:
+            telemetry.event(telemetry.EV_STEP_STOP, self.gc_state, 0, 0)
+        debug_stop("gc-collect-step")
+        #
+        if swept:
+            self.major_collection_done(reserving_size)
+        if marked:
+            self.execute_finalizers()
+
+    def start_major_collection(self):
+        if self.telemetry:
+            telemetry.event(telemetry.EV_MAJOR_START,
+                            intmask(self.get_total_memory_used()), 0, 0)
         debug_print("| used before collection:")
         debug_print("|          in ArenaCollection:     ",
                     self.ac.total_memory_used, "bytes")
@@ -1586,7 +1829,27 @@ class MiniMarkGC(MovingGCBase):
         # them, starting from the roots.
         self.objects_to_trace = self.AddressStack()
         self.collect_roots()
-        self.visit_all_objects()
+        self.gc_state = STATE_MARKING
+        #
+        # If the memory grows that much before the major collection is
+        # finished, we finish it in one go.
+        self.marking_memory_limit = (self.next_major_collection_threshold *
+                                     self.major_collection_threshold)
+        if (self.max_heap_size > 0.0 and
+                self.marking_memory_limit > self.max_heap_size):
+            self.marking_memory_limit = self.max_heap_size
+
+    def finish_marking(self, incremental):
+        # If the marking was done incrementally, the roots may have
+        # changed in the meantime: walk them again.  This is why the
+        # marking ends only when an incremental step runs out of work.
+        if incremental:
+            self.collect_roots()
+        if self.mark_threads > 1:
+            self.visit_all_objects_parallel()
+        else:
+            self.visit_all_objects()
+        self.gc_state = STATE_SWEEPING
         #
         # Finalizer support: adds the flag GCFLAG_VISITED to all objects
         # with a finalizer and all objects reachable from there (and also
@@ -1602,20 +1865,39 @@ class MiniMarkGC(MovingGCBase):
             self.invalidate_old_weakrefs()
         if self.old_objects_with_light_finalizers.non_empty():
             self.deal_with_old_objects_with_finalizers()
-
-        #
-        # Walk all rawmalloced objects and free the ones that don't
-        # have the GCFLAG_VISITED flag.
-        self.free_unvisited_rawmalloc_objects()
         #
-        # Ask the ArenaCollection to visit all objects.  Free the ones
-        # that have not been visited above, and reset GCFLAG_VISITED on
-        # the others.
-        self.ac.mass_free(self._free_if_unvisited)
+        # Prepare the sweeping: the rawmalloced objects and the objects
+        # of the ArenaCollection that don't have GCFLAG_VISITED will be
+        # freed by sweep_step(), which also resets GCFLAG_VISITED on the
+        # others.  New objects are allocated elsewhere in the meantime.
+        self.raw_objects_to_sweep = self.old_rawmalloced_objects
+        self.old_rawmalloced_objects = self.AddressStack()
+        self.ac.mass_free_prepare(self._free_if_unvisited)
         #
         # We also need to reset the GCFLAG_VISITED on prebuilt GC objects.
         self.prebuilt_root_objects.foreach(self._reset_gcflag_visited, None)
-        #
+        if self.telemetry:
+            telemetry.event(telemetry.EV_MAJOR_MARKED,
+                            intmask(self.get_total_memory_used()), 0, 0)
+
+    def sweep_step(self, limit):
+        # Sweep at most 'limit' rawmalloced objects and 'limit' pages of
+        # the ArenaCollection, or everything if 'limit' is negative.
+        # Returns True if the sweeping is finished.
+        objs = self.raw_objects_to_sweep
+        n = limit
+        while n != 0 and objs.non_empty():
+            self.free_rawmalloced_object_if_unvisited(objs.pop())
+            n -= 1
+        if not self.ac.mass_free_incremental(limit):
+            return False
+        if objs.non_empty():
+            return False
+        objs.delete()
+        return True
+
+    def end_major_collection(self):
+        self.gc_state = STATE_SCANNING
         self.debug_check_consistency()
         #
         self.num_major_collects += 1
@@ -1626,8 +1908,16 @@ class MiniMarkGC(MovingGCBase):
                     self.rawmalloced_total_size, "bytes")
         debug_print("| number of major collects:        ",
                     self.num_major_collects)
+        if self.telemetry:
+            telemetry.event(telemetry.EV_MAJOR_STOP,
+                            intmask(self.get_total_memory_used()),
+                            self.num_major_collects, 0)
+        if self.use_hugepages:
+            debug_print("| arenas in huge pages:            ",
+                        self.ac.num_hugepage_arenas)
         debug_print("`----------------------------------------------")
-        debug_stop("gc-collect")
+
+    def major_collection_done(self, reserving_size):
         #
         # Set the threshold for the next major collection to be when we
         # have allocated 'major_collection_threshold' times more than
@@ -1655,11 +1945,6 @@ class MiniMarkGC(MovingGCBase):
                                       "Using too much memory, aborting")
             self.max_heap_size_already_raised = True
             raise MemoryError
-        #
-        # At the end, we can execute the finalizers of the objects
-        # listed in 'run_finalizers'.  Note that this will typically do
-        # more allocations.
-        self.execute_finalizers()
 
 
     def _free_if_unvisited(self, hdr):
@@ -1700,16 +1985,6 @@ class MiniMarkGC(MovingGCBase):
             llarena.arena_free(arena)
             self.rawmalloced_total_size -= r_uint(allocsize)
 
-    def free_unvisited_rawmalloc_objects(self):
-        list = self.old_rawmalloced_objects
-        self.old_rawmalloced_objects = self.AddressStack()
-        #
-        while list.non_empty():
-            self.free_rawmalloced_object_if_unvisited(list.pop())
-        #
-        list.delete()
-
-
     def collect_roots(self):
         # Collect all roots.  Starts from all the objects
         # from 'prebuilt_root_objects'.
@@ -1750,6 +2025,55 @@ class MiniMarkGC(MovingGCBase):
             obj = pending.pop()
             self.visit(obj)
 
+    def visit_all_objects_parallel(self):
+        # Like visit_all_objects(), but with 'mark_threads' threads which
+        # take objects from 'objects_to_trace' and steal work from each
+        # other.  See parallelmark.py.
+        if not parallelmark.start(self.mark_threads):
+            self.visit_all_objects()      # out of memory
+            return
+        pending = self.objects_to_trace
+        while pending.non_empty():
+            parallelmark.add(pending.pop())
+        n = parallelmark.run(llhelper(parallelmark.MARK_THREAD_FN,
+                                      self._mark_thread))
+        parallelmark.stop()
+        debug_print("| marking threads:                 ", n)
+
+    def mark_thread_run(self, n):
+        # Runs in the marking thread 'n'.  Like visit(), but several
+        # threads may see the same object without GCFLAG_VISITED and
+        # both trace it, which is harmless.  This must not allocate,
+        # raise, or print anything.
+        while True:
+            obj = parallelmark.pop(n)
+            if not obj:
+                break
+            hdr = self.header(obj)
+            if hdr.tid & (GCFLAG_VISITED | GCFLAG_NO_HEAP_PTRS):
+                continue
+            hdr.tid |= GCFLAG_VISITED
+            self.trace(obj, self._collect_ref_parallel, n)
+
+    def _collect_ref_parallel(self, root, n):
+        parallelmark.push(n, root.address[0])
+
+    def visit_objects_step(self, budget):
+        # Visit objects from 'objects_to_trace' until we traced about
+        # 'budget' bytes of them.  Returns True if the list is now empty.
+        size_gc_header = self.gcheaderbuilder.size_gc_header
+        pending = self.objects_to_trace
+        while pending.non_empty():
+            if budget <= 0:
+                return False
+            obj = pending.pop()
+            if self.header(obj).tid & (GCFLAG_VISITED | GCFLAG_NO_HEAP_PTRS):
+                budget -= WORD
+            else:
+                budget -= raw_malloc_usage(size_gc_header + self.get_size(obj))
+                self.visit(obj)
+        return True
+
     def visit(self, obj):
         #
         # 'obj' is a live object.  Check GCFLAG_VISITED to know if we
@@ -2047,6 +2371,8 @@ class SimpleArenaCollection(object):
         self.small_request_threshold = small_request_threshold
         self.all_objects = []
         self.total_memory_used = 0
+        self.use_hugepages = False
+        self.num_hugepage_arenas = 0
 
     def malloc(self, size):
         nsize = raw_malloc_usage(size)
@@ -2061,12 +2387,26 @@ class SimpleArenaCollection(object):
         return result
 
     def mass_free(self, ok_to_free_func):
-        objs = self.all_objects
+        self.mass_free_prepare(ok_to_free_func)
+        res = self.mass_free_incremental(-1)
+        assert res
+
+    def mass_free_prepare(self, ok_to_free_func):
+        self.old_all_objects = self.all_objects
         self.all_objects = []
         self.total_memory_used = 0
-        for rawobj, nsize in objs:
-            if ok_to_free_func(rawobj):
+        self.ok_to_free_func = ok_to_free_func
+
+    def mass_free_incremental(self, max_pages):
+        objs = self.old_all_objects
+        while objs:
+            if max_pages == 0:
+                return False
+            max_pages -= 1
+            rawobj, nsize = objs.pop()
+            if self.ok_to_free_func(rawobj):
                 llarena.arena_free(rawobj)
             else:
                 self.all_objects.append((rawobj, nsize))
                 self.total_memory_used += nsize
+        return True
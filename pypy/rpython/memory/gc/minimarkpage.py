@@ -26,6 +26,8 @@ ARENA = lltype.Struct('ArenaReference',
     ('freepages', llmemory.Address),
     # -- A linked list of arenas.  See below.
     ('nextarena', ARENA_PTR),
+    # -- True if 'base' comes from llarena.arena_malloc_hugepages()
+    ('hugepages', lltype.Bool),
     )
 ARENA_PTR.TO.become(ARENA)
 ARENA_NULL = lltype.nullptr(ARENA)
@@ -105,6 +107,14 @@ class ArenaCollection(object):
         self.full_page_for_size = lltype.malloc(rffi.CArray(PAGE_PTR), length,
                                                 flavor='raw', zero=True,
                                                 immortal=True)
+        # the same two lists, for the pages that have not been swept yet
+        # after a major collection; see mass_free_prepare().
+        self.old_page_for_size = lltype.malloc(rffi.CArray(PAGE_PTR), length,
+                                               flavor='raw', zero=True,
+                                               immortal=True)
+        self.old_full_page_for_size = lltype.malloc(rffi.CArray(PAGE_PTR),
+                                                    length, flavor='raw',
+                                                    zero=True, immortal=True)
         self.nblocks_for_size = lltype.malloc(rffi.CArray(lltype.Signed),
                                               length, flavor='raw',
                                               immortal=True)
@@ -139,8 +149,18 @@ class ArenaCollection(object):
         self.num_uninitialized_pages = 0
         #
         # the total memory used, counting every block in use, without
-        # the additional bookkeeping stuff.
+        # the additional bookkeeping stuff.  While sweeping, the blocks
+        # in pages that have not been swept yet are not counted.
         self.total_memory_used = r_uint(0)
+        #
+        # while sweeping, the largest size class that may still have pages
+        # in 'old_page_for_size' or 'old_full_page_for_size'; otherwise -1.
+        self.size_class_with_old_pages = -1
+        #
+        # if True, try to get the arenas from huge pages (PYPY_GC_HUGEPAGES);
+        # reset to False as soon as that fails.
+        self.use_hugepages = False
+        self.num_hugepage_arenas = 0
 
 
     def malloc(self, size):
@@ -189,6 +209,15 @@ class ArenaCollection(object):
     def allocate_new_page(self, size_class):
         """Allocate and return a new page for the given size_class."""
         #
+        # If we are sweeping, first sweep the old pages of this size
+        # class, until one of them has room again.
+        if self.size_class_with_old_pages >= size_class:
+            self.mass_free_in_pages(size_class, self.ok_to_free_func, -1,
+                                    True)
+            page = self.page_for_size[size_class]
+            if page != PAGE_NULL:
+                return page
+        #
         # Allocate a new arena if needed.
         if self.current_arena == ARENA_NULL:
             self.allocate_new_arena()
@@ -268,15 +297,22 @@ class ArenaCollection(object):
             self.min_empty_nfreepages = i
         #
         # No more arena with any free page.  We must allocate a new arena.
-        if not we_are_translated():
+        # (While sweeping, 'arenas_lists' is only updated at the end.)
+        if not we_are_translated() and self.size_class_with_old_pages < 0:
             for a in self._all_arenas():
                 assert a.nfreepages == 0
         #
         # 'arena_base' points to the start of malloced memory; it might not
         # be a page-aligned address
-        arena_base = llarena.arena_malloc(self.arena_size, False)
+        arena_base = NULL
+        if self.use_hugepages:
+            arena_base = llarena.arena_malloc_hugepages(self.arena_size)
+            if not arena_base:
+                self.use_hugepages = False    # fall back to arena_malloc()
         if not arena_base:
-            raise MemoryError("couldn't allocate the next arena")
+            arena_base = llarena.arena_malloc(self.arena_size, False)
+            if not arena_base:
+                raise MemoryError("couldn't allocate the next arena")
         arena_end = arena_base + self.arena_size
         #
         # 'firstpage' points to the first unused page
@@ -291,6 +327,9 @@ class ArenaCollection(object):
         arena.nfreepages = 0        # they are all uninitialized pages
         arena.totalpages = npages
         arena.freepages = firstpage
+        arena.hugepages = self.use_hugepages
+        if self.use_hugepages:
+            self.num_hugepage_arenas += 1
         self.num_uninitialized_pages = npages
         self.current_arena = arena
         #
@@ -301,22 +340,67 @@ class ArenaCollection(object):
         """For each object, if ok_to_free_func(obj) returns True, then free
         the object.
         """
+        self.mass_free_prepare(ok_to_free_func)
+        res = self.mass_free_incremental(-1)
+        ll_assert(res, "mass_free_incremental(-1) returned False")
+
+
+    def mass_free_prepare(self, ok_to_free_func):
+        """Prepare calls to mass_free_incremental(): moves the chained lists
+        of pages into 'self.old_xxx'.  Until the end of the sweeping,
+        malloc() only uses new pages, or old pages that it swept itself
+        because it needed one.
+        """
+        ll_assert(self.size_class_with_old_pages < 0,
+                  "mass_free_prepare() called while sweeping")
+        self.ok_to_free_func = ok_to_free_func
         self.total_memory_used = r_uint(0)
         #
-        # For each size class:
         size_class = self.small_request_threshold >> WORD_POWER_2
+        self.size_class_with_old_pages = size_class
+        #
+        while size_class >= 1:
+            self.old_page_for_size[size_class] = (
+                self.page_for_size[size_class])
+            self.old_full_page_for_size[size_class] = (
+                self.full_page_for_size[size_class])
+            self.page_for_size[size_class] = PAGE_NULL
+            self.full_page_for_size[size_class] = PAGE_NULL
+            size_class -= 1
+
+
+    def mass_free_incremental(self, max_pages):
+        """Sweep at most 'max_pages' of the old pages, or all of them if
+        'max_pages' is negative.  Returns True when the sweeping is over.
+        """
+        size_class = self.size_class_with_old_pages
+        if size_class < 0:
+            return True     # not sweeping
+        #
         while size_class >= 1:
             #
-            # Walk the pages in 'page_for_size[size_class]' and
-            # 'full_page_for_size[size_class]' and free some objects.
+            # Walk the pages in 'old_page_for_size[size_class]' and
+            # 'old_full_page_for_size[size_class]' and free some objects.
             # Pages completely freed are added to 'page.arena.freepages',
             # and become available for reuse by any size class.  Pages
             # not completely freed are re-chained either in
             # 'full_page_for_size[]' or 'page_for_size[]'.
-            self.mass_free_in_pages(size_class, ok_to_free_func)
+            max_pages = self.mass_free_in_pages(size_class,
+                                                self.ok_to_free_func,
+                                                max_pages, False)
+            if max_pages == 0:
+                self.size_class_with_old_pages = size_class
+                return False
             #
             size_class -= 1
         #
+        self.size_class_with_old_pages = -1
+        self.rehash_arenas_lists()
+        return True
+
+
+    def rehash_arenas_lists(self):
+        #
         # Rehash arenas into the correct arenas_lists[i].  If
         # 'self.current_arena' contains an arena too, it remains there.
         (self.old_arenas_lists, self.arenas_lists) = (
@@ -336,7 +420,12 @@ class ArenaCollection(object):
                 if arena.nfreepages == arena.totalpages:
                     #
                     # The whole arena is empty.  Free it.
-                    llarena.arena_free(arena.base)
+                    if arena.hugepages:
+                        llarena.arena_free_hugepages(arena.base,
+                                                     self.arena_size)
+                        self.num_hugepage_arenas -= 1
+                    else:
+                        llarena.arena_free(arena.base)
                     lltype.free(arena, flavor='raw', track_allocation=False)
                     #
                 else:
@@ -353,40 +442,53 @@ class ArenaCollection(object):
         self.min_empty_nfreepages = 1
 
 
-    def mass_free_in_pages(self, size_class, ok_to_free_func):
+    def mass_free_in_pages(self, size_class, ok_to_free_func, max_pages,
+                           stop_at_partial_page):
+        """Sweep the old pages of the given size class.  Stops after
+        'max_pages' pages if it is not negative, or as soon as a page
+        with free blocks is found if 'stop_at_partial_page'.  Returns
+        what remains of 'max_pages'.
+        """
         nblocks = self.nblocks_for_size[size_class]
         block_size = size_class * WORD
-        remaining_partial_pages = PAGE_NULL
-        remaining_full_pages = PAGE_NULL
         #
         step = 0
         while step < 2:
             if step == 0:
-                page = self.full_page_for_size[size_class]
+                page = self.old_full_page_for_size[size_class]
             else:
-                page = self.page_for_size[size_class]
+                page = self.old_page_for_size[size_class]
             #
             while page != PAGE_NULL:
+                if max_pages == 0:
+                    break
+                max_pages -= 1
                 #
                 # Collect the page.
                 surviving = self.walk_page(page, block_size, ok_to_free_func)
                 nextpage = page.nextpage
+                if step == 0:
+                    self.old_full_page_for_size[size_class] = nextpage
+                else:
+                    self.old_page_for_size[size_class] = nextpage
                 #
                 if surviving == nblocks:
                     #
                     # The page is still full.  Re-insert it in the
-                    # 'remaining_full_pages' chained list.
+                    # 'full_page_for_size' chained list.
                     ll_assert(step == 0,
                               "A non-full page became full while freeing")
-                    page.nextpage = remaining_full_pages
-                    remaining_full_pages = page
+                    page.nextpage = self.full_page_for_size[size_class]
+                    self.full_page_for_size[size_class] = page
                     #
                 elif surviving > 0:
                     #
                     # There is at least 1 object surviving.  Re-insert
-                    # the page in the 'remaining_partial_pages' chained list.
-                    page.nextpage = remaining_partial_pages
-                    remaining_partial_pages = page
+                    # the page in the 'page_for_size' chained list.
+                    page.nextpage = self.page_for_size[size_class]
+                    self.page_for_size[size_class] = page
+                    if stop_at_partial_page:
+                        return max_pages
                     #
                 else:
                     # No object survives; free the page.
@@ -396,8 +498,7 @@ class ArenaCollection(object):
             #
             step += 1
         #
-        self.page_for_size[size_class] = remaining_partial_pages
-        self.full_page_for_size[size_class] = remaining_full_pages
+        return max_pages
 
 
     def free_page(self, page):
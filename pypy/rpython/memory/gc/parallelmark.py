@@ -0,0 +1,96 @@
+"""
+Work-stealing mark stacks for the parallel marking of the MiniMark GC.
+The C implementation is in translator/c/src/parallelmark.c.  Before
+translation, the workers are emulated: they run one after the other,
+so the last ones usually find that everything was stolen already.
+"""
+import py
+from pypy.tool.autopath import pypydir
+from pypy.rpython.lltypesystem import lltype, llmemory, rffi
+from pypy.translator.tool.cbuild import ExternalCompilationInfo
+
+
+cdir = py.path.local(pypydir) / 'translator' / 'c'
+
+eci = ExternalCompilationInfo(
+    include_dirs = [cdir],
+    includes = ['src/parallelmark.h'],
+    separate_module_sources = ['#include "src/parallelmark.c"\n'],
+)
+
+MARK_THREAD_FN = lltype.Ptr(lltype.FuncType([lltype.Signed], lltype.Void))
+
+# the number of objects moved at once to or from a shared stack
+BATCH = 64
+
+
+class EmulatedMarking(object):
+    "NOT_RPYTHON"
+    batch = BATCH
+
+    def start(self, nthreads):
+        nthreads = max(nthreads, 1)
+        self.local = [[] for i in range(nthreads)]
+        self.shared = [[] for i in range(nthreads)]
+        self.next_add = 0
+        return 1
+
+    def add(self, obj):
+        self.shared[self.next_add].append(obj)
+        self.next_add = (self.next_add + 1) % len(self.shared)
+
+    def run(self, fn):
+        for n in range(len(self.local)):
+            fn(n)
+        return len(self.local)
+
+    def push(self, n, obj):
+        local = self.local[n]
+        local.append(obj)
+        if (len(local) >= 2 * self.batch and not self.shared[n] and
+                len(self.local) > 1):
+            self.shared[n].extend(local[:self.batch])
+            del local[:self.batch]
+
+    def pop(self, n):
+        local = self.local[n]
+        if not local:
+            nthreads = len(self.shared)
+            for i in range(nthreads):
+                v = (n + i) % nthreads
+                shared = self.shared[v]
+                k = len(shared)
+                if v != n:
+                    k = (k + 1) // 2
+                k = min(k, self.batch)
+                if k > 0:
+                    local.extend(shared[-k:])
+                    del shared[-k:]
+                    break
+            else:
+                return llmemory.NULL
+        return local.pop()
+
+    def stop(self):
+        del self.local
+        del self.shared
+
+emulated = EmulatedMarking()
+
+
+def llexternal(name, args, result, _callable):
+    return rffi.llexternal(name, args, result, compilation_info=eci,
+                           sandboxsafe=True, _nowrapper=True,
+                           _callable=_callable)
+
+start = llexternal('pypy_pmark_start', [lltype.Signed], lltype.Signed,
+                   emulated.start)
+add = llexternal('pypy_pmark_add', [llmemory.Address], lltype.Void,
+                 emulated.add)
+run = llexternal('pypy_pmark_run', [MARK_THREAD_FN], lltype.Signed,
+                 emulated.run)
+push = llexternal('pypy_pmark_push', [lltype.Signed, llmemory.Address],
+                  lltype.Void, emulated.push)
+pop = llexternal('pypy_pmark_pop', [lltype.Signed], llmemory.Address,
+                 emulated.pop)
+stop = llexternal('pypy_pmark_stop', [], lltype.Void, emulated.stop)
@@ -0,0 +1,78 @@
+"""
+Low-overhead telemetry of the GC: if PYPY_GC_TELEMETRY names a file,
+the GC events are written into a ring buffer mmap()ed from this file,
+which an external tool can follow while the process runs (see
+pypy/tool/gctelemetry.py).  The C implementation is in
+translator/c/src/gctelemetry.c.  Before translation, the events are
+just recorded in a list.
+"""
+import sys
+import py
+from pypy.tool.autopath import pypydir
+from pypy.rpython.lltypesystem import lltype, rffi
+from pypy.translator.tool.cbuild import ExternalCompilationInfo
+
+
+cdir = py.path.local(pypydir) / 'translator' / 'c'
+
+if sys.platform.startswith('linux'):
+    libraries = ['rt']     # for clock_gettime() on older glibcs
+else:
+    libraries = []
+
+eci = ExternalCompilationInfo(
+    include_dirs = [cdir],
+    includes = ['src/gctelemetry.h'],
+    separate_module_sources = ['#include "src/gctelemetry.c"\n'],
+    libraries = libraries,
+)
+
+# the format of the file, see src/gctelemetry.h
+MAGIC        = 0x47435445
+VERSION      = 1
+HEADER_WORDS = 8
+RECORD_WORDS = 6
+
+# the kinds of events, with the meaning of their three values
+EVENTS = [
+    ('NURSERY_SIZE',   'nursery size', None, None),
+    ('MINOR_START',    'bytes used in the nursery', None, None),
+    ('MINOR_STOP',     'bytes promoted out of the nursery',
+                       'arrays with cards scanned', 'total memory used'),
+    ('MAJOR_START',    'total memory used', None, None),
+    ('MAJOR_MARKED',   'total memory used', None, None),
+    ('MAJOR_STOP',     'total memory used', 'number of major collects',
+                       None),
+    ('STEP_START',     'gc state', None, None),
+    ('STEP_STOP',      'gc state', None, None),
+    ]
+for _i, _event in enumerate(EVENTS):
+    globals()['EV_' + _event[0]] = _i + 1
+del _i, _event
+
+
+class EmulatedTelemetry(object):
+    "NOT_RPYTHON"
+    enabled = False
+
+    def __init__(self):
+        self.events = []
+
+    def open(self):
+        return int(self.enabled)
+
+    def event(self, kind, value1, value2, value3):
+        if self.enabled:
+            self.events.append((kind, value1, value2, value3))
+
+emulated = EmulatedTelemetry()
+
+
+def llexternal(name, args, result, _callable):
+    return rffi.llexternal(name, args, result, compilation_info=eci,
+                           sandboxsafe=True, _nowrapper=True,
+                           _callable=_callable)
+
+open = llexternal('pypy_gctel_open', [], lltype.Signed, emulated.open)
+event = llexternal('pypy_gctel_event', [lltype.Signed] * 4, lltype.Void,
+                   emulated.event)
@@ -599,3 +599,244 @@ class TestMiniMarkGCSimple(DirectGCTest):
 
 class TestMiniMarkGCFull(DirectGCTest):
     from pypy.rpython.memory.gc.minimark import MiniMarkGC as GCClass
+
+    def test_lazy_sweeping(self):
+        from pypy.rpython.memory.gc import minimark
+        for i in range(20):
+            p = self.malloc(S)
+            p.x = i
+            self.stackroots.append(p)
+        for i in range(2):
+            self.stackroots.append(self.malloc(VAR, self.gc.nonlarge_max + 1))
+        self.gc.collect()
+        used = self.gc.ac.total_memory_used
+        raw_used = self.gc.rawmalloced_total_size
+        del self.stackroots[21]          # one of the 'VAR' dies
+        del self.stackroots[1:20:2]      # and half of the 'S'
+        #
+        # the first step does the marking, but no sweeping yet
+        self.gc.major_collection_step()
+        assert self.gc.gc_state == minimark.STATE_SWEEPING
+        assert self.gc.ac.total_memory_used == 0
+        assert self.gc.rawmalloced_total_size == raw_used
+        #
+        # allocation continues while sweeping
+        p = self.malloc(S)
+        p.x = 100
+        self.stackroots.append(p)
+        while self.gc.gc_state != minimark.STATE_SCANNING:
+            self.gc.minor_collection()
+            self.gc.major_collection_step()
+        assert self.gc.ac.total_memory_used < used
+        assert self.gc.rawmalloced_total_size < raw_used
+        for i in range(10):
+            assert self.stackroots[i].x == 2 * i
+        assert self.stackroots[11].x == 100
+
+    def test_collect_while_sweeping(self):
+        from pypy.rpython.memory.gc import minimark
+        for i in range(10):
+            self.stackroots.append(self.malloc(S))
+        self.gc.collect()
+        used = self.gc.ac.total_memory_used
+        self.gc.major_collection_step()
+        assert self.gc.gc_state == minimark.STATE_SWEEPING
+        self.stackroots.pop()
+        self.gc.collect()
+        assert self.gc.gc_state == minimark.STATE_SCANNING
+        # the object dropped during the sweeping is freed too
+        assert self.gc.ac.total_memory_used < used
+
+    def test_telemetry(self, monkeypatch):
+        from pypy.rpython.memory.gc import telemetry
+        monkeypatch.setattr(telemetry.emulated, 'enabled', True)
+        monkeypatch.setattr(telemetry.emulated, 'events', [])
+        monkeypatch.setattr(self.gc, 'telemetry', True)
+        for i in range(3):
+            self.stackroots.append(self.malloc(S))
+        self.gc.collect()
+        events = telemetry.emulated.events
+        assert [ev[0] for ev in events] == [
+            telemetry.EV_MINOR_START, telemetry.EV_MINOR_STOP,
+            telemetry.EV_STEP_START, telemetry.EV_MAJOR_START,
+            telemetry.EV_MAJOR_MARKED, telemetry.EV_MAJOR_STOP,
+            telemetry.EV_STEP_STOP]
+        size_of_s = llmemory.raw_malloc_usage(
+            self.gc.gcheaderbuilder.size_gc_header + llmemory.sizeof(S))
+        assert events[0][1] >= 3 * size_of_s          # nursery used
+        assert events[1][1] == 3 * size_of_s          # promoted
+        assert events[1][3] == self.gc.get_total_memory_used()
+        assert events[5][2] == self.gc.num_major_collects
+
+class TestMiniMarkGCParallel(TestMiniMarkGCFull):
+    GC_PARAMS = {'mark_threads': 3}
+
+    def test_parallel_marking(self, monkeypatch):
+        from pypy.rpython.memory.gc import parallelmark
+        # small batches, to move objects between the workers more often
+        monkeypatch.setattr(parallelmark.emulated, 'batch', 2)
+        seen = []
+        orig_mark_thread_run = self.gc.mark_thread_run
+        def mark_thread_run(n):
+            seen.append(n)
+            orig_mark_thread_run(n)
+        monkeypatch.setattr(self.gc, 'mark_thread_run', mark_thread_run)
+        #
+        # a binary tree of 'S', plus a few other roots
+        def make_tree(depth):
+            p = self.malloc(S)
+            p.x = depth
+            if depth > 0:
+                self.stackroots.append(p)
+                for name in ['prev', 'next']:
+                    q = make_tree(depth - 1)
+                    self.write(self.stackroots[-1], name, q)
+                p = self.stackroots.pop()
+            return p
+        self.stackroots.append(make_tree(6))
+        for i in range(5):
+            p = self.malloc(S)
+            p.x = 100 + i
+            self.stackroots.append(p)
+        del seen[:]
+        self.gc.collect()
+        self.gc.collect()
+        assert seen == [0, 1, 2, 0, 1, 2]
+        #
+        def count(p, depth):
+            assert p.x == depth
+            if depth == 0:
+                assert not p.prev and not p.next
+                return 1
+            return 1 + count(p.prev, depth - 1) + count(p.next, depth - 1)
+        assert count(self.stackroots[0], 6) == 2**7 - 1
+        for i in range(5):
+            assert self.stackroots[1 + i].x == 100 + i
+
+class TestMiniMarkGCIncremental(DirectGCTest):
+    from pypy.rpython.memory.gc.minimark import MiniMarkGC as GCClass
+    GC_PARAMS = {'incremental_step': 2*WORD}
+
+    def start_marking(self):
+        from pypy.rpython.memory.gc import minimark
+        self.gc.minor_collection()
+        self.gc.major_collection_step()
+        assert self.gc.gc_state == minimark.STATE_MARKING
+
+    def is_black(self, p):
+        from pypy.rpython.memory.gc import minimark
+        hdr = self.gc.header(llmemory.cast_ptr_to_adr(p))
+        return bool(hdr.tid & minimark.GCFLAG_VISITED)
+
+    def test_steps(self):
+        from pypy.rpython.memory.gc import minimark
+        for i in range(10):
+            p = self.malloc(S)
+            p.x = i
+            if self.stackroots:
+                self.write(p, 'next', self.stackroots.pop())
+            self.stackroots.append(p)
+        self.gc.collect()
+        self.start_marking()
+        steps = 1
+        while self.gc.gc_state == minimark.STATE_MARKING:
+            self.gc.minor_collection()
+            self.gc.major_collection_step()
+            steps += 1
+        assert steps > 3
+        p = self.stackroots[0]
+        for i in range(9, -1, -1):
+            assert p.x == i
+            p = p.next
+        assert not p
+
+    def test_write_barrier_while_marking(self):
+        # 'w' is black, 'x' is still grey; move the only reference to
+        # 'y' from 'x' to 'w'.  The write barrier must notice.
+        w = self.malloc(S)
+        x = self.malloc(S)
+        y = self.malloc(S)
+        y.x = 42
+        self.write(x, 'next', y)
+        self.stackroots.append(x)
+        self.stackroots.append(w)
+        self.gc.collect()
+        self.start_marking()
+        x, w = self.stackroots
+        assert self.is_black(w)
+        assert not self.is_black(x)
+        self.write(w, 'next', x.next)
+        self.write(x, 'next', lltype.nullptr(S))
+        self.gc.collect()
+        assert self.stackroots[1].next.x == 42
+
+    def test_stack_root_while_marking(self):
+        # 'y' is only referenced from the stack when the marking ends
+        x = self.malloc(S)
+        y = self.malloc(S)
+        y.x = 42
+        self.write(x, 'next', y)
+        self.stackroots.append(x)
+        self.stackroots.append(self.malloc(S))
+        self.gc.collect()
+        self.start_marking()
+        x = self.stackroots[0]
+        assert not self.is_black(x)
+        self.stackroots.append(x.next)
+        self.write(x, 'next', lltype.nullptr(S))
+        self.gc.collect()
+        assert self.stackroots[2].x == 42
+
+    def test_young_objects_while_marking(self):
+        w = self.malloc(S)
+        self.stackroots.append(w)
+        self.stackroots.append(self.malloc(S))
+        self.gc.collect()
+        self.start_marking()
+        w = self.stackroots[0]
+        assert not self.is_black(w)
+        p = self.malloc(S)
+        p.x = 43
+        self.write(w, 'next', p)
+        a = self.malloc(VAR, self.gc.nonlarge_max + 1)  # raw-malloced
+        self.writearray(a, 1, p)
+        self.stackroots.append(a)
+        self.gc.minor_collection()       # 'p' and 'a' become old
+        self.gc.collect()
+        assert self.stackroots[0].next.x == 43
+        assert self.stackroots[2][1].x == 43
+
+    def test_writebarrier_before_copy_while_marking(self):
+        from pypy.rpython.memory.gc import minimark
+        p_src = self.malloc(VAR, 5)
+        p_dst = self.malloc(VAR, 5)
+        self.writearray(p_src, 2, self.malloc(S))
+        self.stackroots.append(p_src)
+        self.stackroots.append(p_dst)
+        self.gc.collect()
+        self.start_marking()
+        p_src, p_dst = self.stackroots
+        assert self.is_black(p_dst)
+        addr_src = llmemory.cast_ptr_to_adr(p_src)
+        addr_dst = llmemory.cast_ptr_to_adr(p_dst)
+        res = self.gc.writebarrier_before_copy(addr_src, addr_dst, 0, 0, 5)
+        assert res
+        assert (self.gc.header(addr_dst).tid &
+                minimark.GCFLAG_TRACK_YOUNG_PTRS) == 0
+        for i in range(5):
+            p_dst[i] = p_src[i]
+            p_src[i] = lltype.nullptr(S)
+        p_dst[2].x = 44
+        self.gc.collect()
+        assert self.stackroots[1][2].x == 44
+
+    def test_memory_limit_finishes_collection(self):
+        from pypy.rpython.memory.gc import minimark
+        for i in range(10):
+            self.stackroots.append(self.malloc(S))
+        self.gc.collect()
+        self.start_marking()
+        self.gc.marking_memory_limit = 0.0
+        self.gc.minor_collection()
+        self.gc.major_collection_step()
+        assert self.gc.gc_state == minimark.STATE_SCANNING
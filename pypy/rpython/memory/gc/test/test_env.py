@@ -161,3 +161,14 @@ etc.
 """)
     result = env.get_L2cache_linux2(str(filepath))
     assert result == 3072 * 1024
+
+def test_get_hugepage_mode_linux():
+    filepath = udir.join('get_hugepage_mode_linux')
+    filepath.write('always [madvise] never\n')
+    result = env.get_hugepage_mode_linux(str(filepath))
+    assert result == 'madvise'
+    filepath.write('[always] madvise never\n')
+    result = env.get_hugepage_mode_linux(str(filepath))
+    assert result == 'always'
+    result = env.get_hugepage_mode_linux(str(udir.join('does_not_exist')))
+    assert result == ''
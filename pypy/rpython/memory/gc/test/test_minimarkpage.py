@@ -400,9 +400,64 @@ def test_mass_free_half_page_becomes_more_free():
     assert freepages(ac) == NULL
     assert ac.full_page_for_size[2] == PAGE_NULL
 
+def test_mass_free_incremental():
+    pagesize = hdrsize + 7*WORD
+    ac = arena_collection_for_test(pagesize, "###", fill_with_objects=2)
+    ok_to_free = OkToFree(ac, False)
+    ac.mass_free_prepare(ok_to_free)
+    assert ac.full_page_for_size[2] == PAGE_NULL
+    assert ac.total_memory_used == 0
+    res = ac.mass_free_incremental(2)
+    assert res is False
+    assert len(ok_to_free.seen) == 6
+    assert ac.total_memory_used == 6 * 2*WORD
+    res = ac.mass_free_incremental(2)
+    assert res is True
+    assert len(ok_to_free.seen) == 9
+    assert ac.total_memory_used == 9 * 2*WORD
+    assert ac.size_class_with_old_pages == -1
+    page = ac.full_page_for_size[2]
+    for i in [2, 1, 0]:
+        checkpage(ac, page, i)
+        page = page.nextpage
+    assert page == PAGE_NULL
+    assert ac.page_for_size[2] == PAGE_NULL
+    assert ac.mass_free_incremental(2) is True
+
+def test_malloc_sweeps_on_demand():
+    pagesize = hdrsize + 7*WORD
+    ac = arena_collection_for_test(pagesize, "###", fill_with_objects=2)
+    freed = pagenum(ac, 1) + hdrsize
+    ok_to_free = OkToFree(ac, lambda addr: addr == freed)
+    ac.mass_free_prepare(ok_to_free)
+    #
+    # malloc() sweeps the pages of its size class until it finds a free
+    # block; it doesn't need a new page, nor a new arena
+    obj = ac.malloc(2*WORD)
+    assert obj == freed
+    assert ok_to_free.seen == {hdrsize + 0*WORD: False,
+                               hdrsize + 2*WORD: False,
+                               hdrsize + 4*WORD: False,
+                               pagesize + hdrsize + 0*WORD: True,
+                               pagesize + hdrsize + 2*WORD: False,
+                               pagesize + hdrsize + 4*WORD: False}
+    assert ac.size_class_with_old_pages >= 2
+    #
+    res = ac.mass_free_incremental(-1)
+    assert res is True
+    assert len(ok_to_free.seen) == 9
+    assert ac.total_memory_used == 9 * 2*WORD
+    assert len(list(ac._all_arenas())) == 1
+
 # ____________________________________________________________
 
 def test_random():
+    run_random(incremental=False)
+
+def test_random_incremental():
+    run_random(incremental=True)
+
+def run_random(incremental):
     import random
     pagesize = hdrsize + 24*WORD
     num_pages = 3
@@ -428,21 +483,33 @@ def test_random():
                 raise DoneTesting
         a.mark_freed = my_mark_freed
     ac.allocate_new_arena = my_allocate_new_arena
+    def allocate_objects(count, objects, seen={}):
+        for i in range(count):
+            size_class = random.randrange(1, 7)
+            obj = ac.malloc(size_class * WORD)
+            at = (obj.arena, obj.offset)
+            # 'at' may be the place of an object already swept and freed
+            assert at not in live_objects or seen.get(at)
+            assert at not in objects
+            objects[at] = size_class * WORD
     try:
         while True:
             #
             # Allocate some more objects
-            for i in range(random.randrange(50, 100)):
-                size_class = random.randrange(1, 7)
-                obj = ac.malloc(size_class * WORD)
-                at = (obj.arena, obj.offset)
-                assert at not in live_objects
-                live_objects[at] = size_class * WORD
+            allocate_objects(random.randrange(50, 100), live_objects)
             #
             # Free half the objects, randomly
             ok_to_free = OkToFree(ac, lambda obj: random.random() < 0.5,
                                   multiarenas=True)
-            ac.mass_free(ok_to_free)
+            new_objects = {}
+            if not incremental:
+                ac.mass_free(ok_to_free)
+            else:
+                # Sweep in small steps, and allocate more objects in-between
+                ac.mass_free_prepare(ok_to_free)
+                while not ac.mass_free_incremental(random.randrange(1, 4)):
+                    allocate_objects(random.randrange(0, 5), new_objects,
+                                     ok_to_free.seen)
             #
             # Check that we have seen all objects
             assert sorted(ok_to_free.seen) == sorted(live_objects)
@@ -452,6 +519,37 @@ def test_random():
                     del live_objects[at]
                 else:
                     surviving_total_size += live_objects[at]
+            for at, size in new_objects.items():
+                surviving_total_size += size
+            live_objects.update(new_objects)
             assert ac.total_memory_used == surviving_total_size
     except DoneTesting:
         pass
+
+def test_hugepages():
+    pagesize = hdrsize + 2*WORD
+    ac = ArenaCollection(pagesize * 4, pagesize, 99)
+    ac.use_hugepages = True
+    objs = [ac.malloc(2*WORD) for i in range(10)]
+    arenas = list(ac._all_arenas())
+    assert len(arenas) >= 3
+    for arena in arenas:
+        assert arena.hugepages
+    assert ac.num_hugepage_arenas == len(arenas)
+    #
+    ac.mass_free(OkToFree(ac, True, multiarenas=True))
+    remaining = list(ac._all_arenas())
+    assert len(remaining) < len(arenas)
+    assert ac.num_hugepage_arenas == len(remaining)
+    assert ac.use_hugepages
+
+def test_hugepages_fallback(monkeypatch):
+    monkeypatch.setattr(llarena, 'arena_malloc_hugepages',
+                        lambda nbytes: NULL)
+    pagesize = hdrsize + 2*WORD
+    ac = ArenaCollection(pagesize * 4, pagesize, 99)
+    ac.use_hugepages = True
+    ac.malloc(2*WORD)
+    assert not ac.use_hugepages
+    assert not ac.current_arena.hugepages
+    assert ac.num_hugepage_arenas == 0
@@ -0,0 +1,107 @@
+from pypy.rpython.memory.gc import parallelmark
+from pypy.rpython.memory.gc.parallelmark import EmulatedMarking
+from pypy.rpython.lltypesystem import lltype, llmemory, rffi
+from pypy.rpython.annlowlevel import llhelper
+from pypy.translator.c.test import test_standalone
+
+NULL = llmemory.NULL
+
+
+def test_emulated_pop_and_steal():
+    pm = EmulatedMarking()
+    pm.start(2)
+    for obj in ['a', 'b', 'c']:
+        pm.add(obj)
+    assert pm.pop(0) == 'c'       # from its own shared stack
+    assert pm.pop(0) == 'a'
+    assert pm.pop(0) == 'b'       # stolen from worker 1
+    assert pm.pop(0) == NULL
+    assert pm.pop(1) == NULL
+    pm.stop()
+
+def test_emulated_push_gives_work_away():
+    pm = EmulatedMarking()
+    pm.batch = 2
+    pm.start(2)
+    for obj in range(5):
+        pm.push(0, obj)
+    assert pm.shared[0] == [0, 1]
+    assert pm.local[0] == [2, 3, 4]
+    assert pm.pop(1) == 1         # steals half of [0, 1]
+    assert pm.pop(1) == 0
+    assert pm.pop(1) == NULL
+    assert [pm.pop(0) for i in range(4)] == [4, 3, 2, NULL]
+    pm.stop()
+
+def test_emulated_run():
+    pm = EmulatedMarking()
+    pm.start(3)
+    seen = []
+    assert pm.run(seen.append) == 3
+    assert seen == [0, 1, 2]
+    pm.stop()
+
+
+class TestStandalone(test_standalone.StandaloneTests):
+
+    def test_compiled_parallel_marking(self):
+        # a binary tree of N nodes, where node i also points to node i/3;
+        # check that each node is seen at least once, by some worker
+        N = 200000
+        NTHREADS = 4
+        SIGNEDP = rffi.CArray(lltype.Signed)
+        marks = lltype.malloc(SIGNEDP, N, flavor='raw', zero=True,
+                              immortal=True)
+        work = lltype.malloc(SIGNEDP, NTHREADS, flavor='raw', zero=True,
+                             immortal=True)
+        #
+        def push(n, i):
+            if i < N:
+                parallelmark.push(n, llmemory.cast_int_to_adr(i + 1))
+        #
+        def worker(n):
+            while True:
+                obj = parallelmark.pop(n)
+                if not obj:
+                    break
+                i = llmemory.cast_adr_to_int(obj) - 1
+                if marks[i]:
+                    continue
+                marks[i] = 1
+                work[n] += 1
+                push(n, 2 * i + 1)
+                push(n, 2 * i + 2)
+                push(n, i // 3)
+        #
+        def fn(argv):
+            nrunning = 0
+            for rounds in range(5):
+                i = 0
+                while i < N:
+                    marks[i] = 0
+                    i += 1
+                if not parallelmark.start(NTHREADS):
+                    print 'out of memory'
+                    return 1
+                parallelmark.add(llmemory.cast_int_to_adr(1))
+                parallelmark.add(llmemory.cast_int_to_adr(N))
+                nrunning = parallelmark.run(
+                    llhelper(parallelmark.MARK_THREAD_FN, worker))
+                parallelmark.stop()
+                i = 0
+                while i < N:
+                    if not marks[i]:
+                        print 'not marked:', i
+                        return 1
+                    i += 1
+            total = 0
+            for n in range(NTHREADS):
+                total += work[n]
+            print nrunning, total - 5 * N
+            return 0
+        #
+        t, cbuilder = self.compile(fn)
+        data = cbuilder.cmdexec('')
+        nrunning, extra = map(int, data.split())
+        assert nrunning == NTHREADS
+        assert extra >= 0      # some nodes may be seen by several workers
@@ -0,0 +1,57 @@
+from pypy.rpython.memory.gc import telemetry
+from pypy.translator.c.test import test_standalone
+from pypy.tool.gctelemetry import Reader
+from pypy.tool.udir import udir
+
+
+def test_emulated():
+    emu = telemetry.EmulatedTelemetry()
+    assert emu.open() == 0
+    emu.event(telemetry.EV_MINOR_START, 1, 2, 3)
+    assert emu.events == []
+    emu.enabled = True
+    assert emu.open() == 1
+    emu.event(telemetry.EV_MINOR_START, 1, 2, 3)
+    assert emu.events == [(telemetry.EV_MINOR_START, 1, 2, 3)]
+
+
+class TestStandalone(test_standalone.StandaloneTests):
+
+    def test_ring_buffer(self):
+        def fn(argv):
+            if not telemetry.open():
+                print 'disabled'
+                return 0
+            n = int(argv[1])
+            for i in range(n):
+                telemetry.event(telemetry.EV_MAJOR_START, i, 2 * i, -i)
+            print 'ok'
+            return 0
+        #
+        t, cbuilder = self.compile(fn)
+        data = cbuilder.cmdexec('5')
+        assert data == 'disabled\n'
+        #
+        path = udir.join('test_telemetry_ring_buffer')
+        data = cbuilder.cmdexec('5', env={'PYPY_GC_TELEMETRY': str(path)})
+        assert data == 'ok\n'
+        reader = Reader(str(path))
+        events, lost = reader.read_events()
+        assert lost == 0
+        assert [ev[:2] + ev[3:] for ev in events] == [
+            (i, telemetry.EV_MAJOR_START, i, 2 * i, -i) for i in range(5)]
+        timestamps = [ev[2] for ev in events]
+        assert timestamps == sorted(timestamps)
+        reader.close()
+        #
+        # more events than the capacity: only the last ones are left
+        capacity = Reader(str(path)).read_header()['capacity']
+        data = cbuilder.cmdexec(str(capacity + 10),
+                                env={'PYPY_GC_TELEMETRY': str(path)})
+        reader = Reader(str(path))
+        events, lost = reader.read_events()
+        assert lost == 10
+        assert len(events) == capacity
+        assert events[0][3] == 10
+        assert events[-1][3] == capacity + 9
+        reader.close()
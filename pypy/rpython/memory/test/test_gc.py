@@ -921,3 +921,9 @@ class TestMiniMarkGC(TestSemiSpaceGC):
 
 class TestMiniMarkGCCardMarking(TestMiniMarkGC):
     GC_PARAMS = {'card_page_indices': 4}
+
+class TestMiniMarkGCIncremental(TestMiniMarkGC):
+    GC_PARAMS = {'card_page_indices': 4, 'incremental_step': 4*WORD}
+
+class TestMiniMarkGCParallel(TestMiniMarkGC):
+    GC_PARAMS = {'card_page_indices': 4, 'mark_threads': 3}
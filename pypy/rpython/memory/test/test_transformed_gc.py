@@ -1312,6 +1312,36 @@ class TestMiniMarkGC(TestHybridGC):
         res = run([])
         assert res == 123
 
+class TestMiniMarkGCIncremental(TestMiniMarkGC):
+    class gcpolicy(gc.FrameworkGcPolicy):
+        class transformerclass(framework.FrameworkGCTransformer):
+            from pypy.rpython.memory.gc.minimark import MiniMarkGC as GCClass
+            GC_PARAMS = {'nursery_size': 32*WORD,
+                         'page_size': 16*WORD,
+                         'arena_size': 64*WORD,
+                         'small_request_threshold': 5*WORD,
+                         'large_object': 8*WORD,
+                         'card_page_indices': 4,
+                         'incremental_step': 4*WORD,
+                         'translated_to_c': False,
+                         }
+            root_stack_depth = 200
+
+class TestMiniMarkGCParallel(TestMiniMarkGC):
+    class gcpolicy(gc.FrameworkGcPolicy):
+        class transformerclass(framework.FrameworkGCTransformer):
+            from pypy.rpython.memory.gc.minimark import MiniMarkGC as GCClass
+            GC_PARAMS = {'nursery_size': 32*WORD,
+                         'page_size': 16*WORD,
+                         'arena_size': 64*WORD,
+                         'small_request_threshold': 5*WORD,
+                         'large_object': 8*WORD,
+                         'card_page_indices': 4,
+                         'mark_threads': 3,
+                         'translated_to_c': False,
+                         }
+            root_stack_depth = 200
+
 # ________________________________________________________________
 # tagged pointers
 
@@ -0,0 +1,132 @@
+#! /usr/bin/env python
+"""
+Syntax:
+    python gctelemetry.py [-f] <filename>
+
+Print the GC events written by a pypy-c running with
+PYPY_GC_TELEMETRY=<filename>.  With -f, keep following the file for
+new events, like 'tail -f'.  The process can be started before or
+after this tool.
+"""
+import autopath
+import sys, os, time, struct, mmap
+from pypy.rpython.memory.gc import telemetry
+
+WORD = struct.calcsize('l')
+
+
+class Reader(object):
+    """Reads the ring buffer.  'self.next' is the index of the next
+    record to return."""
+
+    def __init__(self, filename):
+        self.filename = filename
+        self.map = None
+        self.next = 0
+
+    def _open(self):
+        try:
+            f = open(self.filename, 'rb')
+        except IOError:
+            return False
+        try:
+            size = os.fstat(f.fileno()).st_size
+            if size < telemetry.HEADER_WORDS * WORD:
+                return False
+            self.map = mmap.mmap(f.fileno(), size, access=mmap.ACCESS_READ)
+        finally:
+            f.close()
+        return True
+
+    def _words(self, index, count):
+        return struct.unpack_from('%dl' % count, self.map, index * WORD)
+
+    def read_header(self):
+        """Returns a dict, or None if the file is not ready yet."""
+        if self.map is None and not self._open():
+            return None
+        (magic, version, header_words, record_words, capacity, count,
+         pid, frequency) = self._words(0, telemetry.HEADER_WORDS)
+        if magic != telemetry.MAGIC:
+            return None
+        if (version != telemetry.VERSION or
+                header_words != telemetry.HEADER_WORDS or
+                record_words != telemetry.RECORD_WORDS):
+            raise ValueError("%s: unsupported format" % (self.filename,))
+        return {'capacity': capacity, 'count': count, 'pid': pid,
+                'frequency': frequency}
+
+    def read_events(self):
+        """Returns the list of the new events, as tuples (index, kind,
+        timestamp, value1, value2, value3), and the number of events
+        that were lost because they were overwritten before we read
+        them."""
+        header = self.read_header()
+        if header is None:
+            return [], 0
+        capacity = header['capacity']
+        count = header['count']
+        lost = 0
+        if count < self.next:
+            self.next = 0      # the process was restarted
+        if count - self.next > capacity:
+            lost = count - capacity - self.next
+            self.next = count - capacity
+        result = []
+        while self.next < count:
+            start = (telemetry.HEADER_WORDS +
+                     (self.next % capacity) * telemetry.RECORD_WORDS)
+            rec = self._words(start, telemetry.RECORD_WORDS)
+            if (rec[0] != self.next + 1 or
+                    self._words(start, 1)[0] != self.next + 1):
+                # overwritten by the writer, which is now at least
+                # 'capacity' records ahead of us: skip it
+                lost += 1
+            else:
+                result.append((self.next,) + rec[1:])
+            self.next += 1
+        return result, lost
+
+    def close(self):
+        if self.map is not None:
+            self.map.close()
+            self.map = None
+
+
+def format_event(event, frequency):
+    index, kind, timestamp, value1, value2, value3 = event
+    if not 1 <= kind <= len(telemetry.EVENTS):
+        return '%d: unknown event %d' % (index, kind)
+    descr = telemetry.EVENTS[kind - 1]
+    parts = ['[%.6f] %s' % (float(timestamp) / frequency, descr[0].lower())]
+    for label, value in zip(descr[1:], [value1, value2, value3]):
+        if label is not None:
+            parts.append('%s: %d' % (label, value))
+    return ', '.join(parts)
+
+
+def main(argv):
+    follow = False
+    if argv and argv[0] == '-f':
+        follow = True
+        argv = argv[1:]
+    if len(argv) != 1:
+        print __doc__
+        sys.exit(2)
+    reader = Reader(argv[0])
+    while True:
+        events, lost = reader.read_events()
+        if lost:
+            print '... %d events lost' % (lost,)
+        if events:
+            frequency = reader.read_header()['frequency']
+            for event in events:
+                print format_event(event, frequency)
+        if not follow:
+            break
+        time.sleep(0.1)
+    reader.close()
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
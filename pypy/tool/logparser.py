@@ -13,13 +13,18 @@ from pypy.rlib.debug import DebugLog
 from pypy.tool import progressbar
 
 def parse_log_file(filename, verbose=True):
-    f = open(filename, 'r')
+    f = open(filename, 'rb')
     if f.read(2) == 'BZ':
         f.close()
         import bz2
         f = bz2.BZ2File(filename, 'r')
     else:
         f.seek(0)
+    if f.read(len(BINARY_MAGIC)) == BINARY_MAGIC:
+        data = f.read()
+        f.close()
+        return parse_binary_log(data, verbose=verbose)
+    f.seek(0)
     lines = f.readlines()
     f.close()
     #
@@ -27,10 +32,14 @@ def parse_log_file(filename, verbose=True):
 
 def parse_log(lines, verbose=False):
     color = "(?:\x1b.*?m)?"
-    r_start = re.compile(color + r"\[([0-9a-fA-F]+)\] \{([\w-]+)" + color + "$")
-    r_stop  = re.compile(color + r"\[([0-9a-fA-F]+)\] ([\w-]+)\}" + color + "$")
+    counters = r"(?: #([0-9a-fA-F,]+))?"
+    r_start = re.compile(color + r"\[([0-9a-fA-F]+)\] \{([\w-]+)" + counters
+                         + color + "$")
+    r_stop  = re.compile(color + r"\[([0-9a-fA-F]+)\] ([\w-]+)\}" + counters
+                         + color + "$")
     lasttime = 0
     log = DebugLog()
+    totals = None
     time_decrase = False
     performance_log = True
     nested = 0
@@ -64,6 +73,12 @@ def parse_log(lines, verbose=False):
             if match:
                 record = log.debug_stop
                 nested -= 1
+            elif line.startswith(COUNTERS_HEADER) and totals is None:
+                totals = CounterTotals(line[len(COUNTERS_HEADER):].split(','))
+                continue
+            elif line.startswith(ISOLATION_HEADER) and i == 0:
+                log.isolation = line[len(ISOLATION_HEADER):]
+                continue
             else:
                 log.debug_print(line)
                 performance_log = performance_log and nested == 0
@@ -72,6 +87,14 @@ def parse_log(lines, verbose=False):
         time_decrase = time_decrase or time < lasttime
         lasttime = time
         record(match.group(2), time=int(match.group(1), 16))
+        if totals is not None and match.group(3):
+            values = [int(x, 16) for x in match.group(3).split(',')]
+            if record == log.debug_start:
+                totals.start(values)
+            else:
+                totals.stop(match.group(2), values)
+    if totals is not None:
+        totals.attach(log)
     if verbose:
         sys.stderr.write('loaded\n')
     if performance_log and time_decrase:
@@ -80,6 +103,180 @@ def parse_log(lines, verbose=False):
                " moved between CPUs.")
     return log
 
+# ____________________________________________________________
+# The values of PYPYLOG_COUNTERS, see translator/c/src/debug_print.c
+
+COUNTERS_HEADER = 'PYPYLOG counters: '
+ISOLATION_HEADER = 'PYPYLOG isolation: '   # see translator/c/src/profiling.c
+
+class CounterTotals(object):
+    """Sums, for each category, the increase of the counters during its
+    sections, minus their increase during the subsections (just like
+    gettotaltimes() does for the time).  There is one instance for each
+    thread, because the counters are per-thread."""
+
+    def __init__(self, names):
+        self.names = names
+        self.totals = {}       # {category: [sum of each counter]}
+        self.stack = []        # [[start values, sum over the subsections]]
+
+    def start(self, values):
+        self.stack.append([values, [0] * len(values)])
+
+    def stop(self, category, values):
+        if not self.stack:
+            return
+        startvalues, inner = self.stack.pop()
+        delta = [stop - start for start, stop in zip(startvalues, values)]
+        if self.stack:
+            outer = self.stack[-1][1]
+            for i in range(len(delta)):
+                outer[i] += delta[i]
+        total = self.totals.setdefault(category, [0] * len(delta))
+        for i in range(len(delta)):
+            total[i] += delta[i] - inner[i]
+
+    def merge(self, other):
+        for category, values in other.totals.items():
+            total = self.totals.setdefault(category, [0] * len(values))
+            for i in range(len(values)):
+                total[i] += values[i]
+
+    def attach(self, log):
+        log.counter_names = self.names
+        log.counter_totals = self.totals
+
+# ____________________________________________________________
+# The binary format of PYPYLOG=bin:..., see translator/c/src/debug_print.c
+
+BINARY_MAGIC = 'PYPYLOG\x01'
+(BIN_START, BIN_STOP, BIN_START_NAME, BIN_STOP_NAME, BIN_TEXT,
+ BIN_COUNTERS) = range(1, 7)
+
+def _read_varint(data, pos):
+    result = 0
+    shift = 0
+    while True:
+        byte = ord(data[pos])
+        pos += 1
+        result |= (byte & 0x7f) << shift
+        if byte < 0x80:
+            return result, pos
+        shift += 7
+
+def _read_timestamp(data, pos):
+    result = 0
+    for i in range(7, -1, -1):
+        result = (result << 8) | ord(data[pos + i])
+    if result >= 1 << 63:
+        result -= 1 << 64
+    return result, pos + 8
+
+def _parse_binary_chunk(log, data, categories, totals=None):
+    pos = 0
+    while pos < len(data):
+        kind = ord(data[pos])
+        pos += 1
+        if kind == BIN_TEXT:
+            length, pos = _read_varint(data, pos)
+            text = data[pos:pos+length]
+            pos += length
+            for line in text.splitlines():
+                log.debug_print(line)
+            continue
+        if kind == BIN_COUNTERS:
+            # the values of the counters at the previous start or stop
+            count, pos = _read_varint(data, pos)
+            values = []
+            for i in range(count):
+                value, pos = _read_varint(data, pos)
+                values.append(value)
+            if totals is not None:
+                if len(log[-1]) == 3:       # ('debug_start', cat, time)
+                    totals.start(values)
+                else:
+                    totals.stop(log[-1][0], values)
+            continue
+        if kind == BIN_START or kind == BIN_STOP:
+            id, pos = _read_varint(data, pos)
+            category = categories[id]
+        elif kind == BIN_START_NAME or kind == BIN_STOP_NAME:
+            length, pos = _read_varint(data, pos)
+            category = data[pos:pos+length]
+            pos += length
+        else:
+            raise ValueError("bad event %d in the binary log" % (kind,))
+        time, pos = _read_timestamp(data, pos)
+        if kind == BIN_START or kind == BIN_START_NAME:
+            log.debug_start(category, time=time)
+        else:
+            log.debug_stop(category, time=time)
+
+def parse_binary_log(data, verbose=False):
+    """Parse the content of a binary log, after the magic header.  The
+    logs of the threads are merged by interleaving their top-level
+    sections in the order of their start time."""
+    categories = {}
+    threadlogs = {}
+    counter_names = None
+    threadtotals = {}
+    isolation = None
+    pos = 0
+    while pos < len(data):
+        kind = data[pos]
+        number, pos = _read_varint(data, pos + 1)
+        length, pos = _read_varint(data, pos)
+        content = data[pos:pos+length]
+        pos += length
+        if kind == 'D':
+            categories[number] = content
+        elif kind == 'C':
+            if number not in threadlogs:
+                threadlogs[number] = DebugLog()
+                if counter_names is not None:
+                    threadtotals[number] = CounterTotals(counter_names)
+            _parse_binary_chunk(threadlogs[number], content, categories,
+                                threadtotals.get(number))
+        elif kind == 'K':
+            counter_names = content.split(',')
+        elif kind == 'I':
+            isolation = content
+        else:
+            raise ValueError("bad record %r in the binary log" % (kind,))
+    if verbose:
+        sys.stderr.write('loaded\n')
+    totals = None
+    if counter_names is not None:
+        totals = CounterTotals(counter_names)
+        for threadtotal in threadtotals.values():
+            totals.merge(threadtotal)
+    if len(threadlogs) == 1:
+        log = threadlogs.values()[0]
+        if totals is not None:
+            totals.attach(log)
+        if isolation is not None:
+            log.isolation = isolation
+        return log
+    # interleave: a top-level debug_print stays after the section that
+    # precedes it in its own thread
+    entries = []
+    for thread, threadlog in threadlogs.items():
+        time = None
+        for i, entry in enumerate(threadlog):
+            if len(entry) == 4:
+                time = entry[1]
+            elif entry[0] == 'debug_start':    # truncated log
+                time = entry[2]
+            entries.append((time, thread, i, entry))
+    entries.sort()
+    log = DebugLog()
+    log.extend([entry for (time, thread, i, entry) in entries])
+    if totals is not None:
+        totals.attach(log)
+    if isolation is not None:
+        log.isolation = isolation
+    return log
+
 def extract_category(log, catprefix='', toplevel=False):
     got = []
     resulttext = []
@@ -399,11 +596,25 @@ def print_summary(log, out):
     l = totaltimes.items()
     l.sort(cmp=lambda a, b: cmp(b[1], a[1]))
     total = sum([b for a, b in l])
+    if getattr(log, 'isolation', None):
+        print >>outfile, 'isolation:', log.isolation
     for a, b in l:
         if a is None:
             a = 'interpret'
         s = " " * (50 - len(a))
         print >>outfile, a, s, str(b*100/total) + "%"
+    names = getattr(log, 'counter_names', None)
+    if names:
+        # the counters of each category, excluding its subcategories
+        print >>outfile
+        print >>outfile, ' ' * 51, ' '.join(['%16s' % (name,)
+                                             for name in names])
+        l = log.counter_totals.items()
+        l.sort(cmp=lambda a, b: cmp(b[1], a[1]))
+        for a, values in l:
+            s = " " * (50 - len(a))
+            print >>outfile, a, s, ' '.join(['%16d' % (value,)
+                                             for value in values])
     if out != '-':
         outfile.close()
 
@@ -0,0 +1,173 @@
+#! /usr/bin/env python
+"""
+Syntax:
+    python samplerdump.py [-e <pypy-c>] [-t] <filename>
+
+Print the samples written by __pypy__.sampler_start() as "collapsed
+stacks": one line per distinct stack, with the frames separated by ';'
+from the outermost to the innermost, followed by the number of samples.
+This is the input format of flamegraph.pl and of most other flame graph
+tools.
+
+The innermost frame is the JIT-compiled loop or bridge that was running,
+if any, or else the C function of the RPython program that was running,
+if the executable is given with -e (this uses 'nm').  With -t, the
+stacks of different threads are kept apart.
+"""
+import autopath
+import sys, os, struct, bisect
+from pypy.rlib import rsampler
+
+WORD = struct.calcsize('l')
+
+
+class Profile(object):
+    """The content of a file written by the sampling profiler."""
+
+    def __init__(self):
+        self.interval_usec = 0
+        self.pid = 0
+        self.start_address = 0     # the address of pypy_sampler_start()
+        self.app_codes = {}    # {code id: 'co_name:firstlineno:filename'}
+        self.jit_codes = []    # sorted list of (address, size, name)
+        self.samples = []      # list of (thread, pc, depth, [ids])
+        self.lost = 0
+
+    def jit_code_at(self, pc):
+        i = bisect.bisect_right(self.jit_codes, (pc, sys.maxint, '')) - 1
+        if i >= 0:
+            address, size, name = self.jit_codes[i]
+            if pc < address + size:
+                return name
+        return None
+
+
+def read_profile(filename):
+    f = open(filename, 'rb')
+    try:
+        data = f.read()
+    finally:
+        f.close()
+    words = struct.unpack('%dl' % (len(data) // WORD,),
+                          data[:len(data) - len(data) % WORD])
+    if (len(words) < rsampler.HEADER_WORDS or
+            words[0] != rsampler.MAGIC or words[2] != WORD):
+        raise ValueError("%s: not a profile" % (filename,))
+    if words[1] != rsampler.VERSION:
+        raise ValueError("%s: unsupported format" % (filename,))
+    profile = Profile()
+    profile.interval_usec = words[3]
+    profile.pid = words[4]
+    profile.start_address = words[5]
+    i = rsampler.HEADER_WORDS
+    while i + 2 <= len(words):
+        tag, count = words[i], words[i + 1]
+        start = i + 2
+        record = words[start:start + count]
+        if len(record) < count:
+            break      # truncated: the process did not call sampler_stop()
+        i = start + count
+        if tag == rsampler.TAG_SAMPLE:
+            profile.samples.append((record[0], record[1], record[2],
+                                    list(record[3:])))
+        elif tag == rsampler.TAG_CODE:
+            kind, address, size, length = record[:4]
+            name = data[(start + 4) * WORD:][:length]
+            if kind == rsampler.CODE_APP:
+                profile.app_codes[address] = name
+            else:
+                profile.jit_codes.append((address, size, name))
+        elif tag == rsampler.TAG_LOST:
+            profile.lost += record[1]
+    profile.jit_codes.sort()
+    return profile
+
+
+class Symbols(object):
+    """The C functions of an executable, read with 'nm'.  They are
+    relocated so that pypy_sampler_start() is at 'start_address'."""
+
+    def __init__(self, executable, start_address):
+        self.addresses = []
+        self.names = []
+        offset = 0
+        for line in os.popen("nm -n --defined-only '%s'" % (executable,)):
+            parts = line.split()
+            if len(parts) == 3 and parts[1] in 'tT':
+                self.addresses.append(int(parts[0], 16))
+                self.names.append(parts[2])
+                if parts[2] == 'pypy_sampler_start':
+                    offset = start_address - self.addresses[-1]
+        self.addresses = [address + offset for address in self.addresses]
+
+    def lookup(self, pc):
+        i = bisect.bisect_right(self.addresses, pc) - 1
+        if i >= 0 and i + 1 < len(self.addresses):
+            return self.names[i]
+        return None     # before the first or after the last function
+
+
+def format_app_code(name):
+    # 'co_name:firstlineno:filename' => 'co_name (filename:firstlineno)'
+    parts = name.split(':', 2)
+    if len(parts) < 3:
+        return name
+    return '%s (%s:%s)' % (parts[0], parts[2], parts[1])
+
+def collapse(profile, symbols=None, per_thread=False):
+    """Returns a dict {tuple of frames: number of samples}."""
+    stacks = {}
+    for thread, pc, depth, ids in profile.samples:
+        frames = []
+        if per_thread:
+            frames.append('thread %d' % (thread,))
+        if depth > len(ids):
+            frames.append('...')
+        for uid in reversed(ids):
+            name = profile.app_codes.get(uid)
+            if name is None:
+                frames.append('<code %d>' % (uid,))
+            else:
+                frames.append(format_app_code(name))
+        leaf = profile.jit_code_at(pc)
+        if leaf is not None:
+            leaf = 'jit: ' + leaf
+        elif symbols is not None:
+            leaf = symbols.lookup(pc)
+        if leaf is not None:
+            frames.append(leaf)
+        if not frames:
+            frames.append('[unknown]')
+        key = tuple(frames)
+        stacks[key] = stacks.get(key, 0) + 1
+    return stacks
+
+
+def main(argv):
+    executable = None
+    per_thread = False
+    while argv and argv[0].startswith('-'):
+        if argv[0] == '-e' and len(argv) > 1:
+            executable = argv[1]
+            argv = argv[2:]
+        elif argv[0] == '-t':
+            per_thread = True
+            argv = argv[1:]
+        else:
+            break
+    if len(argv) != 1:
+        print __doc__
+        sys.exit(2)
+    profile = read_profile(argv[0])
+    symbols = None
+    if executable is not None:
+        symbols = Symbols(executable, profile.start_address)
+    stacks = collapse(profile, symbols, per_thread)
+    for frames in sorted(stacks):
+        print '%s %d' % (';'.join(frames), stacks[frames])
+    if profile.lost:
+        print >> sys.stderr, '%d samples were lost' % (profile.lost,)
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
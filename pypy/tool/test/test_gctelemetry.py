@@ -0,0 +1,56 @@
+import struct
+from pypy.tool.udir import udir
+from pypy.tool.gctelemetry import Reader, format_event
+from pypy.rpython.memory.gc import telemetry
+
+
+def write_file(path, capacity, records, count=None):
+    # 'records' is a list of (seq, kind, timestamp, v1, v2, v3), stored
+    # in this order starting at the index 0 of the ring buffer
+    if count is None:
+        count = len(records)
+    words = [telemetry.MAGIC, telemetry.VERSION, telemetry.HEADER_WORDS,
+             telemetry.RECORD_WORDS, capacity, count, 1234, 1000]
+    for i in range(capacity):
+        if i < len(records):
+            words.extend(records[i])
+        else:
+            words.extend([0] * telemetry.RECORD_WORDS)
+    path.write(struct.pack('%dl' % len(words), *words), 'wb')
+
+def test_read_events():
+    path = udir.join('test_gctelemetry_1')
+    write_file(path, 4, [(1, telemetry.EV_MINOR_START, 5000, 100, 0, 0),
+                         (2, telemetry.EV_MINOR_STOP, 7000, 40, 1, 999)])
+    reader = Reader(str(path))
+    assert reader.read_header()['pid'] == 1234
+    events, lost = reader.read_events()
+    assert lost == 0
+    assert events == [(0, telemetry.EV_MINOR_START, 5000, 100, 0, 0),
+                      (1, telemetry.EV_MINOR_STOP, 7000, 40, 1, 999)]
+    assert reader.read_events() == ([], 0)
+    assert format_event(events[1], 1000) == (
+        '[7.000000] minor_stop, bytes promoted out of the nursery: 40, '
+        'arrays with cards scanned: 1, total memory used: 999')
+    reader.close()
+
+def test_wrap_around():
+    path = udir.join('test_gctelemetry_2')
+    # 7 records were written in a buffer of 4: the indices 3, 4, 5 and 6
+    # are left, and the record 6 (at 6 % 4 == 2) is still being written
+    records = [(5, 1, 0, 0, 0, 0), (6, 2, 0, 0, 0, 0),
+               (0, 0, 0, 0, 0, 0), (4, 4, 0, 0, 0, 0)]
+    write_file(path, 4, records, count=7)
+    reader = Reader(str(path))
+    events, lost = reader.read_events()
+    assert [ev[0] for ev in events] == [3, 4, 5]
+    assert lost == 3 + 1
+
+def test_not_ready():
+    reader = Reader(str(udir.join('test_gctelemetry_missing')))
+    assert reader.read_events() == ([], 0)
+    path = udir.join('test_gctelemetry_3')
+    path.write('\x00' * 1000, 'wb')
+    reader = Reader(str(path))
+    assert reader.read_events() == ([], 0)
+    reader.close()
@@ -38,6 +38,118 @@ def test_parse_log_file():
             ('debug_print', 'test6')]),
         ('debug_print', 'test7')]
 
+def varint(n):
+    result = ''
+    while n >= 0x80:
+        result += chr((n & 0x7f) | 0x80)
+        n >>= 7
+    return result + chr(n)
+
+def record(kind, number, content):
+    return kind + varint(number) + varint(len(content)) + content
+
+def timestamp(n):
+    return ''.join([chr((n >> (8*i)) & 0xff) for i in range(8)])
+
+def start(id, time):
+    return chr(BIN_START) + varint(id) + timestamp(time)
+
+def stop(id, time):
+    return chr(BIN_STOP) + varint(id) + timestamp(time)
+
+def text(s):
+    return chr(BIN_TEXT) + varint(len(s)) + s
+
+def test_parse_binary_log_file():
+    # the same log as 'globalpath', split in two chunks
+    path = udir.join('test_logparser_bin.log')
+    path.write(BINARY_MAGIC +
+               record('C', 1, text('test1\n')) +
+               record('D', 1, 'foo') +
+               record('D', 200, 'bar') +
+               record('C', 1, start(1, 0x12a0) + text('test2a\n') +
+                              text('test2b\n') + start(200, 0x12b0) +
+                              text('test3\n') + stop(200, 0x12e0) +
+                              text('test4\n')) +
+               record('C', 1, start(200, 0x12e5) + text('test5a\ntest5b\n') +
+                              stop(200, 0x12e6) + text('test6\n') +
+                              stop(1, 0x12f0) + text('test7\n')),
+               'wb')
+    log = parse_log_file(str(path))
+    assert log == parse_log_file(str(globalpath))
+
+def test_parse_binary_log_threads():
+    data = (record('D', 1, 'foo') +
+            record('C', 2, start(1, 20) + stop(1, 25) + text('x\n') +
+                           chr(BIN_START_NAME) + varint(3) + 'baz' +
+                           timestamp(40) +
+                           chr(BIN_STOP_NAME) + varint(3) + 'baz' +
+                           timestamp(45)) +
+            record('C', 1, start(1, 10) + stop(1, 30) + text('y\n') +
+                           start(1, 35)))
+    log = parse_binary_log(data)
+    assert log == [
+        ('foo', 10, 30, []),
+        ('debug_print', 'y'),
+        ('foo', 20, 25, []),
+        ('debug_print', 'x'),
+        ('debug_start', 'foo', 35),
+        ('baz', 40, 45, [])]
+
+def counters(*values):
+    return (chr(BIN_COUNTERS) + varint(len(values)) +
+            ''.join([varint(value) for value in values]))
+
+def test_parse_log_counters():
+    log = parse_log("""\
+PYPYLOG counters: cycles,instructions
+[12a0] {foo #100,10
+[12b0] {bar #150,20
+[12e0] bar} #250,25
+[12f0] foo} #400,50
+[1300] {bar #400,50
+[1310] bar} #408,51
+""".splitlines())
+    assert log == [
+        ('foo', 0x12a0, 0x12f0, [
+            ('bar', 0x12b0, 0x12e0, [])]),
+        ('bar', 0x1300, 0x1310, [])]
+    assert log.counter_names == ['cycles', 'instructions']
+    assert log.counter_totals == {'foo': [0x400 - 0x100 - (0x250 - 0x150),
+                                          0x50 - 0x10 - (0x25 - 0x20)],
+                                  'bar': [0x250 - 0x150 + 8,
+                                          0x25 - 0x20 + 1]}
+
+def test_parse_binary_log_counters():
+    data = (record('K', 1, 'task-clock') +
+            record('D', 1, 'foo') +
+            record('D', 2, 'bar') +
+            record('C', 1, start(1, 10) + counters(1000) +
+                           start(2, 12) + counters(1100)) +
+            record('C', 2, start(2, 15) + counters(5) +
+                           stop(2, 16) + counters(7)) +
+            record('C', 1, stop(2, 18) + counters(1600) +
+                           stop(1, 20) + counters(2000)))
+    log = parse_binary_log(data)
+    assert log.counter_names == ['task-clock']
+    assert log.counter_totals == {'foo': [1000 - 500],
+                                  'bar': [500 + 2]}
+
+def test_parse_log_isolation():
+    log = parse_log("""\
+PYPYLOG isolation: cpus=2-3 threads=main main=2 mlock=no
+[12a0] {foo
+[12f0] foo}
+""".splitlines())
+    assert log == [('foo', 0x12a0, 0x12f0, [])]
+    assert log.isolation == 'cpus=2-3 threads=main main=2 mlock=no'
+    #
+    log = parse_binary_log(record('I', 0, 'cpus=1 threads=each main=1') +
+                           record('D', 1, 'foo') +
+                           record('C', 1, start(1, 10) + stop(1, 20)))
+    assert log == [('foo', 10, 20, [])]
+    assert log.isolation == 'cpus=1 threads=each main=1'
+
 def test_extract_category():
     log = parse_log_file(str(globalpath))
     catbar = list(extract_category(log, 'bar'))
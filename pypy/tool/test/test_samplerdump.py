@@ -0,0 +1,62 @@
+import struct
+from pypy.tool.udir import udir
+from pypy.tool.samplerdump import read_profile, collapse
+from pypy.rlib import rsampler
+
+WORD = struct.calcsize('l')
+
+
+def code_record(kind, address, size, name):
+    words = (len(name) + WORD) // WORD
+    data = name + '\x00' * (words * WORD - len(name))
+    return (struct.pack('6l', rsampler.TAG_CODE, 4 + words, kind, address,
+                        size, len(name)) + data)
+
+def sample_record(thread, pc, depth, ids):
+    words = [rsampler.TAG_SAMPLE, 3 + len(ids), thread, pc, depth] + ids
+    return struct.pack('%dl' % len(words), *words)
+
+def write_file(path, records):
+    header = struct.pack('6l', rsampler.MAGIC, rsampler.VERSION, WORD,
+                         1000, 1234, 0x5000)
+    path.write(header + ''.join(records), 'wb')
+
+
+def test_read_and_collapse():
+    path = udir.join('test_samplerdump_1')
+    write_file(path, [
+        code_record(rsampler.CODE_APP, 1, 10, 'main:10:x.py'),
+        code_record(rsampler.CODE_APP, 2, 20, 'f:20:x.py'),
+        code_record(rsampler.CODE_JIT, 0x9000, 0x100, 'Loop # 0: f'),
+        sample_record(0, 0x9010, 2, [2, 1]),
+        sample_record(0, 0x9010, 2, [2, 1]),
+        sample_record(1, 0x1234, 1, [1]),
+        sample_record(0, 0x1234, 5, [3, 2]),
+        struct.pack('4l', rsampler.TAG_LOST, 2, 1, 7),
+        struct.pack('3l', rsampler.TAG_SAMPLE, 9, 0),     # truncated
+        ])
+    profile = read_profile(str(path))
+    assert profile.pid == 1234
+    assert profile.app_codes == {1: 'main:10:x.py', 2: 'f:20:x.py'}
+    assert profile.jit_codes == [(0x9000, 0x100, 'Loop # 0: f')]
+    assert len(profile.samples) == 4
+    assert profile.lost == 7
+    #
+    stacks = collapse(profile)
+    assert stacks == {
+        ('main (x.py:10)', 'f (x.py:20)', 'jit: Loop # 0: f'): 2,
+        ('main (x.py:10)',): 1,
+        ('...', 'f (x.py:20)', '<code 3>'): 1,
+        }
+    stacks = collapse(profile, per_thread=True)
+    assert stacks[('thread 1', 'main (x.py:10)')] == 1
+
+def test_symbols():
+    class FakeSymbols(object):
+        def lookup(self, pc):
+            return {0x1234: 'pypy_g_foo'}.get(pc)
+    path = udir.join('test_samplerdump_2')
+    write_file(path, [sample_record(0, 0x1234, 0, []),
+                      sample_record(0, 0x9999, 0, [])])
+    stacks = collapse(read_profile(str(path)), FakeSymbols())
+    assert stacks == {('pypy_g_foo',): 1, ('[unknown]',): 1}
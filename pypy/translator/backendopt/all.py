@@ -11,6 +11,7 @@ from pypy.translator.backendopt.removeassert import remove_asserts
 from pypy.translator.backendopt.support import log
 from pypy.translator.backendopt.checkvirtual import check_virtual_methods
 from pypy.translator.backendopt.storesink import storesink_graph
+from pypy.translator.backendopt.branchprofile import BranchProfile
 from pypy.objspace.flow.model import checkgraph
 
 INLINE_THRESHOLD_FOR_TEST = 33
@@ -137,6 +138,13 @@ def backend_optimizations(translator, graphs=None, secondary=False, **kwds):
 
     remove_obvious_noops()
 
+    if config.profile_based_branches and not secondary:
+        # last, because the graphs must not change after the training run
+        profile = BranchProfile(graphs)
+        counters = translator.driver_instrument_result(
+            config.profile_based_branches, prepare=profile.instrument)
+        profile.apply(counters)
+
     for graph in graphs:
         checkgraph(graph)
 
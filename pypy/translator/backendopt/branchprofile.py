@@ -0,0 +1,116 @@
+"""
+Profile-guided hints for the C compiler.  The graphs are compiled once
+with a counter on each function entry and on each exit of each two-way
+branch, and a training workload is run (see
+TranslationDriver.instrument_result()).  Then, in the graphs that are
+really compiled:
+
+  * a branch that went the same way at least BIAS of the times gets an
+    'expect' operation on its exitswitch, which the C backend writes as
+    __builtin_expect();
+
+  * a function that was never called is marked as cold, and a function
+    that got at least HOT_FRACTION of all the calls is marked as hot.
+    The C backend declares them with __attribute__((cold)) or ((hot)):
+    GCC places them in separate sections (.text.unlikely or .text.hot),
+    optimizes the cold ones for size and does not inline them into hot
+    code, and treats a path that calls a cold function as unlikely.
+"""
+from pypy.objspace.flow.model import Variable, Constant, SpaceOperation
+from pypy.rpython.lltypesystem.lltype import Void, Signed, Bool
+from pypy.translator.unsimplify import insert_empty_block, varoftype
+from pypy.translator.backendopt.support import log
+
+BIAS = 0.95             # the fraction of the times a branch must go one way
+MIN_BRANCH_COUNT = 100  # ... out of at least that many times
+HOT_FRACTION = 0.001    # the fraction of all the calls for a hot function
+
+
+def find_branches(graphs):
+    """The blocks that end in a switch on a Bool, in a fixed order."""
+    result = []
+    for graph in graphs:
+        for block in graph.iterblocks():
+            if (isinstance(block.exitswitch, Variable) and
+                    block.exitswitch.concretetype is Bool):
+                assert len(block.exits) == 2
+                result.append(block)
+    return result
+
+def first_free_label(graphs):
+    """The first counter that is not already used by an
+    'instrument_count' operation, e.g. from profile-based inlining."""
+    label = 0
+    for graph in graphs:
+        for block in graph.iterblocks():
+            for op in block.operations:
+                if op.opname == 'instrument_count':
+                    label = max(label, op.args[1].value + 1)
+    return label
+
+def count_op(label):
+    return SpaceOperation('instrument_count',
+                          [Constant('branch', Void), Constant(label, Signed)],
+                          varoftype(Void))
+
+
+class BranchProfile(object):
+    """The counters are, from self.base: one per graph, counting the
+    calls, and then two per branch, counting how often its False and its
+    True exit are taken.  The counters are found again by looking at the
+    same graphs in the same order, so instrument() must be called on a
+    copy of the graphs, i.e. in the process forked by
+    TranslationDriver.instrument_result(), and apply() in the parent."""
+
+    def __init__(self, graphs):
+        self.graphs = graphs
+        self.branches = find_branches(graphs)
+        self.base = first_free_label(graphs)
+
+    def instrument(self):
+        label = self.base
+        for graph in self.graphs:
+            graph.startblock.operations.insert(0, count_op(label))
+            label += 1
+        for block in self.branches:
+            for link in list(block.exits):
+                insert_empty_block(None, link,
+                                   [count_op(label + int(link.exitcase))])
+            label += 2
+        log.branchprofile("%d functions and %d branches instrumented" % (
+            len(self.graphs), len(self.branches)))
+
+    def apply(self, counters):
+        def count(label):
+            if label < len(counters):
+                return counters[label]
+            return 0
+        label = self.base
+        calls = [count(label + i) for i in range(len(self.graphs))]
+        label += len(self.graphs)
+        hot_limit = max(sum(calls) * HOT_FRACTION, 1)
+        nhot = ncold = 0
+        for graph, ncalls in zip(self.graphs, calls):
+            if ncalls == 0:
+                graph.hotness = 'cold'
+                ncold += 1
+            elif ncalls >= hot_limit:
+                graph.hotness = 'hot'
+                nhot += 1
+        nbiased = 0
+        for block in self.branches:
+            taken = [count(label), count(label + 1)]   # [False, True]
+            label += 2
+            total = taken[0] + taken[1]
+            if total < MIN_BRANCH_COUNT:
+                continue
+            for expected in [False, True]:
+                if taken[expected] >= total * BIAS:
+                    v_result = varoftype(Bool)
+                    block.operations.append(SpaceOperation('expect',
+                        [block.exitswitch, Constant(expected, Bool)],
+                        v_result))
+                    block.exitswitch = v_result
+                    nbiased += 1
+        log.branchprofile("%d hot and %d cold functions, %d biased branches"
+                          % (nhot, ncold, nbiased))
@@ -0,0 +1,65 @@
+from pypy.objspace.flow.model import summary
+from pypy.translator.backendopt.branchprofile import BranchProfile
+from pypy.translator.backendopt.test.test_constfold import get_graph
+from pypy.translator.backendopt.test.test_constfold import check_graph
+
+
+def fn(n):
+    total = 0
+    while n > 0:
+        if n % 100 == 0:
+            total += 10
+        total += 1
+        n -= 1
+    return total
+
+def test_instrument():
+    graph, t = get_graph(fn, [int])
+    profile = BranchProfile([graph])
+    assert len(profile.branches) == 2
+    profile.instrument()
+    # one counter for the calls, two for each branch
+    labels = [op.args[1].value for block in graph.iterblocks()
+                               for op in block.operations
+                               if op.opname == 'instrument_count']
+    assert sorted(labels) == range(5)
+    assert graph.startblock.operations[0].opname == 'instrument_count'
+    check_graph(graph, [250], 270, t)
+
+def test_instrument_after_other_counters():
+    graph, t = get_graph(fn, [int])
+    BranchProfile([graph]).instrument()
+    profile = BranchProfile([graph])
+    assert profile.base == 5
+
+def test_apply():
+    graph, t = get_graph(fn, [int])
+    profile = BranchProfile([graph])
+    # the order of the branches is the order of graph.iterblocks()
+    loop, modulo = profile.branches
+    assert 'int_gt' in [op.opname for op in loop.operations]
+    assert 'int_mod' in [op.opname for op in modulo.operations]
+    counters = [1,         # calls
+                1, 250,    # 'n > 0': False, True
+                248, 2]    # 'n % 100 == 0': False, True
+    profile.apply(counters)
+    assert graph.hotness == 'hot'
+    assert summary(graph)['expect'] == 2
+    assert loop.operations[-1].opname == 'expect'
+    assert loop.operations[-1].args[1].value == True
+    assert loop.exitswitch is loop.operations[-1].result
+    assert modulo.operations[-1].args[1].value == False
+    check_graph(graph, [250], 270, t)
+
+def test_apply_not_enough_data():
+    graph, t = get_graph(fn, [int])
+    profile = BranchProfile([graph])
+    profile.apply([0, 0, 0])    # a shorter file: the rest counts as 0
+    assert graph.hotness == 'cold'
+    assert 'expect' not in summary(graph)
+    #
+    graph, t = get_graph(fn, [int])
+    profile = BranchProfile([graph])
+    profile.apply([1, 1, 50, 30, 20])     # too few, and not biased
+    assert graph.hotness == 'hot'
+    assert 'expect' not in summary(graph)
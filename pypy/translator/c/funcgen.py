@@ -777,7 +777,7 @@ class FunctionCodeGenerator(object):
             argv.append(self.expr(arg))
         argv.insert(0, c_string_constant(' '.join(format) + '\n'))
         return (
-            "if (PYPY_HAVE_DEBUG_PRINTS) { fprintf(PYPY_DEBUG_FILE, %s); %s}"
+            "if (PYPY_HAVE_DEBUG_PRINTS) { PYPY_DEBUG_PRINTF(%s); %s}"
             % (', '.join(argv), free_line))
 
     def _op_debug(self, opname, arg):
@@ -247,6 +247,8 @@ class CBuilder(object):
             if CBuilder.have___thread:
                 if not self.config.translation.no__thread:
                     defines['USE___THREAD'] = 1
+            if self.config.translation.obmalloc_tcache:
+                defines['WITH_PYMALLOC_TCACHE'] = 1
             if self.config.translation.shared:
                 defines['PYPY_MAIN_FUNCTION'] = "pypy_main_startup"
                 self.eci = self.eci.merge(ExternalCompilationInfo(
@@ -510,8 +512,20 @@ class CStandaloneBuilder(CBuilder):
                 purebasename='lib' + self.executable_name.purebasename,
                 ext=self.translator.platform.so_ext)
         self._compiled = True
+        if self.config.translation.instrumentctl is not None:
+            self.run_instrumented()
         return self.executable_name
 
+    def run_instrumented(self):
+        # we are the process forked by TranslationDriver.instrument_result():
+        # run the training workload, which fills the counters, and exit
+        ProfDriver, args = self.config.translation.instrumentctl
+        profdrv = ProfDriver(self.translator)
+        log.profinstrument('Gathering profile data from: %s %s' % (
+            self.executable_name, args))
+        profdrv.probe(self.executable_name, args)
+        profdrv.after()
+
     def gen_makefile(self, targetdir, exe_name=None):
         cfiles = [self.c_source_filename] + self.extrafiles
         if exe_name is not None:
@@ -858,9 +858,18 @@ class FuncNode(ContainerNode):
 
     def forward_declaration(self):
         for funcgen in self.funcgens:
-            yield '%s;' % (
+            # 'hotness' is set by backendopt.profile_based_branches
+            graph = getattr(funcgen, 'graph', None)
+            hotness = getattr(graph, 'hotness', None)
+            if hotness == 'hot':
+                attribute = ' RPY_HOT'
+            elif hotness == 'cold':
+                attribute = ' RPY_COLD'
+            else:
+                attribute = ''
+            yield '%s%s;' % (
                 forward_cdecl(self.implementationtypename,
-                    funcgen.name(self.name), self.db.standalone))
+                    funcgen.name(self.name), self.db.standalone), attribute)
 
     def implementation(self):
         for funcgen in self.funcgens:
@@ -4,6 +4,11 @@ void *PyObject_Malloc(size_t n);
 void *PyObject_Realloc(void *p, size_t n);
 void PyObject_Free(void *p);
 
+/* memory statistics and trimming of obmalloc.c, see pypy.rlib.rmalloc */
+long pypy_obmalloc_trim(void);
+long pypy_obmalloc_committed(void);
+long pypy_obmalloc_used(void);
+
 
 #ifndef PYPY_NOT_MAIN_FILE
 
@@ -28,4 +33,10 @@ void PyObject_Free(void *p);
 
 #endif
 
+#if defined(TRIVIAL_MALLOC_DEBUG) || defined(LINUXMEMCHK) || defined(NO_OBMALLOC)
+  long pypy_obmalloc_trim(void) { return 0; }
+  long pypy_obmalloc_committed(void) { return 0; }
+  long pypy_obmalloc_used(void) { return 0; }
+#endif
+
 #endif
@@ -1,8 +1,11 @@
 /* This optional file only works for GCC on an x86-64.
  */
 
+/* The lfence keeps rdtsc from running before the previous instructions
+   have completed, which would attribute part of their time to the next
+   section of PYPYLOG.  It is part of SSE2, so always present here. */
 #define READ_TIMESTAMP(val) do {                        \
     Unsigned _rax, _rdx;                           \
-    asm volatile("rdtsc" : "=a"(_rax), "=d"(_rdx)); \
+    asm volatile("lfence\n\trdtsc" : "=a"(_rax), "=d"(_rdx) : : "memory"); \
     val = (_rdx << 32) | _rax;                          \
 } while (0)
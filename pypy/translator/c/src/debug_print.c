@@ -13,6 +13,7 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #endif
+#include <stdarg.h>
 #include "common_header.h"
 #include "src/profiling.h"
 #include "src/debug_print.h"
@@ -21,11 +22,677 @@ long pypy_have_debug_prints = -1;
 FILE *pypy_debug_file = NULL;
 static unsigned char debug_ready = 0;
 static unsigned char debug_profile = 0;
+static unsigned char debug_binary = 0;
 static char *debug_start_colors_1 = "";
 static char *debug_start_colors_2 = "";
 static char *debug_stop_colors = "";
 static char *debug_prefix = NULL;
 
+
+/* The binary format, for PYPYLOG=bin:...  The file starts with the 8
+   bytes "PYPYLOG\1" and then contains records, each starting with a
+   byte, and using LEB128 varints for numbers:
+
+      'D' id length name        define the category number 'id'
+      'C' thread length events  a chunk of events logged by a thread
+      'K' count length names    the names of the PYPYLOG_COUNTERS
+      'I' 0 length layout       the layout of pypy_setup_profiling()
+
+   The events in a chunk are:
+
+      DEBUG_BIN_START id timestamp     debug_start of a known category
+      DEBUG_BIN_STOP  id timestamp     debug_stop of a known category
+      DEBUG_BIN_START_NAME length name timestamp    same, for a category
+      DEBUG_BIN_STOP_NAME  length name timestamp    that has no id
+      DEBUG_BIN_TEXT  length text      output of debug_print()
+      DEBUG_BIN_COUNTERS count values  the counters, after a start or stop
+
+   The timestamps are the raw values of READ_TIMESTAMP, as 8 bytes in
+   little-endian order.  Each thread logs into its own buffer, which is
+   written out as a chunk when it is full, when the thread exits, at
+   exit or on debug_flush().  The chunks of a thread are in order, but
+   chunks of different threads are interleaved arbitrarily.  See
+   pypy/tool/logparser.py for a decoder.
+*/
+#define DEBUG_BIN_MAGIC           "PYPYLOG\1"
+#define DEBUG_BIN_START           1
+#define DEBUG_BIN_STOP            2
+#define DEBUG_BIN_START_NAME      3
+#define DEBUG_BIN_STOP_NAME       4
+#define DEBUG_BIN_TEXT            5
+#define DEBUG_BIN_COUNTERS        6     /* see PYPYLOG_COUNTERS below */
+
+#define DEBUG_BUFFER_SIZE         65536
+#define DEBUG_BUFFER_CACHE        256    /* entries in the category cache */
+#define DEBUG_MAX_CATEGORIES      4096
+#define DEBUG_CATEGORY_HASH       8192   /* must be a power of 2 */
+#define DEBUG_MAX_RECORD          80     /* size of a record, excluding
+                                            the name or the text */
+#define DEBUG_MAX_COUNTERS        4
+
+/* This needs __thread and pthreads; otherwise there is a single buffer,
+   and we rely on the GIL. */
+#if defined(USE___THREAD) && !defined(_WIN32)
+#  include <pthread.h>
+#  define DEBUG_THREADS
+#  define DEBUG_TLS                __thread
+#  define DEBUG_LOCK()             pthread_mutex_lock(&debug_lock)
+#  define DEBUG_UNLOCK()           pthread_mutex_unlock(&debug_lock)
+#  define DEBUG_BUF_LOCK(buf)      pthread_mutex_lock(&(buf)->lock)
+#  define DEBUG_BUF_UNLOCK(buf)    pthread_mutex_unlock(&(buf)->lock)
+#  define DEBUG_BUF_TRYLOCK(buf)   (pthread_mutex_trylock(&(buf)->lock) == 0)
+static pthread_mutex_t debug_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t debug_buffer_key;
+#else
+#  define DEBUG_TLS                /* nothing */
+#  define DEBUG_LOCK()             /* nothing */
+#  define DEBUG_UNLOCK()           /* nothing */
+#  define DEBUG_BUF_LOCK(buf)      /* nothing */
+#  define DEBUG_BUF_UNLOCK(buf)    /* nothing */
+#  define DEBUG_BUF_TRYLOCK(buf)   1
+#endif
+
+/* The owner of a buffer holds its lock while it appends to it or
+   flushes it, so that debug_binary_flush_all() can flush the buffers of
+   the other threads at exit.  The lock order is: the lock of a buffer,
+   then DEBUG_LOCK. */
+
+struct debug_buffer {
+  struct debug_buffer *prev, *next;    /* all buffers, protected by lock */
+  long thread;                         /* numbered from 1 */
+  long count;
+#ifdef DEBUG_THREADS
+  pthread_mutex_t lock;
+#endif
+  const char *cache_key[DEBUG_BUFFER_CACHE];   /* category -> id */
+  long cache_id[DEBUG_BUFFER_CACHE];
+  unsigned char data[DEBUG_BUFFER_SIZE];
+};
+
+static DEBUG_TLS struct debug_buffer *debug_my_buffer = NULL;
+static DEBUG_TLS long debug_my_thread = 0;  /* kept across its buffers */
+static int debug_num_counters = 0;
+static void debug_counters_close(void);
+static struct debug_buffer debug_all_buffers;  /* head of the list */
+static long debug_num_threads = 0;
+static int debug_exited = 0;     /* set by debug_binary_flush_all() */
+
+/* the interned categories, protected by lock.  An entry of
+   'debug_categories' is never changed after its id is published. */
+static const char *debug_categories[DEBUG_MAX_CATEGORIES + 1];
+static long debug_num_categories = 0;
+static long debug_category_hash[DEBUG_CATEGORY_HASH];
+
+static unsigned char *debug_put_varint(unsigned char *p, unsigned long n)
+{
+  while (n >= 0x80)
+    {
+      *p++ = (unsigned char)(n | 0x80);
+      n >>= 7;
+    }
+  *p++ = (unsigned char)n;
+  return p;
+}
+
+static unsigned char *debug_put_timestamp(unsigned char *p, long long ts)
+{
+  int i;
+  unsigned long long n = (unsigned long long)ts;
+  for (i = 0; i < 8; i++)
+    {
+      *p++ = (unsigned char)n;
+      n >>= 8;
+    }
+  return p;
+}
+
+/* write a record directly to the file, with the data in two parts;
+   must hold the lock */
+static void debug_write_record2(char kind, unsigned long number,
+                                const void *data1, unsigned long length1,
+                                const void *data2, unsigned long length2)
+{
+  unsigned char header[DEBUG_MAX_RECORD], *p = header;
+  if (debug_exited)
+    return;       /* the log is finished; drop late events of threads */
+  *p++ = kind;
+  p = debug_put_varint(p, number);
+  p = debug_put_varint(p, length1 + length2);
+  fwrite(header, 1, p - header, pypy_debug_file);
+  fwrite(data1, 1, length1, pypy_debug_file);
+  fwrite(data2, 1, length2, pypy_debug_file);
+}
+
+static void debug_write_record(char kind, unsigned long number,
+                               const void *data, unsigned long length)
+{
+  debug_write_record2(kind, number, data, length, NULL, 0);
+}
+
+/* must hold the lock of 'buf' */
+static void debug_buffer_flush(struct debug_buffer *buf)
+{
+  if (buf->count > 0)
+    {
+      DEBUG_LOCK();
+      debug_write_record('C', buf->thread, buf->data, buf->count);
+      DEBUG_UNLOCK();
+      buf->count = 0;
+    }
+}
+
+/* atexit handler.  The other threads may still be running: a buffer
+   whose owner is in the middle of logging an event is dropped, and all
+   the events logged after this point are dropped too. */
+static void debug_binary_flush_all(void)
+{
+  struct debug_buffer *buf, *mine = debug_my_buffer;
+  if (mine != NULL)
+    {
+      DEBUG_BUF_LOCK(mine);
+      debug_buffer_flush(mine);
+      DEBUG_BUF_UNLOCK(mine);
+    }
+  DEBUG_LOCK();
+  for (buf = debug_all_buffers.next; buf != &debug_all_buffers;
+       buf = buf->next)
+    {
+      if (buf == mine || !DEBUG_BUF_TRYLOCK(buf))
+        continue;
+      if (buf->count > 0)
+        debug_write_record('C', buf->thread, buf->data, buf->count);
+      buf->count = 0;
+      DEBUG_BUF_UNLOCK(buf);
+    }
+  debug_exited = 1;
+  fflush(pypy_debug_file);
+  DEBUG_UNLOCK();
+}
+
+#ifdef DEBUG_THREADS
+/* pthread_key destructor: log the last events of an exiting thread.
+   A destructor running after this one may still log events: then
+   debug_get_buffer() makes a new buffer and registers it again, and
+   this destructor is called again for it. */
+static void debug_buffer_thread_exit(void *arg)
+{
+  struct debug_buffer *buf = arg;
+  debug_my_buffer = NULL;
+  DEBUG_BUF_LOCK(buf);
+  debug_buffer_flush(buf);
+  DEBUG_BUF_UNLOCK(buf);
+  DEBUG_LOCK();
+  buf->prev->next = buf->next;
+  buf->next->prev = buf->prev;
+  DEBUG_UNLOCK();
+  pthread_mutex_destroy(&buf->lock);
+  free(buf);
+}
+
+/* Don't let a fork() in another thread copy a held lock into the child,
+   don't let the child write again the events that the parent did not
+   write yet, and don't let it read the counters of the parent. */
+static void debug_atfork_lock(void)
+{
+  DEBUG_LOCK();
+}
+
+static void debug_atfork_unlock(void)
+{
+  DEBUG_UNLOCK();
+}
+
+static void debug_atfork_child(void)
+{
+  struct debug_buffer *buf;
+  /* the counters opened by the parent still count the parent's thread */
+  debug_counters_close();
+  if (debug_binary)
+    for (buf = debug_all_buffers.next; buf != &debug_all_buffers;
+         buf = buf->next)
+      buf->count = 0;
+  DEBUG_UNLOCK();
+}
+#endif
+
+static void debug_binary_open(void)
+{
+  debug_all_buffers.prev = debug_all_buffers.next = &debug_all_buffers;
+  fwrite(DEBUG_BIN_MAGIC, 1, 8, pypy_debug_file);
+#ifdef DEBUG_THREADS
+  pthread_key_create(&debug_buffer_key, debug_buffer_thread_exit);
+#endif
+  atexit(debug_binary_flush_all);
+}
+
+static struct debug_buffer *debug_get_buffer(void)
+{
+  struct debug_buffer *buf = debug_my_buffer;
+  if (buf == NULL)
+    {
+      buf = calloc(1, sizeof(struct debug_buffer));
+      if (buf == NULL)
+        {
+          fprintf(stderr, "PYPYLOG: out of memory\n");
+          abort();
+        }
+#ifdef DEBUG_THREADS
+      pthread_mutex_init(&buf->lock, NULL);
+#endif
+      DEBUG_LOCK();
+      if (debug_my_thread == 0)
+        debug_my_thread = ++debug_num_threads;
+      buf->thread = debug_my_thread;
+      buf->next = &debug_all_buffers;
+      buf->prev = debug_all_buffers.prev;
+      buf->prev->next = buf;
+      debug_all_buffers.prev = buf;
+      DEBUG_UNLOCK();
+#ifdef DEBUG_THREADS
+      pthread_setspecific(debug_buffer_key, buf);
+#endif
+      debug_my_buffer = buf;
+    }
+  return buf;
+}
+
+/* Returns a pointer to 'size' free bytes in the buffer of the thread;
+   must hold the lock of 'buf' */
+static unsigned char *debug_reserve(struct debug_buffer *buf, long size)
+{
+  if (buf->count + size > DEBUG_BUFFER_SIZE)
+    debug_buffer_flush(buf);
+  return buf->data + buf->count;
+}
+
+/* Returns the id of 'category', or 0 if there are too many categories */
+static long debug_category_id(struct debug_buffer *buf, const char *category)
+{
+  /* the 'category' strings are usually constants, so first look it up
+     by address; but check the content too, because non-constant strings
+     can reuse the address of another one */
+  unsigned long h = ((unsigned long)category) >> 3;
+  unsigned long i;
+  long id;
+  h = (h ^ (h >> 8)) % DEBUG_BUFFER_CACHE;
+  if (buf->cache_key[h] == category)
+    {
+      id = buf->cache_id[h];
+      if (strcmp(debug_categories[id], category) == 0)
+        return id;
+    }
+  /* slow path: look it up or add it in the global table */
+  i = 5381;
+  for (id = 0; category[id]; id++)
+    i = i * 33 + (unsigned char)category[id];
+  DEBUG_LOCK();
+  while (1)
+    {
+      i &= DEBUG_CATEGORY_HASH - 1;
+      id = debug_category_hash[i];
+      if (id == 0 || strcmp(debug_categories[id], category) == 0)
+        break;
+      i++;
+    }
+  if (id == 0 && debug_num_categories < DEBUG_MAX_CATEGORIES)
+    {
+      char *name = strdup(category);
+      if (name != NULL)
+        {
+          id = ++debug_num_categories;
+          debug_categories[id] = name;
+          debug_category_hash[i] = id;
+          debug_write_record('D', id, name, strlen(name));
+        }
+    }
+  DEBUG_UNLOCK();
+  if (id != 0)
+    {
+      buf->cache_key[h] = category;
+      buf->cache_id[h] = id;
+    }
+  return id;
+}
+
+static void debug_binary_startstop(int kind, const char *category,
+                                   long long timestamp,
+                                   const unsigned long long *counters)
+{
+  struct debug_buffer *buf = debug_get_buffer();
+  long id = debug_category_id(buf, category);
+  unsigned char *p;
+  DEBUG_BUF_LOCK(buf);
+  if (id != 0)
+    {
+      p = debug_reserve(buf, DEBUG_MAX_RECORD);
+      *p++ = kind;
+      p = debug_put_varint(p, id);
+    }
+  else
+    {
+      size_t length = strlen(category);
+      if (length > DEBUG_BUFFER_SIZE - DEBUG_MAX_RECORD)
+        length = DEBUG_BUFFER_SIZE - DEBUG_MAX_RECORD;
+      p = debug_reserve(buf, DEBUG_MAX_RECORD + length);
+      *p++ = kind + (DEBUG_BIN_START_NAME - DEBUG_BIN_START);
+      p = debug_put_varint(p, length);
+      memcpy(p, category, length);
+      p += length;
+    }
+  p = debug_put_timestamp(p, timestamp);
+  if (debug_num_counters > 0)
+    {
+      int i;
+      *p++ = DEBUG_BIN_COUNTERS;
+      p = debug_put_varint(p, debug_num_counters);
+      for (i = 0; i < debug_num_counters; i++)
+        p = debug_put_varint(p, counters[i]);
+    }
+  buf->count = p - buf->data;
+  DEBUG_BUF_UNLOCK(buf);
+}
+
+static void debug_binary_print(const char *format, va_list ap)
+{
+  struct debug_buffer *buf = debug_get_buffer();
+  char small[1024], *text = small;
+  unsigned char *p;
+  va_list ap2;
+  int length;
+  va_copy(ap2, ap);
+  length = vsnprintf(small, sizeof(small), format, ap);
+  if (length < 0)
+    length = 0;
+  else if (length >= sizeof(small))
+    {
+      text = malloc(length + 1);
+      if (text != NULL)
+        vsnprintf(text, length + 1, format, ap2);
+      else
+        {
+          text = small;     /* out of memory: truncate it */
+          length = sizeof(small) - 1;
+        }
+    }
+  va_end(ap2);
+  DEBUG_BUF_LOCK(buf);
+  if (length > DEBUG_BUFFER_SIZE - DEBUG_MAX_RECORD)
+    {
+      /* too big for the buffer: write it as a chunk of its own */
+      unsigned char header[DEBUG_MAX_RECORD], *q = header;
+      debug_buffer_flush(buf);
+      *q++ = DEBUG_BIN_TEXT;
+      q = debug_put_varint(q, length);
+      DEBUG_LOCK();
+      debug_write_record2('C', buf->thread, header, q - header,
+                          text, length);
+      DEBUG_UNLOCK();
+    }
+  else
+    {
+      p = debug_reserve(buf, DEBUG_MAX_RECORD + length);
+      *p++ = DEBUG_BIN_TEXT;
+      p = debug_put_varint(p, length);
+      memcpy(p, text, length);
+      buf->count = (p + length) - buf->data;
+    }
+  DEBUG_BUF_UNLOCK(buf);
+  if (text != small)
+    free(text);
+}
+
+static void debug_binary_flush_mine(void)
+{
+  struct debug_buffer *buf = debug_my_buffer;
+  if (buf != NULL)
+    {
+      DEBUG_BUF_LOCK(buf);
+      debug_buffer_flush(buf);
+      DEBUG_BUF_UNLOCK(buf);
+    }
+}
+
+/* Hardware counters, for PYPYLOG_COUNTERS=name1,name2,...  (Linux only)
+   Each thread opens its own perf_event counters the first time that it
+   logs a debug_start or debug_stop, and their values are logged with the
+   timestamp.  When the kernel allows it (cap_user_rdpmc), a counter is
+   read from user space with the rdpmc instruction, using the page that
+   perf_event mmap()s to get the index and offset of the counter; else
+   it is read with read(), which is a system call.  In the text format,
+   the values follow the category as " #value1,value2..." in hex, and the
+   names are given by a first line "PYPYLOG counters: name1,name2...".
+   In the binary format, they are the varints of a DEBUG_BIN_COUNTERS
+   event, which follows the start or stop event.
+*/
+#if defined(__linux__) && defined(DEBUG_THREADS)
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#  include <sys/mman.h>
+#  ifdef __NR_perf_event_open
+#    define DEBUG_COUNTERS
+#  endif
+#endif
+
+#ifdef DEBUG_COUNTERS
+static const struct {
+  const char *name;
+  unsigned int type;
+  unsigned long long config;
+} debug_counter_kinds[] = {
+  { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+  { "cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "branches",         PERF_TYPE_HARDWARE,
+                        PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+  { "branch-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "task-clock",       PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+  { "page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+  { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+  { NULL, 0, 0 }
+};
+
+static int debug_counter_kind[DEBUG_MAX_COUNTERS];
+static char debug_counter_names[256];
+
+struct debug_counters {
+  int ready;          /* 0: not opened yet, 1: opened, -1: failed */
+  int fd[DEBUG_MAX_COUNTERS];
+  struct perf_event_mmap_page *page[DEBUG_MAX_COUNTERS];
+};
+static DEBUG_TLS struct debug_counters debug_my_counters;
+static pthread_key_t debug_counters_key;   /* closes them at thread exit */
+
+/* Parses PYPYLOG_COUNTERS; returns 0 if it is invalid. */
+static int debug_counters_setup(const char *spec)
+{
+  const char *p = spec;
+  size_t length;
+  int k;
+  while (*p)
+    {
+      length = strcspn(p, ",");
+      for (k = 0; debug_counter_kinds[k].name != NULL; k++)
+        if (strlen(debug_counter_kinds[k].name) == length &&
+            strncmp(debug_counter_kinds[k].name, p, length) == 0)
+          break;
+      if (debug_counter_kinds[k].name == NULL ||
+          debug_num_counters == DEBUG_MAX_COUNTERS)
+        {
+          fprintf(stderr, "PYPYLOG_COUNTERS: unknown counter '%.*s', "
+                  "or more than %d counters\n", (int)length, p,
+                  DEBUG_MAX_COUNTERS);
+          debug_num_counters = 0;
+          return 0;
+        }
+      debug_counter_kind[debug_num_counters++] = k;
+      p += length;
+      if (*p == ',')
+        p++;
+    }
+  debug_counter_names[0] = '\0';
+  for (k = 0; k < debug_num_counters; k++)
+    {
+      if (k > 0)
+        strcat(debug_counter_names, ",");
+      strcat(debug_counter_names,
+             debug_counter_kinds[debug_counter_kind[k]].name);
+    }
+  return debug_num_counters > 0;
+}
+
+static int debug_counters_open(struct debug_counters *c)
+{
+  struct perf_event_attr attr;
+  int i, group = -1;
+  for (i = 0; i < debug_num_counters; i++)
+    {
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = debug_counter_kinds[debug_counter_kind[i]].type;
+      attr.config = debug_counter_kinds[debug_counter_kind[i]].config;
+      attr.exclude_kernel = 1;    /* allowed with perf_event_paranoid=2 */
+      attr.exclude_hv = 1;
+      c->fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+      if (c->fd[i] < 0)
+        {
+          static int warned = 0;
+          if (!warned)
+            fprintf(stderr, "PYPYLOG_COUNTERS: cannot open '%s': %s\n",
+                    debug_counter_kinds[debug_counter_kind[i]].name,
+                    strerror(errno));
+          warned = 1;
+          while (--i >= 0)
+            {
+              if (c->page[i] != NULL)
+                munmap(c->page[i], sysconf(_SC_PAGESIZE));
+              close(c->fd[i]);
+            }
+          return -1;
+        }
+      if (group == -1)
+        group = c->fd[i];     /* schedule all the counters together */
+      c->page[i] = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                        c->fd[i], 0);
+      if (c->page[i] == MAP_FAILED)
+        c->page[i] = NULL;    /* use read() */
+    }
+  return 1;
+}
+
+static unsigned long long debug_counter_read(struct debug_counters *c,
+                                             int i)
+{
+  struct perf_event_mmap_page *pc = c->page[i];
+  unsigned long long value = 0;
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+  if (pc != NULL)
+    {
+      unsigned int seq, index, low, high;
+      long long count, pmc;
+      int width;
+      do
+        {
+          seq = pc->lock;
+          asm volatile("" : : : "memory");
+          index = pc->index;
+          count = pc->offset;
+          if (!(pc->cap_user_rdpmc && index != 0))
+            break;
+          width = pc->pmc_width;
+          asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(index - 1));
+          pmc = ((long long)high << 32) | low;
+          pmc <<= 64 - width;            /* sign-extend the 'width' bits */
+          pmc >>= 64 - width;
+          asm volatile("" : : : "memory");
+          if (pc->lock == seq)
+            return (unsigned long long)(count + pmc);
+        }
+      while (1);
+    }
+#endif
+  if (read(c->fd[i], &value, sizeof(value)) != sizeof(value))
+    value = 0;
+  return value;
+}
+
+/* Reads the counters of the current thread into 'values'; returns the
+   number of values. */
+static int debug_read_counters(unsigned long long *values)
+{
+  struct debug_counters *c = &debug_my_counters;
+  int i;
+  if (c->ready == 0)
+    {
+      c->ready = debug_counters_open(c);
+      pthread_setspecific(debug_counters_key, c);
+    }
+  if (c->ready < 0)
+    {
+      for (i = 0; i < debug_num_counters; i++)
+        values[i] = 0;
+    }
+  else
+    {
+      for (i = 0; i < debug_num_counters; i++)
+        values[i] = debug_counter_read(c, i);
+    }
+  return debug_num_counters;
+}
+
+static void debug_counters_close(void)
+{
+  struct debug_counters *c = &debug_my_counters;
+  int i;
+  if (c->ready > 0)
+    for (i = 0; i < debug_num_counters; i++)
+      {
+        if (c->page[i] != NULL)
+          munmap(c->page[i], sysconf(_SC_PAGESIZE));
+        close(c->fd[i]);
+      }
+  c->ready = 0;
+}
+
+/* pthread_key destructor */
+static void debug_counters_thread_exit(void *arg)
+{
+  debug_counters_close();
+}
+
+/* Called when the log is opened: parse PYPYLOG_COUNTERS, check that the
+   counters can be opened, and write their names to the log. */
+static void debug_counters_start(void)
+{
+  char *spec = getenv("PYPYLOG_COUNTERS");
+  if (spec == NULL || spec[0] == '\0' || !debug_counters_setup(spec))
+    return;
+  debug_my_counters.ready = debug_counters_open(&debug_my_counters);
+  if (debug_my_counters.ready < 0)
+    {
+      debug_num_counters = 0;
+      return;
+    }
+  pthread_key_create(&debug_counters_key, debug_counters_thread_exit);
+  pthread_setspecific(debug_counters_key, &debug_my_counters);
+  if (debug_binary)
+    {
+      DEBUG_LOCK();
+      debug_write_record('K', debug_num_counters, debug_counter_names,
+                         strlen(debug_counter_names));
+      DEBUG_UNLOCK();
+    }
+  else
+    fprintf(pypy_debug_file, "PYPYLOG counters: %s\n", debug_counter_names);
+}
+
+#else
+
+static void debug_counters_close(void) { }
+
+#endif   /* DEBUG_COUNTERS */
+
+
 static void pypy_debug_open(void)
 {
   char *filename = getenv("PYPYLOG");
@@ -37,7 +704,14 @@ static void pypy_debug_open(void)
 #endif
   if (filename && filename[0])
     {
-      char *colon = strchr(filename, ':');
+      char *colon;
+      if (strncmp(filename, "bin:", 4) == 0)
+        {
+          /* PYPYLOG=bin:... --- same as '...', in the binary format */
+          debug_binary = 1;
+          filename += 4;
+        }
+      colon = strchr(filename, ':');
       if (!colon)
         {
           /* PYPYLOG=filename --- profiling version */
@@ -59,19 +733,44 @@ static void pypy_debug_open(void)
   if (!pypy_debug_file)
     {
       pypy_debug_file = stderr;
-      if (isatty(2))
+      if (isatty(2) && !debug_binary)
         {
           debug_start_colors_1 = "\033[1m\033[31m";
           debug_start_colors_2 = "\033[31m";
           debug_stop_colors = "\033[0m";
         }
     }
+  if (debug_binary)
+    debug_binary_open();
+  if (debug_profile && pypy_profiling_layout()[0])
+    {
+      /* report the cpus and options chosen by pypy_setup_profiling() */
+      const char *layout = pypy_profiling_layout();
+      if (debug_binary)
+        {
+          DEBUG_LOCK();
+          debug_write_record('I', 0, layout, strlen(layout));
+          DEBUG_UNLOCK();
+        }
+      else
+        fprintf(pypy_debug_file, "PYPYLOG isolation: %s\n", layout);
+    }
+#ifdef DEBUG_COUNTERS
+  if (filename && filename[0])
+    debug_counters_start();
+#endif
+#ifdef DEBUG_THREADS
+  /* see debug_atfork_child() */
+  if (debug_binary || debug_num_counters > 0)
+    pthread_atfork(debug_atfork_lock, debug_atfork_unlock,
+                   debug_atfork_child);
+#endif
   debug_ready = 1;
 }
 
 long pypy_debug_offset(void)
 {
-  if (!debug_ready)
+  if (!debug_ready || debug_binary)
     return -1;
   // note that we deliberately ignore errno, since -1 is fine
   // in case this is not a real file
@@ -84,6 +783,24 @@ void pypy_debug_ensure_opened(void)
     pypy_debug_open();
 }
 
+void pypy_debug_flush(void)
+{
+  if (debug_binary)
+    debug_binary_flush_mine();
+  fflush(pypy_debug_file);
+}
+
+void pypy_debug_printf(const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  if (!debug_binary)
+    vfprintf(pypy_debug_file, format, ap);
+  else
+    debug_binary_print(format, ap);
+  va_end(ap);
+}
+
 
 #ifndef _WIN32
 
@@ -131,10 +848,29 @@ static void display_startstop(const char *prefix, const char *postfix,
                               const char *category, const char *colors)
 {
   long long timestamp;
+  unsigned long long counters[DEBUG_MAX_COUNTERS];
+  char text[DEBUG_MAX_COUNTERS * 20 + 4];
+  int i;
   READ_TIMESTAMP(timestamp);
-  fprintf(pypy_debug_file, "%s[%"PYPY_LONG_LONG_PRINTF_FORMAT"x] %s%s%s\n%s",
+#ifdef DEBUG_COUNTERS
+  if (debug_num_counters > 0)
+    debug_read_counters(counters);
+#endif
+  if (debug_binary)
+    {
+      debug_binary_startstop(prefix[0] == '{' ? DEBUG_BIN_START
+                                              : DEBUG_BIN_STOP,
+                             category, timestamp, counters);
+      return;
+    }
+  text[0] = '\0';
+  for (i = 0; i < debug_num_counters; i++)
+    sprintf(text + strlen(text), "%s%"PYPY_LONG_LONG_PRINTF_FORMAT"x",
+            i == 0 ? " #" : ",", counters[i]);
+  fprintf(pypy_debug_file,
+          "%s[%"PYPY_LONG_LONG_PRINTF_FORMAT"x] %s%s%s%s\n%s",
           colors,
-          timestamp, prefix, category, postfix,
+          timestamp, prefix, category, postfix, text,
           debug_stop_colors);
 }
 
@@ -7,10 +7,14 @@
    (empty)        logging is turned off, apart from top-level debug_prints
                      that go to stderr
    fname          logging for profiling: includes all debug_start/debug_stop
-                     but not any nested debug_print
+                     but not any nested debug_print; the threads are also
+                     pinned to cpus, see PYPYLOG_CPUS and PYPYLOG_ISOLATE
+                     in profiling.c
    :fname         full logging
    prefix:fname   conditional logging
    prefix1,prefix2:fname   conditional logging with multiple selections
+   bin:...        any of the above, but in a compact binary format, with
+                     a buffer per thread (see debug_print.c)
 
    Conditional logging means that it only includes the debug_start/debug_stop
    sections whose name match 'prefix'.  Other sections are ignored, including
@@ -18,17 +22,22 @@
    subsections.
 
    Note that 'fname' can be '-' to send the logging data to stderr.
+
+   If PYPYLOG_COUNTERS is set too, e.g. to 'cycles,instructions', the
+   perf_event counters of the thread are logged with each debug_start and
+   debug_stop (Linux only, see debug_print.c).
 */
 
 /* macros used by the generated code */
 #define PYPY_HAVE_DEBUG_PRINTS    (pypy_have_debug_prints & 1 ? \
                                    (pypy_debug_ensure_opened(), 1) : 0)
 #define PYPY_DEBUG_FILE           pypy_debug_file
+#define PYPY_DEBUG_PRINTF         pypy_debug_printf
 #define PYPY_DEBUG_START(cat)     pypy_debug_start(cat)
 #define PYPY_DEBUG_STOP(cat)      pypy_debug_stop(cat)
 #define OP_DEBUG_OFFSET(res)      res = pypy_debug_offset()
 #define OP_HAVE_DEBUG_PRINTS(r)   r = (pypy_have_debug_prints & 1)
-#define OP_DEBUG_FLUSH() fflush(pypy_debug_file)
+#define OP_DEBUG_FLUSH()          pypy_debug_flush()
 
 /************************************************************/
 
@@ -37,6 +46,12 @@ void pypy_debug_ensure_opened(void);
 void pypy_debug_start(const char *category);
 void pypy_debug_stop(const char *category);
 long pypy_debug_offset(void);
+void pypy_debug_flush(void);
+void pypy_debug_printf(const char *format, ...)
+#ifdef __GNUC__
+     __attribute__((format(printf, 1, 2)))   /* check the generated calls */
+#endif
+     ;
 
 extern long pypy_have_debug_prints;
 extern FILE *pypy_debug_file;
@@ -53,6 +53,16 @@
 #ifdef PYPY_STANDALONE
 #  include "src/allocator.h"
 #  include "src/main.h"
+#else
+/* not using obmalloc.c: the stubs of pypy.rlib.rmalloc */
+long pypy_obmalloc_trim(void);
+long pypy_obmalloc_committed(void);
+long pypy_obmalloc_used(void);
+#  ifndef PYPY_NOT_MAIN_FILE
+long pypy_obmalloc_trim(void) { return 0; }
+long pypy_obmalloc_committed(void) { return 0; }
+long pypy_obmalloc_used(void) { return 0; }
+#  endif
 #endif
 
 /* suppress a few warnings in the generated code */
@@ -23,5 +23,16 @@ typedef _Bool bool_t;
 typedef unsigned char bool_t;
 #endif
 
+/* hints from backendopt.profile_based_branches, see branchprofile.py */
+#ifdef __GNUC__
+#  define RPY_EXPECT(x, expected)  __builtin_expect((x), (expected))
+#  define RPY_HOT                  __attribute__((hot))
+#  define RPY_COLD                 __attribute__((cold))
+#else
+#  define RPY_EXPECT(x, expected)  (x)
+#  define RPY_HOT                  /* nothing */
+#  define RPY_COLD                 /* nothing */
+#endif
+
 
 #include "src/align.h"
@@ -0,0 +1,150 @@
+/************************** GC telemetry ring buffer **************************
+ *
+ * See gctelemetry.h.  The file is created and mapped like the counters
+ * of instrument.h.  There is a single writer, the thread doing the
+ * collection, so writing a record only needs memory barriers to make
+ * sure that a reader sees the sequence number change after the rest.
+ */
+
+#include "src/gctelemetry.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef _WIN32
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  include <time.h>
+#else
+#  include <windows.h>
+#  include <io.h>
+#  include <process.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   /* x86 does not reorder stores with other stores */
+#  define PYPY_GCTEL_BARRIER()  asm volatile("" : : : "memory")
+#elif defined(__GNUC__)
+#  define PYPY_GCTEL_BARRIER()  __sync_synchronize()
+#elif defined(_MSC_VER)
+#  define PYPY_GCTEL_BARRIER()  MemoryBarrier()
+#endif
+
+#define PYPY_GCTEL_SIZE  (sizeof(long) * (PYPY_GCTEL_HEADER_WORDS +       \
+                          PYPY_GCTEL_CAPACITY * PYPY_GCTEL_RECORD_WORDS))
+
+static volatile long *pypy_gctel_header = NULL;
+static volatile long *pypy_gctel_records;
+
+
+static long pypy_gctel_clock_frequency(void)
+{
+#ifndef _WIN32
+    if (sizeof(long) < 8)
+        return 1000000L;     /* microseconds, to wrap around less often */
+    return 1000000000L;      /* nanoseconds */
+#else
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return (long)freq.QuadPart;
+#endif
+}
+
+static long pypy_gctel_timestamp(void)
+{
+#ifndef _WIN32
+    /* CLOCK_MONOTONIC is read without a system call on Linux (vDSO) */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (sizeof(long) < 8)
+        return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+#else
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (long)counter.QuadPart;
+#endif
+}
+
+long pypy_gctel_open(void)
+{
+    char *fname = getenv("PYPY_GC_TELEMETRY");
+    int fd;
+    void *buf;
+    size_t sz = PYPY_GCTEL_SIZE;
+#ifndef _WIN32
+    ssize_t res;
+#else
+    int res;
+    HANDLE map_handle;
+    HANDLE file_handle;
+#endif
+    if (fname == NULL || fname[0] == '\0')
+        return 0;
+    fd = open(fname, O_CREAT|O_TRUNC|O_RDWR, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "PYPY_GC_TELEMETRY: cannot open '%s'\n", fname);
+        return 0;
+    }
+    lseek(fd, sz-1, SEEK_SET);
+    res = write(fd, "", 1);
+    if (res != 1) {
+        /* the file is too short; touching the mapping would crash */
+        fprintf(stderr, "PYPY_GC_TELEMETRY: cannot extend '%s'\n", fname);
+        close(fd);
+        return 0;
+    }
+#ifndef _WIN32
+    buf = mmap(NULL, sz, PROT_WRITE|PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        fprintf(stderr, "PYPY_GC_TELEMETRY: mapping '%s' failed\n", fname);
+        return 0;
+    }
+#else
+    file_handle = (HANDLE)_get_osfhandle(fd);
+    map_handle = CreateFileMapping(file_handle, NULL, PAGE_READWRITE,
+                                   0, sz, "");
+    buf = MapViewOfFile(map_handle, FILE_MAP_WRITE, 0, 0, 0);
+    if (buf == 0) {
+        fprintf(stderr, "PYPY_GC_TELEMETRY: mapping '%s' failed\n", fname);
+        return 0;
+    }
+#endif
+    pypy_gctel_records = ((long *)buf) + PYPY_GCTEL_HEADER_WORDS;
+    pypy_gctel_header = (long *)buf;
+    pypy_gctel_header[1] = PYPY_GCTEL_VERSION;
+    pypy_gctel_header[2] = PYPY_GCTEL_HEADER_WORDS;
+    pypy_gctel_header[3] = PYPY_GCTEL_RECORD_WORDS;
+    pypy_gctel_header[4] = PYPY_GCTEL_CAPACITY;
+    pypy_gctel_header[5] = 0;
+    pypy_gctel_header[6] = (long)getpid();
+    pypy_gctel_header[7] = pypy_gctel_clock_frequency();
+    PYPY_GCTEL_BARRIER();
+    pypy_gctel_header[0] = PYPY_GCTEL_MAGIC;     /* the header is ready */
+    return 1;
+}
+
+void pypy_gctel_event(long kind, long value1, long value2, long value3)
+{
+    volatile long *rec;
+    long index;
+    if (pypy_gctel_header == NULL)
+        return;
+    index = pypy_gctel_header[5];
+    rec = pypy_gctel_records +
+          (index % PYPY_GCTEL_CAPACITY) * PYPY_GCTEL_RECORD_WORDS;
+    rec[0] = 0;                  /* this record is being written */
+    PYPY_GCTEL_BARRIER();
+    rec[1] = kind;
+    rec[2] = pypy_gctel_timestamp();
+    rec[3] = value1;
+    rec[4] = value2;
+    rec[5] = value3;
+    PYPY_GCTEL_BARRIER();
+    rec[0] = index + 1;
+    PYPY_GCTEL_BARRIER();
+    pypy_gctel_header[5] = index + 1;
+}
@@ -0,0 +1,41 @@
+/************************** GC telemetry ring buffer **************************/
+#ifndef _PYPY_GCTELEMETRY_H_
+#define _PYPY_GCTELEMETRY_H_
+
+/* If the environment variable PYPY_GC_TELEMETRY names a file, the GC
+ * writes a record for each of its events into a ring buffer mmap()ed
+ * from this file, in the same way as instrument.h does with the file
+ * named by _INSTRUMENT_COUNTERS.  Another process can map the same file
+ * and follow the events live; the writer never does a system call.
+ *
+ * The file contains machine words in native byte order: a header of
+ * PYPY_GCTEL_HEADER_WORDS words, followed by 'capacity' records of
+ * PYPY_GCTEL_RECORD_WORDS words each.  See pypy/tool/gctelemetry.py for
+ * a reader.
+ *
+ *   header:  magic, version, header words, record words, capacity,
+ *            number of records written so far, pid, clock ticks per second
+ *   record:  sequence number, kind, timestamp, value1, value2, value3
+ *
+ * The record number 'i' (counting from 0) is stored at the index
+ * i % capacity; its sequence number is i + 1.  The sequence number is
+ * written last, after being set to 0 while the record is being filled,
+ * so that a reader can detect records that are being overwritten.
+ */
+
+#define PYPY_GCTEL_MAGIC           0x47435445L      /* fits in 32 bits */
+#define PYPY_GCTEL_VERSION         1
+#define PYPY_GCTEL_HEADER_WORDS    8
+#define PYPY_GCTEL_RECORD_WORDS    6
+#define PYPY_GCTEL_CAPACITY        8192
+
+/* Map the file named by PYPY_GC_TELEMETRY.  Returns 1 if telemetry is
+ * enabled, 0 if it is not or if the file cannot be mapped (in this case
+ * an error is printed to stderr).
+ */
+long pypy_gctel_open(void);
+
+/* Append a record; does nothing if pypy_gctel_open() did not return 1. */
+void pypy_gctel_event(long kind, long value1, long value2, long value3);
+
+#endif
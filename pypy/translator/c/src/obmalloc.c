@@ -204,6 +204,40 @@
  * INIT, [LOCK, UNLOCK]*, FINI.
  */
 
+/*
+ * Per-thread caches (WITH_PYMALLOC_TCACHE, see --obmalloc-tcache).
+ *
+ * Every thread keeps, for each size class, a small "magazine" of free
+ * blocks in front of usedpools[].  Mallocs and frees of small blocks then
+ * only touch thread-local data.  The shared pools are only entered, under
+ * a real lock, to refill an empty magazine with TCACHE_BATCH blocks in one
+ * go, or to give back the surplus of a magazine that grew beyond
+ * TCACHE_MAX blocks.  A magazine is also emptied when its thread exits.
+ * Blocks sitting in a magazine still count as allocated in their pool.
+ *
+ * This needs __thread and pthreads; silently fall back to the plain
+ * allocator if they are not available.
+ */
+#if defined(WITH_PYMALLOC_TCACHE) && (!defined(USE___THREAD) || defined(_WIN32))
+#  undef WITH_PYMALLOC_TCACHE
+#endif
+
+#ifdef WITH_PYMALLOC_TCACHE
+
+#include <pthread.h>
+
+#define TCACHE_BATCH		16	/* blocks fetched per refill	*/
+#define TCACHE_MAX		64	/* larger magazines are trimmed */
+
+#define SIMPLELOCK_DECL(lock)	static pthread_mutex_t lock = \
+					PTHREAD_MUTEX_INITIALIZER;
+#define SIMPLELOCK_INIT(lock)	/* statically initialized */
+#define SIMPLELOCK_FINI(lock)	/* never destroyed */
+#define SIMPLELOCK_LOCK(lock)	pthread_mutex_lock(&lock)
+#define SIMPLELOCK_UNLOCK(lock)	pthread_mutex_unlock(&lock)
+
+#else
+
 /*
  * Python's threads are serialized, so object malloc locking is disabled.
  */
@@ -213,6 +247,8 @@
 #define SIMPLELOCK_LOCK(lock)	/* acquire released lock */
 #define SIMPLELOCK_UNLOCK(lock)	/* release acquired lock */
 
+#endif /* WITH_PYMALLOC_TCACHE */
+
 /*
  * Basic types
  * I don't care if these are defined in <sys/types.h> or elsewhere. Axiom.
@@ -407,12 +443,14 @@ static poolp freepools = NULL;		/* free list for cached pools */
  *
  * CAUTION:  See the long comment block about thread safety in new_arena():
  * the code currently relies in deep ways on that this vector only grows,
- * and only grows by appending at the end.  For now we never return an arena
- * to the OS.
+ * and only grows by appending at the end.  An arena given back to the OS by
+ * pypy_obmalloc_trim() keeps its entry, which is set to 0 so that no address
+ * can match it any more.
  */
 static uptr *volatile arenas = NULL;	/* the pointer itself is volatile */
 static volatile uint narenas = 0;
 static uint maxarenas = 0;
+static uint nlivearenas = 0;		/* narenas minus the released ones */
 
 /* Number of pools still available to be allocated in the current arena. */
 static uint nfreepools = 0;
@@ -420,6 +458,32 @@ static uint nfreepools = 0;
 /* Free space start address in current arena.  This is pool-aligned. */
 static block *arenabase = NULL;
 
+/* Total size of the blocks currently handed out by the pools. */
+static ulong used_bytes = 0;
+
+/*
+ * Decommitted pools.  pypy_obmalloc_trim() tells the OS that it can drop
+ * the pages of the empty pools (madvise(MADV_DONTNEED)).  This destroys
+ * their pool_header, so instead of the freepools list they are kept in
+ * this vector, together with the index of their arena.  They are reused
+ * before new pools are carved out of the current arena; touching them
+ * again is enough to get fresh zero pages from the OS.
+ */
+#if !defined(_WIN32)
+#  include <sys/mman.h>
+#  ifdef MADV_DONTNEED
+#    define HAVE_POOL_DECOMMIT
+#  endif
+#endif
+
+struct decommitted_pool {
+	poolp pool;
+	uint arenaindex;
+};
+static struct decommitted_pool *decommitted = NULL;
+static uint ndecommitted = 0;
+static uint maxdecommitted = 0;
+
 /* Allocate a new arena and return its base address.  If we run out of
  * memory, return NULL.
  */
@@ -510,6 +574,7 @@ new_arena(void)
 	assert(narenas < maxarenas);
 	arenas[narenas] = (uptr)bp;
 	++narenas;	/* can't overflow, since narenas < maxarenas before */
+	++nlivearenas;
 	return bp;
 
 error:
@@ -564,152 +629,350 @@ int Py_ADDRESS_IN_RANGE(void *P, poolp pool);
 
 /*==========================================================================*/
 
-/* malloc.  Note that nbytes==0 tries to return a non-NULL pointer, distinct
- * from all other currently live pointers.  This may not be possible.
+/* Take one block of size class 'size' from the shared pools.  Must be
+ * called with the malloc lock held.  Returns NULL if no new arena could
+ * be obtained.
  */
-
-/*
- * The basic blocks are ordered by decreasing execution frequency,
- * which minimizes the number of jumps in the most common cases,
- * improves branching prediction and instruction scheduling (small
- * block allocations typically result in a couple of instructions).
- * Unless the optimizer reorders everything, being too smart...
- */
-
-#undef PyObject_Malloc
-void *
-PyObject_Malloc(size_t nbytes)
+static block *
+pool_alloc(uint size)
 {
 	block *bp;
 	poolp pool;
 	poolp next;
-	uint size;
 
+	used_bytes += INDEX2SIZE(size);
 	/*
-	 * This implicitly redirects malloc(0).
+	 * Most frequent paths first
 	 */
-	if ((nbytes - 1) < SMALL_REQUEST_THRESHOLD) {
-		LOCK();
+	pool = usedpools[size + size];
+	if (pool != pool->nextpool) {
 		/*
-		 * Most frequent paths first
+		 * There is a used pool for this size class.
+		 * Pick up the head block of its free list.
 		 */
-		size = (uint )(nbytes - 1) >> ALIGNMENT_SHIFT;
-		pool = usedpools[size + size];
-		if (pool != pool->nextpool) {
-			/*
-			 * There is a used pool for this size class.
-			 * Pick up the head block of its free list.
-			 */
-			++pool->ref.count;
-			bp = pool->freeblock;
-			assert(bp != NULL);
-			if ((pool->freeblock = *(block **)bp) != NULL) {
-				UNLOCK();
-				return (void *)bp;
-			}
-			/*
-			 * Reached the end of the free list, try to extend it
-			 */
-			if (pool->nextoffset <= pool->maxnextoffset) {
-				/*
-				 * There is room for another block
-				 */
-				pool->freeblock = (block *)pool +
-						  pool->nextoffset;
-				pool->nextoffset += INDEX2SIZE(size);
-				*(block **)(pool->freeblock) = NULL;
-				UNLOCK();
-				return (void *)bp;
-			}
+		++pool->ref.count;
+		bp = pool->freeblock;
+		assert(bp != NULL);
+		if ((pool->freeblock = *(block **)bp) != NULL)
+			return bp;
+		/*
+		 * Reached the end of the free list, try to extend it
+		 */
+		if (pool->nextoffset <= pool->maxnextoffset) {
 			/*
-			 * Pool is full, unlink from used pools
+			 * There is room for another block
 			 */
-			next = pool->nextpool;
-			pool = pool->prevpool;
-			next->prevpool = pool;
-			pool->nextpool = next;
-			UNLOCK();
-			return (void *)bp;
+			pool->freeblock = (block *)pool +
+					  pool->nextoffset;
+			pool->nextoffset += INDEX2SIZE(size);
+			*(block **)(pool->freeblock) = NULL;
+			return bp;
 		}
 		/*
-		 * Try to get a cached free pool
+		 * Pool is full, unlink from used pools
 		 */
-		pool = freepools;
-		if (pool != NULL) {
-			/*
-			 * Unlink from cached pools
-			 */
-			freepools = pool->nextpool;
-		init_pool:
-			/*
-			 * Frontlink to used pools
-			 */
-			next = usedpools[size + size]; /* == prev */
-			pool->nextpool = next;
-			pool->prevpool = next;
-			next->nextpool = pool;
-			next->prevpool = pool;
-			pool->ref.count = 1;
-			if (pool->szidx == size) {
-				/*
-				 * Luckily, this pool last contained blocks
-				 * of the same size class, so its header
-				 * and free list are already initialized.
-				 */
-				bp = pool->freeblock;
-				pool->freeblock = *(block **)bp;
-				UNLOCK();
-				return (void *)bp;
-			}
+		next = pool->nextpool;
+		pool = pool->prevpool;
+		next->prevpool = pool;
+		pool->nextpool = next;
+		return bp;
+	}
+	/*
+	 * Try to get a cached free pool
+	 */
+	pool = freepools;
+	if (pool != NULL) {
+		/*
+		 * Unlink from cached pools
+		 */
+		freepools = pool->nextpool;
+	init_pool:
+		/*
+		 * Frontlink to used pools
+		 */
+		next = usedpools[size + size]; /* == prev */
+		pool->nextpool = next;
+		pool->prevpool = next;
+		next->nextpool = pool;
+		next->prevpool = pool;
+		pool->ref.count = 1;
+		if (pool->szidx == size) {
 			/*
-			 * Initialize the pool header, set up the free list to
-			 * contain just the second block, and return the first
-			 * block.
+			 * Luckily, this pool last contained blocks
+			 * of the same size class, so its header
+			 * and free list are already initialized.
 			 */
-			pool->szidx = size;
-			size = INDEX2SIZE(size);
-			bp = (block *)pool + POOL_OVERHEAD;
-			pool->nextoffset = POOL_OVERHEAD + (size << 1);
-			pool->maxnextoffset = POOL_SIZE - size;
-			pool->freeblock = bp + size;
-			*(block **)(pool->freeblock) = NULL;
-			UNLOCK();
-			return (void *)bp;
+			bp = pool->freeblock;
+			pool->freeblock = *(block **)bp;
+			return bp;
 		}
 		/*
-		 * Allocate new pool
+		 * Initialize the pool header, set up the free list to
+		 * contain just the second block, and return the first
+		 * block.
+		 */
+		pool->szidx = size;
+		size = INDEX2SIZE(size);
+		bp = (block *)pool + POOL_OVERHEAD;
+		pool->nextoffset = POOL_OVERHEAD + (size << 1);
+		pool->maxnextoffset = POOL_SIZE - size;
+		pool->freeblock = bp + size;
+		*(block **)(pool->freeblock) = NULL;
+		return bp;
+	}
+	/*
+	 * Reuse a pool whose memory was given back to the OS
+	 */
+	if (ndecommitted) {
+		--ndecommitted;
+		pool = decommitted[ndecommitted].pool;
+		pool->arenaindex = decommitted[ndecommitted].arenaindex;
+		pool->szidx = DUMMY_SIZE_IDX;
+		goto init_pool;
+	}
+	/*
+	 * Allocate new pool
+	 */
+	if (nfreepools) {
+	commit_pool:
+		--nfreepools;
+		pool = (poolp)arenabase;
+		arenabase += POOL_SIZE;
+		pool->arenaindex = narenas - 1;
+		pool->szidx = DUMMY_SIZE_IDX;
+		goto init_pool;
+	}
+	/*
+	 * Allocate new arena
+	 */
+#ifdef WITH_MEMORY_LIMITS
+	if (!(narenas < MAX_ARENAS)) {
+		used_bytes -= INDEX2SIZE(size);
+		return NULL;
+	}
+#endif
+	bp = new_arena();
+	if (bp != NULL)
+		goto commit_pool;
+	used_bytes -= INDEX2SIZE(size);
+	return NULL;
+}
+
+/* Give the block p back to its pool.  Must be called with the malloc
+ * lock held.
+ */
+static void
+pool_free(poolp pool, block *p)
+{
+	block *lastfree;
+	poolp next, prev;
+	uint size;
+
+	/*
+	 * Link p to the start of the pool's freeblock list.  Since
+	 * the pool had at least the p block outstanding, the pool
+	 * wasn't empty (so it's already in a usedpools[] list, or
+	 * was full and is in no list -- it's not in the freeblocks
+	 * list in any case).
+	 */
+	assert(pool->ref.count > 0);	/* else it was empty */
+	used_bytes -= INDEX2SIZE(pool->szidx);
+	*(block **)p = lastfree = pool->freeblock;
+	pool->freeblock = p;
+	if (lastfree) {
+		/*
+		 * freeblock wasn't NULL, so the pool wasn't full,
+		 * and the pool is in a usedpools[] list.
 		 */
-		if (nfreepools) {
-		commit_pool:
-			--nfreepools;
-			pool = (poolp)arenabase;
-			arenabase += POOL_SIZE;
-			pool->arenaindex = narenas - 1;
-			pool->szidx = DUMMY_SIZE_IDX;
-			goto init_pool;
+		if (--pool->ref.count != 0) {
+			/* pool isn't empty:  leave it in usedpools */
+			return;
 		}
 		/*
-		 * Allocate new arena
+		 * Pool is now empty:  unlink from usedpools, and
+		 * link to the front of freepools.  This ensures that
+		 * previously freed pools will be allocated later
+		 * (being not referenced, they are perhaps paged out).
 		 */
-#ifdef WITH_MEMORY_LIMITS
-		if (!(narenas < MAX_ARENAS)) {
-			UNLOCK();
-			goto redirect;
+		next = pool->nextpool;
+		prev = pool->prevpool;
+		next->prevpool = prev;
+		prev->nextpool = next;
+		/* Link to freepools.  This is a singly-linked list,
+		 * and pool->prevpool isn't used there.
+		 */
+		pool->nextpool = freepools;
+		freepools = pool;
+		return;
+	}
+	/*
+	 * Pool was full, so doesn't currently live in any list:
+	 * link it to the front of the appropriate usedpools[] list.
+	 * This mimics LRU pool usage for new allocations and
+	 * targets optimal filling when several pools contain
+	 * blocks of the same size class.
+	 */
+	--pool->ref.count;
+	assert(pool->ref.count > 0);	/* else the pool is empty */
+	size = pool->szidx;
+	next = usedpools[size + size];
+	prev = next->prevpool;
+	/* insert pool before next:   prev <-> pool <-> next */
+	pool->nextpool = next;
+	pool->prevpool = prev;
+	next->prevpool = pool;
+	prev->nextpool = pool;
+}
+
+#ifdef WITH_PYMALLOC_TCACHE
+
+/* A magazine: a stack of free blocks of one size class, linked through
+ * their first word like the pools' own free lists.
+ */
+struct tcache_bin {
+	block *head;
+	uint count;
+};
+
+static __thread struct tcache_bin tcache[NB_SMALL_SIZE_CLASSES];
+static __thread int tcache_registered = 0;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+/* Give all but 'keep' blocks of the magazine back to the shared pools. */
+static void
+tcache_flush(struct tcache_bin *bin, uint keep)
+{
+	block *bp;
+
+	LOCK();
+	while (bin->count > keep) {
+		bp = bin->head;
+		bin->head = *(block **)bp;
+		--bin->count;
+		pool_free(POOL_ADDR(bp), bp);
+	}
+	UNLOCK();
+}
+
+/* Empty all the magazines of the current thread. */
+static void
+tcache_flush_all(void)
+{
+	uint i;
+	for (i = 0; i < NB_SMALL_SIZE_CLASSES; ++i)
+		if (tcache[i].count != 0)
+			tcache_flush(&tcache[i], 0);
+}
+
+/* pthread_key destructor: empty the magazines of an exiting thread. */
+static void
+tcache_thread_exit(void *unused)
+{
+	tcache_flush_all();
+}
+
+/* Don't let a fork() in another thread copy a held lock into the child. */
+static void
+tcache_atfork_lock(void)
+{
+	LOCK();
+}
+
+static void
+tcache_atfork_unlock(void)
+{
+	UNLOCK();
+}
+
+static void
+tcache_init_once(void)
+{
+	pthread_key_create(&tcache_key, tcache_thread_exit);
+	pthread_atfork(tcache_atfork_lock, tcache_atfork_unlock,
+		       tcache_atfork_unlock);
+}
+
+/* Called the first time a thread puts blocks in its magazines, so that
+ * they are given back when the thread exits.
+ */
+static void
+tcache_register(void)
+{
+	pthread_once(&tcache_key_once, tcache_init_once);
+	pthread_setspecific(tcache_key, (void *)1);
+	tcache_registered = 1;
+}
+
+/* The magazine for 'size' is empty: take a batch of blocks from the shared
+ * pools while holding the lock only once.  Returns one of them, or NULL if
+ * even the first one could not be allocated.
+ */
+static block *
+tcache_refill(uint size)
+{
+	struct tcache_bin *bin = &tcache[size];
+	block *result, *bp;
+	uint i;
+
+	if (!tcache_registered)
+		tcache_register();
+	LOCK();
+	result = pool_alloc(size);
+	if (result != NULL) {
+		for (i = 1; i < TCACHE_BATCH; ++i) {
+			bp = pool_alloc(size);
+			if (bp == NULL)
+				break;
+			*(block **)bp = bin->head;
+			bin->head = bp;
+			++bin->count;
 		}
+	}
+	UNLOCK();
+	return result;
+}
+
+#endif /* WITH_PYMALLOC_TCACHE */
+
+/* malloc.  Note that nbytes==0 tries to return a non-NULL pointer, distinct
+ * from all other currently live pointers.  This may not be possible.
+ */
+
+#undef PyObject_Malloc
+void *
+PyObject_Malloc(size_t nbytes)
+{
+	block *bp;
+	uint size;
+
+	/*
+	 * This implicitly redirects malloc(0).
+	 */
+	if ((nbytes - 1) < SMALL_REQUEST_THRESHOLD) {
+		size = (uint )(nbytes - 1) >> ALIGNMENT_SHIFT;
+#ifdef WITH_PYMALLOC_TCACHE
+		bp = tcache[size].head;
+		if (bp != NULL) {
+			tcache[size].head = *(block **)bp;
+			--tcache[size].count;
+			return (void *)bp;
+		}
+		bp = tcache_refill(size);
+#else
+		LOCK();
+		bp = pool_alloc(size);
+		UNLOCK();
 #endif
-		bp = new_arena();
 		if (bp != NULL)
-			goto commit_pool;
-		UNLOCK();
-		goto redirect;
+			return (void *)bp;
 	}
 
         /* The small block allocator ends here. */
 
-redirect:
 	/*
 	 * Redirect the original request to the underlying (libc) allocator.
-	 * We jump here on bigger requests, on error in the code above (as a
+	 * We get here on bigger requests, on error in the code above (as a
 	 * last chance to serve the request) or when the max memory limit
 	 * has been reached.
 	 */
@@ -725,9 +988,6 @@ void
 PyObject_Free(void *p)
 {
 	poolp pool;
-	block *lastfree;
-	poolp next, prev;
-	uint size;
 
 	if (p == NULL)	/* free(NULL) has no effect */
 		return;
@@ -735,63 +995,22 @@ PyObject_Free(void *p)
 	pool = POOL_ADDR(p);
 	if (Py_ADDRESS_IN_RANGE(p, pool)) {
 		/* We allocated this address. */
-		LOCK();
-		/*
-		 * Link p to the start of the pool's freeblock list.  Since
-		 * the pool had at least the p block outstanding, the pool
-		 * wasn't empty (so it's already in a usedpools[] list, or
-		 * was full and is in no list -- it's not in the freeblocks
-		 * list in any case).
+#ifdef WITH_PYMALLOC_TCACHE
+		/* The pool's szidx cannot change while p is allocated,
+		 * so it is safe to read without the lock.
 		 */
-		assert(pool->ref.count > 0);	/* else it was empty */
-		*(block **)p = lastfree = pool->freeblock;
-		pool->freeblock = (block *)p;
-		if (lastfree) {
-			/*
-			 * freeblock wasn't NULL, so the pool wasn't full,
-			 * and the pool is in a usedpools[] list.
-			 */
-			if (--pool->ref.count != 0) {
-				/* pool isn't empty:  leave it in usedpools */
-				UNLOCK();
-				return;
-			}
-			/*
-			 * Pool is now empty:  unlink from usedpools, and
-			 * link to the front of freepools.  This ensures that
-			 * previously freed pools will be allocated later
-			 * (being not referenced, they are perhaps paged out).
-			 */
-			next = pool->nextpool;
-			prev = pool->prevpool;
-			next->prevpool = prev;
-			prev->nextpool = next;
-			/* Link to freepools.  This is a singly-linked list,
-			 * and pool->prevpool isn't used there.
-			 */
-			pool->nextpool = freepools;
-			freepools = pool;
-			UNLOCK();
-			return;
-		}
-		/*
-		 * Pool was full, so doesn't currently live in any list:
-		 * link it to the front of the appropriate usedpools[] list.
-		 * This mimics LRU pool usage for new allocations and
-		 * targets optimal filling when several pools contain
-		 * blocks of the same size class.
-		 */
-		--pool->ref.count;
-		assert(pool->ref.count > 0);	/* else the pool is empty */
-		size = pool->szidx;
-		next = usedpools[size + size];
-		prev = next->prevpool;
-		/* insert pool before next:   prev <-> pool <-> next */
-		pool->nextpool = next;
-		pool->prevpool = prev;
-		next->prevpool = pool;
-		prev->nextpool = pool;
+		struct tcache_bin *bin = &tcache[pool->szidx];
+		if (!tcache_registered)
+			tcache_register();
+		*(block **)p = bin->head;
+		bin->head = (block *)p;
+		if (++bin->count > TCACHE_MAX)
+			tcache_flush(bin, TCACHE_MAX / 2);
+#else
+		LOCK();
+		pool_free(pool, (block *)p);
 		UNLOCK();
+#endif
 		return;
 	}
 
@@ -864,6 +1083,143 @@ PyObject_Realloc(void *p, size_t nbytes)
    	return bp ? bp : p;
 }
 
+/*==========================================================================*/
+/* Giving memory back to the OS. */
+
+/* Number of whole pools in arena number i. */
+#define ARENA_NUMPOOLS(i)  (ARENA_SIZE / POOL_SIZE -			\
+			    ((arenas[i] & (uptr)POOL_SIZE_MASK) != 0))
+
+#ifdef HAVE_POOL_DECOMMIT
+/* Move all the pools of the freepools list to the decommitted vector and
+ * tell the OS that it can drop their pages.  Returns the number of bytes
+ * decommitted.
+ */
+static ulong
+decommit_free_pools(void)
+{
+	poolp pool;
+	ulong result = 0;
+
+	while ((pool = freepools) != NULL) {
+		if (ndecommitted == maxdecommitted) {
+			struct decommitted_pool *p;
+			uint newmax = maxdecommitted ? maxdecommitted << 1 : 64;
+			p = (struct decommitted_pool *)realloc(decommitted,
+					newmax * sizeof(*decommitted));
+			if (p == NULL)
+				break;
+			decommitted = p;
+			maxdecommitted = newmax;
+		}
+		freepools = pool->nextpool;
+		decommitted[ndecommitted].pool = pool;
+		decommitted[ndecommitted].arenaindex = pool->arenaindex;
+		++ndecommitted;
+		madvise((void *)pool, POOL_SIZE, MADV_DONTNEED);
+		result += POOL_SIZE;
+	}
+	return result;
+}
+#endif
+
+/* Free the arenas, apart from the current one, in which all pools are
+ * either in freepools or decommitted.  Returns the number of bytes that
+ * were still committed in them.
+ */
+static ulong
+release_free_arenas(void)
+{
+	uint *nfree;
+	uint i, j;
+	poolp pool, *link;
+	ulong result = 0;
+
+	if (narenas <= 1)
+		return 0;
+	nfree = (uint *)calloc(narenas, sizeof(uint));
+	if (nfree == NULL)
+		return 0;
+	for (pool = freepools; pool != NULL; pool = pool->nextpool)
+		++nfree[pool->arenaindex];
+	for (j = 0; j < ndecommitted; ++j)
+		++nfree[decommitted[j].arenaindex];
+
+	/* the last arena is the one pools are being carved out of */
+	for (i = 0; i < narenas - 1; ++i) {
+		if (arenas[i] == 0 || nfree[i] != ARENA_NUMPOOLS(i)) {
+			nfree[i] = 0;
+			continue;
+		}
+		nfree[i] = 1;	/* mark the arena as released */
+	}
+	nfree[narenas - 1] = 0;
+
+	/* unlink the pools of the released arenas from both lists */
+	link = &freepools;
+	while ((pool = *link) != NULL) {
+		if (nfree[pool->arenaindex] == 1) {
+			*link = pool->nextpool;
+			result += POOL_SIZE;
+		}
+		else
+			link = &pool->nextpool;
+	}
+	for (i = 0, j = 0; j < ndecommitted; ++j) {
+		if (nfree[decommitted[j].arenaindex] != 1)
+			decommitted[i++] = decommitted[j];
+	}
+	ndecommitted = i;
+
+	for (i = 0; i < narenas - 1; ++i) {
+		if (nfree[i] == 1) {
+			/* the alignment slack was committed too */
+			result += ARENA_SIZE - ARENA_NUMPOOLS(i) * POOL_SIZE;
+			free((void *)arenas[i]);
+			arenas[i] = 0;
+			--nlivearenas;
+		}
+	}
+	free(nfree);
+	return result;
+}
+
+/* Give as much memory as possible back to the OS: the empty pools are
+ * decommitted and the arenas that contain only empty pools are freed.
+ * Returns the number of bytes that were released.
+ */
+long
+pypy_obmalloc_trim(void)
+{
+	ulong result = 0;
+
+#ifdef WITH_PYMALLOC_TCACHE
+	tcache_flush_all();
+#endif
+	LOCK();
+#ifdef HAVE_POOL_DECOMMIT
+	result += decommit_free_pools();
+#endif
+	result += release_free_arenas();
+	UNLOCK();
+	return (long)result;
+}
+
+/* Number of bytes of arena memory not given back to the OS. */
+long
+pypy_obmalloc_committed(void)
+{
+	return (long)((ulong)nlivearenas * ARENA_SIZE -
+		      (ulong)ndecommitted * POOL_SIZE);
+}
+
+/* Number of bytes in the blocks currently handed out by the pools. */
+long
+pypy_obmalloc_used(void)
+{
+	return (long)used_bytes;
+}
+
 #else	/* ! WITH_PYMALLOC */
 
 /*==========================================================================*/
@@ -1322,6 +1678,8 @@ _PyObject_DebugMallocStats(void)
 		uint j;
 		uptr base = arenas[i];
 
+		if (base == 0)		/* released by pypy_obmalloc_trim() */
+			continue;
 		/* round up to pool alignment */
 		poolsinarena = ARENA_SIZE / POOL_SIZE;
 		if (base & (uptr)POOL_SIZE_MASK) {
@@ -0,0 +1,322 @@
+/********** Work-stealing mark stacks for the GC's parallel marking **********
+ *
+ * See parallelmark.h.  Each worker pushes and pops the objects to mark
+ * on its private stack.  When this stack grows and the worker's shared
+ * stack is empty, a batch of objects is moved to the shared stack.  A
+ * worker whose private stack is empty takes a batch back from its own
+ * shared stack, or steals half of another worker's shared stack.  When
+ * there is nothing left to steal, the worker becomes idle; the marking
+ * is done when all the workers are idle at the same time.
+ *
+ * The threads only exist during pypy_pmark_run(), so that we don't have
+ * to care about fork() or about threads parked between collections.
+ */
+
+#include "src/parallelmark.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#  include <signal.h>
+#  include <sched.h>
+#  define PMARK_THREADS
+#endif
+
+/* the number of objects moved at once to or from a shared stack */
+#define PMARK_BATCH  64
+
+
+/* A deque, kept as a ring of 'size' items, 'size' being a power of two.
+   The worker pushes and pops at the top; batches are given away from
+   the bottom, so that neither end needs to move the other items. */
+struct pmark_stack {
+    void **items;
+    long head, count, size;         /* 'head' is the index of the bottom */
+};
+
+#define PMARK_ITEM(st, i)  \
+    ((st)->items[((st)->head + (i)) & ((st)->size - 1)])
+
+struct pmark_worker {
+    struct pmark_stack local;       /* only used by the worker itself */
+    struct pmark_stack shared;      /* protected by 'lock' */
+    volatile long shared_count;     /* copy of shared.count, read unlocked */
+#ifdef PMARK_THREADS
+    pthread_mutex_t lock;
+#endif
+    char padding[64];               /* avoid false sharing between workers */
+};
+
+static struct {
+    struct pmark_worker *workers;
+    long nthreads;
+    long next_add;
+    pypy_pmark_fn fn;
+#ifdef PMARK_THREADS
+    pthread_t *threads;
+    char *started;
+    pthread_mutex_t idle_lock;      /* protects 'nrunning' and 'nidle' */
+    long nrunning, nidle;
+    volatile long done;
+#endif
+} pmark;
+
+#ifdef PMARK_THREADS
+#  define PMARK_LOCK(w)    pthread_mutex_lock(&(w)->lock)
+#  define PMARK_UNLOCK(w)  pthread_mutex_unlock(&(w)->lock)
+#else
+#  define PMARK_LOCK(w)    /* nothing */
+#  define PMARK_UNLOCK(w)  /* nothing */
+#endif
+
+
+static void pmark_out_of_memory(void)
+{
+    fprintf(stderr, "Fatal error: out of memory in the GC's parallel "
+                    "marking\n");
+    abort();
+}
+
+static void pmark_append(struct pmark_stack *st, void *obj)
+{
+    if (st->count == st->size) {
+        long i, newsize = st->size ? st->size * 2 : PMARK_BATCH;
+        void **items = malloc(newsize * sizeof(void *));
+        if (items == NULL)
+            pmark_out_of_memory();
+        for (i = 0; i < st->count; i++)
+            items[i] = PMARK_ITEM(st, i);
+        free(st->items);
+        st->items = items;
+        st->head = 0;
+        st->size = newsize;
+    }
+    PMARK_ITEM(st, st->count) = obj;
+    st->count++;
+}
+
+static void *pmark_pop_top(struct pmark_stack *st)
+{
+    st->count--;
+    return PMARK_ITEM(st, st->count);
+}
+
+/* move the 'n' oldest items of 'src' to 'dst' */
+static void pmark_move_bottom(struct pmark_stack *dst,
+                              struct pmark_stack *src, long n)
+{
+    long i;
+    for (i = 0; i < n; i++)
+        pmark_append(dst, PMARK_ITEM(src, i));
+    src->head = (src->head + n) & (src->size - 1);
+    src->count -= n;
+}
+
+/* move the 'n' newest items of 'src' to 'dst' */
+static void pmark_move_top(struct pmark_stack *dst,
+                           struct pmark_stack *src, long n)
+{
+    long i;
+    for (i = src->count - n; i < src->count; i++)
+        pmark_append(dst, PMARK_ITEM(src, i));
+    src->count -= n;
+}
+
+
+long pypy_pmark_start(long nthreads)
+{
+    long i;
+#ifdef PMARK_THREADS
+    if (nthreads < 1)
+        nthreads = 1;
+#else
+    nthreads = 1;
+#endif
+    memset(&pmark, 0, sizeof(pmark));
+    pmark.workers = calloc(nthreads, sizeof(struct pmark_worker));
+    if (pmark.workers == NULL)
+        return 0;
+#ifdef PMARK_THREADS
+    pmark.threads = malloc(nthreads * sizeof(pthread_t));
+    pmark.started = calloc(nthreads, 1);
+    if (pmark.threads == NULL || pmark.started == NULL) {
+        free(pmark.started);
+        free(pmark.threads);
+        free(pmark.workers);
+        return 0;
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_mutex_init(&pmark.workers[i].lock, NULL);
+    pthread_mutex_init(&pmark.idle_lock, NULL);
+#endif
+    pmark.nthreads = nthreads;
+    return 1;
+}
+
+void pypy_pmark_add(void *obj)
+{
+    struct pmark_worker *w = &pmark.workers[pmark.next_add];
+    pmark_append(&w->shared, obj);
+    w->shared_count = w->shared.count;
+    pmark.next_add++;
+    if (pmark.next_add == pmark.nthreads)
+        pmark.next_add = 0;
+}
+
+#ifdef PMARK_THREADS
+static void *pmark_thread_main(void *arg)
+{
+    /* signals must be handled by the main thread, not by us */
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    pmark.fn((long)arg);
+    return NULL;
+}
+#endif
+
+long pypy_pmark_run(pypy_pmark_fn fn)
+{
+    long nrunning = 1;
+#ifdef PMARK_THREADS
+    long i;
+    pmark.fn = fn;
+    pmark.nidle = 0;
+    pmark.done = 0;
+    /* Hold 'idle_lock' while starting the threads: nobody can decide
+       that the marking is done before we know how many workers run. */
+    pthread_mutex_lock(&pmark.idle_lock);
+    pmark.nrunning = 1;
+    for (i = 1; i < pmark.nthreads; i++) {
+        if (pthread_create(&pmark.threads[i], NULL, pmark_thread_main,
+                           (void *)i) == 0) {
+            pmark.started[i] = 1;
+            pmark.nrunning++;
+        }
+    }
+    nrunning = pmark.nrunning;
+    pthread_mutex_unlock(&pmark.idle_lock);
+#endif
+    fn(0);
+#ifdef PMARK_THREADS
+    for (i = 1; i < pmark.nthreads; i++) {
+        if (pmark.started[i]) {
+            pthread_join(pmark.threads[i], NULL);
+            pmark.started[i] = 0;
+        }
+    }
+#endif
+    return nrunning;
+}
+
+void pypy_pmark_push(long n, void *obj)
+{
+    struct pmark_worker *w = &pmark.workers[n];
+    pmark_append(&w->local, obj);
+    if (w->local.count >= 2 * PMARK_BATCH && w->shared_count == 0 &&
+            pmark.nthreads > 1) {
+        /* give some work away */
+        PMARK_LOCK(w);
+        pmark_move_bottom(&w->shared, &w->local, PMARK_BATCH);
+        w->shared_count = w->shared.count;
+        PMARK_UNLOCK(w);
+    }
+}
+
+/* Refill the private stack of worker 'n' from its own shared stack, or
+   else from the shared stack of another worker.  Returns 0 if all the
+   shared stacks seem to be empty. */
+static int pmark_refill(long n)
+{
+    struct pmark_worker *w = &pmark.workers[n];
+    long i, k;
+    for (i = 0; i < pmark.nthreads; i++) {
+        struct pmark_worker *v = &pmark.workers[(n + i) % pmark.nthreads];
+        if (v->shared_count == 0)
+            continue;
+        PMARK_LOCK(v);
+        k = v->shared.count;
+        if (v != w)
+            k = (k + 1) / 2;       /* steal half of it */
+        if (k > PMARK_BATCH)
+            k = PMARK_BATCH;
+        pmark_move_top(&w->local, &v->shared, k);
+        v->shared_count = v->shared.count;
+        PMARK_UNLOCK(v);
+        if (k > 0)
+            return 1;
+    }
+    return 0;
+}
+
+#ifdef PMARK_THREADS
+/* Called when worker 'n' found no work anywhere.  Wait until either
+   some other worker publishes work, in which case we return 1, or all
+   the workers are idle, in which case we return 0.  A worker only goes
+   idle after its own stacks are empty, and only the owner pushes to a
+   shared stack; so when all of them are idle, no work is left. */
+static int pmark_wait_for_work(void)
+{
+    long i;
+    pthread_mutex_lock(&pmark.idle_lock);
+    pmark.nidle++;
+    if (pmark.nidle == pmark.nrunning)
+        pmark.done = 1;
+    pthread_mutex_unlock(&pmark.idle_lock);
+
+    while (!pmark.done) {
+        for (i = 0; i < pmark.nthreads; i++) {
+            if (pmark.workers[i].shared_count > 0) {
+                int busy_again;
+                pthread_mutex_lock(&pmark.idle_lock);
+                busy_again = !pmark.done;
+                if (busy_again)
+                    pmark.nidle--;
+                pthread_mutex_unlock(&pmark.idle_lock);
+                return busy_again;
+            }
+        }
+        sched_yield();
+    }
+    return 0;
+}
+#endif
+
+void *pypy_pmark_pop(long n)
+{
+    struct pmark_worker *w = &pmark.workers[n];
+    while (1) {
+        if (w->local.count > 0)
+            return pmark_pop_top(&w->local);
+        if (pmark_refill(n))
+            continue;
+#ifdef PMARK_THREADS
+        if (pmark.nthreads > 1 && pmark_wait_for_work())
+            continue;
+#endif
+        return NULL;
+    }
+}
+
+void pypy_pmark_stop(void)
+{
+    long i;
+    for (i = 0; i < pmark.nthreads; i++) {
+        struct pmark_worker *w = &pmark.workers[i];
+        free(w->local.items);
+        free(w->shared.items);
+#ifdef PMARK_THREADS
+        pthread_mutex_destroy(&w->lock);
+#endif
+    }
+#ifdef PMARK_THREADS
+    pthread_mutex_destroy(&pmark.idle_lock);
+    free(pmark.started);
+    free(pmark.threads);
+#endif
+    free(pmark.workers);
+    memset(&pmark, 0, sizeof(pmark));
+}
@@ -0,0 +1,39 @@
+/********** Work-stealing mark stacks for the GC's parallel marking **********/
+#ifndef _PYPY_PARALLELMARK_H_
+#define _PYPY_PARALLELMARK_H_
+
+/* The marking is done by 'nthreads' workers, numbered from 0 to
+ * nthreads-1.  Each worker has a private mark stack, plus a shared one
+ * from which the other workers can steal when they run out of work.
+ * Worker 0 runs in the thread that calls pypy_pmark_run(); the others
+ * run in new threads, started for the duration of that call.
+ *
+ * There is only one set of workers per process: this is meant to be
+ * used by the GC with the rest of the program stopped.
+ */
+typedef void (*pypy_pmark_fn)(long);
+
+/* Allocate the workers.  Returns 0 if out of memory. */
+long pypy_pmark_start(long nthreads);
+
+/* Before pypy_pmark_run(): add an object to mark.  The objects are
+ * spread over the shared stacks of all workers.
+ */
+void pypy_pmark_add(void *obj);
+
+/* Call 'fn(n)' in each worker.  Returns the number of workers that
+ * actually ran in their own thread, including worker 0.  If we cannot
+ * start a thread, its share of the objects is stolen by the others.
+ */
+long pypy_pmark_run(pypy_pmark_fn fn);
+
+/* For worker 'n' only: push an object to mark, or get the next one.
+ * pypy_pmark_pop() returns NULL when all workers ran out of work.
+ */
+void pypy_pmark_push(long n, void *obj);
+void *pypy_pmark_pop(long n);
+
+/* Free the workers. */
+void pypy_pmark_stop(void);
+
+#endif
@@ -1,31 +1,336 @@
-
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE      /* for sched_setaffinity() */
+#endif
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "src/profiling.h"
+
+/* The layout reported by pypy_profiling_layout(), e.g.
+   "cpus=2-5 threads=main main=2 mlock=no latency=no governor=powersave" */
+static char profiling_layout[256] = "";
+
 #if defined(__GNUC__) && defined(__linux__)
 
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
 #include <sched.h>
-#endif
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
-cpu_set_t base_cpu_set;
-int profiling_setup = 0;
+/* With PYPYLOG=filename, the process is set up for benchmarking:
+
+     PYPYLOG_CPUS=list     the cpus to run on, like '2-5,8', or 'isolated'
+                           for the cpus given to the kernel's isolcpus=;
+                           by default, the cpus that we are allowed to use;
+                           the other cpus of the list are ignored
+     PYPYLOG_ISOLATE=options,...  where the options are:
+        main      the main thread on the first cpu of the list, and the
+                  other threads on the other cpus (the default)
+        each      each thread on its own cpu, in turn over the list
+        all       every thread on the first cpu of the list
+        none      don't pin the threads at all
+        mlock     lock all the memory of the process with mlockall()
+        latency   ask the kernel to keep the cpus out of their deep idle
+                  states, with /dev/cpu_dma_latency (usually needs root)
+
+   The threads started later are pinned by pypy_profiling_thread_start(),
+   which is called by the thread bootstrap code.
+*/
+
+enum { PIN_MAIN, PIN_EACH, PIN_ALL, PIN_NONE };
+
+static cpu_set_t base_cpu_set;
+static cpu_set_t profiling_cpus;     /* the cpus given by PYPYLOG_CPUS */
+static int profiling_cpu_list[CPU_SETSIZE];
+static int profiling_num_cpus = 0;
+static int profiling_pin = PIN_MAIN;
+static int profiling_mlock = 0;
+static int profiling_latency_fd = -1;
+static int profiling_next_thread = 0;
+static int profiling_setup = 0;
+
+/* Parses a list like '2-5,8' into 'set'; returns 0 if it is invalid. */
+static int profiling_parse_cpus(const char *p, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  while (*p && *p != '\n')
+    {
+      char *end;
+      long first, last;
+      first = last = strtol(p, &end, 10);
+      if (end == p)
+        return 0;
+      p = end;
+      if (*p == '-')
+        {
+          last = strtol(p + 1, &end, 10);
+          if (end == p + 1)
+            return 0;
+          p = end;
+        }
+      if (first < 0 || last < first || last >= CPU_SETSIZE)
+        return 0;
+      for (; first <= last; first++)
+        CPU_SET(first, set);
+      if (*p == ',')
+        p++;
+    }
+  return 1;
+}
+
+static int profiling_isolated_cpus(cpu_set_t *set)
+{
+  char line[1024];
+  int ok = 0;
+  FILE *f = fopen("/sys/devices/system/cpu/isolated", "r");
+  if (f == NULL)
+    return 0;
+  if (fgets(line, sizeof(line), f) != NULL)
+    ok = profiling_parse_cpus(line, set) && CPU_COUNT(set) > 0;
+  fclose(f);
+  return ok;
+}
+
+/* Appends 'set' to 'p' in the format of profiling_parse_cpus(). */
+static char *profiling_format_cpus(char *p, char *end, cpu_set_t *set)
+{
+  int i = 0, j, first = 1;
+  while (i < CPU_SETSIZE)
+    {
+      if (!CPU_ISSET(i, set))
+        {
+          i++;
+          continue;
+        }
+      for (j = i; j + 1 < CPU_SETSIZE && CPU_ISSET(j + 1, set); j++)
+        ;
+      if (j == i)
+        p += snprintf(p, end - p, "%s%d", first ? "" : ",", i);
+      else
+        p += snprintf(p, end - p, "%s%d-%d", first ? "" : ",", i, j);
+      if (p >= end)
+        return end - 1;
+      first = 0;
+      i = j + 1;
+    }
+  return p;
+}
+
+static void profiling_options(const char *spec)
+{
+  const char *p = spec;
+  size_t length;
+  while (*p)
+    {
+      length = strcspn(p, ",");
+      if (length == 4 && strncmp(p, "main", 4) == 0)
+        profiling_pin = PIN_MAIN;
+      else if (length == 4 && strncmp(p, "each", 4) == 0)
+        profiling_pin = PIN_EACH;
+      else if (length == 3 && strncmp(p, "all", 3) == 0)
+        profiling_pin = PIN_ALL;
+      else if (length == 4 && strncmp(p, "none", 4) == 0)
+        profiling_pin = PIN_NONE;
+      else if (length == 5 && strncmp(p, "mlock", 5) == 0)
+        profiling_mlock = 1;
+      else if (length == 7 && strncmp(p, "latency", 7) == 0)
+        profiling_latency_fd = -2;     /* opened later */
+      else
+        fprintf(stderr, "PYPYLOG_ISOLATE: unknown option '%.*s'\n",
+                (int)length, p);
+      p += length;
+      if (*p == ',')
+        p++;
+    }
+}
+
+/* Fills profiling_cpu_list from profiling_cpus. */
+static void profiling_list_cpus(void)
+{
+  int i;
+  profiling_num_cpus = 0;
+  for (i = 0; i < CPU_SETSIZE; i++)
+    if (CPU_ISSET(i, &profiling_cpus))
+      profiling_cpu_list[profiling_num_cpus++] = i;
+}
+
+/* Returns 0 on success, or -1 with errno set. */
+static int profiling_pin_to(int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(cpu_set_t), &set);
+}
+
+/* For the threads started later: their layout was already reported, so
+   we can only complain. */
+static void profiling_thread_failed(void)
+{
+  static int warned = 0;
+  if (!warned)
+    perror("PYPYLOG_ISOLATE: cannot pin a thread");
+  warned = 1;
+}
+
+static void profiling_describe(void)
+{
+  static const char *pins[] = { "main", "each", "all", "none" };
+  char governor[64] = "unknown";
+  char *p = profiling_layout;
+  char *end = profiling_layout + sizeof(profiling_layout);
+  char path[128];
+  FILE *f;
+
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+           profiling_cpu_list[0]);
+  f = fopen(path, "r");
+  if (f != NULL)
+    {
+      if (fgets(governor, sizeof(governor), f) != NULL)
+        governor[strcspn(governor, "\n")] = '\0';
+      fclose(f);
+    }
+  p += snprintf(p, end - p, "cpus=");
+  p = profiling_format_cpus(p, end, &profiling_cpus);
+  p += snprintf(p, end - p, " threads=%s", pins[profiling_pin]);
+  if (profiling_pin != PIN_NONE && p < end)
+    p += snprintf(p, end - p, " main=%d", profiling_cpu_list[0]);
+  if (p < end)
+    snprintf(p, end - p, " mlock=%s latency=%s governor=%s",
+             profiling_mlock ? "yes" : "no",
+             profiling_latency_fd >= 0 ? "yes" : "no", governor);
+}
 
 void pypy_setup_profiling()
 {
-  if (!profiling_setup) {
-    cpu_set_t set;
-    sched_getaffinity(0, sizeof(cpu_set_t), &base_cpu_set);
-    CPU_ZERO(&set);
-    CPU_SET(0, &set);   /* restrict to a single cpu */
-    sched_setaffinity(0, sizeof(cpu_set_t), &set);
-    profiling_setup = 1;
-  }
+  char *spec;
+  if (profiling_setup)
+    return;
+  sched_getaffinity(0, sizeof(cpu_set_t), &base_cpu_set);
+
+  profiling_cpus = base_cpu_set;
+  spec = getenv("PYPYLOG_CPUS");
+  if (spec != NULL && spec[0] != '\0')
+    {
+      cpu_set_t set;
+      int ok;
+      if (strcmp(spec, "isolated") == 0)
+        ok = profiling_isolated_cpus(&set);
+      else
+        ok = profiling_parse_cpus(spec, &set) && CPU_COUNT(&set) > 0;
+      if (!ok)
+        fprintf(stderr, "PYPYLOG_CPUS: invalid or no cpus in '%s'\n", spec);
+      else
+        {
+          /* we cannot run on the cpus that are offline or not allowed */
+          cpu_set_t allowed;
+          CPU_AND(&allowed, &set, &base_cpu_set);
+          if (CPU_COUNT(&allowed) == 0)
+            fprintf(stderr, "PYPYLOG_CPUS: none of the cpus in '%s' can "
+                    "be used\n", spec);
+          else
+            {
+              if (!CPU_EQUAL(&allowed, &set))
+                fprintf(stderr, "PYPYLOG_CPUS: ignoring the cpus in '%s' "
+                        "that cannot be used\n", spec);
+              profiling_cpus = allowed;
+            }
+        }
+    }
+  profiling_list_cpus();
+
+  spec = getenv("PYPYLOG_ISOLATE");
+  if (spec != NULL)
+    profiling_options(spec);
+
+  switch (profiling_pin)
+    {
+    case PIN_MAIN:
+    case PIN_EACH:
+    case PIN_ALL:
+      if (profiling_pin_to(profiling_cpu_list[0]) == 0)
+        {
+          profiling_next_thread = 1;
+          break;
+        }
+      perror("PYPYLOG_ISOLATE: cannot pin the main thread");
+      profiling_pin = PIN_NONE;
+      /* fall through */
+    case PIN_NONE:
+      if (sched_setaffinity(0, sizeof(cpu_set_t), &profiling_cpus) < 0)
+        {
+          perror("PYPYLOG_CPUS: cannot restrict the process to the cpus");
+          /* report the cpus that we really run on */
+          sched_getaffinity(0, sizeof(cpu_set_t), &profiling_cpus);
+          profiling_list_cpus();
+        }
+      break;
+    }
+  if (profiling_mlock && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    {
+      perror("PYPYLOG_ISOLATE: mlockall");
+      profiling_mlock = 0;
+    }
+  if (profiling_latency_fd == -2)
+    {
+      /* the request stays in effect as long as the file is open */
+      int zero = 0;
+      profiling_latency_fd = open("/dev/cpu_dma_latency", O_WRONLY);
+      if (profiling_latency_fd < 0 ||
+          write(profiling_latency_fd, &zero, sizeof(zero)) != sizeof(zero))
+        {
+          perror("PYPYLOG_ISOLATE: /dev/cpu_dma_latency");
+          if (profiling_latency_fd >= 0)
+            close(profiling_latency_fd);
+          profiling_latency_fd = -1;
+        }
+    }
+  profiling_describe();
+  profiling_setup = 1;
+}
+
+void pypy_profiling_thread_start(void)
+{
+  cpu_set_t set;
+  int i;
+  if (!profiling_setup)
+    return;
+  switch (profiling_pin)
+    {
+    case PIN_MAIN:
+      /* the new thread inherited the cpu of the main thread */
+      if (profiling_num_cpus > 1)
+        {
+          set = profiling_cpus;
+          CPU_CLR(profiling_cpu_list[0], &set);
+          if (sched_setaffinity(0, sizeof(cpu_set_t), &set) < 0)
+            profiling_thread_failed();
+        }
+      break;
+    case PIN_EACH:
+      i = __sync_fetch_and_add(&profiling_next_thread, 1);
+      if (profiling_pin_to(profiling_cpu_list[i % profiling_num_cpus]) < 0)
+        profiling_thread_failed();
+      break;
+    default:
+      break;    /* the affinity inherited from the main thread is right */
+    }
 }
 
 void pypy_teardown_profiling()
 {
   if (profiling_setup) {
     sched_setaffinity(0, sizeof(cpu_set_t), &base_cpu_set);
+    if (profiling_mlock)
+      munlockall();
+    if (profiling_latency_fd >= 0)
+      close(profiling_latency_fd);
+    profiling_mlock = 0;
+    profiling_latency_fd = -1;
+    profiling_layout[0] = '\0';
     profiling_setup = 0;
   }
 }
@@ -36,29 +341,42 @@ void pypy_teardown_profiling()
 DWORD_PTR base_affinity_mask;
 int profiling_setup = 0;
 
-void pypy_setup_profiling() { 
+void pypy_setup_profiling() {
     if (!profiling_setup) {
         DWORD_PTR affinity_mask, system_affinity_mask;
+        int cpu = 0;
         GetProcessAffinityMask(GetCurrentProcess(),
             &base_affinity_mask, &system_affinity_mask);
         affinity_mask = 1;
         /* Pick one cpu allowed by the system */
         if (system_affinity_mask)
-            while ((affinity_mask & system_affinity_mask) == 0)
+            while ((affinity_mask & system_affinity_mask) == 0) {
                 affinity_mask <<= 1;
+                cpu++;
+            }
         SetProcessAffinityMask(GetCurrentProcess(), affinity_mask);
+        sprintf(profiling_layout, "cpus=%d threads=all main=%d", cpu, cpu);
         profiling_setup = 1;
     }
 }
 
+void pypy_profiling_thread_start(void) { }
+
 void pypy_teardown_profiling() {
     if (profiling_setup) {
         SetProcessAffinityMask(GetCurrentProcess(), base_affinity_mask);
+        profiling_layout[0] = '\0';
         profiling_setup = 0;
     }
 }
 
 #else
 void pypy_setup_profiling() { }
+void pypy_profiling_thread_start(void) { }
 void pypy_teardown_profiling() { }
 #endif
+
+const char *pypy_profiling_layout(void)
+{
+  return profiling_layout;
+}
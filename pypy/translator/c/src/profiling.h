@@ -1,8 +1,14 @@
-
 #ifndef PROFILING_H
 #define PROFILING_H
 
 void pypy_setup_profiling();
 void pypy_teardown_profiling();
 
+/* Called at the start of every new thread, to pin it to its cpu */
+void pypy_profiling_thread_start(void);
+
+/* A description of the cpus and of the options chosen by
+   pypy_setup_profiling(), or "" */
+const char *pypy_profiling_layout(void);
+
 #endif
@@ -0,0 +1,84 @@
+#include <string.h>
+#include "src/rsre_scan.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+long pypy_rsre_find_char(const char *s, long start, long end, long c)
+{
+  const char *p;
+  if (start >= end)
+    return -1;
+  /* the memchr() of the C library is vectorized on most platforms */
+  p = memchr(s + start, (unsigned char)c, end - start);
+  return p != NULL ? p - s : -1;
+}
+
+long pypy_rsre_find_prefix(const char *s, long start, long end,
+                           const char *prefix, long length)
+{
+  const char *p = s + start;
+  const char *last = s + end - length;     /* the last possible start */
+
+  /* 'length' is at least 2: see search_context() in rsre_core.py */
+  if (end - start < length)
+    return -1;
+
+#ifdef __SSE2__
+  {
+    /* Compare 16 possible starts at once with the first and the last
+       character of the prefix, and only check the middle of the
+       candidates that match both. */
+    __m128i first = _mm_set1_epi8(prefix[0]);
+    __m128i final = _mm_set1_epi8(prefix[length - 1]);
+    while (last - p >= 15)
+      {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + length - 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                   _mm_cmpeq_epi8(b, final)));
+        while (mask != 0)
+          {
+            int i = __builtin_ctz(mask);
+            if (memcmp(p + i + 1, prefix + 1, length - 2) == 0)
+              return p + i - s;
+            mask &= mask - 1;
+          }
+        p += 16;
+      }
+  }
+#endif
+
+  while (p <= last)
+    {
+      p = memchr(p, (unsigned char)prefix[0], last - p + 1);
+      if (p == NULL)
+        return -1;
+      if (memcmp(p + 1, prefix + 1, length - 1) == 0)
+        return p - s;
+      p++;
+    }
+  return -1;
+}
+
+long pypy_rsre_find_charset(const char *s, long start, long end,
+                            const char *table)
+{
+  const unsigned char *p = (const unsigned char *)s;
+  long i = start;
+
+  while (end - i >= 4)
+    {
+      if (table[p[i]])     return i;
+      if (table[p[i + 1]]) return i + 1;
+      if (table[p[i + 2]]) return i + 2;
+      if (table[p[i + 3]]) return i + 3;
+      i += 4;
+    }
+  for (; i < end; i++)
+    if (table[p[i]])
+      return i;
+  return -1;
+}
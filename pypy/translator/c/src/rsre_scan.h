@@ -0,0 +1,17 @@
+/************************** rsre fast scanning **************************/
+#ifndef _PYPY_RSRE_SCAN_H_
+#define _PYPY_RSRE_SCAN_H_
+
+/* Helpers for rlib/rsre/rsre_scan.py.  They look for the next position
+ * in s[start:end] where a search can start: the next occurrence of a
+ * character, or of a prefix of 'length' bytes, or of a byte whose entry
+ * in the 256-bytes 'table' is not zero.  They return that position, or
+ * -1 if there is none.
+ */
+long pypy_rsre_find_char(const char *s, long start, long end, long c);
+long pypy_rsre_find_prefix(const char *s, long start, long end,
+                           const char *prefix, long length);
+long pypy_rsre_find_charset(const char *s, long start, long end,
+                            const char *table);
+
+#endif
@@ -0,0 +1,494 @@
+/************************** sampling profiler **************************
+ *
+ * See sampler.h.  The signal handler and the writer thread communicate
+ * through the 'head' and 'tail' counters of each ring: the handler only
+ * writes 'head' and the writer only writes 'tail', so the only ordering
+ * needed is that the words of a sample are stored before 'head' moves.
+ * The list of threads, the table of code names and the output buffer
+ * are protected by a mutex, which is never taken by the signal handler.
+ * The mutex is not held while writing to the file: the writer swaps
+ * the full output buffer with an empty one, and writes it afterwards.
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE      /* for REG_RIP and REG_EIP */
+#endif
+
+#include "src/sampler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <signal.h>
+#  include <pthread.h>
+#  include <sys/time.h>
+#  include <time.h>
+#  include <ucontext.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   /* x86 does not reorder stores with other stores, nor loads with
+      other loads */
+#  define PYPY_SAMPLER_BARRIER()  asm volatile("" : : : "memory")
+#elif defined(__GNUC__)
+#  define PYPY_SAMPLER_BARRIER()  __sync_synchronize()
+#endif
+
+#define PYPY_SAMPLER_RING(t, i)  ((t)->ring[(i) & (PYPY_SAMPLER_RING_WORDS-1)])
+
+#ifndef _WIN32
+
+struct pypy_sampler_code_s {
+    long kind, addr, size;
+    char *name;
+};
+
+static struct pypy_sampler_code_s *pypy_sampler_codes = NULL;
+static long pypy_sampler_codes_count = 0, pypy_sampler_codes_allocated = 0;
+
+struct pypy_sampler_thread_s {
+    long stack[PYPY_SAMPLER_STACK_DEPTH + 1];
+    long ring[PYPY_SAMPLER_RING_WORDS];
+    volatile unsigned long head;      /* only written by the handler */
+    volatile unsigned long tail;      /* only written by the writer */
+    volatile long lost;
+    long index;
+    int in_use;
+    struct pypy_sampler_thread_s *next;
+};
+
+static pthread_mutex_t pypy_sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pypy_sampler_thread_s *pypy_sampler_threads = NULL;
+static long pypy_sampler_threads_count = 0;
+static __thread struct pypy_sampler_thread_s *pypy_sampler_current = NULL;
+static pthread_key_t pypy_sampler_key;
+static int pypy_sampler_initialized = 0;
+
+static volatile int pypy_sampler_running = 0;
+static volatile int pypy_sampler_stopping;
+static int pypy_sampler_fd;
+static pthread_t pypy_sampler_writer_thread;
+static struct sigaction pypy_sampler_old_action;
+
+struct pypy_sampler_buffer_s {
+    long *words;
+    long count, allocated;
+};
+
+/* the output buffer, only used with the lock acquired; and the buffer
+   being written to the file, only used by the writer thread, or by
+   pypy_sampler_start() and pypy_sampler_stop() when it is not running */
+#define PYPY_SAMPLER_BUFFER_WORDS  8192
+static struct pypy_sampler_buffer_s pypy_sampler_output = { NULL, 0, 0 };
+static struct pypy_sampler_buffer_s pypy_sampler_writing = { NULL, 0, 0 };
+
+
+/* Returns a pointer to 'words' free words at the end of the output
+   buffer, which is enlarged if needed; returns NULL if out of memory,
+   and then the record is dropped. */
+static long *pypy_sampler_reserve(long words)
+{
+    struct pypy_sampler_buffer_s *b = &pypy_sampler_output;
+    long *p;
+    if (b->count + words > b->allocated)
+      {
+        long newsize = b->allocated * 2;
+        if (newsize < PYPY_SAMPLER_BUFFER_WORDS)
+            newsize = PYPY_SAMPLER_BUFFER_WORDS;
+        if (newsize < b->count + words)
+            newsize = b->count + words;
+        p = (long *)realloc(b->words, newsize * sizeof(long));
+        if (p == NULL)
+            return NULL;
+        b->words = p;
+        b->allocated = newsize;
+      }
+    p = b->words + b->count;
+    b->count += words;
+    return p;
+}
+
+/* Must hold the lock: takes the content of the output buffer, to be
+   written by pypy_sampler_write() after the lock is released. */
+static void pypy_sampler_take_output(void)
+{
+    struct pypy_sampler_buffer_s full = pypy_sampler_output;
+    pypy_sampler_output = pypy_sampler_writing;
+    pypy_sampler_output.count = 0;
+    pypy_sampler_writing = full;
+}
+
+static void pypy_sampler_write(void)
+{
+    char *p = (char *)pypy_sampler_writing.words;
+    size_t size = pypy_sampler_writing.count * sizeof(long);
+    ssize_t n;
+    while (size > 0)
+      {
+        n = write(pypy_sampler_fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;     /* write error: drop the rest */
+        p += n;
+        size -= n;
+      }
+    pypy_sampler_writing.count = 0;
+}
+
+static void pypy_sampler_emit_code(struct pypy_sampler_code_s *code)
+{
+    long length = strlen(code->name);
+    long words = (length + sizeof(long)) / sizeof(long);
+    long *p = pypy_sampler_reserve(6 + words);
+    if (p == NULL)
+        return;
+    p[0] = PYPY_SAMPLER_TAG_CODE;
+    p[1] = 4 + words;
+    p[2] = code->kind;
+    p[3] = code->addr;
+    p[4] = code->size;
+    p[5] = length;
+    p[5 + words] = 0;     /* the padding of the last word */
+    memcpy(p + 6, code->name, length);
+}
+
+/* Move the samples of the ring of 't' to the output buffer. */
+static void pypy_sampler_drain(struct pypy_sampler_thread_s *t)
+{
+    unsigned long tail = t->tail;
+    unsigned long head = t->head;
+    long i, size, *p;
+    PYPY_SAMPLER_BARRIER();
+    while (tail != head)
+      {
+        size = PYPY_SAMPLER_RING(t, tail);
+        p = pypy_sampler_reserve(2 + size);
+        if (p == NULL)
+            break;       /* out of memory: try again the next time */
+        p[0] = PYPY_SAMPLER_TAG_SAMPLE;
+        p[1] = size;          /* the thread index replaces 'size' */
+        p[2] = t->index;
+        for (i = 1; i < size; i++)
+            p[2 + i] = PYPY_SAMPLER_RING(t, tail + i);
+        tail += size;
+      }
+    PYPY_SAMPLER_BARRIER();
+    t->tail = tail;
+}
+
+static void *pypy_sampler_writer(void *arg)
+{
+    struct pypy_sampler_thread_s *t;
+    struct timespec delay;
+    sigset_t all;
+    int stopping;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    while (1)
+      {
+        stopping = pypy_sampler_stopping;
+        pthread_mutex_lock(&pypy_sampler_lock);
+        for (t = pypy_sampler_threads; t != NULL; t = t->next)
+            pypy_sampler_drain(t);
+        pypy_sampler_take_output();
+        pthread_mutex_unlock(&pypy_sampler_lock);
+        pypy_sampler_write();
+        if (stopping)
+            break;
+        delay.tv_sec = 0;
+        delay.tv_nsec = 10000000;     /* 10 ms */
+        nanosleep(&delay, NULL);
+      }
+    return NULL;
+}
+
+static long pypy_sampler_pc(void *ucontext)
+{
+    ucontext_t *uc = (ucontext_t *)ucontext;
+#if defined(__linux__) && defined(__x86_64__)
+#  ifndef REG_RIP
+#    define REG_RIP  16     /* if <sys/ucontext.h> came without _GNU_SOURCE */
+#  endif
+    return (long)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__linux__) && defined(__i386__)
+#  ifndef REG_EIP
+#    define REG_EIP  14
+#  endif
+    return (long)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__APPLE__) && defined(__x86_64__)
+    return (long)uc->uc_mcontext->__ss.__rip;
+#elif defined(__APPLE__) && defined(__i386__)
+    return (long)uc->uc_mcontext->__ss.__eip;
+#else
+    return 0;      /* unknown */
+#endif
+}
+
+static void pypy_sampler_handler(int signum, siginfo_t *info, void *ucontext)
+{
+    struct pypy_sampler_thread_s *t = pypy_sampler_current;
+    unsigned long head;
+    long depth, top, n, i;
+
+    if (t == NULL || !pypy_sampler_running)
+        return;
+    depth = t->stack[0];
+    top = depth;
+    if (top > PYPY_SAMPLER_STACK_DEPTH)
+        top = PYPY_SAMPLER_STACK_DEPTH;
+    n = top;
+    if (n > PYPY_SAMPLER_SAMPLE_DEPTH)
+        n = PYPY_SAMPLER_SAMPLE_DEPTH;
+    if (n < 0)
+        n = 0;
+
+    head = t->head;
+    if (PYPY_SAMPLER_RING_WORDS - (head - t->tail) < (unsigned long)(3 + n))
+      {
+        t->lost++;
+        return;
+      }
+    PYPY_SAMPLER_RING(t, head) = 3 + n;
+    PYPY_SAMPLER_RING(t, head + 1) = pypy_sampler_pc(ucontext);
+    PYPY_SAMPLER_RING(t, head + 2) = depth;
+    for (i = 0; i < n; i++)
+        PYPY_SAMPLER_RING(t, head + 3 + i) = t->stack[top - i];
+    PYPY_SAMPLER_BARRIER();
+    t->head = head + 3 + n;
+}
+
+static void pypy_sampler_thread_exit(void *p)
+{
+    /* the ring is kept, and given to the next new thread */
+    struct pypy_sampler_thread_s *t = (struct pypy_sampler_thread_s *)p;
+    pthread_mutex_lock(&pypy_sampler_lock);
+    t->stack[0] = 0;
+    t->in_use = 0;
+    pthread_mutex_unlock(&pypy_sampler_lock);
+}
+
+static void pypy_sampler_after_fork(void)
+{
+    /* in the child, there is neither a timer nor a writer thread */
+    pthread_mutex_init(&pypy_sampler_lock, NULL);
+    pypy_sampler_running = 0;
+    pypy_sampler_output.count = 0;
+}
+
+static void pypy_sampler_initialize(void)
+{
+    if (!pypy_sampler_initialized)
+      {
+        pthread_key_create(&pypy_sampler_key, pypy_sampler_thread_exit);
+        pthread_atfork(NULL, NULL, pypy_sampler_after_fork);
+        pypy_sampler_initialized = 1;
+      }
+}
+
+long *pypy_sampler_thread_stack(void)
+{
+    struct pypy_sampler_thread_s *t = pypy_sampler_current;
+    if (t != NULL)
+        return t->stack;
+
+    pthread_mutex_lock(&pypy_sampler_lock);
+    pypy_sampler_initialize();
+    for (t = pypy_sampler_threads; t != NULL; t = t->next)
+        if (!t->in_use)
+            break;
+    if (t == NULL)
+      {
+        t = (struct pypy_sampler_thread_s *)malloc(sizeof(*t));
+        if (t == NULL)
+          {
+            pthread_mutex_unlock(&pypy_sampler_lock);
+            return NULL;
+          }
+        t->head = t->tail = 0;
+        t->lost = 0;
+        t->index = pypy_sampler_threads_count++;
+        t->next = pypy_sampler_threads;
+        pypy_sampler_threads = t;
+      }
+    t->stack[0] = 0;
+    t->in_use = 1;
+    pthread_mutex_unlock(&pypy_sampler_lock);
+
+    pthread_setspecific(pypy_sampler_key, t);
+    pypy_sampler_current = t;
+    return t->stack;
+}
+
+void pypy_sampler_register_code(long kind, long addr, long size,
+                                const char *name)
+{
+    struct pypy_sampler_code_s *code;
+    pthread_mutex_lock(&pypy_sampler_lock);
+    if (pypy_sampler_codes_count == pypy_sampler_codes_allocated)
+      {
+        long newsize = pypy_sampler_codes_allocated * 2 + 64;
+        code = (struct pypy_sampler_code_s *)
+            realloc(pypy_sampler_codes, newsize * sizeof(*code));
+        if (code == NULL)
+            goto done;       /* out of memory: the name is missing */
+        pypy_sampler_codes = code;
+        pypy_sampler_codes_allocated = newsize;
+      }
+    code = &pypy_sampler_codes[pypy_sampler_codes_count];
+    code->name = strdup(name);
+    if (code->name == NULL)
+        goto done;
+    code->kind = kind;
+    code->addr = addr;
+    code->size = size;
+    pypy_sampler_codes_count++;
+    if (pypy_sampler_running)
+        pypy_sampler_emit_code(code);
+ done:
+    pthread_mutex_unlock(&pypy_sampler_lock);
+}
+
+long pypy_sampler_start(long fd, long interval_usec)
+{
+    struct sigaction action;
+    struct itimerval timer;
+    long i, *p;
+
+    if (pypy_sampler_running)
+      {
+        errno = EBUSY;
+        return -1;
+      }
+    if (interval_usec <= 0)
+      {
+        errno = EINVAL;
+        return -1;
+      }
+    pthread_mutex_lock(&pypy_sampler_lock);
+    pypy_sampler_initialize();
+    pypy_sampler_fd = (int)fd;
+    pypy_sampler_output.count = 0;
+    p = pypy_sampler_reserve(6);
+    if (p == NULL)
+      {
+        pthread_mutex_unlock(&pypy_sampler_lock);
+        errno = ENOMEM;
+        return -1;
+      }
+    p[0] = PYPY_SAMPLER_MAGIC;
+    p[1] = PYPY_SAMPLER_VERSION;
+    p[2] = sizeof(long);
+    p[3] = interval_usec;
+    p[4] = (long)getpid();
+    p[5] = (long)pypy_sampler_start;
+    for (i = 0; i < pypy_sampler_codes_count; i++)
+        pypy_sampler_emit_code(&pypy_sampler_codes[i]);
+    pypy_sampler_take_output();
+    /* from now on, new code names are added to the output buffer */
+    pypy_sampler_running = 1;
+    pthread_mutex_unlock(&pypy_sampler_lock);
+
+    /* the writer thread is not started yet: write the header first */
+    pypy_sampler_write();
+    pypy_sampler_stopping = 0;
+    if (pthread_create(&pypy_sampler_writer_thread, NULL,
+                       pypy_sampler_writer, NULL) != 0)
+      {
+        pypy_sampler_running = 0;
+        errno = EAGAIN;
+        return -1;
+      }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = pypy_sampler_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &pypy_sampler_old_action);
+
+    timer.it_interval.tv_sec = interval_usec / 1000000;
+    timer.it_interval.tv_usec = interval_usec % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) < 0)
+      {
+        int saved_errno = errno;
+        pypy_sampler_stop();
+        errno = saved_errno;
+        return -1;
+      }
+    return 0;
+}
+
+long pypy_sampler_stop(void)
+{
+    struct pypy_sampler_thread_s *t;
+    struct itimerval timer;
+    long lost = 0;
+
+    if (!pypy_sampler_running)
+        return -1;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    pypy_sampler_running = 0;
+    /* a SIGPROF can still be pending: if the previous action was the
+       default one, which kills the process, ignore it instead */
+    if (!(pypy_sampler_old_action.sa_flags & SA_SIGINFO) &&
+        pypy_sampler_old_action.sa_handler == SIG_DFL)
+        pypy_sampler_old_action.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &pypy_sampler_old_action, NULL);
+
+    pypy_sampler_stopping = 1;
+    pthread_join(pypy_sampler_writer_thread, NULL);
+
+    pthread_mutex_lock(&pypy_sampler_lock);
+    for (t = pypy_sampler_threads; t != NULL; t = t->next)
+        if (t->lost > 0)
+          {
+            long *p = pypy_sampler_reserve(4);
+            if (p != NULL)
+              {
+                p[0] = PYPY_SAMPLER_TAG_LOST;
+                p[1] = 2;
+                p[2] = t->index;
+                p[3] = t->lost;
+              }
+            lost += t->lost;
+            t->lost = 0;
+          }
+    pypy_sampler_take_output();
+    pthread_mutex_unlock(&pypy_sampler_lock);
+    /* the writer thread is finished */
+    pypy_sampler_write();
+    return lost;
+}
+
+#else   /* _WIN32: no SIGPROF */
+
+static long pypy_sampler_stack_of_all_threads[PYPY_SAMPLER_STACK_DEPTH + 1];
+
+long *pypy_sampler_thread_stack(void)
+{
+    return pypy_sampler_stack_of_all_threads;
+}
+
+void pypy_sampler_register_code(long kind, long addr, long size,
+                                const char *name)
+{
+}
+
+long pypy_sampler_start(long fd, long interval_usec)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+long pypy_sampler_stop(void)
+{
+    return -1;
+}
+
+#endif
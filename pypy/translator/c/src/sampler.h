@@ -0,0 +1,77 @@
+/************************** sampling profiler **************************/
+#ifndef _PYPY_SAMPLER_H_
+#define _PYPY_SAMPLER_H_
+
+/* A statistical profiler driven by SIGPROF.  At each tick, the signal
+ * handler records in a ring buffer of the current thread:
+ *
+ *   - the interrupted program counter, which is either in an RPython
+ *     function of the executable or in machine code written by the JIT;
+ *
+ *   - the top of the thread's "code stack", an array of words that the
+ *     interpreter updates when it enters or leaves an app-level frame
+ *     (item 0 is the depth, the following items are the ids of the
+ *     code objects, outermost first).  JIT-compiled code keeps it up
+ *     to date too, so the app-level frames are known even there.
+ *
+ * There is one ring per thread, with a single producer (the signal
+ * handler, which only runs in its own thread) and a single consumer (a
+ * writer thread, which wakes up every few milliseconds and appends the
+ * new samples to the output file).  Nothing is locked or allocated in
+ * the signal handler.  If a ring is full, the sample is counted as lost.
+ *
+ * The file contains machine words in native byte order: a header
+ *
+ *   magic, version, word size, sampling interval in microseconds, pid,
+ *   address of pypy_sampler_start() (to relocate the symbols of a PIE)
+ *
+ * followed by records 'tag, number of words that follow, words...':
+ *
+ *   SAMPLE:  thread index, pc, depth, code ids (innermost first)
+ *   CODE:    kind, address or id, size or first line, name length,
+ *            name padded with zeroes to a word boundary
+ *   LOST:    thread index, number of samples lost
+ *
+ * A CODE record of kind PYPY_SAMPLER_CODE_APP maps an id of the code
+ * stack to the name "co_name:co_firstlineno:co_filename"; a record of
+ * kind PYPY_SAMPLER_CODE_JIT gives the name of the JIT-compiled loop or
+ * bridge found at the given address and size.  The code registered
+ * before pypy_sampler_start() is written at the start of the file.
+ * See pypy/tool/samplerdump.py for a reader.
+ */
+
+#define PYPY_SAMPLER_MAGIC          0x50534d50L      /* fits in 32 bits */
+#define PYPY_SAMPLER_VERSION        1
+#define PYPY_SAMPLER_TAG_SAMPLE     1
+#define PYPY_SAMPLER_TAG_CODE       2
+#define PYPY_SAMPLER_TAG_LOST       3
+#define PYPY_SAMPLER_CODE_APP       0
+#define PYPY_SAMPLER_CODE_JIT       1
+
+#define PYPY_SAMPLER_STACK_DEPTH    1024    /* items of the code stack */
+#define PYPY_SAMPLER_SAMPLE_DEPTH   128     /* code ids kept per sample */
+#define PYPY_SAMPLER_RING_WORDS     65536   /* a power of two */
+
+/* Start sampling every 'interval_usec' microseconds of CPU time and
+ * writing to the file descriptor 'fd'.  Returns 0, or -1 with errno set
+ * (EBUSY if already started, ENOSYS if not supported on this platform).
+ */
+long pypy_sampler_start(long fd, long interval_usec);
+
+/* Stop sampling, wait until the writer thread has written everything,
+ * and return the number of samples lost, or -1 if not started.
+ */
+long pypy_sampler_stop(void);
+
+/* Return the code stack of the current thread, which is allocated the
+ * first time.  Returns NULL if out of memory.
+ */
+long *pypy_sampler_thread_stack(void);
+
+/* Register a name for an app-level code id or for a range of JIT code.
+ * The name is copied.
+ */
+void pypy_sampler_register_code(long kind, long addr, long size,
+                                const char *name);
+
+#endif
@@ -16,6 +16,13 @@
 #endif
 
 #include <signal.h>
+#include <errno.h>
+
+#if defined(__linux__) && !defined(PYPY_NO_SIGNALFD)
+#  define PYPYSIG_WITH_SIGNALFD
+#  include <sys/signalfd.h>
+#  include <pthread.h>
+#endif
 
 #if defined(PYOS_OS2) && !defined(PYCC_GCC)
 #define NSIG 12
@@ -47,6 +54,7 @@ void pypysig_default(int signum); /* signal will do default action (SIG_DFL) */
 void pypysig_setflag(int signum); /* signal will set a flag which can be
                                      queried with pypysig_poll() */
 int pypysig_set_wakeup_fd(int fd);
+int pypysig_set_signalfd(int signum, int flag);  /* Linux only, see below */
 
 /* utility to poll for signals that arrived */
 int pypysig_poll(void);   /* => signum or -1 */
@@ -74,11 +82,69 @@ void *pypysig_getaddr_occurred(void) { return (void *)(&pypysig_counter); }
 #ifndef PYPY_NOT_MAIN_FILE
 
 struct pypysig_long_struct pypysig_counter = {0};
-static char volatile pypysig_flags[NSIG] = {0};
+
+/* The pending signals are a bitmask, set with atomic operations by the
+   signal handler and taken as a whole by pypysig_poll().  The signals
+   taken but not returned yet are in pypysig_taken, which is only used
+   by pypysig_poll(). */
+#define PYPYSIG_WORD_BITS   ((int)(sizeof(long) * CHAR_BIT))
+#define PYPYSIG_WORDS       ((NSIG + PYPYSIG_WORD_BITS - 1) / PYPYSIG_WORD_BITS)
+
+#if defined(__GNUC__)
+#  define PYPYSIG_ATOMIC_OR(p, v)   __sync_fetch_and_or(p, v)
+#  define PYPYSIG_ATOMIC_TAKE(p)    __sync_lock_test_and_set(p, 0)
+#elif defined(_MSC_VER)
+#  include <intrin.h>
+#  define PYPYSIG_ATOMIC_OR(p, v)   _InterlockedOr(p, v)
+#  define PYPYSIG_ATOMIC_TAKE(p)    _InterlockedExchange(p, 0)
+#else
+   /* not atomic: add other compilers here */
+#  define PYPYSIG_ATOMIC_OR(p, v)   pypysig_or_word(p, v)
+#  define PYPYSIG_ATOMIC_TAKE(p)    pypysig_or_word(p, -1)
+static long pypysig_or_word(long volatile *p, long v)
+{
+    long result = *p;
+    *p = (v == -1) ? 0 : (result | v);
+    return result;
+}
+#endif
+
+static long volatile pypysig_pending[PYPYSIG_WORDS];
+static unsigned long pypysig_taken[PYPYSIG_WORDS];
 static int volatile pypysig_occurred = 0;
 /* pypysig_occurred is only an optimization: it tells if any
-   pypysig_flags could be set. */
+   pypysig_pending bit could be set. */
 static int wakeup_fd = -1;
+static long volatile wakeup_sent = 0;
+/* wakeup_sent is set when a byte is written to wakeup_fd.  Until the
+   next pypysig_poll() clears it, more signals don't write again. */
+
+static void pypysig_mark(int signum)
+{
+    if (0 <= signum && signum < NSIG)
+      {
+        PYPYSIG_ATOMIC_OR(&pypysig_pending[signum / PYPYSIG_WORD_BITS],
+                          (long)(1UL << (signum % PYPYSIG_WORD_BITS)));
+        pypysig_occurred = 1;
+        pypysig_counter.value = -1;
+      }
+}
+
+static void pypysig_wakeup(void)
+{
+    if (wakeup_fd != -1 && !PYPYSIG_ATOMIC_OR(&wakeup_sent, 1))
+      {
+#ifndef _WIN32
+        ssize_t res;
+#else
+        int res;
+#endif
+        int old_errno = errno;
+        res = write(wakeup_fd, "\0", 1);
+        /* the return value is ignored here */
+        errno = old_errno;
+      }
+}
 
 void pypysig_ignore(int signum)
 {
@@ -110,23 +176,8 @@ void pypysig_default(int signum)
 
 static void signal_setflag_handler(int signum)
 {
-    if (0 <= signum && signum < NSIG)
-      {
-        pypysig_flags[signum] = 1;
-        pypysig_occurred = 1;
-        pypysig_counter.value = -1;
-      }
-
-    if (wakeup_fd != -1) 
-      {
-#ifndef _WIN32
-        ssize_t res;
-#else
-        int res;
-#endif
-        res = write(wakeup_fd, "\0", 1);
-        /* the return value is ignored here */
-      }
+    pypysig_mark(signum);
+    pypysig_wakeup();
 }
 
 void pypysig_setflag(int signum)
@@ -160,18 +211,29 @@ void pypysig_reinstall(int signum)
 
 int pypysig_poll(void)
 {
+  int i;
   if (pypysig_occurred)
     {
-      int i;
+      /* take all the pending signals at once */
       pypysig_occurred = 0;
-      for (i=0; i<NSIG; i++)
-        if (pypysig_flags[i])
-          {
-            pypysig_flags[i] = 0;
-            pypysig_occurred = 1;   /* maybe another signal is pending */
-            return i;
-          }
+      wakeup_sent = 0;
+      for (i=0; i<PYPYSIG_WORDS; i++)
+        pypysig_taken[i] |= PYPYSIG_ATOMIC_TAKE(&pypysig_pending[i]);
     }
+  for (i=0; i<PYPYSIG_WORDS; i++)
+    if (pypysig_taken[i])
+      {
+        unsigned long word = pypysig_taken[i];
+        int bit;
+#ifdef __GNUC__
+        bit = __builtin_ctzl(word);
+#else
+        for (bit = 0; !(word & (1UL << bit)); bit++)
+          ;
+#endif
+        pypysig_taken[i] = word & (word - 1);
+        return i * PYPYSIG_WORD_BITS + bit;
+      }
   return -1;  /* no pending signal */
 }
 
@@ -182,6 +244,115 @@ int pypysig_set_wakeup_fd(int fd)
   return old_fd;
 }
 
+/* Linux only: after pypysig_set_signalfd(signum, 1), the signal 'signum'
+   is blocked in the calling thread, and so in the threads that it starts
+   afterwards.  It is read from a signalfd by a helper thread, which
+   marks as pending all the signals that it reads at once, with a single
+   wakeup.  This avoids running the handler and writing to the wakeup fd
+   for every signal, e.g. with many SIGCHLDs.  Unlike with the handler,
+   blocking system calls are not interrupted.  The handler installed by
+   pypysig_setflag() is still needed for the signals that go to other
+   threads.  Returns 0, or -1 with errno set. */
+#ifdef PYPYSIG_WITH_SIGNALFD
+static int signalfd_fd = -1;
+static sigset_t signalfd_mask;
+static int signalfd_atfork_registered = 0;
+
+static void *pypysig_signalfd_reader(void *arg)
+{
+    struct signalfd_siginfo infos[16];
+    sigset_t all;
+    ssize_t n, i;
+    int fd = (int)(long)arg;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    while (1)
+      {
+        n = read(fd, infos, sizeof(infos));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          break;
+        for (i = 0; i < n / (ssize_t)sizeof(infos[0]); i++)
+          pypysig_mark(infos[i].ssi_signo);
+        pypysig_wakeup();
+      }
+    return NULL;
+}
+
+static void pypysig_signalfd_after_fork(void)
+{
+    /* there is no reader thread in the child process: go back to
+       delivering the signals to the handler */
+    if (signalfd_fd != -1)
+      {
+        pthread_sigmask(SIG_UNBLOCK, &signalfd_mask, NULL);
+        close(signalfd_fd);
+        signalfd_fd = -1;
+      }
+}
+
+int pypysig_set_signalfd(int signum, int flag)
+{
+    sigset_t one;
+    pthread_t thread;
+    pthread_attr_t attr;
+    int fd;
+
+    if (signum < 1 || signum >= NSIG)
+      {
+        errno = EINVAL;
+        return -1;
+      }
+    if (signalfd_fd == -1)
+      {
+        if (!flag)
+          return 0;
+        sigemptyset(&signalfd_mask);
+        if (!signalfd_atfork_registered)
+          {
+            pthread_atfork(NULL, NULL, pypysig_signalfd_after_fork);
+            signalfd_atfork_registered = 1;
+          }
+      }
+    if (flag)
+      sigaddset(&signalfd_mask, signum);
+    else
+      sigdelset(&signalfd_mask, signum);
+
+    fd = signalfd(signalfd_fd, &signalfd_mask, SFD_CLOEXEC);
+    if (fd < 0)
+      return -1;
+    if (signalfd_fd == -1)
+      {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_attr_setstacksize(&attr, 64 * 1024);
+        if (pthread_create(&thread, &attr, pypysig_signalfd_reader,
+                           (void *)(long)fd) != 0)
+          {
+            pthread_attr_destroy(&attr);
+            close(fd);
+            errno = EAGAIN;
+            return -1;
+          }
+        pthread_attr_destroy(&attr);
+        signalfd_fd = fd;
+      }
+    sigemptyset(&one);
+    sigaddset(&one, signum);
+    pthread_sigmask(flag ? SIG_BLOCK : SIG_UNBLOCK, &one, NULL);
+    return 0;
+}
+#else
+int pypysig_set_signalfd(int signum, int flag)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
 #endif  /* !PYPY_NOT_MAIN_FILE */
 
 #endif
@@ -17,6 +17,7 @@ extern char _LLstacktoobig_report_error;
 
 char LL_stack_too_big_slowpath(long);    /* returns 0 (ok) or 1 (too big) */
 void LL_stack_set_length_fraction(double);
+char *LL_stack_replace_end(char *);      /* for stacklets in separate stacks */
 
 /* some macros referenced from pypy.rlib.rstack */
 #define LL_stack_get_end() ((long)_LLstacktoobig_stack_end)
@@ -43,11 +44,112 @@ void LL_stack_set_length_fraction(double);
 char *_LLstacktoobig_stack_end = NULL;
 long _LLstacktoobig_stack_length = MAX_STACK_SIZE;
 char _LLstacktoobig_report_error = 1;
-static RPyThreadStaticTLS end_tls_key;
+
+/* The length requested with LL_stack_set_length_fraction().  The real
+   bounds of the stack of each thread are queried the first time we see
+   it, and _LLstacktoobig_stack_length is made smaller if needed, so that
+   we report a stack overflow before really running out of stack. */
+static long requested_length = MAX_STACK_SIZE;
+static RPyThreadStaticTLS end_tls_key;    /* base of the current stack */
+static RPyThreadStaticTLS low_tls_key;    /* the thread's stack: lowest */
+static RPyThreadStaticTLS high_tls_key;   /*    and highest address     */
+static char end_tls_key_created = 0;
+
+/* how much of the real stack we keep free, at most */
+#define STACK_SAFETY_MARGIN  (256 * 1024)
+
+static int _LL_stack_create_key(void)
+{
+	/* XXX We assume that initialization is performed early,
+	   when there is still only one thread running.  This
+	   allows us to ignore race conditions here */
+	char *errmsg;
+	if (end_tls_key_created)
+		return 0;
+	errmsg = RPyThreadStaticTLS_Create(&end_tls_key);
+	if (!errmsg)
+		errmsg = RPyThreadStaticTLS_Create(&low_tls_key);
+	if (!errmsg)
+		errmsg = RPyThreadStaticTLS_Create(&high_tls_key);
+	if (errmsg) {
+		/* XXX should we exit the process? */
+		fprintf(stderr, "Internal PyPy error: %s\n", errmsg);
+		return -1;
+	}
+	end_tls_key_created = 1;
+	return 0;
+}
+
+#if defined(__linux__) && defined(__GLIBC__)
+extern int pthread_getattr_np(pthread_t, pthread_attr_t *);
+#endif
+
+/* Query the bounds of the stack of the current thread, or return 0
+   if we don't know how to on this platform. */
+static int _LL_stack_query_bounds(char **plow, char **phigh)
+{
+#if defined(__linux__) && defined(__GLIBC__)
+	pthread_attr_t attr;
+	void *addr;
+	size_t size;
+	int ok;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0)
+		return 0;
+	ok = pthread_attr_getstack(&attr, &addr, &size) == 0;
+	pthread_attr_destroy(&attr);
+	if (!ok)
+		return 0;
+	*plow = (char *)addr;
+	*phigh = (char *)addr + size;
+	return 1;
+#elif defined(__APPLE__)
+	pthread_t self = pthread_self();
+	*phigh = (char *)pthread_get_stackaddr_np(self);
+	*plow = *phigh - pthread_get_stacksize_np(self);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Set _LLstacktoobig_stack_length for a stack whose base is 'baseptr':
+   if it is in the thread's stack, don't let it go beyond the bottom. */
+static void _LL_stack_update_length(char *baseptr)
+{
+	char *low = (char *) RPyThreadStaticTLS_Get(low_tls_key);
+	char *high = (char *) RPyThreadStaticTLS_Get(high_tls_key);
+	long length = requested_length;
+
+	if (low < baseptr && baseptr <= high && baseptr - low < length)
+		length = baseptr - low;
+	_LLstacktoobig_stack_length = length;
+}
+
+/* The first time we see a thread: returns the real base of its stack,
+   or 'curptr' if we don't know it. */
+static char *_LL_stack_new_thread(char *curptr)
+{
+	char *low, *high;
+	long margin;
+
+	if (!_LL_stack_query_bounds(&low, &high) ||
+	    !(low < curptr && curptr <= high))
+		return curptr;
+	margin = (high - low) / 4;
+	if (margin > STACK_SAFETY_MARGIN)
+		margin = STACK_SAFETY_MARGIN;
+	RPyThreadStaticTLS_Set(low_tls_key, low + margin);
+	RPyThreadStaticTLS_Set(high_tls_key, high);
+	return high;
+}
 
 void LL_stack_set_length_fraction(double fraction)
 {
-	_LLstacktoobig_stack_length = (long)(MAX_STACK_SIZE * fraction);
+	requested_length = (long)(MAX_STACK_SIZE * fraction);
+	if (end_tls_key_created && _LLstacktoobig_stack_end != NULL)
+		_LL_stack_update_length(_LLstacktoobig_stack_end);
+	else
+		_LLstacktoobig_stack_length = requested_length;
 }
 
 char LL_stack_too_big_slowpath(long current)
@@ -59,27 +161,20 @@ char LL_stack_too_big_slowpath(long current)
 	   if it is still 0 or if we later find a 'curptr' position
 	   that is above it.  The real stack_end pointer is stored in
 	   thread-local storage, but we try to minimize its overhead by
-	   keeping a local copy in _LLstacktoobig_stack_end. */
-
-	if (_LLstacktoobig_stack_end == NULL) {
-		/* not initialized */
-		/* XXX We assume that initialization is performed early,
-		   when there is still only one thread running.  This
-		   allows us to ignore race conditions here */
-		char *errmsg = RPyThreadStaticTLS_Create(&end_tls_key);
-		if (errmsg) {
-			/* XXX should we exit the process? */
-			fprintf(stderr, "Internal PyPy error: %s\n", errmsg);
-			return 1;
-		}
-	}
+	   keeping a local copy in _LLstacktoobig_stack_end.  Similarly,
+	   _LLstacktoobig_stack_length is updated for the current thread. */
+
+	if (_LL_stack_create_key() < 0)
+		return 1;
 
 	baseptr = (char *) RPyThreadStaticTLS_Get(end_tls_key);
-	max_stack_size = _LLstacktoobig_stack_length;
 	if (baseptr == NULL) {
 		/* first time we see this thread */
+		baseptr = _LL_stack_new_thread(curptr);
 	}
 	else {
+		_LL_stack_update_length(baseptr);
+		max_stack_size = _LLstacktoobig_stack_length;
 		diff = baseptr - curptr;
 		if (((unsigned long)diff) <= (unsigned long)max_stack_size) {
 			/* within bounds, probably just had a thread switch */
@@ -93,13 +188,32 @@ char LL_stack_too_big_slowpath(long current)
 		else {	/* stack overflow (probably) */
 			return _LLstacktoobig_report_error;
 		}
+		baseptr = curptr;
 	}
 
-	/* update the stack base pointer to the current value */
-	baseptr = curptr;
+	/* update the stack base pointer */
 	RPyThreadStaticTLS_Set(end_tls_key, baseptr);
 	_LLstacktoobig_stack_end = baseptr;
+	_LL_stack_update_length(baseptr);
 	return 0;
 }
 
+char *LL_stack_replace_end(char *new_end)
+{
+	/* Called when the current thread switches to a different stack,
+	   e.g. by stacklets running in separate stacks.  'new_end' is
+	   the base of the new stack, or NULL if it is not known yet (it
+	   is then computed by the slow path as usual).  Returns the base
+	   of the stack that we are leaving. */
+	char *old_end;
+	if (_LL_stack_create_key() < 0)
+		return NULL;
+	old_end = (char *) RPyThreadStaticTLS_Get(end_tls_key);
+	RPyThreadStaticTLS_Set(end_tls_key, new_end);
+	_LLstacktoobig_stack_end = new_end;
+	if (new_end != NULL)
+		_LL_stack_update_length(new_end);
+	return old_end;
+}
+
 #endif
@@ -0,0 +1,200 @@
+/************************************************************
+ * Microbenchmark of stacklet_switch().
+ *
+ * For both implementations (copying the stack, and separate stacks)
+ * and for each combination of:
+ *
+ *   depth:  the bytes of stack used by each stacklet, between the point
+ *           where it was created and the point where it switches;
+ *   live:   the number of suspended stacklets that the main stack
+ *           switches to and from, round-robin;
+ *   lazy:   the bytes of stack that the main stack uses below the point
+ *           where the stacklets were created.  This part of the main
+ *           stack is saved lazily, i.e. only because it overlaps the
+ *           stack of the stacklet that we switch to;
+ *
+ * we measure the time per switch, and the number of bytes copied and
+ * of calls to malloc() (or mmap()) per switch.  The results are printed
+ * as one JSON object per line, to be compared with benchcompare.py.
+ *
+ * Usage: run_bench [min_time_in_ms]
+ *
+ * The counting is done by including stacklet.c directly, after
+ * redefining memcpy(), malloc() and mmap().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#ifndef _WIN32
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+static long count_bytes, count_mallocs;
+
+static void *bench_memcpy(void *dest, const void *src, size_t n)
+{
+  count_bytes += n;
+  return memcpy(dest, src, n);
+}
+
+static void *bench_malloc(size_t size)
+{
+  count_mallocs++;
+  return malloc(size);
+}
+
+#ifndef _WIN32
+static void *bench_mmap(void *addr, size_t length, int prot, int flags,
+                        int fd, off_t offset)
+{
+  count_mallocs++;
+  return mmap(addr, length, prot, flags, fd, offset);
+}
+#  define mmap    bench_mmap
+#endif
+#define memcpy  bench_memcpy
+#define malloc  bench_malloc
+
+#include "stacklet.c"
+
+#undef memcpy
+#undef malloc
+#undef mmap
+
+/************************************************************/
+
+#define FRAME_SIZE  256
+
+static stacklet_thread_handle thrd;
+static stacklet_handle *handles;
+static long live, rounds;
+static int stopping;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Call 'fn(h)' after using about 'bytes' more bytes of stack.
+ */
+static stacklet_handle at_depth(long bytes,
+                                stacklet_handle (*fn)(stacklet_handle),
+                                stacklet_handle h)
+{
+  volatile char frame[FRAME_SIZE];
+  if (bytes < FRAME_SIZE)
+    return fn(h);
+  frame[0] = 0;
+  h = at_depth(bytes - FRAME_SIZE, fn, h);
+  frame[FRAME_SIZE - 1] = frame[0];     /* not a tail call */
+  return h;
+}
+
+static stacklet_handle switch_back_forever(stacklet_handle h)
+{
+  while (!stopping)
+    h = stacklet_switch(thrd, h);
+  return h;
+}
+
+static stacklet_handle bench_callback(stacklet_handle h, void *arg)
+{
+  return at_depth((long)arg, switch_back_forever, h);
+}
+
+static stacklet_handle round_robin(stacklet_handle unused)
+{
+  long n, i;
+  for (n = 0; n < rounds; n++)
+    for (i = 0; i < live; i++)
+      handles[i] = stacklet_switch(thrd, handles[i]);
+  return NULL;
+}
+
+static void run_one(int separate, long depth, long nlive, long lazy,
+                    double min_time)
+{
+  long i, switches, bytes, mallocs;
+  double t0, elapsed, best = -1.0;
+  int repeat;
+
+  thrd = separate ? stacklet_newthread_separate(0) : stacklet_newthread();
+  if (thrd == NULL)
+    return;      /* not available on this platform */
+  live = nlive;
+  handles = (stacklet_handle *)malloc(live * sizeof(stacklet_handle));
+  stopping = 0;
+  for (i = 0; i < live; i++)
+    {
+      handles[i] = stacklet_new(thrd, bench_callback, (void *)depth);
+      assert(handles[i] != NULL && handles[i] != EMPTY_STACKLET_HANDLE);
+    }
+
+  /* warm up the pools, and find how many rounds we need */
+  rounds = 1;
+  while (1)
+    {
+      t0 = now();
+      at_depth(lazy, round_robin, NULL);
+      elapsed = now() - t0;
+      if (elapsed >= min_time / 5.0 || rounds >= (1L << 30))
+        break;
+      rounds *= 2;
+    }
+
+  /* the best of 5 runs */
+  count_bytes = count_mallocs = 0;
+  for (repeat = 0; repeat < 5; repeat++)
+    {
+      t0 = now();
+      at_depth(lazy, round_robin, NULL);
+      elapsed = now() - t0;
+      if (best < 0.0 || elapsed < best)
+        best = elapsed;
+    }
+  switches = 2 * rounds * live;     /* to the stacklet and back */
+  bytes = count_bytes;
+  mallocs = count_mallocs;
+
+  stopping = 1;
+  for (i = 0; i < live; i++)
+    {
+      handles[i] = stacklet_switch(thrd, handles[i]);
+      assert(handles[i] == EMPTY_STACKLET_HANDLE);
+    }
+  free(handles);
+  stacklet_deletethread(thrd);
+
+  printf("{\"mode\": \"%s\", \"depth\": %ld, \"live\": %ld, \"lazy\": %ld, "
+         "\"switches\": %ld, \"ns_per_switch\": %.2f, "
+         "\"bytes_per_switch\": %.1f, \"mallocs_per_switch\": %.4f}\n",
+         separate ? "separate" : "copy", depth, nlive, lazy, switches,
+         best * 1e9 / switches, (double)bytes / (5 * switches),
+         (double)mallocs / (5 * switches));
+  fflush(stdout);
+}
+
+static long depths[] = { 0, 1024, 16384, 131072, -1 };
+static long lives[]  = { 1, 16, 256, -1 };
+static long lazies[] = { 0, 4096, 65536, -1 };
+
+int main(int argc, char **argv)
+{
+  double min_time = 0.2;
+  int separate, a, b, c;
+  if (argc > 1)
+    min_time = atoi(argv[1]) / 1000.0;
+
+  for (separate = 0; separate < 2; separate++)
+    for (a = 0; depths[a] >= 0; a++)
+      for (b = 0; lives[b] >= 0; b++)
+        for (c = 0; lazies[c] >= 0; c++)
+          run_one(separate, depths[a], lives[b], lazies[c], min_time);
+  return 0;
+}
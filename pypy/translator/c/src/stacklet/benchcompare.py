@@ -0,0 +1,69 @@
+#! /usr/bin/env python
+"""
+Syntax:
+    python benchcompare.py [-t percent] <old.json> <new.json>
+
+Compare two outputs of run_bench (see bench.c).  Prints the results that
+got slower by more than 'percent' (default 10), or that now copy more
+bytes or call malloc() more often, and exits with status 1 if there is
+any.
+"""
+import sys
+import json
+
+
+def load(filename):
+    results = {}
+    f = open(filename)
+    try:
+        for line in f:
+            line = line.strip()
+            if line:
+                r = json.loads(line)
+                key = (r['mode'], r['depth'], r['live'], r['lazy'])
+                results[key] = r
+    finally:
+        f.close()
+    return results
+
+def compare(old, new, threshold):
+    regressions = []
+    for key in sorted(new):
+        if key not in old:
+            continue
+        o = old[key]
+        n = new[key]
+        ratio = n['ns_per_switch'] / max(o['ns_per_switch'], 0.01)
+        problems = []
+        if ratio > 1.0 + threshold / 100.0:
+            problems.append('%.2f ns -> %.2f ns (%+.0f%%)' % (
+                o['ns_per_switch'], n['ns_per_switch'], (ratio - 1) * 100))
+        if n['bytes_per_switch'] > o['bytes_per_switch']:
+            problems.append('%.1f -> %.1f bytes' % (
+                o['bytes_per_switch'], n['bytes_per_switch']))
+        if n['mallocs_per_switch'] > o['mallocs_per_switch']:
+            problems.append('%.4f -> %.4f mallocs' % (
+                o['mallocs_per_switch'], n['mallocs_per_switch']))
+        if problems:
+            regressions.append((key, problems))
+    return regressions
+
+def main(argv):
+    threshold = 10.0
+    if argv and argv[0] == '-t':
+        threshold = float(argv[1])
+        argv = argv[2:]
+    if len(argv) != 2:
+        print __doc__
+        sys.exit(2)
+    regressions = compare(load(argv[0]), load(argv[1]), threshold)
+    for (mode, depth, live, lazy), problems in regressions:
+        print '%-8s depth=%-6d live=%-3d lazy=%-5d %s' % (
+            mode, depth, live, lazy, ', '.join(problems))
+    if regressions:
+        sys.exit(1)
+    print 'no regression'
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
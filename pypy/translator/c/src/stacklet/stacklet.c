@@ -7,6 +7,10 @@
 #include <stddef.h>
 #include <assert.h>
 #include <string.h>
+#ifndef _WIN32
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
 
 /************************************************************
  * platform specific code
@@ -49,11 +53,48 @@ struct stacklet_s {
      * this points to the next stacklet with a partially unsaved stack,
      * creating a linked list with each stacklet's stack_stop higher
      * than the previous one.  The last entry in the list is always the
-     * main stack.
+     * main stack.  When the stacklet is in the pool of free blocks of
+     * its thread, this is the next block of the same size class.
      */
     struct stacklet_s *stack_prev;
+
+    /* The size class of this block, or -1 if it was malloc()ed with
+     * its exact size because it is too big for the pool, or
+     * SEPARATE_STACK.
+     */
+    int size_class;
+
+    /* Only for SEPARATE_STACK: the size of the mmap()ed area, and the
+     * value given to the 'stack end hook' when switching to this stack.
+     */
+    ptrdiff_t mapping_size;
+    char *stack_end_for_hook;
 };
 
+/* With separate stacks (see stacklet_newthread_separate()), a stacklet
+ * is not a copy of a part of the stack, but the descriptor of a whole
+ * stack.  There is one such descriptor per stack, stored at the top of
+ * the stack's mmap()ed area, or in the stacklet_thread_s for the main
+ * stack.  'stack_start' is the stack pointer saved when the stack was
+ * suspended; 'stack_saved' is always 0.
+ */
+#define SEPARATE_STACK     (-2)
+#define SEPARATE_STACK_DEFAULT_SIZE  (sizeof(void *) >= 8 ?             \
+                                      8 * 1024 * 1024 : 2 * 1024 * 1024)
+#define SEPARATE_STACK_HEADER  ((sizeof(struct stacklet_s) + 63) & ~63)
+#define SEPARATE_STACK_POOL    8    /* free stacks kept per thread */
+
+/* The blocks holding the stacklets are recycled in a per-thread pool,
+ * to avoid a malloc() and a free() for every switch.  There are four
+ * size classes per power of two, from POOL_MIN_SIZE bytes to just
+ * below POOL_MIN_SIZE << (POOL_NUM_CLASSES / 4); larger blocks are not
+ * pooled.  A thread keeps at most POOL_MAX_BYTES in its pool.
+ */
+#define POOL_MIN_SHIFT     8
+#define POOL_MIN_SIZE      ((ptrdiff_t)1 << POOL_MIN_SHIFT)
+#define POOL_NUM_CLASSES   40
+#define POOL_MAX_BYTES     ((ptrdiff_t)1024 * 1024)
+
 void *(*_stacklet_switchstack)(void*(*)(void*, void*),
                                void*(*)(void*, void*), void*) = NULL;
 void (*_stacklet_initialstub)(struct stacklet_thread_s *,
@@ -65,10 +106,100 @@ struct stacklet_thread_s {
     char *g_current_stack_marker;
     struct stacklet_s *g_source;
     struct stacklet_s *g_target;
+    struct stacklet_s *g_pool[POOL_NUM_CLASSES];
+    ptrdiff_t g_pool_bytes;
+    long g_pool_stats[STACKLET_POOL_NUM_STATS];
+
+    /* only with separate stacks */
+    int g_separate;
+    ptrdiff_t g_stack_size;
+    struct stacklet_s g_main;          /* descriptor of the main stack */
+    struct stacklet_s *g_current;      /* the stack now running */
+    struct stacklet_s *g_dead;         /* the stack that just finished */
+    stacklet_run_fn g_run;
+    void *g_run_arg;
+    char *(*g_stack_end_hook)(char *);
 };
 
 /***************************************************************/
 
+/* Returns the size class to use for blocks of 'size' bytes, or -1,
+ * and in '*class_size' the size of the blocks of this class.
+ */
+static int g_size_class(ptrdiff_t size, ptrdiff_t *class_size)
+{
+    /* the class sizes are 'm << (s + POOL_MIN_SHIFT - 2)', for 'm'
+       between 4 and 7; here, 'm' starts as the size in units of
+       POOL_MIN_SIZE/4, rounded up, and is halved until it fits */
+    ptrdiff_t m = (size + (POOL_MIN_SIZE / 4 - 1)) >> (POOL_MIN_SHIFT - 2);
+    int s = 0;
+    while (m > 8) {
+        m = (m + 1) >> 1;
+        s++;
+    }
+    if (m <= 4)
+        m = 4;
+    else if (m == 8) {
+        m = 4;
+        s++;
+    }
+    if (s * 4 + (int)(m - 4) >= POOL_NUM_CLASSES)
+        return -1;
+    *class_size = m << (s + POOL_MIN_SHIFT - 2);
+    return s * 4 + (int)(m - 4);
+}
+
+static ptrdiff_t g_class_size(int size_class)
+{
+    return (ptrdiff_t)(4 + (size_class & 3)) <<
+        (size_class / 4 + POOL_MIN_SHIFT - 2);
+}
+
+static struct stacklet_s *g_allocate(struct stacklet_thread_s *thrd,
+                                     ptrdiff_t size)
+{
+    struct stacklet_s *g;
+    ptrdiff_t class_size;
+    int size_class = g_size_class(size, &class_size);
+
+    if (size_class < 0) {
+        thrd->g_pool_stats[STACKLET_POOL_MISSES]++;
+        g = malloc(size);
+    }
+    else {
+        g = thrd->g_pool[size_class];
+        if (g != NULL) {
+            thrd->g_pool_stats[STACKLET_POOL_HITS]++;
+            thrd->g_pool[size_class] = g->stack_prev;
+            thrd->g_pool_bytes -= class_size;
+            return g;
+        }
+        thrd->g_pool_stats[STACKLET_POOL_MISSES]++;
+        g = malloc(class_size);
+    }
+    if (g != NULL)
+        g->size_class = size_class;
+    return g;
+}
+
+static void g_free(struct stacklet_thread_s *thrd, struct stacklet_s *g)
+{
+    int size_class = g->size_class;
+    if (size_class >= 0) {
+        ptrdiff_t class_size = g_class_size(size_class);
+        if (thrd->g_pool_bytes + class_size <= POOL_MAX_BYTES) {
+            g->stack_prev = thrd->g_pool[size_class];
+            thrd->g_pool[size_class] = g;
+            thrd->g_pool_bytes += class_size;
+            return;
+        }
+    }
+    thrd->g_pool_stats[STACKLET_POOL_FREES]++;
+    free(g);
+}
+
+/***************************************************************/
+
 static void g_save(struct stacklet_s* g, char* stop
 #ifdef DEBUG_DUMP
                    , int overwrite_stack_for_debug
@@ -123,7 +254,7 @@ static int g_allocate_source_stacklet(void *old_stack_pointer,
     ptrdiff_t stack_size = (thrd->g_current_stack_stop -
                             (char *)old_stack_pointer);
 
-    thrd->g_source = malloc(sizeof(struct stacklet_s) + stack_size);
+    thrd->g_source = g_allocate(thrd, sizeof(struct stacklet_s) + stack_size);
     if (thrd->g_source == NULL)
         return -1;
 
@@ -211,7 +342,7 @@ static void *g_destroy_state(void *old_stack_pointer, void *rawthrd)
 }
 
 /* Restore the C stack by copying back from the heap in 'g_target',
- * and free 'g_target'.
+ * and give 'g_target' back to the pool.
  */
 static void *g_restore_state(void *new_stack_pointer, void *rawthrd)
 {
@@ -227,7 +358,7 @@ static void *g_restore_state(void *new_stack_pointer, void *rawthrd)
     memcpy(g->stack_start - stack_saved, g+1, stack_saved);
 #endif
     thrd->g_current_stack_stop = g->stack_stop;
-    free(g);
+    g_free(thrd, g);
     return EMPTY_STACKLET_HANDLE;
 }
 
@@ -256,6 +387,146 @@ static void g_initialstub(struct stacklet_thread_s *thrd,
     /* The second time it returns. */
 }
 
+/************************************************************
+ * separate stacks
+ */
+
+#ifndef _WIN32
+
+static struct stacklet_s *s_allocate_stack(struct stacklet_thread_s *thrd)
+{
+    struct stacklet_s *g;
+    char *mapping;
+    ptrdiff_t size = thrd->g_stack_size;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    g = thrd->g_pool[0];
+    if (g != NULL) {
+        thrd->g_pool_stats[STACKLET_POOL_HITS]++;
+        thrd->g_pool[0] = g->stack_prev;
+        thrd->g_pool_bytes -= g->mapping_size;
+    }
+    else {
+        thrd->g_pool_stats[STACKLET_POOL_MISSES]++;
+#ifdef MAP_NORESERVE
+        flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+        flags |= MAP_STACK;
+#endif
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (mapping == MAP_FAILED)
+            return NULL;
+        /* the guard page, at the far end of the stack */
+        if (mprotect(mapping, sysconf(_SC_PAGESIZE), PROT_NONE) != 0) {
+            munmap(mapping, size);
+            return NULL;
+        }
+        g = (struct stacklet_s *)(mapping + size - SEPARATE_STACK_HEADER);
+        g->size_class = SEPARATE_STACK;
+        g->mapping_size = size;
+    }
+    /* the stack pointer to start with: 'g' is aligned to 64 bytes */
+    g->stack_start = (char *)g;
+    g->stack_stop = (char *)g;
+    g->stack_saved = 0;
+    g->stack_prev = NULL;
+    g->stack_end_for_hook = (char *)g;
+    return g;
+}
+
+static void s_free_stack(struct stacklet_thread_s *thrd, struct stacklet_s *g)
+{
+    /* 'thrd' may not be the thread that created 'g', see
+       stacklet_destroy(), and it may not even use separate stacks */
+    if (thrd->g_separate && g->mapping_size == thrd->g_stack_size &&
+            thrd->g_pool_bytes < SEPARATE_STACK_POOL * thrd->g_stack_size) {
+        g->stack_prev = thrd->g_pool[0];
+        thrd->g_pool[0] = g;
+        thrd->g_pool_bytes += g->mapping_size;
+        return;
+    }
+    thrd->g_pool_stats[STACKLET_POOL_FREES]++;
+    munmap(((char *)g) + SEPARATE_STACK_HEADER - g->mapping_size,
+           g->mapping_size);
+}
+
+/* Leave the current stack, which can be resumed later, and jump to
+ * 'g_target'.
+ */
+static void *s_save_state(void *old_stack_pointer, void *rawthrd)
+{
+    struct stacklet_thread_s *thrd = (struct stacklet_thread_s *)rawthrd;
+    struct stacklet_s *current = thrd->g_current;
+    current->stack_start = old_stack_pointer;
+    thrd->g_source = current;
+    if (thrd->g_stack_end_hook != NULL)
+        current->stack_end_for_hook =
+            thrd->g_stack_end_hook(thrd->g_target->stack_end_for_hook);
+    return thrd->g_target->stack_start;
+}
+
+/* Leave the current stack, whose run() function has finished, and jump
+ * to 'g_target'.
+ */
+static void *s_save_state_finished(void *old_stack_pointer, void *rawthrd)
+{
+    struct stacklet_thread_s *thrd = (struct stacklet_thread_s *)rawthrd;
+    thrd->g_source = EMPTY_STACKLET_HANDLE;
+    if (thrd->g_stack_end_hook != NULL)
+        thrd->g_stack_end_hook(thrd->g_target->stack_end_for_hook);
+    return thrd->g_target->stack_start;
+}
+
+/* Now running on the target stack: nothing to restore.
+ */
+static void *s_restore_state(void *new_stack_pointer, void *rawthrd)
+{
+    struct stacklet_thread_s *thrd = (struct stacklet_thread_s *)rawthrd;
+    thrd->g_current = thrd->g_target;
+    if (thrd->g_dead != NULL) {
+        s_free_stack(thrd, thrd->g_dead);
+        thrd->g_dead = NULL;
+    }
+    return EMPTY_STACKLET_HANDLE;
+}
+
+/* Called as the 'restore_state' of the switch to a fresh stack: this
+ * becomes the bottom frame of the new stack, so it must never return.
+ */
+static void *s_start_new_stack(void *new_stack_pointer, void *rawthrd)
+{
+    struct stacklet_thread_s *thrd = (struct stacklet_thread_s *)rawthrd;
+    struct stacklet_s *current = thrd->g_target;
+    struct stacklet_s *result;
+
+    thrd->g_current = current;
+    result = thrd->g_run(thrd->g_source, thrd->g_run_arg);
+
+    /* Then switch to 'result', and free this stack from there. */
+    thrd->g_dead = current;
+    thrd->g_target = result;
+    _stacklet_switchstack(s_save_state_finished, s_restore_state, thrd);
+
+    assert(!"stacklet: we should not return here");
+    abort();
+    return NULL;
+}
+
+static stacklet_handle s_new(struct stacklet_thread_s *thrd,
+                             stacklet_run_fn run, void *run_arg)
+{
+    thrd->g_target = s_allocate_stack(thrd);
+    if (thrd->g_target == NULL)
+        return NULL;
+    thrd->g_run = run;
+    thrd->g_run_arg = run_arg;
+    _stacklet_switchstack(s_save_state, s_start_new_stack, thrd);
+    return thrd->g_source;
+}
+
+#endif  /* !_WIN32 */
+
 /************************************************************/
 
 stacklet_thread_handle stacklet_newthread(void)
@@ -275,8 +546,53 @@ stacklet_thread_handle stacklet_newthread(void)
     return thrd;
 }
 
+stacklet_thread_handle stacklet_newthread_separate(long stack_size)
+{
+#ifdef _WIN32
+    return NULL;
+#else
+    struct stacklet_thread_s *thrd;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (stack_size <= 0)
+        stack_size = SEPARATE_STACK_DEFAULT_SIZE;
+    stack_size = (stack_size + page_size - 1) & ~(page_size - 1);
+    if (stack_size < 4 * page_size)
+        stack_size = 4 * page_size;
+
+    thrd = stacklet_newthread();
+    if (thrd != NULL) {
+        thrd->g_separate = 1;
+        thrd->g_stack_size = stack_size;
+        thrd->g_main.size_class = SEPARATE_STACK;
+        thrd->g_current = &thrd->g_main;
+    }
+    return thrd;
+#endif
+}
+
+void stacklet_set_stack_end_hook(stacklet_thread_handle thrd,
+                                 char *(*hook)(char *))
+{
+    thrd->g_stack_end_hook = hook;
+}
+
 void stacklet_deletethread(stacklet_thread_handle thrd)
 {
+    int i;
+    for (i = 0; i < POOL_NUM_CLASSES; i++) {
+        while (thrd->g_pool[i] != NULL) {
+            struct stacklet_s *g = thrd->g_pool[i];
+            thrd->g_pool[i] = g->stack_prev;
+#ifndef _WIN32
+            if (thrd->g_separate)
+                munmap(((char *)g) + SEPARATE_STACK_HEADER - g->mapping_size,
+                       g->mapping_size);
+            else
+#endif
+                free(g);
+        }
+    }
     free(thrd);
 }
 
@@ -284,6 +600,10 @@ stacklet_handle stacklet_new(stacklet_thread_handle thrd,
                              stacklet_run_fn run, void *run_arg)
 {
     long stackmarker;
+#ifndef _WIN32
+    if (thrd->g_separate)
+        return s_new(thrd, run, run_arg);
+#endif
     assert((char *)NULL < (char *)&stackmarker);
     if (thrd->g_current_stack_stop <= (char *)&stackmarker)
         thrd->g_current_stack_stop = ((char *)&stackmarker) + 1;
@@ -297,6 +617,13 @@ stacklet_handle stacklet_switch(stacklet_thread_handle thrd,
                                 stacklet_handle target)
 {
     long stackmarker;
+#ifndef _WIN32
+    if (thrd->g_separate) {
+        thrd->g_target = target;
+        _stacklet_switchstack(s_save_state, s_restore_state, thrd);
+        return thrd->g_source;
+    }
+#endif
     if (thrd->g_current_stack_stop <= (char *)&stackmarker)
         thrd->g_current_stack_stop = ((char *)&stackmarker) + 1;
 
@@ -307,6 +634,15 @@ stacklet_handle stacklet_switch(stacklet_thread_handle thrd,
 
 void stacklet_destroy(stacklet_thread_handle thrd, stacklet_handle target)
 {
+#ifndef _WIN32
+    if (target->size_class == SEPARATE_STACK) {
+        /* the main stack's descriptor is not freed; the main stack is
+           just never resumed */
+        if (target->mapping_size != 0)
+            s_free_stack(thrd, target);
+        return;
+    }
+#endif
     /* remove 'target' from the chained list 'unsaved_stack', if it is there */
     struct stacklet_s **pp = &thrd->g_stack_chain_head;
     for (; *pp != NULL; pp = &(*pp)->stack_prev)
@@ -314,15 +650,24 @@ void stacklet_destroy(stacklet_thread_handle thrd, stacklet_handle target)
             *pp = target->stack_prev;
             break;
         }
-    free(target);
+    g_free(thrd, target);
+}
+
+long stacklet_pool_stat(stacklet_thread_handle thrd, int which)
+{
+    if (which == STACKLET_POOL_BYTES)
+        return (long)thrd->g_pool_bytes;
+    if (which < 0 || which >= STACKLET_POOL_NUM_STATS)
+        return -1;
+    return thrd->g_pool_stats[which];
 }
 
 char **_stacklet_translate_pointer(stacklet_handle context, char **ptr)
 {
   char *p = (char *)ptr;
   long delta;
-  if (context == NULL)
-    return ptr;
+  if (context == NULL || context->size_class == SEPARATE_STACK)
+    return ptr;      /* separate stacks are never moved */
   delta = p - context->stack_start;
   if (((unsigned long)delta) < ((unsigned long)context->stack_saved)) {
       /* a pointer to a saved away word */
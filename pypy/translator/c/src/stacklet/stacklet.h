@@ -24,6 +24,22 @@ typedef struct stacklet_thread_s *stacklet_thread_handle;
 stacklet_thread_handle stacklet_newthread(void);
 void stacklet_deletethread(stacklet_thread_handle thrd);
 
+/* Alternative implementation: the stacklets of this thread each run in
+ * their own mmap()ed stack of 'stack_size' bytes (0 for the default),
+ * with a guard page at the end.  Instead of copying parts of the stack
+ * around, a switch only saves and restores the registers.  The rest of
+ * the API is the same.  Returns NULL if not available on this platform.
+ */
+stacklet_thread_handle stacklet_newthread_separate(long stack_size);
+
+/* With separate stacks: 'hook(end)' is called just before every switch
+ * with the end (highest address) of the stack we switch to, and returns
+ * the end of the stack we leave, as it was last set.  Needed e.g. to
+ * keep stack overflow detection working.
+ */
+void stacklet_set_stack_end_hook(stacklet_thread_handle thrd,
+                                 char *(*hook)(char *));
+
 
 /* The "run" function of a stacklet.  The first argument is the handle
  * of the stack from where we come.  When such a function returns, it
@@ -52,6 +68,18 @@ stacklet_handle stacklet_switch(stacklet_thread_handle thrd,
  */
 void stacklet_destroy(stacklet_thread_handle thrd, stacklet_handle target);
 
+/* Statistics about the pool in which a thread recycles the memory
+ * holding the suspended stacks: the number of allocations served from
+ * the pool, and not, and the number of blocks really free()d.  The
+ * last one is the number of bytes currently kept in the pool.
+ */
+#define STACKLET_POOL_HITS      0
+#define STACKLET_POOL_MISSES    1
+#define STACKLET_POOL_FREES     2
+#define STACKLET_POOL_NUM_STATS 3
+#define STACKLET_POOL_BYTES     3
+long stacklet_pool_stat(stacklet_thread_handle thrd, int which);
+
 /* stacklet_handle _stacklet_switch_to_copy(stacklet_handle) --- later */
 
 /* Hack: translate a pointer into the stack of a stacklet into a pointer
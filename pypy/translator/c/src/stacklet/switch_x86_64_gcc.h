@@ -12,6 +12,11 @@ static void *slp_switch(void *(*save_state)(void*, void*),
      "pushq %%r14\n"
      "pushq %%r15\n"
 
+     "movq %%rsp, %%rbp\n" /* align the stack to 16 bytes for the calls, */
+     "andq $-16, %%rsp\n"  /* as save_state() and restore_state() may  */
+     "pushq %%rbp\n"       /* use aligned SSE instructions; keep the   */
+     "pushq %%rbp\n"       /* unaligned value (twice, for alignment)   */
+
      "movq %%rax, %%r12\n" /* save 'restore_state' for later */
      "movq %%rsi, %%r13\n" /* save 'extra' for later         */
 
@@ -34,6 +39,8 @@ static void *slp_switch(void *(*save_state)(void*, void*),
      /* The stack's content is now restored. */
 
      "0:\n"
+     "popq %%rbp\n"
+     "popq %%rsp\n"       /* undo the alignment */
      "popq %%r15\n"
      "popq %%r14\n"
      "popq %%r13\n"
@@ -6,6 +6,7 @@
 
 
 static stacklet_thread_handle thrd;
+static int separate;     /* using stacklet_newthread_separate() */
 
 /************************************************************/
 
@@ -193,6 +194,108 @@ void test_various_depths(void)
     withdepth(0, rand() % 50);
 }
 
+/************************************************************/
+
+stacklet_handle pingpong_callback(stacklet_handle h, void *arg)
+{
+  int i;
+  for (i = 0; i < 1000; i++)
+    h = stacklet_switch(thrd, h);
+  return h;
+}
+
+void test_pool(void)
+{
+  long hits, misses, frees;
+  stacklet_handle h = stacklet_new(thrd, pingpong_callback, NULL);
+
+  hits = stacklet_pool_stat(thrd, STACKLET_POOL_HITS);
+  misses = stacklet_pool_stat(thrd, STACKLET_POOL_MISSES);
+  frees = stacklet_pool_stat(thrd, STACKLET_POOL_FREES);
+  while (h != EMPTY_STACKLET_HANDLE)
+    h = stacklet_switch(thrd, h);
+
+  if (separate)
+    {
+      /* the pool is only used for whole stacks: no allocation here */
+      assert(stacklet_pool_stat(thrd, STACKLET_POOL_HITS) == hits);
+      assert(stacklet_pool_stat(thrd, STACKLET_POOL_MISSES) == misses);
+      assert(stacklet_pool_stat(thrd, STACKLET_POOL_FREES) == frees);
+      return;
+    }
+  /* after the first few switches, every save area comes from the pool */
+  assert(stacklet_pool_stat(thrd, STACKLET_POOL_HITS) - hits >= 1990);
+  assert(stacklet_pool_stat(thrd, STACKLET_POOL_MISSES) - misses <= 10);
+  assert(stacklet_pool_stat(thrd, STACKLET_POOL_FREES) == frees);
+  assert(stacklet_pool_stat(thrd, STACKLET_POOL_BYTES) > 0);
+  assert(stacklet_pool_stat(thrd, STACKLET_POOL_NUM_STATS + 1) == -1);
+}
+
+/************************************************************/
+
+static char *hook_stack_end;
+
+char *stack_end_hook(char *new_end)
+{
+  char *old_end = hook_stack_end;
+  hook_stack_end = new_end;
+  return old_end;
+}
+
+static int deep_recursion(int depth, stacklet_handle *ph)
+{
+  char buffer[1000];
+  int i, result;
+  for (i = 0; i < 1000; i++)
+    buffer[i] = (char)(depth + i);
+  if (depth == 0)
+    {
+      /* switch back and forth a lot from a deep stack */
+      if (separate)
+        assert(hook_stack_end - buffer < 250 * 1000);
+      for (i = 0; i < 100; i++)
+        *ph = stacklet_switch(thrd, *ph);
+      result = 0;
+    }
+  else
+    result = deep_recursion(depth - 1, ph);
+  for (i = 0; i < 1000; i++)
+    assert(buffer[i] == (char)(depth + i));
+  return result + 1;
+}
+
+stacklet_handle deep_callback(stacklet_handle h, void *arg)
+{
+  assert(deep_recursion(200, &h) == 201);
+  return h;
+}
+
+void test_deep(void)
+{
+  char marker[100];
+  char *main_end = marker + 100;
+  stacklet_handle h;
+
+  if (separate)
+    {
+      hook_stack_end = main_end;
+      stacklet_set_stack_end_hook(thrd, stack_end_hook);
+    }
+  h = stacklet_new(thrd, deep_callback, NULL);
+  while (h != EMPTY_STACKLET_HANDLE)
+    {
+      /* each time, the stack end of the main stack is restored */
+      if (separate)
+        assert(hook_stack_end == main_end);
+      h = stacklet_switch(thrd, h);
+    }
+  if (separate)
+    {
+      assert(hook_stack_end == main_end);
+      stacklet_set_stack_end_hook(thrd, NULL);
+    }
+}
+
 /************************************************************/
 #if 0
 
@@ -638,6 +741,8 @@ static test_t test_list[] = {
   TEST(test_new),
   TEST(test_simple_switch),
   TEST(test_various_depths),
+  TEST(test_pool),
+  TEST(test_deep),
 #if 0
   TEST(test_new_pending),
   TEST(test_not_switched),
@@ -659,13 +764,23 @@ int main(int argc, char **argv)
   if (argc > 1)
     srand(atoi(argv[1]));
 
-  thrd = stacklet_newthread();
-  for (tst=test_list; tst->runtest; tst++)
+  for (separate = 0; separate < 2; separate++)
     {
-      printf("+++ Running %s... +++\n", tst->name);
-      tst->runtest();
+      if (separate)
+        {
+          thrd = stacklet_newthread_separate(0);
+          assert(thrd != NULL);
+          printf("+++ With separate stacks: +++\n");
+        }
+      else
+        thrd = stacklet_newthread();
+      for (tst=test_list; tst->runtest; tst++)
+        {
+          printf("+++ Running %s... +++\n", tst->name);
+          tst->runtest();
+        }
+      stacklet_deletethread(thrd);
     }
-  stacklet_deletethread(thrd);
   printf("+++ All ok. +++\n");
   return 0;
 }
@@ -12,6 +12,7 @@
 
 #define RUNNING_ON_LLINTERP	0
 #define OP_JIT_RECORD_KNOWN_CLASS(i, c, r)  /* nothing */
+#define OP_EXPECT(x, expected, r)  r = RPY_EXPECT(x, expected)
 
 #define FAIL_EXCEPTION(exc, msg) \
 	{ \
@@ -5,6 +5,9 @@
 #define __PYPY_THREAD_H
 #include <assert.h>
 
+/* the number of items written by RPyGilProfileSnapshot() */
+#define RPY_GIL_PROFILE_SIZE  (6 + 2 * 32)
+
 #ifdef _WIN32
 #include "thread_nt.h"
 #else
@@ -41,5 +44,12 @@ long RPyGilAllocate(void);
 long RPyGilYieldThread(void);
 void RPyGilRelease(void);
 void RPyGilAcquire(void);
+void RPyGilSetSwitchInterval(long microseconds);
+long RPyGilGetSwitchInterval(void);
+long RPyGilThreadWaitCount(void);
+long RPyGilThreadWaitTime(void);
+long RPyGilProfileEnable(long enable);
+void RPyGilProfileReset(void);
+void RPyGilProfileSnapshot(long *result);
 
 #endif
@@ -273,5 +273,48 @@ void RPyGilAcquire(void)
     InterlockedDecrement(&pending_acquires);
 }
 
+/* XXX the Windows GIL is not the handoff-based one of thread_pthread.h:
+   the switch interval is only recorded, and no statistics are kept,
+   neither per thread nor by the contention profiler */
+static long gil_switch_interval = 5000;
+
+void RPyGilSetSwitchInterval(long microseconds)
+{
+    if (microseconds < 1)
+        microseconds = 1;
+    gil_switch_interval = microseconds;
+}
+
+long RPyGilGetSwitchInterval(void)
+{
+    return gil_switch_interval;
+}
+
+long RPyGilThreadWaitCount(void)
+{
+    return 0;
+}
+
+long RPyGilThreadWaitTime(void)
+{
+    return 0;
+}
+
+long RPyGilProfileEnable(long enable)
+{
+    return 0;
+}
+
+void RPyGilProfileReset(void)
+{
+}
+
+void RPyGilProfileSnapshot(long *result)
+{
+    int i;
+    for (i = 0; i < RPY_GIL_PROFILE_SIZE; i++)
+        result[i] = 0;
+}
+
 
 #endif /* PYPY_NOT_MAIN_FILE */
@@ -11,8 +11,10 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <sys/time.h>
 
 /* The following is hopefully equivalent to what CPython does
    (which is trying to compile a snippet of code using it) */
@@ -142,8 +144,18 @@ long RPyThreadGetIdent(void)
 
 static long _pypythread_stacksize = 0;
 
+/* Defined in profiling.c, which is not linked in every program that uses
+   threads (e.g. not in the tests of ll_thread), hence the weak symbol */
+#ifdef __GNUC__
+void pypy_profiling_thread_start(void) __attribute__((weak));
+#endif
+
 static void *bootstrap_pthread(void *func)
 {
+#ifdef __GNUC__
+  if (pypy_profiling_thread_start != NULL)
+    pypy_profiling_thread_start();
+#endif
   ((void(*)(void))func)();
   return NULL;
 }
@@ -503,43 +515,268 @@ static void _debug_print(const char *msg)
 #endif
 }
 
-static volatile long pending_acquires = -1;
-static pthread_mutex_t mutex_gil = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t cond_gil = PTHREAD_COND_INITIALIZER;
+/* The GIL is a flag 'gil_locked' protected by 'gil_mutex'.  Threads
+   that want it queue up in FIFO order, each waiting on its own
+   condition variable, and the thread releasing the GIL hands it over
+   directly to the first one: it is never up for grabs while somebody
+   is waiting, so the thread that just released it cannot immediately
+   take it back.
+
+   A waiting thread does not interrupt the running one at once: only if
+   it has been waiting for 'gil_switch_interval' microseconds without
+   any switch occurring does it set 'gil_drop_request'.  The running
+   thread checks this flag in RPyGilYieldThread(), which is cheap when
+   the flag is not set.  (This is the design of the "new GIL" of
+   CPython 3.2.)
+*/
+
+struct gil_waiter {
+    pthread_cond_t cond;
+    int granted;
+    struct gil_waiter *next;
+};
+
+static pthread_mutex_t gil_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int gil_locked = 0;
+static struct gil_waiter *gil_first_waiter = NULL;
+static struct gil_waiter *gil_last_waiter = NULL;
+static volatile long gil_drop_request = 0;
+static unsigned long gil_switch_number = 0;
+static long gil_switch_interval = 5000;      /* in microseconds */
+
+/* statistics about the time spent waiting for the GIL, per thread */
+struct gil_wait_stats {
+    long count;
+    long total_us;
+};
+#ifdef USE___THREAD
+static __thread struct gil_wait_stats gil_stats;
+#  define GIL_WAIT_STATS()  (&gil_stats)
+#else
+static pthread_key_t gil_stats_key;
+static pthread_once_t gil_stats_once = PTHREAD_ONCE_INIT;
+static struct gil_wait_stats gil_stats_fallback;
+
+static void gil_stats_key_init(void)
+{
+    pthread_key_create(&gil_stats_key, free);
+}
+
+static struct gil_wait_stats *gil_wait_stats(void)
+{
+    struct gil_wait_stats *stats;
+    pthread_once(&gil_stats_once, gil_stats_key_init);
+    stats = pthread_getspecific(gil_stats_key);
+    if (stats == NULL) {
+        stats = calloc(1, sizeof(struct gil_wait_stats));
+        if (stats == NULL)
+            return &gil_stats_fallback;
+        pthread_setspecific(gil_stats_key, stats);
+    }
+    return stats;
+}
+#  define GIL_WAIT_STATS()  gil_wait_stats()
+#endif
+
+static long gil_time_us(struct timeval *tv)
+{
+    return tv->tv_sec * 1000000L + tv->tv_usec;
+}
 
 static void assert_has_the_gil(void)
 {
 #ifdef RPY_ASSERT
-    assert(pthread_mutex_trylock(&mutex_gil) != 0);
-    assert(pending_acquires >= 0);
+    assert(gil_locked);
 #endif
 }
 
+/* GIL contention profiler, off by default; enabled with the environment
+   variable PYPY_GIL_PROFILE or RPyGilProfileEnable().  When it is off,
+   the cost is a test of 'gil_profiling' on paths that already take
+   'gil_mutex'.  All the numbers are protected by 'gil_mutex'.  The
+   durations are in microseconds, in histograms of power-of-two buckets:
+   the bucket 'n' counts durations 'd' such that 2**(n-1) <= d < 2**n,
+   and the bucket 0 counts the durations below one microsecond. */
+#define GIL_PROF_ACQUIRES           0     /* number of acquires */
+#define GIL_PROF_CONTENDED          1     /* acquires that had to wait */
+#define GIL_PROF_FORCED_SWITCHES    2     /* yields on a drop request */
+#define GIL_PROF_DROP_REQUESTS      3     /* drop requests by waiters */
+#define GIL_PROF_WAIT_TIME          4     /* total time waiting */
+#define GIL_PROF_HOLD_TIME          5     /* total time holding */
+#define GIL_PROF_NCOUNTERS          6
+#define GIL_PROF_NBUCKETS           32
+#if GIL_PROF_NCOUNTERS + 2 * GIL_PROF_NBUCKETS != RPY_GIL_PROFILE_SIZE
+#  error "RPY_GIL_PROFILE_SIZE in thread.h is out of date"
+#endif
+
+static int gil_profiling = -1;        /* -1: check the environment */
+static long gil_prof_hold_start;      /* 0: unknown */
+static long gil_prof_counters[GIL_PROF_NCOUNTERS];
+static long gil_prof_latency[GIL_PROF_NBUCKETS];
+static long gil_prof_hold[GIL_PROF_NBUCKETS];
+
+static long gil_now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return gil_time_us(&tv);
+}
+
+static void gil_prof_record(long *histogram, long duration)
+{
+    int bucket = 0;
+    while (duration > 0 && bucket < GIL_PROF_NBUCKETS - 1) {
+        duration >>= 1;
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+/* the current thread just got the GIL, after waiting 'latency' (or -1
+   if it did not have to wait) */
+static void gil_prof_acquired(long now, long latency)
+{
+    gil_prof_counters[GIL_PROF_ACQUIRES]++;
+    if (latency >= 0) {
+        gil_prof_counters[GIL_PROF_CONTENDED]++;
+        gil_prof_counters[GIL_PROF_WAIT_TIME] += latency;
+    }
+    else
+        latency = 0;
+    gil_prof_record(gil_prof_latency, latency);
+    gil_prof_hold_start = now;
+}
+
+/* the current thread is about to give up the GIL */
+static void gil_prof_released(void)
+{
+    long hold;
+    if (gil_prof_hold_start == 0)
+        return;
+    hold = gil_now_us() - gil_prof_hold_start;
+    gil_prof_counters[GIL_PROF_HOLD_TIME] += hold;
+    gil_prof_record(gil_prof_hold, hold);
+    gil_prof_hold_start = 0;
+}
+
+/* must be called with 'gil_mutex' held, by the thread holding the GIL */
+static void gil_handoff(void)
+{
+    struct gil_waiter *waiter = gil_first_waiter;
+    if (gil_profiling > 0)
+        gil_prof_released();
+    gil_drop_request = 0;
+    if (waiter == NULL) {
+        gil_locked = 0;
+        return;
+    }
+    gil_first_waiter = waiter->next;
+    if (gil_first_waiter == NULL)
+        gil_last_waiter = NULL;
+    /* 'gil_locked' stays set: the GIL now belongs to 'waiter' */
+    waiter->granted = 1;
+    gil_switch_number++;
+    ASSERT_STATUS(pthread_cond_signal(&waiter->cond));
+}
+
+/* must be called with 'gil_mutex' held; returns with the GIL */
+static void gil_wait_for_handoff(void)
+{
+    struct gil_waiter waiter;
+    struct gil_wait_stats *stats;
+    struct timeval start, now;
+    struct timespec deadline;
+    unsigned long switch_number;
+    long t;
+
+    ASSERT_STATUS(pthread_cond_init(&waiter.cond, NULL));
+    waiter.granted = 0;
+    waiter.next = NULL;
+    if (gil_last_waiter == NULL)
+        gil_first_waiter = &waiter;
+    else
+        gil_last_waiter->next = &waiter;
+    gil_last_waiter = &waiter;
+
+    gettimeofday(&start, NULL);
+    now = start;
+    while (!waiter.granted) {
+        switch_number = gil_switch_number;
+        t = gil_time_us(&now) + gil_switch_interval;
+        deadline.tv_sec = t / 1000000L;
+        deadline.tv_nsec = (t % 1000000L) * 1000L;
+        if (pthread_cond_timedwait(&waiter.cond, &gil_mutex,
+                                   &deadline) == ETIMEDOUT &&
+                !waiter.granted && switch_number == gil_switch_number) {
+            /* nobody got the GIL during a whole interval: ask the
+               running thread to drop it */
+            if (gil_profiling > 0 && !gil_drop_request)
+                gil_prof_counters[GIL_PROF_DROP_REQUESTS]++;
+            gil_drop_request = 1;
+        }
+        gettimeofday(&now, NULL);
+    }
+    ASSERT_STATUS(pthread_cond_destroy(&waiter.cond));
+
+    stats = GIL_WAIT_STATS();
+    stats->count++;
+    stats->total_us += gil_time_us(&now) - gil_time_us(&start);
+    if (gil_profiling > 0)
+        gil_prof_acquired(gil_time_us(&now),
+                          gil_time_us(&now) - gil_time_us(&start));
+}
+
+static void gil_after_fork_child(void)
+{
+    /* the other threads are gone, and so are their waiters; the thread
+       that called fork() holds the GIL */
+    pthread_mutex_init(&gil_mutex, NULL);
+    gil_first_waiter = NULL;
+    gil_last_waiter = NULL;
+    gil_drop_request = 0;
+}
+
 long RPyGilAllocate(void)
 {
+    static int atfork_registered = 0;
     _debug_print("RPyGilAllocate\n");
-    pending_acquires = 0;
-    pthread_mutex_trylock(&mutex_gil);
-    assert_has_the_gil();
+    if (!atfork_registered) {
+        if (pthread_atfork(NULL, NULL, gil_after_fork_child) != 0)
+            return 0;
+        atfork_registered = 1;
+    }
+    ASSERT_STATUS(pthread_mutex_lock(&gil_mutex));
+    gil_locked = 1;
+    if (gil_profiling < 0) {
+        char *s = getenv("PYPY_GIL_PROFILE");
+        gil_profiling = (s != NULL && s[0] != '\0' && s[0] != '0');
+    }
+    if (gil_profiling > 0)
+        gil_prof_hold_start = gil_now_us();
+    ASSERT_STATUS(pthread_mutex_unlock(&gil_mutex));
     return 1;
 }
 
 long RPyGilYieldThread(void)
 {
     /* can be called even before RPyGilAllocate(), but in this case,
-       pending_acquires will be -1 */
-#ifdef RPY_ASSERT
-    if (pending_acquires >= 0)
-        assert_has_the_gil();
-#endif
-    if (pending_acquires <= 0)
+       gil_drop_request is 0 */
+    if (!gil_drop_request)
+        return 0;
+    assert_has_the_gil();
+    ASSERT_STATUS(pthread_mutex_lock(&gil_mutex));
+    if (gil_first_waiter == NULL) {
+        gil_drop_request = 0;
+        ASSERT_STATUS(pthread_mutex_unlock(&gil_mutex));
         return 0;
-    atomic_add(&pending_acquires, 1L);
+    }
     _debug_print("{");
-    ASSERT_STATUS(pthread_cond_signal(&cond_gil));
-    ASSERT_STATUS(pthread_cond_wait(&cond_gil, &mutex_gil));
+    if (gil_profiling > 0)
+        gil_prof_counters[GIL_PROF_FORCED_SWITCHES]++;
+    gil_handoff();
+    gil_wait_for_handoff();
     _debug_print("}");
-    atomic_add(&pending_acquires, -1L);
+    ASSERT_STATUS(pthread_mutex_unlock(&gil_mutex));
     assert_has_the_gil();
     return 1;
 }
@@ -547,26 +784,89 @@ long RPyGilYieldThread(void)
 void RPyGilRelease(void)
 {
     _debug_print("RPyGilRelease\n");
-#ifdef RPY_ASSERT
-    assert(pending_acquires >= 0);
-#endif
     assert_has_the_gil();
-    ASSERT_STATUS(pthread_mutex_unlock(&mutex_gil));
-    ASSERT_STATUS(pthread_cond_signal(&cond_gil));
+    ASSERT_STATUS(pthread_mutex_lock(&gil_mutex));
+    gil_handoff();
+    ASSERT_STATUS(pthread_mutex_unlock(&gil_mutex));
 }
 
 void RPyGilAcquire(void)
 {
     _debug_print("about to RPyGilAcquire...\n");
-#ifdef RPY_ASSERT
-    assert(pending_acquires >= 0);
-#endif
-    atomic_add(&pending_acquires, 1L);
-    ASSERT_STATUS(pthread_mutex_lock(&mutex_gil));
-    atomic_add(&pending_acquires, -1L);
+    ASSERT_STATUS(pthread_mutex_lock(&gil_mutex));
+    if (!gil_locked) {
+        gil_locked = 1;
+        if (gil_profiling > 0)
+            gil_prof_acquired(gil_now_us(), -1);
+    }
+    else
+        gil_wait_for_handoff();
+    ASSERT_STATUS(pthread_mutex_unlock(&gil_mutex));
     assert_has_the_gil();
     _debug_print("RPyGilAcquire\n");
 }
 
+void RPyGilSetSwitchInterval(long microseconds)
+{
+    if (microseconds < 1)
+        microseconds = 1;
+    gil_switch_interval = microseconds;
+}
+
+long RPyGilGetSwitchInterval(void)
+{
+    return gil_switch_interval;
+}
+
+long RPyGilThreadWaitCount(void)
+{
+    return GIL_WAIT_STATS()->count;
+}
+
+long RPyGilThreadWaitTime(void)
+{
+    return GIL_WAIT_STATS()->total_us;
+}
+
+long RPyGilProfileEnable(long enable)
+{
+    long previous;
+    ASSERT_STATUS(pthread_mutex_lock(&gil_mutex));
+    previous = gil_profiling > 0;
+    gil_profiling = enable != 0;
+    /* called with the GIL: it is held from now on */
+    gil_prof_hold_start = gil_profiling ? gil_now_us() : 0;
+    ASSERT_STATUS(pthread_mutex_unlock(&gil_mutex));
+    return previous;
+}
+
+void RPyGilProfileReset(void)
+{
+    int i;
+    ASSERT_STATUS(pthread_mutex_lock(&gil_mutex));
+    for (i = 0; i < GIL_PROF_NCOUNTERS; i++)
+        gil_prof_counters[i] = 0;
+    for (i = 0; i < GIL_PROF_NBUCKETS; i++) {
+        gil_prof_latency[i] = 0;
+        gil_prof_hold[i] = 0;
+    }
+    if (gil_prof_hold_start != 0)
+        gil_prof_hold_start = gil_now_us();
+    ASSERT_STATUS(pthread_mutex_unlock(&gil_mutex));
+}
+
+/* copies the counters, then the acquire latency histogram and the hold
+   time histogram, into 'result' of size RPY_GIL_PROFILE_SIZE */
+void RPyGilProfileSnapshot(long *result)
+{
+    ASSERT_STATUS(pthread_mutex_lock(&gil_mutex));
+    memcpy(result, gil_prof_counters, sizeof(gil_prof_counters));
+    result += GIL_PROF_NCOUNTERS;
+    memcpy(result, gil_prof_latency, sizeof(gil_prof_latency));
+    result += GIL_PROF_NBUCKETS;
+    memcpy(result, gil_prof_hold, sizeof(gil_prof_hold));
+    ASSERT_STATUS(pthread_mutex_unlock(&gil_mutex));
+}
+
 
 #endif /* PYPY_NOT_MAIN_FILE */
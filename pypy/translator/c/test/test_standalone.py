@@ -117,7 +117,6 @@ class TestStandalone(StandaloneTests):
         assert counters == (0,3,2)
 
     def test_prof_inline(self):
-        py.test.skip("broken by 5b0e029514d4, but we don't use it any more")
         if sys.platform == 'win32':
             py.test.skip("instrumentation support is unix only for now")
         def add(a,b):
@@ -146,6 +145,43 @@ class TestStandalone(StandaloneTests):
         out = py.process.cmdexec("%s 500" % exe)
         assert int(out) == 500*501/2
 
+    def test_prof_branches(self):
+        if sys.platform == 'win32':
+            py.test.skip("instrumentation support is unix only for now")
+        def never_called(x):
+            return x * 3 + 1
+        def entry_point(argv):
+            tot = 0
+            x = int(argv[1])
+            while x > 0:
+                if x % 1000 == 999:
+                    tot += 5
+                else:
+                    tot += 1
+                x -= 1
+            if tot < 0:
+                tot = never_called(tot)
+            os.write(1, str(tot))
+            return 0
+        from pypy.translator.interactive import Translation
+        t = Translation(entry_point, backend='c', standalone=True)
+        t.backendopt(profile_based_branches="5000")
+        exe = t.compile()
+        out = py.process.cmdexec("%s 5000" % exe)
+        assert int(out) == 5000 + 5 * 4
+        #
+        graph = t.context.graphs[0]
+        assert getattr(graph, 'hotness', None) == 'hot'
+        expected = [op.args[1].value for block in graph.iterblocks()
+                                     for op in block.operations
+                                     if op.opname == 'expect']
+        # 'x > 0' is usually true and 'x % 1000 == 999' usually false
+        assert sorted(expected) == [False, True]
+        src = '\n'.join([f.read() for f in
+                         py.path.local(exe).dirpath().listdir('*.[ch]')])
+        assert 'OP_EXPECT(' in src
+        assert 'RPY_COLD' in src
+
     def test_frexp(self):
         import math
         def entry_point(argv):
@@ -431,6 +467,87 @@ class TestStandalone(StandaloneTests):
         assert 'bar' == lines[1]
         assert 'foo}' in lines[2]
 
+    def test_debug_print_binary(self):
+        from pypy.tool.logparser import parse_log_file
+        def entry_point(argv):
+            debug_print("toplevel")
+            for i in range(3):
+                debug_start("mycat")
+                debug_print("foo", i)
+                debug_start(argv[1])
+                debug_print("x" * 70000)
+                debug_stop(argv[1])
+                debug_stop("mycat")
+            debug_flush()
+            os.write(1, str(debug_offset()) + '\n')
+            return 0
+        t, cbuilder = self.compile(entry_point)
+        path = udir.join('test_debug_binary.log')
+        out, err = cbuilder.cmdexec("cat2", err=True,
+                                    env={'PYPYLOG': 'bin::%s' % path})
+        assert out.strip() == '-1'
+        assert not err
+        log = parse_log_file(str(path))
+        assert log[0] == ('debug_print', 'toplevel')
+        assert len(log) == 4
+        for i in range(3):
+            cat, start, stop, children = log[1 + i]
+            assert cat == 'mycat'
+            assert start <= stop
+            assert children[0] == ('debug_print', 'foo %d' % i)
+            assert children[1][0] == 'cat2'
+            assert children[1][3] == [('debug_print', 'x' * 70000)]
+        # the category names are only written once
+        assert path.read('rb').count('mycat') == 1
+        #
+        # check with PYPYLOG=bin:myc:somefilename
+        path = udir.join('test_debug_binary_myc.log')
+        out, err = cbuilder.cmdexec("cat2", err=True,
+                                    env={'PYPYLOG': 'bin:myc:%s' % path})
+        log = parse_log_file(str(path))
+        assert len(log) == 4
+        assert log[1][3] == [('debug_print', 'foo 0')]
+        #
+        # check with PYPYLOG=bin:somefilename (profiling)
+        path = udir.join('test_debug_binary_prof.log')
+        out, err = cbuilder.cmdexec("cat2", err=True,
+                                    env={'PYPYLOG': 'bin:%s' % path})
+        log = parse_log_file(str(path))
+        assert len(log) == 4
+        assert [entry[0] for entry in log[1][3]] == ['cat2']
+
+    def test_debug_print_counters(self):
+        from pypy.tool.logparser import parse_log_file
+        if not sys.platform.startswith('linux'):
+            py.test.skip("PYPYLOG_COUNTERS is Linux-only")
+        def entry_point(argv):
+            debug_start("mycat")
+            lst = []
+            for i in range(100000):
+                lst.append(str(i))
+            debug_stop("mycat")
+            return len(lst) - 100000
+        t, cbuilder = self.compile(entry_point)
+        for mode in ['', 'bin:']:
+            path = udir.join('test_debug_counters_%s.log' % mode[:3])
+            out, err = cbuilder.cmdexec("", err=True, env={
+                'PYPYLOG': '%s:%s' % (mode, path),
+                'PYPYLOG_COUNTERS': 'task-clock,page-faults'})
+            if 'cannot open' in err:
+                py.test.skip("perf_event_open() is not allowed here")
+            assert not err
+            log = parse_log_file(str(path))
+            assert [entry[0] for entry in log] == ['mycat']
+            assert log.counter_names == ['task-clock', 'page-faults']
+            clock, faults = log.counter_totals['mycat']
+            assert clock > 0 and faults > 0
+        #
+        out, err = cbuilder.cmdexec("", err=True, env={
+            'PYPYLOG': ':%s' % (path,), 'PYPYLOG_COUNTERS': 'foobar'})
+        assert "unknown counter 'foobar'" in err
+        log = parse_log_file(str(path))
+        assert not hasattr(log, 'counter_names')
+
 
     def test_fatal_error(self):
         def g(x):
@@ -825,7 +942,7 @@ class TestThread(object):
     gcrootfinder = 'shadowstack'
     config = None
 
-    def compile(self, entry_point):
+    def compile(self, entry_point, stackcheck=False):
         t = TranslationContext(self.config)
         t.config.translation.gc = "semispace"
         t.config.translation.gcrootfinder = self.gcrootfinder
@@ -833,6 +950,10 @@ class TestThread(object):
         t.buildannotator().build_types(entry_point, [s_list_of_strings])
         t.buildrtyper().specialize()
         #
+        if stackcheck:
+            from pypy.translator.transform import insert_ll_stackcheck
+            insert_ll_stackcheck(t)
+        #
         cbuilder = CStandaloneBuilder(t, entry_point, t.config)
         cbuilder.generate_source(defines=cbuilder.DEBUG_DEFINES)
         cbuilder.compile()
@@ -939,6 +1060,52 @@ class TestThread(object):
             py.test.fail("none of the stack sizes worked")
 
 
+    def test_stack_overflow_in_small_thread(self):
+        # the stack checks use the real size of the stack of the thread,
+        # which is here much smaller than the length allowed by default
+        import time
+        from pypy.module.thread import ll_thread
+        from pypy.rlib.rstack import _stack_set_length_fraction
+        from pypy.rlib.rstackovf import StackOverflow
+
+        class State:
+            pass
+        state = State()
+
+        def recurse(n):
+            if n > 0:
+                return recurse(n + 1) + 1
+            return 0
+
+        def bootstrap():
+            try:
+                recurse(1)
+            except StackOverflow:
+                state.result = 1
+            else:
+                state.result = 2
+
+        def entry_point(argv):
+            _stack_set_length_fraction(float(argv[1]))
+            error = ll_thread.set_stacksize(256 * 1024)
+            assert error == 0
+            state.result = 0
+            ll_thread.start_new_thread(bootstrap, ())
+            while state.result == 0:
+                time.sleep(0.05)
+            os.write(1, "result: %d\n" % state.result)
+            # the main thread's stack is much bigger
+            try:
+                recurse(1)
+            except StackOverflow:
+                os.write(1, "main thread: overflow\n")
+            return 0
+
+        t, cbuilder = self.compile(entry_point, stackcheck=True)
+        for fraction in ['1.0', '100.0']:
+            data = cbuilder.cmdexec(fraction)
+            assert data == 'result: 1\nmain thread: overflow\n'
+
     def test_thread_and_gc(self):
         import time, gc
         from pypy.module.thread import ll_thread
@@ -1019,6 +1186,438 @@ class TestThread(object):
                                      '5 ok']
 
 
+    def test_obmalloc_tcache(self):
+        import time
+        from pypy.module.thread import ll_thread
+        from pypy.rpython.lltypesystem import lltype, rffi
+        from pypy.rlib.objectmodel import invoke_around_extcall
+        from pypy.config.pypyoption import get_pypy_config
+
+        class State:
+            pass
+        state = State()
+
+        def before():
+            ll_assert(not ll_thread.acquire_NOAUTO(state.ll_lock, False),
+                      "lock not held!")
+            ll_thread.release_NOAUTO(state.ll_lock)
+        def after():
+            ll_thread.acquire_NOAUTO(state.ll_lock, True)
+            ll_thread.gc_thread_run()
+
+        def check_and_free(p, size, c):
+            for j in range(size):
+                if p[j] != c:
+                    state.errors += 1
+            lltype.free(p, flavor='raw')
+
+        def churn(seed):
+            # allocate and free small raw blocks of all size classes,
+            # checking that live blocks are not handed out twice
+            c = chr(seed)
+            blocks = []
+            for i in range(3000):
+                size = (i * 7 + seed) % 256 + 1
+                p = lltype.malloc(rffi.CCHARP.TO, size, flavor='raw')
+                for j in range(size):
+                    p[j] = c
+                blocks.append((p, size))
+                if len(blocks) > 150:
+                    p, size = blocks.pop(0)
+                    check_and_free(p, size, c)
+                if i % 100 == 0:
+                    time.sleep(0.001)      # invokes before/after
+            for p, size in blocks:
+                check_and_free(p, size, c)
+
+        def bootstrap():
+            ll_thread.gc_thread_start()
+            state.seed += 1
+            churn(state.seed)
+            state.done += 1
+            ll_thread.gc_thread_die()
+
+        def entry_point(argv):
+            state.seed = 0
+            state.done = 0
+            state.errors = 0
+            state.ll_lock = ll_thread.allocate_ll_lock()
+            after()
+            invoke_around_extcall(before, after)
+            for i in range(4):
+                ll_thread.gc_thread_prepare()
+                ll_thread.start_new_thread(bootstrap, ())
+            churn(100)
+            while state.done < 4:
+                time.sleep(0.1)
+            # the exited threads gave their cached blocks back
+            churn(101)
+            print 'errors:', state.errors
+            return 0
+
+        config = get_pypy_config(translating=True)
+        config.translation.obmalloc_tcache = True
+        self.config = config
+        t, cbuilder = self.compile(entry_point)
+        data = cbuilder.cmdexec('')
+        assert data == 'errors: 0\n'
+
+    def test_debug_print_binary_threads(self):
+        import time
+        from pypy.module.thread import ll_thread
+        from pypy.rlib.objectmodel import invoke_around_extcall
+        from pypy.tool.logparser import parse_log_file
+
+        class State:
+            pass
+        state = State()
+
+        def before():
+            ll_thread.release_NOAUTO(state.ll_lock)
+        def after():
+            ll_thread.acquire_NOAUTO(state.ll_lock, True)
+            ll_thread.gc_thread_run()
+
+        def work(name):
+            for i in range(500):
+                debug_start("cat-" + name)
+                debug_print(name, i)
+                debug_stop("cat-" + name)
+                if i % 50 == 0:
+                    time.sleep(0.001)      # invokes before/after
+
+        def bootstrap():
+            ll_thread.gc_thread_start()
+            state.count += 1
+            work(str(state.count))
+            state.done += 1
+            ll_thread.gc_thread_die()
+
+        def entry_point(argv):
+            state.count = 0
+            state.done = 0
+            state.ll_lock = ll_thread.allocate_ll_lock()
+            after()
+            invoke_around_extcall(before, after)
+            for i in range(3):
+                ll_thread.gc_thread_prepare()
+                ll_thread.start_new_thread(bootstrap, ())
+            work("main")
+            while state.done < 3:
+                time.sleep(0.1)
+            return 0
+
+        t, cbuilder = self.compile(entry_point)
+        path = udir.join('test_debug_binary_threads.log')
+        cbuilder.cmdexec('', env={'PYPYLOG': 'bin::%s' % path})
+        log = parse_log_file(str(path))
+        assert len(log) == 4 * 500
+        counts = {}
+        for cat, start, stop, children in log:
+            name = cat[4:]
+            i = counts.get(name, 0)
+            assert children == [('debug_print', '%s %d' % (name, i))]
+            counts[name] = i + 1
+        assert counts == {'main': 500, '1': 500, '2': 500, '3': 500}
+
+    def test_debug_print_binary_exit_with_threads(self):
+        import time
+        from pypy.module.thread import ll_thread
+        from pypy.rlib.objectmodel import invoke_around_extcall
+        from pypy.tool.logparser import parse_log_file
+
+        class State:
+            pass
+        state = State()
+
+        def before():
+            ll_thread.release_NOAUTO(state.ll_lock)
+        def after():
+            ll_thread.acquire_NOAUTO(state.ll_lock, True)
+            ll_thread.gc_thread_run()
+
+        def bootstrap():
+            ll_thread.gc_thread_start()
+            state.count += 1
+            name = str(state.count)
+            i = 0
+            while True:      # still logging when the process exits
+                debug_start("cat-" + name)
+                debug_print(name, i)
+                debug_stop("cat-" + name)
+                i += 1
+                if i % 50 == 0:
+                    time.sleep(0.001)
+
+        def entry_point(argv):
+            state.count = 0
+            state.ll_lock = ll_thread.allocate_ll_lock()
+            after()
+            invoke_around_extcall(before, after)
+            for i in range(3):
+                ll_thread.gc_thread_prepare()
+                ll_thread.start_new_thread(bootstrap, ())
+            while state.count < 3:
+                time.sleep(0.01)
+            for i in range(500):
+                debug_start("cat-main")
+                debug_print("main", i)
+                debug_stop("cat-main")
+            return 0
+
+        t, cbuilder = self.compile(entry_point)
+        path = udir.join('test_debug_binary_exit_with_threads.log')
+        for i in range(5):
+            cbuilder.cmdexec('', env={'PYPYLOG': 'bin::%s' % path})
+            log = parse_log_file(str(path))
+            # no event is lost in the exiting thread, and the events of
+            # the other threads are neither torn nor duplicated
+            counts = {}
+            for entry in log:
+                if len(entry) != 4:
+                    continue          # a thread stopped in a section
+                name = entry[0][4:]
+                i = counts.get(name, 0)
+                assert entry[3] == [('debug_print', '%s %d' % (name, i))]
+                counts[name] = i + 1
+            assert counts['main'] == 500
+
+    def test_debug_print_binary_after_thread_exit(self):
+        import time
+        from pypy.module.thread import ll_thread
+        from pypy.rlib.objectmodel import invoke_around_extcall
+        from pypy.rpython.lltypesystem import lltype, rffi
+        from pypy.tool.logparser import parse_log_file
+        # a pthread_key destructor that runs after the one of debug_print.c
+        # and logs again
+        eci = ExternalCompilationInfo(
+            post_include_bits=['void late_setup(void);',
+                               'void late_register(void);'],
+            separate_module_sources=["""
+            #include <pthread.h>
+            void pypy_debug_start(const char *category);
+            void pypy_debug_stop(const char *category);
+            static pthread_key_t late_key;
+            static void late_destructor(void *arg) {
+                pypy_debug_start("late");
+                pypy_debug_stop("late");
+            }
+            void late_setup(void) {
+                pthread_key_create(&late_key, late_destructor);
+            }
+            void late_register(void) {
+                pthread_setspecific(late_key, (void *)1);
+            }
+            """])
+        late_setup = rffi.llexternal('late_setup', [], lltype.Void,
+                                     compilation_info=eci,
+                                     _nowrapper=True)
+        late_register = rffi.llexternal('late_register', [], lltype.Void,
+                                        compilation_info=eci,
+                                        _nowrapper=True)
+
+        class State:
+            pass
+        state = State()
+
+        def before():
+            ll_thread.release_NOAUTO(state.ll_lock)
+        def after():
+            ll_thread.acquire_NOAUTO(state.ll_lock, True)
+            ll_thread.gc_thread_run()
+
+        def bootstrap():
+            ll_thread.gc_thread_start()
+            debug_start("cat")
+            debug_stop("cat")
+            late_register()
+            state.done += 1
+            ll_thread.gc_thread_die()
+
+        def entry_point(argv):
+            debug_start("cat")
+            debug_stop("cat")
+            late_setup()
+            state.done = 0
+            state.ll_lock = ll_thread.allocate_ll_lock()
+            after()
+            invoke_around_extcall(before, after)
+            for i in range(3):
+                ll_thread.gc_thread_prepare()
+                ll_thread.start_new_thread(bootstrap, ())
+            while state.done < 3:
+                time.sleep(0.01)
+            time.sleep(0.2)       # let the threads finish exiting
+            return 0
+
+        t, cbuilder = self.compile(entry_point)
+        path = udir.join('test_debug_binary_after_thread_exit.log')
+        cbuilder.cmdexec('', env={'PYPYLOG': 'bin::%s' % path})
+        log = parse_log_file(str(path))
+        cats = [entry[0] for entry in log]
+        assert cats.count('cat') == 4
+        assert cats.count('late') == 3
+
+    def test_debug_print_counters_threads(self):
+        import time
+        from pypy.module.thread import ll_thread
+        from pypy.rlib.objectmodel import invoke_around_extcall
+        if not os.path.exists('/proc/self/fd'):
+            py.test.skip("needs /proc/self/fd")
+
+        class State:
+            pass
+        state = State()
+
+        def before():
+            ll_thread.release_NOAUTO(state.ll_lock)
+        def after():
+            ll_thread.acquire_NOAUTO(state.ll_lock, True)
+            ll_thread.gc_thread_run()
+
+        def bootstrap():
+            ll_thread.gc_thread_start()
+            debug_start("cat-thread")
+            debug_stop("cat-thread")
+            state.done += 1
+            ll_thread.gc_thread_die()
+
+        def entry_point(argv):
+            state.ll_lock = ll_thread.allocate_ll_lock()
+            after()
+            invoke_around_extcall(before, after)
+            debug_start("cat-main")
+            debug_stop("cat-main")
+            before_fds = len(os.listdir('/proc/self/fd'))
+            state.done = 0
+            for i in range(20):
+                ll_thread.gc_thread_prepare()
+                ll_thread.start_new_thread(bootstrap, ())
+                while state.done <= i:
+                    time.sleep(0.001)
+            time.sleep(0.1)       # let the last thread finish exiting
+            print len(os.listdir('/proc/self/fd')) - before_fds
+            return 0
+
+        t, cbuilder = self.compile(entry_point)
+        for mode in ['', 'bin:']:
+            path = udir.join('test_debug_counters_threads_%s.log' % mode[:3])
+            out, err = cbuilder.cmdexec("", err=True, env={
+                'PYPYLOG': '%s:%s' % (mode, path),
+                'PYPYLOG_COUNTERS': 'task-clock,page-faults'})
+            if 'cannot open' in err:
+                py.test.skip("perf_event_open() is not allowed here")
+            # the exited threads closed their counters
+            assert int(out) < 4
+
+    def test_profiling_isolation(self):
+        import time
+        from pypy.module.thread import ll_thread
+        from pypy.rlib.objectmodel import invoke_around_extcall
+        from pypy.tool.logparser import parse_log_file
+        if not os.path.exists('/proc/thread-self/status'):
+            py.test.skip("needs Linux >= 3.17")
+
+        class State:
+            pass
+        state = State()
+
+        def before():
+            ll_thread.release_NOAUTO(state.ll_lock)
+        def after():
+            ll_thread.acquire_NOAUTO(state.ll_lock, True)
+            ll_thread.gc_thread_run()
+
+        def report(name):
+            # prints the cpus on which the current thread can run
+            fd = os.open('/proc/thread-self/status', os.O_RDONLY, 0)
+            data = os.read(fd, 8192)
+            os.close(fd)
+            for line in data.split('\n'):
+                if line.startswith('Cpus_allowed_list:'):
+                    os.write(1, '%s %s\n' % (name, line[18:].strip('\t')))
+
+        def bootstrap():
+            ll_thread.gc_thread_start()
+            state.count += 1
+            report('thread')
+            state.done += 1
+            ll_thread.gc_thread_die()
+
+        def entry_point(argv):
+            state.count = 0
+            state.done = 0
+            state.ll_lock = ll_thread.allocate_ll_lock()
+            after()
+            invoke_around_extcall(before, after)
+            debug_start("cat-main")
+            report('main')
+            debug_stop("cat-main")
+            for i in range(2):
+                ll_thread.gc_thread_prepare()
+                ll_thread.start_new_thread(bootstrap, ())
+            while state.done < 2:
+                time.sleep(0.1)
+            return 0
+
+        def parse_cpus(text):
+            result = []
+            for part in text.split(','):
+                first, _, last = part.partition('-')
+                result.extend(range(int(first), int(last or first) + 1))
+            return result
+
+        t, cbuilder = self.compile(entry_point)
+        status = open('/proc/self/status').read()
+        cpus = parse_cpus(status.split('Cpus_allowed_list:')[1].split()[0])
+        first = str(cpus[0])
+        for mode in ['', 'bin:']:
+            path = udir.join('test_profiling_isolation_%s.log' % mode[:3])
+            out = cbuilder.cmdexec('', env={'PYPYLOG': mode + str(path),
+                                            'PYPYLOG_CPUS': first,
+                                            'PYPYLOG_ISOLATE': 'each'})
+            assert sorted(out.splitlines()) == ['main ' + first,
+                                                'thread ' + first,
+                                                'thread ' + first]
+            log = parse_log_file(str(path))
+            assert log.isolation.startswith(
+                'cpus=%s threads=each main=%s mlock=no latency=no ' % (
+                    first, first))
+            assert [entry[0] for entry in log] == ['cat-main']
+        #
+        # the cpus that we are not allowed to use are ignored, and the
+        # header reports the cpus that are really used
+        path = udir.join('test_profiling_isolation_unallowed.log')
+        out, err = cbuilder.cmdexec('', err=True, env={
+            'PYPYLOG': str(path), 'PYPYLOG_CPUS': first + ',1023',
+            'PYPYLOG_ISOLATE': 'all'})
+        assert "ignoring the cpus in '%s,1023'" % first in err
+        assert sorted(out.splitlines()) == ['main ' + first,
+                                            'thread ' + first,
+                                            'thread ' + first]
+        log = parse_log_file(str(path))
+        assert log.isolation.startswith('cpus=%s threads=all main=%s ' % (
+            first, first))
+        out, err = cbuilder.cmdexec('', err=True, env={
+            'PYPYLOG': str(path), 'PYPYLOG_CPUS': '1023',
+            'PYPYLOG_ISOLATE': 'none'})
+        assert "none of the cpus in '1023' can be used" in err
+        log = parse_log_file(str(path))
+        assert parse_cpus(log.isolation.split()[0][5:]) == cpus
+        #
+        # by default, the main thread is alone on its cpu, if there are
+        # several cpus
+        out = cbuilder.cmdexec('', env={'PYPYLOG': str(path)})
+        lines = out.splitlines()
+        assert lines[0] == 'main ' + first
+        for line in lines[1:]:
+            name, allowed = line.split()
+            assert name == 'thread'
+            if len(cpus) > 1:
+                assert parse_cpus(allowed) == cpus[1:]
+            else:
+                assert parse_cpus(allowed) == cpus
+
     def test_gc_with_fork_without_threads(self):
         from pypy.rlib.objectmodel import invoke_around_extcall
         if not hasattr(os, 'fork'):
@@ -48,6 +48,7 @@ class Instrument(Exception):
 
 class ProfInstrument(object):
     name = "profinstrument"
+    # 'compiler' is anything with a 'platform', like the TranslationContext
     def __init__(self, datafile, compiler):
         self.datafile = datafile
         self.compiler = compiler
@@ -222,7 +223,11 @@ class TranslationDriver(SimpleTaskEngine):
         self.libdef = libdef
         self.secondary_entrypoints = libdef.functions
 
-    def instrument_result(self, args):
+    def instrument_result(self, args, prepare=None):
+        """Build and run the program with the 'instrument_count'
+        operations enabled, in a forked process, with the command-line
+        'args'; return the counters.  The graphs are compiled as they
+        are now, after a call to prepare() in the forked process."""
         backend, ts = self.get_backend_and_type_system()
         if backend != 'c' or sys.platform == 'win32':
             raise Exception("instrumentation requires the c backend"
@@ -234,6 +239,8 @@ class TranslationDriver(SimpleTaskEngine):
         pid = os.fork()
         if pid == 0:
             # child compiling and running with instrumentation
+            if prepare is not None:
+                prepare()
             self.config.translation.instrument = True
             self.config.translation.instrumentctl = (makeProfInstrument,
                                                      args)